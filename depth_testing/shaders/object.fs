@@ -5,10 +5,15 @@ out vec4 FragColor;
 
 uniform sampler2D objectTexture;
 
-float near = 0.1;
-float far = 100.0;
+uniform float near;
+uniform float far;
+uniform bool reversedZ;      // Infinite reversed projection, depth in [0, 1] from glClipControl
+uniform bool visualizeDepth;
 
+// Distance to the camera plane
 float LinearizeDepth(float depth){
+    if (reversedZ)
+        return near / depth; // depth = near / distance, no far plane
     float z = depth * 2.0 - 1.0; // NDC
     return (2.0 * near * far) / (far + near - z * (far - near));
 }
@@ -17,7 +22,9 @@ void main()
 {
     FragColor = texture(objectTexture, TexCoords);
 
-    // Visualizing the depth buffer
-    // float depth = LinearizeDepth(gl_FragCoord.z) / 10.;
-    // FragColor = vec4(vec3(depth), 1.0);
-}
\ No newline at end of file
+    // Visualizing the depth buffer, log scale so the far cubes are still told apart
+    if (visualizeDepth){
+        float depth = log2(LinearizeDepth(gl_FragCoord.z) / near) / log2(10000.0 / near);
+        FragColor = vec4(vec3(depth), 1.0);
+    }
+}
@@ -4,6 +4,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cstring>
 #include <iostream>
 #include <math.h>
 
@@ -15,8 +16,21 @@ Camera camera;
 float lastX = 400, lastY = 300; // Center of the screen
 bool firstMouse = true;
 
+// Reversed-Z: depth 1 at the near plane and 0 at infinity in a float buffer. Otherwise the
+// classic [-1, 1] projection clipped at 100 units into a 24 bit buffer, like the window's
+bool reversedZ = true;
+bool visualizeDepth = false;
+bool depthModeKeyDown = false, visualizeKeyDown = false;
+bool depthModeChanged = false;
+
+int windowWidth = 800, windowHeight = 600;
+bool windowResized = false;
+
 void framebuffer_size_callback(GLFWwindow* window, int width, int height){
     glViewport(0, 0, width, height);
+    windowWidth = width;
+    windowHeight = height;
+    windowResized = true;
 }
 
 void processInput(GLFWwindow* window, const float deltaTime){
@@ -35,6 +49,18 @@ void processInput(GLFWwindow* window, const float deltaTime){
         camera.ProcessKeyboard(Camera_Movement::UP, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL))
         camera.ProcessKeyboard(Camera_Movement::DOWN, deltaTime);
+
+    // Z switches the depth mode, V shows the linearized depth instead of the textures
+    bool depthModeDown = glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS;
+    if (depthModeDown && !depthModeKeyDown){
+        reversedZ = !reversedZ;
+        depthModeChanged = true;
+    }
+    depthModeKeyDown = depthModeDown;
+    bool visualizeDown = glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS;
+    if (visualizeDown && !visualizeKeyDown)
+        visualizeDepth = !visualizeDepth;
+    visualizeKeyDown = visualizeDown;
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos){
@@ -93,8 +119,60 @@ unsigned int loadTexture(char const *path)
     return textureID;
 }
 
-int main()
+// The window's depth buffer can't be floating point, the scene goes to an FBO blitted to it
+struct SceneTarget
+{
+    unsigned int framebuffer = 0, color = 0, depth = 0;
+
+    void Create(const int width, const int height, const bool floatDepth)
+    {
+        Release();
+        glCreateTextures(GL_TEXTURE_2D, 1, &color);
+        glTextureStorage2D(color, 1, GL_RGBA8, width, height);
+        glCreateRenderbuffers(1, &depth);
+        glNamedRenderbufferStorage(depth, floatDepth ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24, width, height);
+
+        glCreateFramebuffers(1, &framebuffer);
+        glNamedFramebufferTexture(framebuffer, GL_COLOR_ATTACHMENT0, color, 0);
+        glNamedFramebufferRenderbuffer(framebuffer, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+        if (glCheckNamedFramebufferStatus(framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cerr << "Scene framebuffer is not complete\n";
+    }
+
+    void Release()
+    {
+        if (framebuffer){
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteTextures(1, &color);
+            glDeleteRenderbuffers(1, &depth);
+        }
+        framebuffer = color = depth = 0;
+    }
+};
+
+// Clip control, depth test and clear value of the current mode
+void applyDepthMode(SceneTarget& target){
+    if (reversedZ){
+        glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+        glDepthFunc(GL_GREATER);
+        glClearDepth(0.0);
+    }
+    else{
+        glClipControl(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE);
+        glDepthFunc(GL_LESS);
+        glClearDepth(1.0);
+    }
+    target.Create(windowWidth, windowHeight, reversedZ);
+    std::cout << "Depth: " << (reversedZ ? "reversed-Z, 32 bit float, infinite far plane" : "standard, 24 bit, far plane at 100") << "\n";
+}
+
+int main(int argc, char** argv)
 {
+    for (int i = 1 ; i + 1 < argc ; i++){
+        if (std::strcmp(argv[i], "--depth") == 0)
+            reversedZ = std::strcmp(argv[i + 1], "standard") != 0;
+    }
+
     if (!glfwInit()){
         std::cerr << "Error at GLFW initialization\n";
         return -1;
@@ -127,6 +205,8 @@ int main()
     glEnable(GL_DEPTH_TEST); // Disabled by default
     // GL_ALWAYS, GL_NEVER, GL_LESS (default), GL_EQUAL, GL_LEQUAL, ...
     // glDepthFunc(GL_ALWAYS);
+    SceneTarget sceneTarget;
+    applyDepthMode(sceneTarget);
 
     float cube_vertices[] = {
         // Back face
@@ -245,6 +325,8 @@ int main()
     int viewLocation = glGetUniformLocation(objectShader.m_id, "view");
     int projectionLocation = glGetUniformLocation(objectShader.m_id, "projection");
     objectShader.SetInt("objectTexture", 0);
+    objectShader.SetFloat("near", NEAR_PLANE);
+    objectShader.SetFloat("far", FAR_PLANE);
 
     // -----------------------------------
 
@@ -257,12 +339,25 @@ int main()
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
-        
+
+        if (windowWidth == 0 || windowHeight == 0){ // Minimized
+            glfwPollEvents();
+            continue;
+        }
+        if (depthModeChanged || windowResized){
+            applyDepthMode(sceneTarget);
+            depthModeChanged = windowResized = false;
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneTarget.framebuffer);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
         objectShader.Use();
+        objectShader.SetBool("reversedZ", reversedZ);
+        objectShader.SetBool("visualizeDepth", visualizeDepth);
 
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), 800.f/600.f, 0.1f, 100.f);
+        float aspect = (float)windowWidth / windowHeight;
+        glm::mat4 projection = reversedZ ? camera.GetReversedInfiniteProjectionMatrix(aspect) : camera.GetProjectionMatrix(aspect);
         glUniformMatrix4fv(projectionLocation, 1, GL_FALSE, glm::value_ptr(projection));
 
         glm::mat4 view = glm::lookAt(camera.Position, camera.Position+camera.Front, camera.Up); 
@@ -284,6 +379,17 @@ int main()
         glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(cube_model));
         glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
 
+        // A row of cubes up to 5 km away, scaled with their distance so they keep their size on
+        // screen. Past 100 units the standard mode clips them
+        for (unsigned int i = 0 ; i < 12 ; i++){
+            float distance = 5.f * powf(2.f, (float)i);
+            cube_model = glm::mat4(1.f);
+            cube_model = glm::translate(cube_model, glm::vec3(4.f + distance * 0.1f, 0.5f, -distance));
+            cube_model = glm::scale(cube_model, glm::vec3(distance * 0.1f));
+            glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(cube_model));
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+        }
+
         // -----------------------------------
         // FLOOR OBJECT
         glBindTexture(GL_TEXTURE_2D, floorTexture);
@@ -295,6 +401,8 @@ int main()
 
         // -----------------------------------
 
+        glBlitNamedFramebuffer(sceneTarget.framebuffer, 0, 0, 0, windowWidth, windowHeight, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
@@ -303,6 +411,7 @@ int main()
     glDeleteBuffers(1, &cubeVBO);
     glDeleteVertexArrays(1, &floorVAO);
     glDeleteBuffers(1, &floorVBO);
+    sceneTarget.Release();
     
     glfwDestroyWindow(window);
     glfwTerminate();
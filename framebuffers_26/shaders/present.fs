@@ -0,0 +1,27 @@
+#version 460 core
+
+in vec2 TexCoords;
+out vec4 FragColor;
+
+uniform sampler2D screenTexture;
+uniform float sharpness; // 0 disables, set when the scene rendered under the window resolution
+
+#include "../../includes/shaders/color_lut.glsl"
+
+// Upsamples the result of the compute post-processing to the window, then the colour LUT
+void main()
+{
+    vec3 color = texture(screenTexture, TexCoords).rgb;
+
+    // Unsharp mask with the 4 neighbours, restores some of the detail the bilinear upsample smooths
+    if (sharpness > 0.0){
+        vec2 texel = 1.0 / vec2(textureSize(screenTexture, 0));
+        vec3 neighbours = texture(screenTexture, TexCoords + vec2(texel.x, 0.0)).rgb
+                        + texture(screenTexture, TexCoords - vec2(texel.x, 0.0)).rgb
+                        + texture(screenTexture, TexCoords + vec2(0.0, texel.y)).rgb
+                        + texture(screenTexture, TexCoords - vec2(0.0, texel.y)).rgb;
+        color = max(color + (color * 4.0 - neighbours) * 0.25 * sharpness, 0.0);
+    }
+
+    FragColor = vec4(ApplyColorLut(color), 1.0);
+}
@@ -5,31 +5,23 @@ out vec4 FragColor;
 
 uniform sampler2D screenTexture;
 
-const float offset = 1.0 / 300.0;
+#include "../../includes/shaders/color_lut.glsl"
 
 void main()
 {
-    // Normal
-    // FragColor = texture(screenTexture, TexCoords);
-    
-    // Inversion
-    // FragColor = vec4(vec3(1.0 - texture(screenTexture, TexCoords)), 1.0);
-    
-    // Grayscale
-    // FragColor = texture(screenTexture, TexCoords);
-    // float average = 0.2126*FragColor.r + 0.7152*FragColor.g + 0.0722*FragColor.b; 
-    // FragColor = vec4(vec3(average), 1.0);
+    // One texel, the same neighbours as the compute path whatever the resolution
+    vec2 offset = 1.0 / vec2(textureSize(screenTexture, 0));
 
     vec2 offsets[9] = vec2[](
-        vec2(-offset, offset), // top-left
-        vec2(0.0f, offset), // top-center
-        vec2(offset, offset), // top-right
-        vec2(-offset, 0.0f), // center-left
+        vec2(-offset.x, offset.y), // top-left
+        vec2(0.0f, offset.y), // top-center
+        vec2(offset.x, offset.y), // top-right
+        vec2(-offset.x, 0.0f), // center-left
         vec2(0.0f, 0.0f), // center-center
-        vec2(offset, 0.0f), // center-right
-        vec2(-offset, -offset), // bottom-left
-        vec2(0.0f, -offset), // bottom-center
-        vec2(offset, -offset) // bottom-right
+        vec2(offset.x, 0.0f), // center-right
+        vec2(-offset.x, -offset.y), // bottom-left
+        vec2(0.0f, -offset.y), // bottom-center
+        vec2(offset.x, -offset.y) // bottom-right
     );
 
     float sharpen_kernel[9] = float[](
@@ -62,5 +54,6 @@ void main()
     for(int i = 0; i < 9; i++)
         col += sampleTex[i] * edge_detection_kernel[i];
 
-    FragColor = vec4(col, 1.0);
+    // Inversion, grayscale and the other colour operators are all in the LUT
+    FragColor = vec4(ApplyColorLut(col), 1.0);
 }
\ No newline at end of file
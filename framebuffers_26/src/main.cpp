@@ -4,10 +4,21 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <math.h>
 
 #include "camera.hpp"
+#include "color_lut.hpp"
+#include "dynamic_resolution.hpp"
+#include "frame_stats.hpp"
+#include "gl_state.hpp"
+#include "gpu_timer.hpp"
+#include "post_process.hpp"
+#include "readback.hpp"
+#include "render_graph.hpp"
+#include "render_target_pool.hpp"
 #include "shader.hpp"
 #include "stb_image.h"
 
@@ -15,8 +26,24 @@ Camera camera;
 float lastX = 400, lastY = 300; // Center of the screen
 bool firstMouse = true;
 
+// A window drag sends many sizes, render targets are only rebuilt once it stays the same for a while
+const double RESIZE_SETTLE_SECONDS = 0.2;
+int pendingWidth = 800, pendingHeight = 600;
+double lastResizeTime = 0.0;
+
+// Keys 1 to 5 toggle the colour operators, applied once per frame
+const unsigned int COLOR_KEYS = 5;
+bool colorKeyDown[COLOR_KEYS] = {};
+unsigned int colorToggles = 0; // Bit per operator
+
+// P saves a screenshot
+bool screenshotKeyDown = false;
+bool screenshotRequested = false;
+
 void framebuffer_size_callback(GLFWwindow* window, int width, int height){
-    glViewport(0, 0, width, height);
+    pendingWidth = width;
+    pendingHeight = height;
+    lastResizeTime = glfwGetTime();
 }
 
 void processInput(GLFWwindow* window, const float deltaTime){
@@ -35,6 +62,18 @@ void processInput(GLFWwindow* window, const float deltaTime){
         camera.ProcessKeyboard(Camera_Movement::UP, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL))
         camera.ProcessKeyboard(Camera_Movement::DOWN, deltaTime);
+
+    for (unsigned int i = 0 ; i < COLOR_KEYS ; i++){
+        bool down = glfwGetKey(window, GLFW_KEY_1 + i) == GLFW_PRESS;
+        if (down && !colorKeyDown[i])
+            colorToggles |= 1u << i;
+        colorKeyDown[i] = down;
+    }
+
+    bool screenshotDown = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+    if (screenshotDown && !screenshotKeyDown)
+        screenshotRequested = true;
+    screenshotKeyDown = screenshotDown;
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos){
@@ -93,8 +132,43 @@ unsigned int loadTexture(char const *path)
     return textureID;
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    // --trace <file> records one frame once the scene is warm, for the replay project
+    // --post fragment|compute|compare picks the post-processing, compare runs both and shows the compute one
+    // --blur <sigma> replaces the compute edge detection with a gaussian blur
+    // --budget <ms> GPU frame time the scene resolution adapts to, 0 keeps the full resolution
+    // --sharpen <amount> sharpening of the upsample when the scene renders under the window resolution
+    // --sequence <prefix> saves every frame as <prefix>00000.ppm, <prefix>00001.ppm...
+    // --compare <file.ppm> compares the frame CAPTURE_FRAME with a reference screenshot
+    const char* tracePath = NULL;
+    const unsigned int TRACE_FRAME = 60;
+    const unsigned int CAPTURE_FRAME = 60;
+    const char* sequencePrefix = NULL;
+    const char* referencePath = NULL;
+    enum class PostPath { Fragment, Compute, Compare };
+    PostPath postPath = PostPath::Compute;
+    float blurSigma = 0.f;
+    float budgetMs = 16.6f;
+    float sharpen = 0.5f;
+    for (int i = 1 ; i + 1 < argc ; i++){
+        if (std::strcmp(argv[i], "--trace") == 0)
+            tracePath = argv[i + 1];
+        else if (std::strcmp(argv[i], "--post") == 0)
+            postPath = std::strcmp(argv[i + 1], "fragment") == 0 ? PostPath::Fragment :
+                       std::strcmp(argv[i + 1], "compare") == 0 ? PostPath::Compare : PostPath::Compute;
+        else if (std::strcmp(argv[i], "--blur") == 0)
+            blurSigma = (float)std::atof(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--budget") == 0)
+            budgetMs = (float)std::atof(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--sharpen") == 0)
+            sharpen = (float)std::atof(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--sequence") == 0)
+            sequencePrefix = argv[i + 1];
+        else if (std::strcmp(argv[i], "--compare") == 0)
+            referencePath = argv[i + 1];
+    }
+
     if (!glfwInit()){
         std::cerr << "Error at GLFW initialization\n";
         return -1;
@@ -117,7 +191,9 @@ int main()
         return -1;
     }
 
-    glViewport(0, 0, 800, 600);
+    glfwGetFramebufferSize(window, &pendingWidth, &pendingHeight);
+    int width = pendingWidth, height = pendingHeight;
+    glViewport(0, 0, width, height);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     glfwSetCursorPosCallback(window, mouse_callback);
@@ -245,55 +321,33 @@ int main()
 
     Shader objectShader("../shaders/object.vs", "../shaders/object.fs");
     Shader quadShader("../shaders/quad.vs", "../shaders/quad.fs");
+    Shader presentShader("../shaders/quad.vs", "../shaders/present.fs");
     objectShader.Use();
 
-    int modelLocation = glGetUniformLocation(objectShader.m_id, "model");
-    int viewLocation = glGetUniformLocation(objectShader.m_id, "view");
-    int projectionLocation = glGetUniformLocation(objectShader.m_id, "projection");
+    Uniform<glm::mat4> modelUniform = objectShader.GetUniform<glm::mat4>("model");
+    Uniform<glm::mat4> viewUniform = objectShader.GetUniform<glm::mat4>("view");
+    Uniform<glm::mat4> projectionUniform = objectShader.GetUniform<glm::mat4>("projection");
     objectShader.SetInt("objectTexture", 0);
 
     quadShader.SetInt("screenTexture", 0);
+    presentShader.SetInt("screenTexture", 0);
+    quadShader.SetInt("colorLut", 1);
+    presentShader.SetInt("colorLut", 1);
+    Uniform<float> sharpnessUniform = presentShader.GetUniform<float>("sharpness");
 
     // -----------------------------------
-    // FRAMEBUFFER
-    
-    unsigned int FBO;
-    glGenFramebuffers(1, &FBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-    // From now, all the next read and write (draw) framebuffer operations will affect the currently bound framebuffer
-    // It's also possible to bind a specific framebuffer for reading operations (GL_READ_FRAMEBUFFER) 
-    // and for drawing operations (GL_DRAW_FRAMEBUFFER)
-
-    // Texture attachements
-    unsigned int framebuffer_texture;
-    glGenTextures(1, &framebuffer_texture);
-    glBindTexture(GL_TEXTURE_2D, framebuffer_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 800, 600, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-    // NULL is passed as the texture's data parameter in glTexImage2D
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    
-    // Attach the new texture to the new framebuffer
-    // We can also attach a depth or stencil texture
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, framebuffer_texture, 0);
-    
-    // Depth and stencil testing with the new framebuffer are done with a renderbufferobject
-    unsigned int RBO;
-    glGenRenderbuffers(1, &RBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, RBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, 800, 600);
-    glBindRenderbuffer(GL_RENDERBUFFER, 0); // Unbind RBO
-
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, RBO);
-    
-    // We can check if a framebuffer follows the requirements with : 
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE)
-        std::cout << "The current framebuffer is ready\n";
-    else   
-        std::cout << "The current framebuffer can't be used\n";
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0); // Back to the default framebuffer
+    // COLOUR PIPELINE
+    // Any number of operators costs one LUT fetch in the last pass, the chain is baked again when it changes
+
+    ColorLut colorLut;
+    colorLut.Add(ColorOperator::Contrast(1.15f));
+    colorLut.Add(ColorOperator::ToneCurve(0.2f, 0.5f, 0.8f));
+    colorLut.Add(ColorOperator::Grading(glm::vec3(0.02f, 0.f, 0.04f), glm::vec3(1.f, 1.f, 0.95f), glm::vec3(1.05f, 1.f, 0.95f)));
+    colorLut.Add(ColorOperator::Grayscale());
+    colorLut.Add(ColorOperator::Invert());
+    colorLut.Toggle(3); // Grayscale and inversion start disabled
+    colorLut.Toggle(4);
+    colorLut.Update();
 
     // -----------------------------------
 
@@ -320,66 +374,247 @@ int main()
 
     // -----------------------------------
 
+    // -----------------------------------
+    // RENDER GRAPH
+    // The scene is drawn in textures owned by the graph, then post-processed into the window
+
+    // Targets come from the pool, on a resize the graph compiles again and gets the new sizes from it
+    RenderTargetPool targetPool;
+    RenderGraph graph(targetPool);
+    RenderResource backbuffer = graph.ImportBackbuffer(width, height);
+    RenderResource sceneColor = graph.CreateTexture("scene color", RenderTextureDesc{width, height, GL_RGBA8});
+    RenderResource sceneDepth = graph.CreateTexture("scene depth", RenderTextureDesc{width, height, GL_DEPTH24_STENCIL8});
+    // Window targets follow the window, scene targets follow it at the dynamic resolution scale
+    std::vector<RenderResource> windowTargets = {backbuffer};
+    std::vector<RenderResource> sceneTargets = {sceneColor, sceneDepth};
+    DynamicResolution dynamicResolution(budgetMs);
+    dynamicResolution.SetEnabled(budgetMs > 0.f);
+
+    graph.AddPass("scene",
+        [&](RenderPassBuilder& pass){
+            pass.WriteColor(sceneColor, LoadOp::Clear, glm::vec4(0.1f, 0.1f, 0.1f, 1.f));
+            pass.WriteDepth(sceneDepth, LoadOp::Clear);
+        },
+        [&](const RenderPassContext&){
+            g_glState.Enable(GL_DEPTH_TEST);
+            objectShader.Use();
+
+            glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)width/height, 0.1f, 100.f);
+            objectShader.Set(projectionUniform, projection);
+
+            glm::mat4 view = glm::lookAt(camera.Position, camera.Position+camera.Front, camera.Up); 
+            objectShader.Set(viewUniform, view);
+
+            // -----------------------------------
+            // CUBE OBJECT
+            g_glState.BindTexture(0, GL_TEXTURE_2D, cubeTexture);
+
+            g_glState.BindVertexArray(cubeVAO);
+            glm::mat4 cube_model = glm::mat4(1.f);
+            cube_model = glm::translate(cube_model, glm::vec3(-1.0f, 0.01f, -1.0f));
+            objectShader.Set(modelUniform, cube_model);
+            g_glState.DrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT);
+
+            cube_model = glm::mat4(1.f);
+            cube_model = glm::translate(cube_model, glm::vec3(2.0f, 0.01f, 0.0f));
+            objectShader.Set(modelUniform, cube_model);
+            g_glState.DrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT);
+
+            // -----------------------------------
+            // FLOOR OBJECT
+            g_glState.BindTexture(0, GL_TEXTURE_2D, floorTexture);
+
+            g_glState.BindVertexArray(floorVAO);
+            glm::mat4 floor_model = glm::mat4(1.f);
+            objectShader.Set(modelUniform, floor_model);
+            g_glState.DrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT);
+        });
+
+    // The 3x3 edge detection kernel of quad.fs, as a fragment pass or as compute passes.
+    // Both are timed on the GPU, compare runs them on the same frame
+    PostProcess post("../../includes/shaders/");
+    GpuTimer fragmentTimer, computeTimer;
+    bool fragmentPost = postPath != PostPath::Compute;
+    bool computePost = postPath != PostPath::Fragment;
+
+    if (fragmentPost){
+        RenderResource fragmentOutput = postPath == PostPath::Compare ?
+            graph.CreateTexture("fragment post", RenderTextureDesc{width, height, GL_RGBA8}) : backbuffer;
+        graph.AddPass("fragment post",
+            [&, fragmentOutput](RenderPassBuilder& pass){
+                pass.Read(sceneColor);
+                pass.WriteColor(fragmentOutput, LoadOp::Clear, glm::vec4(1.f));
+                pass.SideEffect(); // Only timed when comparing, nothing reads it
+            },
+            [&](const RenderPassContext& context){
+                fragmentTimer.Begin();
+                quadShader.Use();
+                g_glState.BindVertexArray(quadVAO);
+                g_glState.Disable(GL_DEPTH_TEST);
+                g_glState.BindTexture(0, GL_TEXTURE_2D, context.Texture(sceneColor));
+                g_glState.BindTexture(1, GL_TEXTURE_3D, colorLut.Texture());
+                g_glState.DrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT);
+                fragmentTimer.End();
+            });
+        if (postPath == PostPath::Compare)
+            windowTargets.push_back(fragmentOutput);
+    }
+
+    if (computePost){
+        RenderResource postOutput = graph.CreateTexture("post output", RenderTextureDesc{width, height, GL_RGBA16F});
+        sceneTargets.push_back(postOutput);
+        if (blurSigma > 0.f)
+            post.AddGaussianBlur(graph, "blur", sceneColor, postOutput, blurSigma, &computeTimer);
+        else
+            post.AddConvolution(graph, "edge detection", sceneColor, postOutput, ConvolutionKernel{3, {1, 1, 1, 1, -8, 1, 1, 1, 1}}, &computeTimer);
+
+        graph.AddPass("present",
+            [&, postOutput](RenderPassBuilder& pass){
+                pass.Read(postOutput);
+                pass.WriteColor(backbuffer, LoadOp::DontCare);
+            },
+            [&, postOutput](const RenderPassContext& context){
+                presentShader.Use();
+                presentShader.Set(sharpnessUniform, dynamicResolution.Scale() < 1.f ? sharpen : 0.f);
+                g_glState.BindVertexArray(quadVAO);
+                g_glState.Disable(GL_DEPTH_TEST);
+                g_glState.BindTexture(0, GL_TEXTURE_2D, context.Texture(postOutput));
+                g_glState.BindTexture(1, GL_TEXTURE_3D, colorLut.Texture());
+                g_glState.DrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT);
+            });
+    }
+
+    if (graph.Compile()){
+        graph.PrintReport();
+        targetPool.PrintReport();
+    }
+
+    // Every target gets its size from the window and the scale, the graph is compiled again with them
+    auto resizeTargets = [&](){
+        int sceneWidth = dynamicResolution.Scaled(width), sceneHeight = dynamicResolution.Scaled(height);
+        for (RenderResource target : windowTargets)
+            graph.Resize(target, width, height);
+        for (RenderResource target : sceneTargets)
+            graph.Resize(target, sceneWidth, sceneHeight);
+        post.Resize(graph, sceneWidth, sceneHeight);
+        if (graph.Compile())
+            targetPool.PrintReport();
+    };
+    GpuTimer frameTimer;
+    unsigned int frameTimerResults = 0;
+
+    // -----------------------------------
+    // READBACK
+    // Frames are copied to pixel buffers and handed over a few frames later, files are written on another thread
+
+    AsyncReadback readback;
+    ImageWriter imageWriter;
+    int referenceWidth = 0, referenceHeight = 0;
+    std::vector<unsigned char> reference;
+    if (referencePath && !ReadPpm(referencePath, referenceWidth, referenceHeight, reference)){
+        std::cerr << "Can't read the reference image " << referencePath << "\n";
+        referencePath = NULL;
+    }
+
+    auto saveFrame = [&](const char* prefix){
+        return [&imageWriter, prefix = std::string(prefix)](const ReadbackImage& image){
+            char number[16];
+            std::snprintf(number, sizeof(number), "%05u", image.frame);
+            imageWriter.Write(prefix + number + ".ppm", image);
+        };
+    };
+    auto compareFrame = [&](const ReadbackImage& image){
+        if (image.width != referenceWidth || image.height != referenceHeight){
+            std::printf("[readback] frame %u is %dx%d, the reference %dx%d\n", image.frame, image.width, image.height, referenceWidth, referenceHeight);
+            return;
+        }
+        ImageDifference difference = CompareImages(image.width, image.height, image.pixels, reference.data());
+        std::printf("[readback] frame %u against %s : max difference %d, rmse %.3f, %u pixels off\n",
+            image.frame, referencePath, difference.maxDifference, difference.rmse, difference.pixelsAbove);
+    };
+
     float deltaTime = 0.f;
     float lastFrame = 0.f;
+    FrameStatsReporter frameStats;
+    float lastPostReport = 0.f;
+    unsigned int frameIndex = 0;
+
+    // Everything above bound objects directly, the render loop only goes through GLState
+    g_glState.Reset();
 
     // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
     while (!glfwWindowShouldClose(window)){
         processInput(window, deltaTime);
+        if (tracePath && frameIndex == TRACE_FRAME)
+            g_glTrace.Begin(tracePath);
 
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
         
-        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glEnable(GL_DEPTH_TEST);
-
-        objectShader.Use();
-
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), 800.f/600.f, 0.1f, 100.f);
-        glUniformMatrix4fv(projectionLocation, 1, GL_FALSE, glm::value_ptr(projection));
-
-        glm::mat4 view = glm::lookAt(camera.Position, camera.Position+camera.Front, camera.Up); 
-        glUniformMatrix4fv(viewLocation, 1, GL_FALSE, glm::value_ptr(view));
-
-        // -----------------------------------
-        // CUBE OBJECT
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, cubeTexture); 	
-
-        glBindVertexArray(cubeVAO);
-        glm::mat4 cube_model = glm::mat4(1.f);
-        cube_model = glm::translate(cube_model, glm::vec3(-1.0f, 0.01f, -1.0f));
-        glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(cube_model));
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-        cube_model = glm::mat4(1.f);
-        cube_model = glm::translate(cube_model, glm::vec3(2.0f, 0.01f, 0.0f));
-        glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(cube_model));
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-        // -----------------------------------
-        // FLOOR OBJECT
-        glBindTexture(GL_TEXTURE_2D, floorTexture);
-
-        glBindVertexArray(floorVAO);
-        glm::mat4 floor_model = glm::mat4(1.f);
-        glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(floor_model));
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-
-        // -----------------------------------
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0); // Back to defaulot framebuffer
-        glClearColor(1.f, 1.f, 1.f, 1.f);
-        glClear(GL_COLOR_BUFFER_BIT);
-        quadShader.Use();
-        glBindVertexArray(quadVAO);
-        glDisable(GL_DEPTH_TEST);
-        glBindTexture(GL_TEXTURE_2D, framebuffer_texture);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        // Minimized windows report 0x0, the previous targets are kept until it comes back
+        bool resized = pendingWidth != width || pendingHeight != height;
+        if (resized && pendingWidth > 0 && pendingHeight > 0 && currentFrame - lastResizeTime > RESIZE_SETTLE_SECONDS){
+            width = pendingWidth;
+            height = pendingHeight;
+            resizeTargets();
+        }
+
+        // One new GPU time at most per frame, the scale follows it with hysteresis
+        if (frameTimer.Results() != frameTimerResults){
+            frameTimerResults = frameTimer.Results();
+            if (dynamicResolution.Update(frameTimer.LastMs())){
+                std::printf("[dynamic resolution] scene at %.0f%% (%dx%d)\n", dynamicResolution.Scale() * 100.f,
+                    dynamicResolution.Scaled(width), dynamicResolution.Scaled(height));
+                resizeTargets();
+            }
+        }
+
+        for (unsigned int i = 0 ; i < COLOR_KEYS ; i++){
+            if (colorToggles & (1u << i))
+                colorLut.Toggle(i);
+        }
+        colorToggles = 0;
+        colorLut.Update();
+
+        frameTimer.Begin();
+        graph.Execute();
+        frameTimer.End();
+
+        // Copies are queued after the timed section, capturing doesn't change the measured frame time
+        if (sequencePrefix)
+            readback.RequestFramebuffer(0, width, height, saveFrame(sequencePrefix));
+        if (screenshotRequested)
+            readback.RequestFramebuffer(0, width, height, saveFrame("screenshot_"));
+        if (referencePath && frameIndex == CAPTURE_FRAME)
+            readback.RequestFramebuffer(0, width, height, compareFrame);
+        screenshotRequested = false;
+        readback.Poll();
+        readback.EndFrame();
+        targetPool.EndFrame();
+        if (dynamicResolution.Enabled()){
+            g_frameStats.gpuFrameUs = (unsigned long long)(frameTimer.LastMs() * 1000.f);
+            g_frameStats.gpuBudgetUs = (unsigned long long)(dynamicResolution.BudgetMs() * 1000.f);
+            g_frameStats.renderScale = (unsigned long long)std::lround(dynamicResolution.Scale() * 100.f);
+        }
+
+        if (currentFrame - lastPostReport > 2.f){
+            float fragmentMs = fragmentTimer.TakeAverageMs();
+            float computeMs = computeTimer.TakeAverageMs();
+            if (fragmentPost && computePost)
+                std::printf("[post] fragment %.3f ms | compute %.3f ms\n", fragmentMs, computeMs);
+            else
+                std::printf("[post] %s %.3f ms\n", fragmentPost ? "fragment" : "compute", fragmentPost ? fragmentMs : computeMs);
+            lastPostReport = currentFrame;
+        }
+
+        frameStats.EndFrame(glfwGetTime());
+        if (g_glTrace.Recording()){
+            g_glTrace.EndFrame();
+            g_glTrace.End();
+        }
+        frameIndex++;
         
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -392,7 +627,17 @@ int main()
     glDeleteVertexArrays(1, &quadVAO);
     glDeleteBuffers(1, &quadVBO);
 
-    glDeleteFramebuffers(1, &FBO);
+    readback.Poll(true);
+    if (readback.Dropped())
+        std::printf("[readback] %u of %u copies dropped, every buffer was in flight\n", readback.Dropped(), readback.Dropped() + readback.Delivered());
+    readback.Release();
+    graph.Release();
+    targetPool.Release();
+    post.Release();
+    colorLut.Release();
+    fragmentTimer.Release();
+    frameTimer.Release();
+    computeTimer.Release();
     
     glfwDestroyWindow(window);
     glfwTerminate();
@@ -17,6 +17,8 @@ const float PITCH       =  0.0f;
 const float SPEED       =  2.5f;
 const float SENSITIVITY =  0.1f;
 const float ZOOM        =  45.0f;
+const float NEAR_PLANE  =  0.1f;
+const float FAR_PLANE   =  100.0f;
 
 class Camera
 {
@@ -58,6 +60,35 @@ class Camera
             return glm::lookAt(Position, Position + Front, Up);
         }
 
+        // Classic projection, depth in [-1, 1] and clipped at far
+        glm::mat4 GetProjectionMatrix(float aspect, float near = NEAR_PLANE, float far = FAR_PLANE)
+        {
+            return glm::perspective(glm::radians(Zoom), aspect, near, far);
+        }
+
+        // Reversed-Z with the far plane at infinity, for glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE).
+        // Depth is near / distance: 1 at the near plane, towards 0 far away, so the float exponent
+        // spends its precision where the 1/z of the projection lost it. Use GL_GREATER and clear to 0
+        glm::mat4 GetReversedInfiniteProjectionMatrix(float aspect, float near = NEAR_PLANE)
+        {
+            float f = 1.0f / tan(glm::radians(Zoom) * 0.5f);
+            glm::mat4 projection(0.0f);
+            projection[0][0] = f / aspect;
+            projection[1][1] = f;
+            projection[2][3] = -1.0f;
+            projection[3][2] = near;
+            return projection;
+        }
+
+        // Same with a far plane, geometry past it is clipped
+        glm::mat4 GetReversedProjectionMatrix(float aspect, float near = NEAR_PLANE, float far = FAR_PLANE)
+        {
+            glm::mat4 projection = GetReversedInfiniteProjectionMatrix(aspect, near);
+            projection[2][2] = near / (far - near);
+            projection[3][2] = far * near / (far - near);
+            return projection;
+        }
+
         void ProcessKeyboard(Camera_Movement direction, float deltaTime)
         {
             float velocity = MovementSpeed * deltaTime;
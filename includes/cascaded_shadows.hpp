@@ -0,0 +1,554 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "gl_state.hpp"
+#include "gpu_timer.hpp"
+#include "shader.hpp"
+
+// Shadows of a directional light over the view frustum, cut in up to MAX_CASCADES slices each
+// rendered into a layer of one depth array texture. All cascades render in a single pass: every
+// caster is drawn once with the mask of the cascades it overlaps, and cascade_shadow.gs emits
+// its triangles to those layers only. includes/shaders/shadows.glsl samples the result.
+//
+// With the static cache on, static casters render into a second array that is kept between frames.
+// A cascade re-renders them only when its region moved, the light turned, or InvalidateStatic hit
+// it. Otherwise its layer is a copy of the cached one with the dynamic casters drawn on top, or
+// just stays as it is when no dynamic caster touched it this frame or the last.
+//
+// Receivers filter the shadow with PCF over a (2r+1)^2 kernel, or with exponential variance
+// shadow maps: EndPass warps the depth of the changed cascades into moments, blurs them with
+// evsm_blur.comp and builds their mips, then the receivers need one trilinear fetch.
+//
+// Frame order: Fit, CasterMask for each caster (thread-safe, the chapter calls it while
+// recording its command lists), BeginPass, draw the static casters, BeginDynamic, draw the
+// dynamic ones, EndPass, then Bind on the programs receiving the shadows
+enum class ShadowFilter
+{
+    Pcf,
+    Evsm
+};
+
+class CascadedShadowMap
+{
+    public:
+        static const unsigned int MAX_CASCADES = 4; // MAX_CASCADES in cascade_shadow.gs and shadows.glsl
+        // With the static cache, cascades cover this much more than their slice, and only move
+        // once the slice leaves them. Costs as much resolution, saves re-rendering the static casters
+        static constexpr float CACHE_MARGIN = 0.1f;
+        // Match the defines of evsm_blur.comp
+        static const int EVSM_TILE = 128;
+        static const int MAX_EVSM_RADIUS = 8;
+        static const int MAX_PCF_RADIUS = 3;
+
+        // shaderDirectory holds evsm_blur.comp, only loaded once EVSM is selected
+        CascadedShadowMap(const unsigned int cascades = 4, const int size = 2048, const std::string& shaderDirectory = "../../includes/shaders/")
+            : m_cascades(std::clamp(cascades, 1u, MAX_CASCADES)), m_size(size), m_shaderDirectory(shaderDirectory)
+        {
+            for (int& resolution : m_resolutions)
+                resolution = size;
+        }
+
+        ~CascadedShadowMap()
+        {
+            Release();
+        }
+
+        void Release()
+        {
+            if (m_framebuffer)
+                glDeleteFramebuffers(1, &m_framebuffer);
+            if (m_texture)
+                glDeleteTextures(1, &m_texture);
+            if (m_staticFramebuffer)
+                glDeleteFramebuffers(1, &m_staticFramebuffer);
+            if (m_staticTexture)
+                glDeleteTextures(1, &m_staticTexture);
+            if (m_momentTexture)
+                glDeleteTextures(1, &m_momentTexture);
+            if (m_blurTexture)
+                glDeleteTextures(1, &m_blurTexture);
+            if (m_depthSampler)
+                glDeleteSamplers(1, &m_depthSampler);
+            m_framebuffer = m_texture = m_staticFramebuffer = m_staticTexture = 0;
+            m_momentTexture = m_blurTexture = m_depthSampler = 0;
+            m_staticValid = m_momentsValid = 0;
+            m_evsmBlur.reset();
+            m_timer.Release();
+        }
+
+        // Cascade i renders into the lower left resolution x resolution texels of its layer.
+        // Far cascades cover more ground per texel anyway, giving them less costs less fill rate
+        void SetResolution(const unsigned int cascade, const int resolution)
+        {
+            m_resolutions[cascade] = std::clamp(resolution, 16, m_size);
+            m_valid &= ~(1u << cascade);
+            m_staticValid &= ~(1u << cascade);
+            m_momentsValid &= ~(1u << cascade);
+        }
+
+        // pcfRadius 0 is a single hardware 2x2 comparison, r a (2r+1)^2 kernel of them
+        void SetFilter(const ShadowFilter filter, const int pcfRadius = 1)
+        {
+            m_filter = filter;
+            m_pcfRadius = std::clamp(pcfRadius, 0, MAX_PCF_RADIUS);
+        }
+
+        // Exponents warp the depth before the moments are taken: larger ones bleed less light but
+        // overflow sooner, 40 and 5 are the largest 32 bit floats allow with margin. Bleed reduction
+        // cuts the tail of the Chebyshev bound, 0 keeps it, near 1 darkens the penumbras
+        void SetEvsm(const float positiveExponent, const float negativeExponent, const float bleedReduction, const int blurRadius)
+        {
+            m_evsmExponents = glm::vec2(std::clamp(positiveExponent, 1.f, 42.f), std::clamp(negativeExponent, 1.f, 42.f));
+            m_bleedReduction = std::clamp(bleedReduction, 0.f, 0.95f);
+            m_blurRadius = std::clamp(blurRadius, 0, MAX_EVSM_RADIUS);
+            m_momentsValid = 0;
+        }
+
+        void SetBleedReduction(const float bleedReduction) { m_bleedReduction = std::clamp(bleedReduction, 0.f, 0.95f); }
+
+        ShadowFilter Filter() const { return m_filter; }
+        int PcfRadius() const { return m_pcfRadius; }
+        float BleedReduction() const { return m_bleedReduction; }
+
+        // GPU time of the last pass whose result came back, blur included
+        float LastPassMs() const { return m_timer.LastMs(); }
+
+        // Off, every caster renders into the cascades each time they update
+        void SetStaticCaching(const bool enabled)
+        {
+            m_staticCaching = enabled;
+            m_staticValid = 0;
+            std::printf("[shadows] static cache %s\n", enabled ? "on" : "off");
+        }
+
+        bool StaticCaching() const { return m_staticCaching; }
+
+        // A static caster moved, appeared or disappeared: the cached cascades it shadows are
+        // rendered again. Call it with the bounding sphere before and after a move
+        void InvalidateStatic(const glm::vec3& centre, const float radius)
+        {
+            glm::vec3 light(m_lightView * glm::vec4(centre, 1.f));
+            for (unsigned int i = 0 ; i < m_cascades ; i++){
+                const Cascade& cascade = m_static[i];
+                if (std::fabs(light.x - cascade.centre.x) <= cascade.radius + radius &&
+                    std::fabs(light.y - cascade.centre.y) <= cascade.radius + radius)
+                    m_staticValid &= ~(1u << i);
+            }
+        }
+
+        void SetShadowDistance(const float distance) { m_shadowDistance = distance; }
+
+        // 0 splits the distance uniformly, 1 logarithmically
+        void SetSplitLambda(const float lambda) { m_splitLambda = lambda; }
+
+        // GPU time of the pass above which cascades are updated in turn, 0 always updates them all
+        void SetBudget(const float budgetMs) { m_budgetMs = budgetMs; }
+
+        unsigned int Cascades() const { return m_cascades; }
+
+        // Fits every cascade to its slice of the camera frustum and picks the ones rendered this frame.
+        // Each slice is bounded by a sphere, its size doesn't change when the camera turns, and its
+        // centre snaps to whole shadow texels, so the shadow edges don't shimmer when the camera moves
+        void Fit(const glm::mat4& view, const float fovY, const float aspect, const float near, const glm::vec3& lightDirection)
+        {
+            glm::vec3 direction = glm::normalize(lightDirection);
+            bool turned = direction != m_direction;
+            if (turned)
+                m_staticValid = 0; // Every cached depth is seen from the old direction
+            m_direction = direction;
+            glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(0.f, 0.f, 1.f) : glm::vec3(0.f, 1.f, 0.f);
+            m_lightView = glm::lookAt(glm::vec3(0.f), direction, up);
+
+            glm::mat4 inverseView = glm::inverse(view);
+            glm::vec3 position(inverseView[3]);
+            glm::vec3 forward = -glm::normalize(glm::vec3(inverseView[2]));
+            float tanY = std::tan(fovY * 0.5f);
+            float k2 = tanY * tanY * (1.f + aspect * aspect); // Squared distance of a corner to the axis, per unit of depth
+
+            float sliceNear = near;
+            for (unsigned int i = 0 ; i < m_cascades ; i++){
+                float p = (i + 1) / (float)m_cascades;
+                float logarithmic = near * std::pow(m_shadowDistance / near, p);
+                float uniform = near + (m_shadowDistance - near) * p;
+                float sliceFar = m_splitLambda * logarithmic + (1.f - m_splitLambda) * uniform;
+
+                // Centre on the view axis at the same distance of the near and far corners
+                float centre = std::min(0.5f * (sliceNear + sliceFar) * (1.f + k2), sliceFar);
+                float radius = std::max(std::sqrt((sliceFar - centre) * (sliceFar - centre) + sliceFar * sliceFar * k2),
+                                        std::sqrt((centre - sliceNear) * (centre - sliceNear) + sliceNear * sliceNear * k2));
+                radius = std::ceil(radius * 16.f) / 16.f;
+
+                glm::vec3 lightCentre(m_lightView * glm::vec4(position + forward * centre, 1.f));
+                Cascade& cascade = m_fitted[i];
+                float slice = radius;
+                if (m_staticCaching){
+                    // Stay put while the slice's sphere is inside the last square
+                    radius = std::ceil(radius * (1.f + CACHE_MARGIN) * 16.f) / 16.f;
+                    glm::vec3 moved = glm::abs(lightCentre - cascade.centre);
+                    if (!turned && cascade.radius == radius && std::max(moved.x, std::max(moved.y, moved.z)) <= radius - slice){
+                        sliceNear = sliceFar;
+                        continue;
+                    }
+                }
+                float texel = 2.f * radius / m_resolutions[i];
+                lightCentre.x = std::floor(lightCentre.x / texel) * texel;
+                lightCentre.y = std::floor(lightCentre.y / texel) * texel;
+
+                // The light looks down -z. Only receivers set the depth range, casters closer to the
+                // light are clamped onto the near plane by GL_DEPTH_CLAMP and still cast
+                cascade.centre = lightCentre;
+                cascade.radius = radius;
+                cascade.matrix = glm::ortho(lightCentre.x - radius, lightCentre.x + radius, lightCentre.y - radius, lightCentre.y + radius,
+                                            -(lightCentre.z + radius), -(lightCentre.z - radius)) * m_lightView;
+                sliceNear = sliceFar;
+            }
+            schedule();
+
+            for (unsigned int i = 0 ; i < m_cascades ; i++){
+                if (m_fitted[i].centre != m_static[i].centre || m_fitted[i].radius != m_static[i].radius)
+                    m_staticValid &= ~(1u << i);
+            }
+            m_staticRefresh = m_staticCaching ? m_scheduled & ~m_staticValid : m_scheduled;
+        }
+
+        // Cascades the caster's bounding sphere can shadow among those it's drawn into this frame, 0
+        // means it can be skipped. Static casters only go to cascades whose cache is re-rendered.
+        // Outside the square of a cascade or beyond its receivers (seen from the light), it can't
+        unsigned int CasterMask(const glm::vec3& centre, const float radius, const bool isStatic) const
+        {
+            glm::vec3 light(m_lightView * glm::vec4(centre, 1.f));
+            unsigned int drawn = isStatic ? m_staticRefresh : m_scheduled;
+            unsigned int mask = 0;
+            for (unsigned int i = 0 ; i < m_cascades ; i++){
+                const Cascade& cascade = m_fitted[i];
+                if (!(drawn & (1u << i)) ||
+                    std::fabs(light.x - cascade.centre.x) > cascade.radius + radius ||
+                    std::fabs(light.y - cascade.centre.y) > cascade.radius + radius ||
+                    light.z + radius < cascade.centre.z - cascade.radius)
+                    continue;
+                mask |= 1u << i;
+            }
+            return mask;
+        }
+
+        // Casters kept per cascade out of `tested`, summed by the recording jobs once each
+        void AddCasterCounts(const unsigned int (&kept)[MAX_CASCADES], const unsigned int tested)
+        {
+            for (unsigned int i = 0 ; i < MAX_CASCADES ; i++)
+                m_kept[i].fetch_add(kept[i], std::memory_order_relaxed);
+            m_tested.fetch_add(tested, std::memory_order_relaxed);
+        }
+
+        // Or of the dynamic casters' masks, summed by the recording jobs once each. Cascades
+        // without dynamic casters this frame and the last don't need their cached layer copied
+        void AddDynamicMask(const unsigned int mask)
+        {
+            m_dynamicMask.fetch_or(mask, std::memory_order_relaxed);
+        }
+
+        // Binds the layered framebuffer of the static casters and clears the cascades they render
+        // into this frame, the cache's or the sampled one without the cache. The caster program
+        // (cascade_shadow.vs/.gs) gets the matrices, each draw then sets its "cascadeMask"
+        void BeginPass(Shader& casterShader)
+        {
+            static constexpr unsigned int MATRIX_HASHES[MAX_CASCADES] = {
+                "lightMatrices[0]"_uniform, "lightMatrices[1]"_uniform, "lightMatrices[2]"_uniform, "lightMatrices[3]"_uniform
+            };
+            if (!m_texture)
+                create(m_texture, m_framebuffer);
+            if (m_staticCaching && !m_staticTexture)
+                create(m_staticTexture, m_staticFramebuffer);
+            m_timer.Begin();
+            unsigned int target = m_staticCaching ? m_staticTexture : m_texture;
+            g_glState.BindFramebuffer(GL_FRAMEBUFFER, m_staticCaching ? m_staticFramebuffer : m_framebuffer);
+            const float farDepth = 1.f;
+            for (unsigned int i = 0 ; i < m_cascades ; i++){
+                if (!(m_scheduled & (1u << i)))
+                    continue;
+                if (m_staticRefresh & (1u << i))
+                    glClearTexSubImage(target, 0, 0, 0, i, m_resolutions[i], m_resolutions[i], 1, GL_DEPTH_COMPONENT, GL_FLOAT, &farDepth);
+                // Viewport 0 belongs to GLState, cascades use 1 to MAX_CASCADES
+                glViewportIndexedf(i + 1, 0.f, 0.f, (float)m_resolutions[i], (float)m_resolutions[i]);
+            }
+            g_glState.Enable(GL_DEPTH_TEST);
+            g_glState.Enable(GL_DEPTH_CLAMP);
+            g_glState.DepthMask(true);
+            g_glState.DepthFunc(GL_LESS);
+            casterShader.Use();
+            for (unsigned int i = 0 ; i < m_cascades ; i++)
+                casterShader.Set(MATRIX_HASHES[i], m_fitted[i].matrix);
+        }
+
+        // With the cache, copies the cached layers under the dynamic casters and binds the sampled
+        // framebuffer. A layer is left alone when it already holds the cache and nothing dynamic
+        // was or will be drawn on it. Without the cache both kinds of casters draw into the same layers
+        void BeginDynamic()
+        {
+            unsigned int dynamic = m_dynamicMask.exchange(0, std::memory_order_relaxed) & m_scheduled;
+            m_changed = m_scheduled;
+            if (!m_staticCaching)
+                return;
+            unsigned int copied = (m_staticRefresh | dynamic | m_dynamicLast) & m_scheduled;
+            m_changed = copied;
+            for (unsigned int i = 0 ; i < m_cascades ; i++){
+                if (copied & (1u << i))
+                    glCopyImageSubData(m_staticTexture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, m_texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, i,
+                                       m_resolutions[i], m_resolutions[i], 1);
+            }
+            m_dynamicLast = (m_dynamicLast & ~m_scheduled) | dynamic;
+            g_glState.BindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+        }
+
+        // Back to the default framebuffer, with EVSM the moments of the changed cascades are filtered.
+        // Every `interval` seconds prints a [shadows] line
+        void EndPass(const double now, const double interval = 2.0)
+        {
+            g_glState.Disable(GL_DEPTH_CLAMP);
+            g_glState.BindFramebuffer(GL_FRAMEBUFFER, 0);
+            if (m_filter == ShadowFilter::Evsm)
+                filterMoments(m_changed | (((1u << m_cascades) - 1) & ~m_momentsValid));
+            else
+                m_momentsValid &= ~m_changed;
+            m_timer.End();
+
+            unsigned int rendered = 0;
+            for (unsigned int i = 0 ; i < m_cascades ; i++){
+                if (m_scheduled & (1u << i)){
+                    m_rendered[i] = m_fitted[i];
+                    rendered++;
+                }
+                if (m_staticCaching && (m_staticRefresh & (1u << i))){
+                    m_static[i] = m_fitted[i];
+                    m_cacheMisses++;
+                }
+            }
+            m_valid |= m_scheduled;
+            if (m_staticCaching){
+                m_staticValid |= m_staticRefresh;
+                m_cacheLookups += rendered;
+            }
+            m_renderedAverage += (rendered - m_renderedAverage) * 0.1f;
+            m_frames++;
+            m_updates += rendered;
+
+            if (m_reportStart < 0.0)
+                m_reportStart = now;
+            if (now - m_reportStart < interval)
+                return;
+            m_reportStart = now;
+            unsigned int tested = m_tested.exchange(0);
+            std::printf("[shadows] gpu %.2f ms", m_timer.TakeAverageMs());
+            if (m_budgetMs > 0.f)
+                std::printf(" of %.2f ms budget", m_budgetMs);
+            std::printf(" | %.2f cascade updates per frame%s | casters kept", m_updates / (double)m_frames, m_staggered ? " (staggered)" : "");
+            for (unsigned int i = 0 ; i < m_cascades ; i++)
+                std::printf(" %.1f%%", tested ? 100.0 * m_kept[i].exchange(0) / tested : 0.0);
+            std::printf(" of %.0f per frame", tested / (double)m_frames);
+            if (m_staticCaching)
+                std::printf(" | static cache hit %.1f%% of updates", m_cacheLookups ? 100.0 * (m_cacheLookups - m_cacheMisses) / m_cacheLookups : 0.0);
+            std::printf("\n");
+            m_frames = m_updates = 0;
+            m_cacheLookups = m_cacheMisses = 0;
+        }
+
+        // Textures and uniforms of shadows.glsl, with the matrices each cascade was last rendered with.
+        // The depth goes to unit and the moments to unit + 1, both samplers must point to a unit of their type
+        void Bind(const Shader& receiver, const unsigned int unit) const
+        {
+            static constexpr unsigned int MATRIX_HASHES[MAX_CASCADES] = {
+                "cascadeMatrices[0]"_uniform, "cascadeMatrices[1]"_uniform, "cascadeMatrices[2]"_uniform, "cascadeMatrices[3]"_uniform
+            };
+            static constexpr unsigned int SCALE_HASHES[MAX_CASCADES] = {
+                "cascadeScale[0]"_uniform, "cascadeScale[1]"_uniform, "cascadeScale[2]"_uniform, "cascadeScale[3]"_uniform
+            };
+            static constexpr unsigned int TEXEL_HASHES[MAX_CASCADES] = {
+                "cascadeWorldTexel[0]"_uniform, "cascadeWorldTexel[1]"_uniform, "cascadeWorldTexel[2]"_uniform, "cascadeWorldTexel[3]"_uniform
+            };
+            static constexpr unsigned int RANGE_HASHES[MAX_CASCADES] = {
+                "cascadeDepthRange[0]"_uniform, "cascadeDepthRange[1]"_uniform, "cascadeDepthRange[2]"_uniform, "cascadeDepthRange[3]"_uniform
+            };
+            g_glState.BindTexture(unit, GL_TEXTURE_2D_ARRAY, m_texture);
+            g_glState.BindTexture(unit + 1, GL_TEXTURE_2D_ARRAY, m_momentTexture);
+            receiver.SetInt("shadowMap"_uniform, (int)unit);
+            receiver.SetInt("shadowMoments"_uniform, (int)unit + 1);
+            receiver.SetInt("cascadeCount"_uniform, (int)m_cascades);
+            receiver.SetInt("shadowFilter"_uniform, (int)m_filter);
+            receiver.SetInt("shadowPcfRadius"_uniform, m_pcfRadius);
+            receiver.Set("shadowEvsm"_uniform, glm::vec3(m_evsmExponents, m_bleedReduction));
+            for (unsigned int i = 0 ; i < m_cascades ; i++){
+                const Cascade& cascade = m_rendered[i];
+                receiver.Set(MATRIX_HASHES[i], cascade.matrix);
+                receiver.Set(SCALE_HASHES[i], m_resolutions[i] / (float)m_size);
+                receiver.Set(TEXEL_HASHES[i], 2.f * cascade.radius / m_resolutions[i]);
+                receiver.Set(RANGE_HASHES[i], 2.f * cascade.radius);
+            }
+        }
+
+        unsigned int Texture() const { return m_texture; }
+
+    private:
+        struct Cascade
+        {
+            glm::mat4 matrix = glm::mat4(1.f);
+            glm::vec3 centre = glm::vec3(0.f); // Light space, snapped
+            float radius = 0.f;
+        };
+
+        unsigned int m_cascades;
+        int m_size; // Layers of the texture, the largest resolution
+        int m_resolutions[MAX_CASCADES];
+        float m_shadowDistance = 50.f;
+        float m_splitLambda = 0.75f;
+        float m_budgetMs = 0.f;
+
+        glm::mat4 m_lightView = glm::mat4(1.f);
+        Cascade m_fitted[MAX_CASCADES];   // This frame's fit
+        Cascade m_rendered[MAX_CASCADES]; // What each layer holds, sampled by the receivers
+        unsigned int m_scheduled = 0;     // Cascades rendered this frame
+        unsigned int m_valid = 0;         // Cascades rendered at least once with their current resolution
+        glm::vec3 m_direction = glm::vec3(0.f);
+
+        bool m_staticCaching = true;
+        Cascade m_static[MAX_CASCADES];  // What each layer of the cache holds
+        unsigned int m_staticValid = 0;  // Cache layers still matching their cascade
+        unsigned int m_staticRefresh = 0; // Layers the static casters render into this frame
+        unsigned int m_dynamicLast = 0;  // Layers with dynamic casters the last time they were rendered
+        std::atomic<unsigned int> m_dynamicMask = 0;
+        unsigned int m_cacheLookups = 0, m_cacheMisses = 0;
+        bool m_staggered = false;
+        unsigned int m_nextStaggered = 1;
+
+        ShadowFilter m_filter = ShadowFilter::Pcf;
+        int m_pcfRadius = 1;
+        glm::vec2 m_evsmExponents = glm::vec2(40.f, 5.f);
+        float m_bleedReduction = 0.3f;
+        int m_blurRadius = 2;
+        std::string m_shaderDirectory;
+        std::unique_ptr<Shader> m_evsmBlur;
+        unsigned int m_momentTexture = 0, m_blurTexture = 0; // RGBA32F moments, with mips, and the horizontal pass
+        unsigned int m_depthSampler = 0;  // Reads the depth without comparison
+        unsigned int m_changed = 0;       // Layers whose depth changed this frame
+        unsigned int m_momentsValid = 0;  // Layers whose moments match their depth
+
+        unsigned int m_framebuffer = 0, m_texture = 0;             // Sampled by the receivers
+        unsigned int m_staticFramebuffer = 0, m_staticTexture = 0; // Static cache
+        GpuTimer m_timer;
+        unsigned int m_timerResults = 0;
+        float m_renderedAverage = 0.f;
+
+        std::atomic<unsigned int> m_kept[MAX_CASCADES] = {};
+        std::atomic<unsigned int> m_tested = 0;
+        unsigned int m_frames = 0, m_updates = 0;
+        double m_reportStart = -1.0;
+
+        void create(unsigned int& texture, unsigned int& framebuffer)
+        {
+            glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &texture);
+            glTextureStorage3D(texture, 1, GL_DEPTH_COMPONENT32F, m_size, m_size, m_cascades);
+            glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTextureParameteri(texture, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTextureParameteri(texture, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+            glCreateFramebuffers(1, &framebuffer);
+            glNamedFramebufferTexture(framebuffer, GL_DEPTH_ATTACHMENT, texture, 0); // Layered
+            glNamedFramebufferDrawBuffer(framebuffer, GL_NONE);
+            glNamedFramebufferReadBuffer(framebuffer, GL_NONE);
+            if (glCheckNamedFramebufferStatus(framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cerr << "Cascaded shadow framebuffer is not complete\n";
+        }
+
+        // Horizontal pass from the depth into m_blurTexture, vertical pass into level 0 of the moments,
+        // one dispatch per layer since each cascade has its own resolution. Then the mips of every layer.
+        // Texels of a layer outside its cascade hold the moments of the far plane, nothing occludes
+        // there, so the mips averaging across the cascade's edge never pull in zero moments
+        void filterMoments(const unsigned int layers)
+        {
+            if (!layers)
+                return;
+            if (!m_momentTexture){
+                int levels = 1;
+                while ((m_size >> levels) > 0)
+                    levels++;
+                glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &m_momentTexture);
+                glTextureStorage3D(m_momentTexture, levels, GL_RGBA32F, m_size, m_size, m_cascades);
+                glTextureParameteri(m_momentTexture, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                glTextureParameteri(m_momentTexture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTextureParameteri(m_momentTexture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTextureParameteri(m_momentTexture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glTextureParameterf(m_momentTexture, GL_TEXTURE_MAX_ANISOTROPY, 8.f);
+                glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &m_blurTexture);
+                glTextureStorage3D(m_blurTexture, 1, GL_RGBA32F, m_size, m_size, m_cascades);
+                glCreateSamplers(1, &m_depthSampler);
+                glSamplerParameteri(m_depthSampler, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+                glSamplerParameteri(m_depthSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glSamplerParameteri(m_depthSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                m_evsmBlur = std::make_unique<Shader>((m_shaderDirectory + "evsm_blur.comp").c_str());
+            }
+            Shader& blur = *m_evsmBlur;
+            blur.Use();
+            blur.SetInt("radius"_uniform, m_blurRadius);
+            blur.Set("exponents"_uniform, m_evsmExponents);
+            for (unsigned int i = 0 ; i < m_cascades ; i++){
+                if (!(layers & (1u << i)))
+                    continue;
+                int extent = m_resolutions[i];
+                if (extent < m_size){
+                    float farPositive = std::exp(m_evsmExponents.x), farNegative = -std::exp(-m_evsmExponents.y);
+                    const float lit[4] = {farPositive, farPositive * farPositive, farNegative, farNegative * farNegative};
+                    glClearTexSubImage(m_momentTexture, 0, extent, 0, i, m_size - extent, m_size, 1, GL_RGBA, GL_FLOAT, lit);
+                    glClearTexSubImage(m_momentTexture, 0, 0, extent, i, extent, m_size - extent, 1, GL_RGBA, GL_FLOAT, lit);
+                }
+                blur.SetInt("layer"_uniform, (int)i);
+                blur.SetInt("extent"_uniform, extent);
+                for (int horizontal = 1 ; horizontal >= 0 ; horizontal--){
+                    blur.SetInt("horizontal"_uniform, horizontal);
+                    g_glState.BindTexture(0, GL_TEXTURE_2D_ARRAY, horizontal ? m_texture : m_blurTexture);
+                    g_glState.BindSampler(0, horizontal ? m_depthSampler : 0);
+                    // One layer bound as an image2D, GLState only binds whole levels
+                    glBindImageTexture(0, horizontal ? m_blurTexture : m_momentTexture, 0, GL_FALSE, i, GL_WRITE_ONLY, GL_RGBA32F);
+                    g_glState.DispatchCompute((extent + EVSM_TILE - 1) / EVSM_TILE, extent);
+                    g_glState.MemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+                }
+            }
+            g_glState.BindSampler(0, 0);
+            glGenerateTextureMipmap(m_momentTexture);
+            m_momentsValid |= layers;
+        }
+
+        // Over budget, the first cascade still updates every frame and the others take turns. Back to
+        // all of them once the estimated cost of a full update fits in 80% of the budget
+        void schedule()
+        {
+            if (m_budgetMs > 0.f && m_timer.Results() != m_timerResults){
+                m_timerResults = m_timer.Results();
+                float ms = m_timer.LastMs();
+                float fullMs = ms * m_cascades / std::max(m_renderedAverage, 1.f);
+                if (!m_staggered && ms > m_budgetMs)
+                    m_staggered = true;
+                else if (m_staggered && fullMs < m_budgetMs * 0.8f)
+                    m_staggered = false;
+            }
+            if (m_budgetMs <= 0.f)
+                m_staggered = false;
+
+            unsigned int all = (1u << m_cascades) - 1;
+            if (!m_staggered || m_cascades == 1){
+                m_scheduled = all;
+                return;
+            }
+            m_scheduled = 1u | (1u << m_nextStaggered) | (all & ~m_valid);
+            m_nextStaggered = m_nextStaggered + 1 < m_cascades ? m_nextStaggered + 1 : 1;
+        }
+};
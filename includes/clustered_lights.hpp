@@ -0,0 +1,606 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CLUSTERED_LIGHTS_SSE
+#endif
+
+#include "gl_state.hpp"
+#include "gl_trace.hpp"
+#include "gpu_timer.hpp"
+#include "job_pool.hpp"
+#include "point_shadows.hpp"
+#include "shader.hpp"
+
+// Point or spot light of ClusteredLights, attenuated like phong.glsl. Point lights keep the
+// default cutOffs, whose cone never cuts
+struct ClusterLight
+{
+    glm::vec3 position = glm::vec3(0.f);
+    glm::vec3 diffuse = glm::vec3(1.f);
+    glm::vec3 specular = glm::vec3(1.f);
+    float ambient = 0.f;
+    float constant = 1.f, linear = 0.09f, quadratic = 0.032f;
+    glm::vec3 direction = glm::vec3(0.f, -1.f, 0.f); // Spot lights only
+    float cutOff = -1.f, outerCutOff = -2.f;         // Cosines
+    int shadow = -1;                                 // Light of PointShadowMaps, -1 unshadowed
+};
+
+// Clustered forward lighting. The view is split in a grid of tiles times exponential depth
+// slices; every frame cluster_lights.comp lists the lights reaching each cluster, and receivers
+// built with CLUSTERED_LIGHTS (includes/shaders/clustered_lights.glsl) only loop over the list of
+// their fragment's cluster. A light reaches as far as its attenuation brings it under
+// RANGE_THRESHOLD, so dim lights touch few clusters and the cost of a fragment follows the lights
+// that actually light it, not the number in the scene.
+//
+// Each cluster holds up to CLUSTER_STRIDE - 1 lights, the rest are dropped and counted as overflow.
+//
+// Bin builds the same lists on the CPU for GPUs with weak compute: one job per slice keeps the
+// lights crossing the slice's depths, then tests them against each tile's box four at a time with
+// SSE. The lists are packed and written to a persistently mapped ring, with no per-cluster limit.
+//
+// The lights live in a persistently mapped buffer of FRAMES_IN_FLIGHT copies. SetLights writes the
+// next copy in place and binds it from then on, so a change costs one copy and frames still in
+// flight keep reading the previous one; nothing is uploaded while the lights don't change. The
+// count is a uniform, adding lights never rebuilds a program
+class ClusteredLights
+{
+    public:
+        static const unsigned int GROUP_SIZE = 128;    // Match cluster_lights.comp
+        static const unsigned int CLUSTER_STRIDE = 256; // Match clustered_lights.glsl
+        static const unsigned int LIGHT_BINDING = 5;
+        static const unsigned int LIST_BINDING = 6;
+        static const unsigned int STATS_BINDING = 7;
+        static constexpr float RANGE_THRESHOLD = 1.f / 32.f;
+        static const unsigned int FRAMES_IN_FLIGHT = 3; // Slots of the CPU lists
+
+        // shaderDirectory holds cluster_lights.comp. far is where the slices end, fragments past it use the last one
+        ClusteredLights(const unsigned int tilesX = 16, const unsigned int tilesY = 9, const unsigned int slices = 24,
+                        const float near = 0.1f, const float far = 100.f, const std::string& shaderDirectory = "../../includes/shaders/")
+            : m_grid(std::max(1u, tilesX), std::max(1u, tilesY), std::max(1u, slices)), m_near(near), m_far(far), m_shaderDirectory(shaderDirectory) {}
+
+        ~ClusteredLights()
+        {
+            Release();
+        }
+
+        void Release()
+        {
+            releaseLights();
+            if (m_listBuffer)
+                glDeleteBuffers(1, &m_listBuffer);
+            if (m_statsBuffer)
+                glDeleteBuffers(1, &m_statsBuffer);
+            for (GLsync& fence : m_fences){
+                if (fence)
+                    glDeleteSync(fence);
+                fence = 0;
+            }
+            if (m_ringBuffer){
+                glUnmapNamedBuffer(m_ringBuffer);
+                glDeleteBuffers(1, &m_ringBuffer);
+            }
+            m_listBuffer = m_statsBuffer = m_ringBuffer = 0;
+            m_ring = nullptr;
+            m_slotWords = 0;
+            m_culling.reset();
+            m_timer.Release();
+        }
+
+        // Writes the lights to the next copy of the buffer, their range is derived from the
+        // attenuation and the brightest channel. Call when they change, not every frame
+        void SetLights(const std::vector<ClusterLight>& lights)
+        {
+            GpuLight* entries = acquireLights((unsigned int)lights.size());
+            if (!entries){ // No buffer left, draw without lights rather than index into none
+                m_count = 0;
+                m_cpuLights.clear();
+                return;
+            }
+            m_count = (unsigned int)lights.size();
+            m_cpuLights.resize(m_count);
+            for (unsigned int i = 0 ; i < m_count ; i++){
+                const ClusterLight& light = lights[i];
+                glm::vec3 brightest = glm::max(light.diffuse, light.specular);
+                float intensity = std::max(std::max(brightest.r, brightest.g), std::max(brightest.b, light.ambient));
+                float range = PointShadowMaps::AttenuationRange(light.constant, light.linear, light.quadratic, intensity, RANGE_THRESHOLD);
+                GpuLight entry;
+                entry.positionRange = glm::vec4(light.position, range);
+                entry.diffuseAmbient = glm::vec4(light.diffuse, light.ambient);
+                entry.specularShadow = glm::vec4(light.specular, (float)light.shadow);
+                entry.directionCutOff = glm::vec4(glm::normalize(light.direction), light.cutOff);
+                entry.attenuation = glm::vec4(light.constant, light.linear, light.quadratic, light.outerCutOff);
+                entries[i] = entry; // Write-only, the mapping is uncached on some drivers
+                m_cpuLights[i] = CpuLight{entry.positionRange, glm::vec4(glm::vec3(entry.directionCutOff), light.outerCutOff)};
+            }
+            if (m_count && g_glTrace.Recording())
+                g_glTrace.BufferSubData(m_lightBuffer, m_lightSlot * m_lightStride, entries, m_count * sizeof(GpuLight));
+            m_lightUploads++;
+        }
+
+        // Fills the light lists of this frame. FrameData must already hold its view and projection
+        void Cull()
+        {
+            if (!m_culling)
+                create();
+            m_timer.Begin();
+            const unsigned int zero[4] = {};
+            glNamedBufferSubData(m_statsBuffer, 0, sizeof(zero), zero);
+            if (g_glTrace.Recording())
+                g_glTrace.BufferSubData(m_statsBuffer, 0, zero, sizeof(zero));
+            bindBuffers();
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, STATS_BINDING, m_statsBuffer);
+            if (g_glTrace.Recording())
+                g_glTrace.BindBufferRange(GL_SHADER_STORAGE_BUFFER, STATS_BINDING, m_statsBuffer, 0, 0);
+            m_culling->Use();
+            setUniforms(*m_culling);
+            g_glState.DispatchCompute((Clusters() + GROUP_SIZE - 1) / GROUP_SIZE, 1);
+            g_glState.MemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            m_timer.End();
+            m_cpuLists = false;
+        }
+
+        // Fills the light lists of this frame on the CPU, the GPU only reads them. Call EndFrame
+        // after the last draw using them
+        void Bin(JobPool& jobs, const glm::mat4& view, const glm::mat4& projection)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            if (projection != m_boxProjection || m_boxes.empty())
+                computeBoxes(projection);
+
+            // Lights in view space, in lanes padded to 4 with lights that reach nothing
+            unsigned int padded = (m_count + 3) & ~3u;
+            m_viewX.assign(padded, 0.f);
+            m_viewY.assign(padded, 0.f);
+            m_viewZ.assign(padded, 0.f);
+            m_radius.assign(padded, -1e30f);
+            m_radius2.assign(padded, -1.f);
+            m_viewCones.resize(m_count);
+            glm::mat3 rotation(view);
+            for (unsigned int i = 0 ; i < m_count ; i++){
+                const CpuLight& light = m_cpuLights[i];
+                glm::vec3 position(view * glm::vec4(glm::vec3(light.positionRange), 1.f));
+                m_viewX[i] = position.x;
+                m_viewY[i] = position.y;
+                m_viewZ[i] = position.z;
+                m_radius[i] = light.positionRange.w;
+                m_radius2[i] = light.positionRange.w * light.positionRange.w;
+                m_viewCones[i] = glm::vec4(rotation * glm::vec3(light.cone), light.cone.w);
+            }
+
+            m_slices.resize(m_grid.z);
+            auto binSlice = [this, padded](unsigned int slice){ binSliceLights(slice, padded); };
+            jobs.Run(m_grid.z, binSlice);
+
+            // Heads first, then the lists of every slice one after the other
+            unsigned int clusters = Clusters();
+            size_t words = clusters;
+            for (const SliceLists& lists : m_slices)
+                words += lists.lists.size();
+            unsigned int* slot = acquireSlot(words);
+            if (!slot){ // No ring to write to, the GPU builds this frame's lists instead
+                Cull();
+                return;
+            }
+            unsigned int offset = clusters;
+            unsigned int tiles = m_grid.x * m_grid.y;
+            m_binIndices = m_binMax = m_binOccupied = 0;
+            for (unsigned int s = 0 ; s < m_grid.z ; s++){
+                const SliceLists& lists = m_slices[s];
+                for (unsigned int t = 0 ; t < tiles ; t++){
+                    slot[s * tiles + t] = offset + lists.heads[t];
+                    unsigned int count = lists.lists[lists.heads[t]];
+                    m_binIndices += count;
+                    m_binMax = std::max(m_binMax, count);
+                    m_binOccupied += count > 0;
+                }
+                std::memcpy(slot + offset, lists.lists.data(), lists.lists.size() * sizeof(unsigned int));
+                offset += (unsigned int)lists.lists.size();
+            }
+            m_slotUsed = (unsigned int)words;
+            m_cpuLists = true;
+            m_binUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+            m_binFrames++;
+            m_binThreads = jobs.Size();
+        }
+
+        // Fences the slot of the CPU lists, call after the last draw reading them
+        void EndFrame()
+        {
+            if (!m_cpuLists || !m_ringBuffer)
+                return;
+            m_fences[m_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            m_slot = (m_slot + 1) % FRAMES_IN_FLIGHT;
+        }
+
+        // Light buffers and grid of the receivers
+        void Bind(const Shader& receiver) const
+        {
+            bindBuffers();
+            setUniforms(receiver);
+        }
+
+        // Only the lights and their count, for passes doing their own culling (TiledDeferred)
+        void BindLights(const Shader& shader) const
+        {
+            bindLights();
+            shader.SetInt("clusterLightCount"_uniform, (int)m_count);
+        }
+
+        // Every `interval` seconds prints a [clusters] line. With the GPU lists, the counters are
+        // read back right away, which waits for the last culling pass once per report
+        void Report(const double now, const double interval = 2.0)
+        {
+            if (m_reportStart < 0.0)
+                m_reportStart = now;
+            if (now - m_reportStart < interval)
+                return;
+            m_reportStart = now;
+            unsigned int uploads = m_lightUploads;
+            m_lightUploads = 0;
+            if (uploads)
+                std::printf("[clusters] lights written %u times, %u lights, %.1f KB each\n", uploads, m_count, m_count * sizeof(GpuLight) / 1024.0);
+            if (m_cpuLists){
+                double ms = m_binFrames ? m_binUs / 1000.0 / m_binFrames : 0.0;
+                std::printf("[clusters] cpu %.3f ms on %u threads | %u lights, %ux%ux%u clusters | %u occupied, %.1f lights each, at most %u | %.0f light-cluster pairs per ms\n",
+                    ms, m_binThreads, m_count, m_grid.x, m_grid.y, m_grid.z, m_binOccupied,
+                    m_binOccupied ? m_binIndices / (double)m_binOccupied : 0.0, m_binMax, ms > 0.0 ? (double)m_count * Clusters() / ms : 0.0);
+                m_binUs = 0;
+                m_binFrames = 0;
+                return;
+            }
+            if (!m_statsBuffer)
+                return;
+            unsigned int stats[4];
+            glGetNamedBufferSubData(m_statsBuffer, 0, sizeof(stats), stats);
+            std::printf("[clusters] gpu %.2f ms | %u lights, %ux%ux%u clusters | %u occupied, %.1f lights each, at most %u | %u overflowed\n",
+                m_timer.TakeAverageMs(), m_count, m_grid.x, m_grid.y, m_grid.z, stats[3],
+                stats[3] ? stats[0] / (double)stats[3] : 0.0, stats[1], stats[2]);
+        }
+
+        unsigned int Lights() const { return m_count; }
+        unsigned int Clusters() const { return m_grid.x * m_grid.y * m_grid.z; }
+        bool CpuLists() const { return m_cpuLists; }
+
+    private:
+        // std430 layout of ClusterLight in the shaders
+        struct GpuLight
+        {
+            glm::vec4 positionRange;
+            glm::vec4 diffuseAmbient;
+            glm::vec4 specularShadow;
+            glm::vec4 directionCutOff;
+            glm::vec4 attenuation; // outerCutOff in w
+        };
+
+        struct CpuLight
+        {
+            glm::vec4 positionRange;
+            glm::vec4 cone; // Direction, cos outerCutOff, below -1 for point lights
+        };
+
+        // View space box of a cluster, and its bounding sphere for the cone test
+        struct ClusterBox
+        {
+            glm::vec3 min, max;
+            glm::vec3 centre;
+            float radius;
+        };
+
+        // Written by the job of one slice: the count and indices of each tile, heads[tile] is where its count is
+        struct SliceLists
+        {
+            std::vector<unsigned int> heads;
+            std::vector<unsigned int> lists;
+            std::vector<float> x, y, z, radius2; // Lights crossing the slice's depths, padded to 4
+            std::vector<unsigned int> index;
+        };
+
+        glm::uvec3 m_grid;
+        float m_near, m_far;
+        std::string m_shaderDirectory;
+        std::unique_ptr<Shader> m_culling;
+        unsigned int m_listBuffer = 0, m_statsBuffer = 0;
+        unsigned int m_count = 0;
+
+        // Lights, one persistently mapped copy per frame in flight
+        unsigned int m_lightBuffer = 0;
+        char* m_lights = nullptr;
+        unsigned int m_lightCapacity = 0; // Lights a copy holds
+        size_t m_lightStride = 0;         // Bytes between copies, aligned for the binding
+        unsigned int m_lightSlot = 0;     // Copy bound to the shaders
+        GLsync m_lightFences[FRAMES_IN_FLIGHT] = {};
+        unsigned int m_lightUploads = 0;  // SetLights calls since the last report
+        GpuTimer m_timer;
+        double m_reportStart = -1.0;
+
+        // CPU binning
+        bool m_cpuLists = false; // The last lists came from Bin
+        std::vector<CpuLight> m_cpuLights;
+        std::vector<float> m_viewX, m_viewY, m_viewZ, m_radius, m_radius2;
+        std::vector<glm::vec4> m_viewCones;
+        glm::mat4 m_boxProjection = glm::mat4(0.f);
+        std::vector<ClusterBox> m_boxes;
+        std::vector<float> m_sliceDepths;
+        std::vector<SliceLists> m_slices;
+        unsigned int m_ringBuffer = 0;
+        unsigned int* m_ring = nullptr;
+        size_t m_slotWords = 0;      // Capacity of a slot
+        size_t m_slotStride = 0;     // Bytes between slots, aligned for the binding
+        unsigned int m_slot = 0;
+        unsigned int m_slotUsed = 0; // Words written to the current slot
+        GLsync m_fences[FRAMES_IN_FLIGHT] = {};
+        long long m_binUs = 0;
+        unsigned int m_binFrames = 0, m_binThreads = 1;
+        unsigned int m_binIndices = 0, m_binMax = 0, m_binOccupied = 0;
+
+        void create()
+        {
+            glCreateBuffers(1, &m_listBuffer);
+            glNamedBufferStorage(m_listBuffer, (GLsizeiptr)Clusters() * (CLUSTER_STRIDE + 1) * sizeof(unsigned int), NULL, 0);
+            glCreateBuffers(1, &m_statsBuffer);
+            glNamedBufferStorage(m_statsBuffer, 4 * sizeof(unsigned int), NULL, GL_DYNAMIC_STORAGE_BIT);
+            if (!m_lightBuffer && !acquireLights(0)) // No light yet, an empty buffer still has to be bound
+                m_count = 0;
+            m_culling = std::make_unique<Shader>((m_shaderDirectory + "cluster_lights.comp").c_str());
+        }
+
+        void bindBuffers() const
+        {
+            unsigned int listBuffer = m_cpuLists ? m_ringBuffer : m_listBuffer;
+            unsigned int listOffset = m_cpuLists ? (unsigned int)(m_slot * m_slotStride) : 0;
+            unsigned int listSize = (m_cpuLists ? m_slotUsed : Clusters() * (CLUSTER_STRIDE + 1)) * sizeof(unsigned int);
+            bindLights();
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, LIST_BINDING, listBuffer, listOffset, listSize);
+            if (g_glTrace.Recording())
+                g_glTrace.BindBufferRange(GL_SHADER_STORAGE_BUFFER, LIST_BINDING, listBuffer, listOffset, listSize);
+        }
+
+        void bindLights() const
+        {
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, m_lightBuffer, m_lightSlot * m_lightStride, m_lightCapacity * sizeof(GpuLight));
+            if (g_glTrace.Recording())
+                g_glTrace.BindBufferRange(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, m_lightBuffer, m_lightSlot * m_lightStride, m_lightCapacity * sizeof(GpuLight));
+        }
+
+        // Next copy of the lights, holding at least `count`. The copy bound until now is fenced:
+        // the draws already submitted are the last to read it
+        GpuLight* acquireLights(const unsigned int count)
+        {
+            if (count > m_lightCapacity || !m_lightBuffer){
+                releaseLights();
+                int alignment = 256;
+                glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+                m_lightCapacity = 64;
+                while (m_lightCapacity < count)
+                    m_lightCapacity *= 2;
+                m_lightStride = (m_lightCapacity * sizeof(GpuLight) + alignment - 1) / alignment * alignment;
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                glCreateBuffers(1, &m_lightBuffer);
+                glNamedBufferStorage(m_lightBuffer, m_lightStride * FRAMES_IN_FLIGHT, NULL, flags);
+                m_lights = (char*)glMapNamedBufferRange(m_lightBuffer, 0, m_lightStride * FRAMES_IN_FLIGHT, flags);
+                if (!m_lights){
+                    std::cerr << "Can't map the light buffer\n";
+                    releaseLights(); // The next call tries again instead of writing through a null mapping
+                    return nullptr;
+                }
+                return (GpuLight*)m_lights;
+            }
+            if (m_lightFences[m_lightSlot])
+                glDeleteSync(m_lightFences[m_lightSlot]);
+            m_lightFences[m_lightSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            m_lightSlot = (m_lightSlot + 1) % FRAMES_IN_FLIGHT;
+            GLsync& fence = m_lightFences[m_lightSlot];
+            if (fence){ // Only waits when the lights change more often than frames complete
+                glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+                glDeleteSync(fence);
+                fence = 0;
+            }
+            return (GpuLight*)(m_lights + m_lightSlot * m_lightStride);
+        }
+
+        // The buffer is deleted right away, GL keeps it alive for the draws still reading it
+        void releaseLights()
+        {
+            for (GLsync& fence : m_lightFences){
+                if (fence)
+                    glDeleteSync(fence);
+                fence = 0;
+            }
+            if (m_lightBuffer){
+                glUnmapNamedBuffer(m_lightBuffer);
+                glDeleteBuffers(1, &m_lightBuffer);
+            }
+            m_lightBuffer = 0;
+            m_lights = nullptr;
+            m_lightCapacity = 0;
+            m_lightSlot = 0;
+        }
+
+        // Same boxes as cluster_lights.comp, recomputed when the projection changes
+        void computeBoxes(const glm::mat4& projection)
+        {
+            m_boxProjection = projection;
+            glm::mat4 inverse = glm::inverse(projection);
+            auto viewRay = [&inverse](const float x, const float y){
+                glm::vec4 near = inverse * glm::vec4(x, y, -1.f, 1.f);
+                near /= near.w;
+                return glm::vec3(near) / -near.z;
+            };
+            m_sliceDepths.resize(m_grid.z + 1);
+            for (unsigned int s = 0 ; s <= m_grid.z ; s++)
+                m_sliceDepths[s] = m_near * std::pow(m_far / m_near, s / (float)m_grid.z);
+            m_boxes.resize(Clusters());
+            for (unsigned int c = 0 ; c < Clusters() ; c++){
+                unsigned int x = c % m_grid.x, y = (c / m_grid.x) % m_grid.y, s = c / (m_grid.x * m_grid.y);
+                float x0 = x / (float)m_grid.x * 2.f - 1.f, x1 = (x + 1) / (float)m_grid.x * 2.f - 1.f;
+                float y0 = y / (float)m_grid.y * 2.f - 1.f, y1 = (y + 1) / (float)m_grid.y * 2.f - 1.f;
+                glm::vec3 rays[4] = {viewRay(x0, y0), viewRay(x1, y0), viewRay(x0, y1), viewRay(x1, y1)};
+                ClusterBox& box = m_boxes[c];
+                box.min = glm::vec3(1e30f);
+                box.max = glm::vec3(-1e30f);
+                for (const glm::vec3& ray : rays){
+                    box.min = glm::min(box.min, glm::min(ray * m_sliceDepths[s], ray * m_sliceDepths[s + 1]));
+                    box.max = glm::max(box.max, glm::max(ray * m_sliceDepths[s], ray * m_sliceDepths[s + 1]));
+                }
+                box.centre = (box.min + box.max) * 0.5f;
+                box.radius = glm::length(box.max - box.centre);
+            }
+        }
+
+        // Lights crossing the slice's depths first, then each of them against the box of every tile
+        void binSliceLights(const unsigned int slice, const unsigned int padded)
+        {
+            SliceLists& out = m_slices[slice];
+            out.x.clear();
+            out.y.clear();
+            out.z.clear();
+            out.radius2.clear();
+            out.index.clear();
+            float nearDepth = m_sliceDepths[slice], farDepth = m_sliceDepths[slice + 1];
+            for (unsigned int i = 0 ; i < padded ; i += 4){
+                int mask = 0;
+#ifdef CLUSTERED_LIGHTS_SSE
+                __m128 depth = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&m_viewZ[i]));
+                __m128 radius = _mm_loadu_ps(&m_radius[i]);
+                mask = _mm_movemask_ps(_mm_and_ps(_mm_cmpge_ps(_mm_add_ps(depth, radius), _mm_set1_ps(nearDepth)),
+                                                  _mm_cmple_ps(_mm_sub_ps(depth, radius), _mm_set1_ps(farDepth))));
+#else
+                for (unsigned int lane = 0 ; lane < 4 ; lane++)
+                    mask |= (-m_viewZ[i + lane] + m_radius[i + lane] >= nearDepth && -m_viewZ[i + lane] - m_radius[i + lane] <= farDepth) << lane;
+#endif
+                for (unsigned int lane = 0 ; mask && lane < 4 ; lane++){
+                    if (!(mask & (1 << lane)))
+                        continue;
+                    out.x.push_back(m_viewX[i + lane]);
+                    out.y.push_back(m_viewY[i + lane]);
+                    out.z.push_back(m_viewZ[i + lane]);
+                    out.radius2.push_back(m_radius2[i + lane]);
+                    out.index.push_back(i + lane);
+                }
+            }
+            while (out.index.size() % 4){
+                out.x.push_back(0.f);
+                out.y.push_back(0.f);
+                out.z.push_back(0.f);
+                out.radius2.push_back(-1.f);
+                out.index.push_back(0);
+            }
+
+            unsigned int tiles = m_grid.x * m_grid.y;
+            unsigned int candidates = (unsigned int)out.index.size();
+            out.heads.resize(tiles);
+            out.lists.clear();
+            for (unsigned int t = 0 ; t < tiles ; t++){
+                const ClusterBox& box = m_boxes[slice * tiles + t];
+                unsigned int head = (unsigned int)out.lists.size();
+                out.heads[t] = head;
+                out.lists.push_back(0);
+#ifdef CLUSTERED_LIGHTS_SSE
+                __m128 minX = _mm_set1_ps(box.min.x), maxX = _mm_set1_ps(box.max.x);
+                __m128 minY = _mm_set1_ps(box.min.y), maxY = _mm_set1_ps(box.max.y);
+                __m128 minZ = _mm_set1_ps(box.min.z), maxZ = _mm_set1_ps(box.max.z);
+                __m128 zero = _mm_setzero_ps();
+#endif
+                for (unsigned int i = 0 ; i < candidates ; i += 4){
+                    int mask = 0;
+#ifdef CLUSTERED_LIGHTS_SSE
+                    // Distance from the centre to the box along each axis, 0 inside
+                    __m128 x = _mm_loadu_ps(&out.x[i]), y = _mm_loadu_ps(&out.y[i]), z = _mm_loadu_ps(&out.z[i]);
+                    __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX, x), _mm_sub_ps(x, maxX)), zero);
+                    __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY, y), _mm_sub_ps(y, maxY)), zero);
+                    __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minZ, z), _mm_sub_ps(z, maxZ)), zero);
+                    __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                    mask = _mm_movemask_ps(_mm_cmple_ps(distance2, _mm_loadu_ps(&out.radius2[i])));
+#else
+                    for (unsigned int lane = 0 ; lane < 4 ; lane++){
+                        glm::vec3 centre(out.x[i + lane], out.y[i + lane], out.z[i + lane]);
+                        glm::vec3 d = glm::clamp(centre, box.min, box.max) - centre;
+                        mask |= (glm::dot(d, d) <= out.radius2[i + lane]) << lane;
+                    }
+#endif
+                    for (unsigned int lane = 0 ; mask && lane < 4 ; lane++){
+                        if (!(mask & (1 << lane)))
+                            continue;
+                        unsigned int light = out.index[i + lane];
+                        if (m_viewCones[light].w >= -1.f && !coneReachesBox(light, box))
+                            continue;
+                        out.lists.push_back(light);
+                    }
+                }
+                out.lists[head] = (unsigned int)out.lists.size() - head - 1;
+            }
+        }
+
+        // SphereInCone of cluster_lights.comp, against the box's bounding sphere
+        bool coneReachesBox(const unsigned int light, const ClusterBox& box) const
+        {
+            glm::vec3 apex(m_viewX[light], m_viewY[light], m_viewZ[light]);
+            glm::vec4 cone = m_viewCones[light];
+            glm::vec3 v = box.centre - apex;
+            float along = glm::dot(v, glm::vec3(cone));
+            float across = std::sqrt(std::max(glm::dot(v, v) - along * along, 0.f));
+            float sinAngle = std::sqrt(std::max(1.f - cone.w * cone.w, 0.f));
+            if (cone.w * across - along * sinAngle > box.radius)
+                return false;
+            return along >= -box.radius && along <= m_radius[light] + box.radius;
+        }
+
+        // The current slot of the ring, with room for `words`. Grows the ring once every slot is free
+        unsigned int* acquireSlot(const size_t words)
+        {
+            if (words > m_slotWords){
+                for (GLsync& fence : m_fences){
+                    if (fence){
+                        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+                        glDeleteSync(fence);
+                        fence = 0;
+                    }
+                }
+                if (m_ringBuffer){
+                    glUnmapNamedBuffer(m_ringBuffer);
+                    glDeleteBuffers(1, &m_ringBuffer);
+                }
+                int alignment = 256;
+                glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+                m_slotWords = std::max(words * 2, (size_t)Clusters() * 8);
+                m_slotStride = (m_slotWords * sizeof(unsigned int) + alignment - 1) / alignment * alignment;
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                glCreateBuffers(1, &m_ringBuffer);
+                glNamedBufferStorage(m_ringBuffer, m_slotStride * FRAMES_IN_FLIGHT, NULL, flags);
+                m_ring = (unsigned int*)glMapNamedBufferRange(m_ringBuffer, 0, m_slotStride * FRAMES_IN_FLIGHT, flags);
+                if (!m_ring){
+                    std::cerr << "Can't map the cluster list buffer\n";
+                    glDeleteBuffers(1, &m_ringBuffer); // The next call tries again instead of writing through a null mapping
+                    m_ringBuffer = 0;
+                    m_slotWords = 0;
+                    return nullptr;
+                }
+            }
+            GLsync& fence = m_fences[m_slot];
+            if (fence){ // Only waits when the GPU is FRAMES_IN_FLIGHT frames behind
+                glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+                glDeleteSync(fence);
+                fence = 0;
+            }
+            return (unsigned int*)((char*)m_ring + m_slot * m_slotStride);
+        }
+
+        void setUniforms(const Shader& shader) const
+        {
+            shader.Set("clusterGrid"_uniform, glm::vec3(m_grid));
+            shader.Set("clusterDepth"_uniform, glm::vec2(m_near, m_far));
+            shader.SetInt("clusterLightCount"_uniform, (int)m_count);
+        }
+};
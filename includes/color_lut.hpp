@@ -0,0 +1,169 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+enum class ColorOperatorType
+{
+    Invert,
+    Grayscale,  // a.x : amount
+    Saturation, // a.x : 0 gray, 1 unchanged
+    Contrast,   // a.x : amount, a.y : pivot
+    ToneCurve,  // a : output at 0.25, 0.5 and 0.75 of the input, the ends stay at 0 and 1
+    Grading     // a : lift, b : gamma, c : gain, per channel
+};
+
+struct ColorOperator
+{
+    ColorOperatorType type;
+    glm::vec3 a = glm::vec3(0.f), b = glm::vec3(0.f), c = glm::vec3(0.f);
+    bool enabled = true;
+
+    static ColorOperator Invert() { return ColorOperator{ColorOperatorType::Invert}; }
+    static ColorOperator Grayscale(const float amount = 1.f) { return ColorOperator{ColorOperatorType::Grayscale, glm::vec3(amount, 0.f, 0.f)}; }
+    static ColorOperator Saturation(const float amount) { return ColorOperator{ColorOperatorType::Saturation, glm::vec3(amount, 0.f, 0.f)}; }
+    static ColorOperator Contrast(const float amount, const float pivot = 0.5f) { return ColorOperator{ColorOperatorType::Contrast, glm::vec3(amount, pivot, 0.f)}; }
+    static ColorOperator ToneCurve(const float shadows, const float midtones, const float highlights)
+    {
+        return ColorOperator{ColorOperatorType::ToneCurve, glm::vec3(shadows, midtones, highlights)};
+    }
+    static ColorOperator Grading(const glm::vec3& lift, const glm::vec3& gamma, const glm::vec3& gain)
+    {
+        return ColorOperator{ColorOperatorType::Grading, lift, gamma, gain};
+    }
+
+    // Results are kept in [0, 1], the domain of the LUT
+    glm::vec3 Apply(const glm::vec3& color) const
+    {
+        const glm::vec3 luma(0.2126f, 0.7152f, 0.0722f);
+        glm::vec3 result = color;
+        switch (type){
+            case ColorOperatorType::Invert: result = glm::vec3(1.f) - color; break;
+            case ColorOperatorType::Grayscale: result = glm::mix(color, glm::vec3(glm::dot(color, luma)), a.x); break;
+            case ColorOperatorType::Saturation: result = glm::mix(glm::vec3(glm::dot(color, luma)), color, a.x); break;
+            case ColorOperatorType::Contrast: result = (color - a.y) * a.x + a.y; break;
+            case ColorOperatorType::ToneCurve:
+                for (int i = 0 ; i < 3 ; i++)
+                    result[i] = toneCurve(color[i]);
+                break;
+            case ColorOperatorType::Grading:
+                result = c * (color + a * (glm::vec3(1.f) - color));
+                result = glm::pow(glm::max(result, glm::vec3(0.f)), 1.f / glm::max(b, glm::vec3(0.01f)));
+                break;
+        }
+        return glm::clamp(result, glm::vec3(0.f), glm::vec3(1.f));
+    }
+
+    // Catmull-Rom through (0, 0), the three control points and (1, 1)
+    float toneCurve(const float x) const
+    {
+        const float points[7] = {-a.x, 0.f, a.x, a.y, a.z, 1.f, 2.f - a.z};
+        float position = glm::clamp(x, 0.f, 1.f) * 4.f;
+        int segment = glm::min((int)position, 3);
+        float t = position - segment;
+        float p0 = points[segment], p1 = points[segment + 1], p2 = points[segment + 2], p3 = points[segment + 3];
+        return 0.5f * (2.f * p1 + (p2 - p0) * t + (2.f * p0 - 5.f * p1 + 4.f * p2 - p3) * t * t + (3.f * p1 - p0 - 3.f * p2 + p3) * t * t * t);
+    }
+};
+
+// A chain of colour operators baked into a SIZE^3 3D texture whenever it changes, so the frame
+// applies any number of them with one filtered fetch, ApplyColorLut in shaders/color_lut.glsl
+class ColorLut
+{
+    public:
+        static const int SIZE = 32; // LUT_SIZE in color_lut.glsl
+
+        ~ColorLut()
+        {
+            Release();
+        }
+
+        void Release()
+        {
+            if (m_texture)
+                glDeleteTextures(1, &m_texture);
+            m_texture = 0;
+        }
+
+        // Index to change or toggle the operator later
+        unsigned int Add(const ColorOperator& op)
+        {
+            m_operators.push_back(op);
+            m_dirty = true;
+            return (unsigned int)m_operators.size() - 1;
+        }
+
+        void Set(const unsigned int index, const ColorOperator& op)
+        {
+            m_operators[index] = op;
+            m_dirty = true;
+        }
+
+        void Toggle(const unsigned int index)
+        {
+            m_operators[index].enabled = !m_operators[index].enabled;
+            m_dirty = true;
+        }
+
+        const ColorOperator& Operator(const unsigned int index) const { return m_operators[index]; }
+        size_t Size() const { return m_operators.size(); }
+
+        glm::vec3 Apply(glm::vec3 color) const
+        {
+            for (const ColorOperator& op : m_operators){
+                if (op.enabled)
+                    color = op.Apply(color);
+            }
+            return color;
+        }
+
+        // Bakes the chain if it changed since the last call, returns true when it did
+        bool Update()
+        {
+            if (!m_dirty && m_texture)
+                return false;
+            auto start = std::chrono::steady_clock::now();
+            m_texels.resize(SIZE * SIZE * SIZE * 4);
+            for (int b = 0 ; b < SIZE ; b++){
+                for (int g = 0 ; g < SIZE ; g++){
+                    for (int r = 0 ; r < SIZE ; r++){
+                        glm::vec3 color = Apply(glm::vec3(r, g, b) / (SIZE - 1.f));
+                        float* texel = &m_texels[((b * SIZE + g) * SIZE + r) * 4];
+                        texel[0] = color.r;
+                        texel[1] = color.g;
+                        texel[2] = color.b;
+                        texel[3] = 1.f;
+                    }
+                }
+            }
+            if (!m_texture){
+                glCreateTextures(GL_TEXTURE_3D, 1, &m_texture);
+                glTextureStorage3D(m_texture, 1, GL_RGBA16F, SIZE, SIZE, SIZE);
+                glTextureParameteri(m_texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                glTextureParameteri(m_texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTextureParameteri(m_texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTextureParameteri(m_texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glTextureParameteri(m_texture, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            }
+            glTextureSubImage3D(m_texture, 0, 0, 0, 0, SIZE, SIZE, SIZE, GL_RGBA, GL_FLOAT, m_texels.data());
+            m_dirty = false;
+
+            unsigned int enabled = 0;
+            for (const ColorOperator& op : m_operators)
+                enabled += op.enabled;
+            std::printf("[color lut] %u of %zu operators baked in %.2f ms\n", enabled, m_operators.size(),
+                std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
+            return true;
+        }
+
+        unsigned int Texture() const { return m_texture; }
+
+    private:
+        std::vector<ColorOperator> m_operators;
+        std::vector<float> m_texels;
+        unsigned int m_texture = 0;
+        bool m_dirty = true;
+};
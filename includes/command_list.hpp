@@ -0,0 +1,123 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "frame_stats.hpp"
+#include "gl_state.hpp"
+#include "shader.hpp"
+
+enum class RenderCommandType : unsigned char
+{
+    UseProgram, BindVertexArray, BindTexture, Enable, Disable, Uniform,
+    DrawArrays, DrawElements, DrawElementsInstanced
+};
+
+// Meaning of args per type :
+// BindVertexArray (vao), BindTexture (unit, target, texture), Enable/Disable (cap),
+// Uniform (slot index, payload offset, size), DrawArrays (mode, first, count),
+// DrawElements (mode, count, index type, offset), DrawElementsInstanced (mode, count, offset, instances)
+struct RenderCommand
+{
+    RenderCommandType type;
+    unsigned int args[4];
+    const Shader* shader; // UseProgram and Uniform
+};
+
+static_assert(std::is_trivially_copyable<RenderCommand>::value, "Render commands are plain data");
+
+// Commands recorded without touching GL, so any thread can fill one. Only the thread owning
+// the context calls Execute, lists of one frame are executed in the order they must draw.
+// Uniform values are copied into the list's payload, Clear keeps the memory of both arrays
+// so a list rebuilt every frame stops allocating after the first ones
+class CommandList
+{
+    public:
+        void Clear()
+        {
+            m_commands.clear();
+            m_payload.clear();
+        }
+
+        size_t Size() const { return m_commands.size(); }
+
+        // The program is resolved at execution, a hot reload in between is fine
+        void UseProgram(const Shader& shader)
+        {
+            push(RenderCommandType::UseProgram, 0, 0, 0, 0, &shader);
+        }
+
+        void BindVertexArray(const unsigned int vertexArray)
+        {
+            push(RenderCommandType::BindVertexArray, vertexArray);
+        }
+
+        void BindTexture(const unsigned int unit, const GLenum target, const unsigned int texture)
+        {
+            push(RenderCommandType::BindTexture, unit, target, texture);
+        }
+
+        void Enable(const GLenum cap) { push(RenderCommandType::Enable, cap); }
+        void Disable(const GLenum cap) { push(RenderCommandType::Disable, cap); }
+
+        // Handles must be looked up before recording, Shader isn't read by the recording thread
+        template <typename T>
+        void SetUniform(const Shader& shader, const Uniform<T> uniform, const T& value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "Uniform payloads are copied as bytes");
+            if (!uniform.Valid())
+                return;
+            unsigned int offset = (unsigned int)m_payload.size();
+            m_payload.resize(offset + sizeof(T));
+            std::memcpy(m_payload.data() + offset, &value, sizeof(T));
+            push(RenderCommandType::Uniform, (unsigned int)uniform.index, offset, sizeof(T), 0, &shader);
+        }
+
+        void DrawArrays(const GLenum mode, const int first, const int count)
+        {
+            push(RenderCommandType::DrawArrays, mode, first, count);
+        }
+
+        void DrawElements(const GLenum mode, const int count, const GLenum type, const unsigned int offset = 0)
+        {
+            push(RenderCommandType::DrawElements, mode, count, type, offset);
+        }
+
+        // Indices are GL_UNSIGNED_INT
+        void DrawElementsInstanced(const GLenum mode, const int count, const unsigned int offset, const int instances)
+        {
+            push(RenderCommandType::DrawElementsInstanced, mode, count, offset, instances);
+        }
+
+        // GL thread only, state goes through GLState so consecutive lists don't rebind the same objects
+        void Execute() const
+        {
+            for (const RenderCommand& command : m_commands){
+                const unsigned int* a = command.args;
+                switch (command.type){
+                    case RenderCommandType::UseProgram: g_glState.UseProgram(command.shader->m_id); break;
+                    case RenderCommandType::BindVertexArray: g_glState.BindVertexArray(a[0]); break;
+                    case RenderCommandType::BindTexture: g_glState.BindTexture(a[0], a[1], a[2]); break;
+                    case RenderCommandType::Enable: g_glState.Enable(a[0]); break;
+                    case RenderCommandType::Disable: g_glState.Disable(a[0]); break;
+                    case RenderCommandType::Uniform: command.shader->SetRaw((int)a[0], m_payload.data() + a[1], a[2]); break;
+                    case RenderCommandType::DrawArrays: g_glState.DrawArrays(a[0], (int)a[1], (int)a[2]); break;
+                    case RenderCommandType::DrawElements: g_glState.DrawElements(a[0], (int)a[1], a[2], a[3]); break;
+                    case RenderCommandType::DrawElementsInstanced: g_glState.DrawElementsInstanced(a[0], (int)a[1], GL_UNSIGNED_INT, a[2], (int)a[3]); break;
+                }
+            }
+            g_frameStats.commands += m_commands.size();
+        }
+
+    private:
+        std::vector<RenderCommand> m_commands;
+        std::vector<unsigned char> m_payload;
+
+        void push(const RenderCommandType type, const unsigned int a0, const unsigned int a1 = 0, const unsigned int a2 = 0,
+                  const unsigned int a3 = 0, const Shader* shader = nullptr)
+        {
+            m_commands.push_back(RenderCommand{type, {a0, a1, a2, a3}, shader});
+        }
+};
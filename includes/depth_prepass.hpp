@@ -0,0 +1,181 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstdio>
+
+#include "gl_state.hpp"
+#include "gpu_timer.hpp"
+
+// Fragments passing the depth test in a section of the frame, from GL_SAMPLES_PASSED queries
+// read a few frames later like GpuTimer. One query of a target is active at a time, so two
+// counters can follow each other but not overlap
+class SamplesCounter
+{
+    public:
+        static const unsigned int LATENCY = 4;
+
+        ~SamplesCounter()
+        {
+            Release();
+        }
+
+        void Release()
+        {
+            if (m_queries[0])
+                glDeleteQueries(LATENCY, m_queries);
+            m_queries[0] = 0;
+        }
+
+        void Begin()
+        {
+            if (!m_queries[0])
+                glCreateQueries(GL_SAMPLES_PASSED, LATENCY, m_queries);
+            poll();
+            m_skipped = m_pending[m_next];
+            if (!m_skipped)
+                glBeginQuery(GL_SAMPLES_PASSED, m_queries[m_next]);
+        }
+
+        void End()
+        {
+            if (m_skipped)
+                return;
+            glEndQuery(GL_SAMPLES_PASSED);
+            m_pending[m_next] = true;
+            m_next = (m_next + 1) % LATENCY;
+        }
+
+        // Mean of the results since the last call, 0 if there was none
+        double TakeAverage()
+        {
+            double average = m_samples ? (double)m_total / m_samples : 0.0;
+            m_total = 0;
+            m_samples = 0;
+            return average;
+        }
+
+    private:
+        unsigned int m_queries[LATENCY] = {};
+        bool m_pending[LATENCY] = {};
+        unsigned int m_next = 0;
+        bool m_skipped = false;
+        unsigned long long m_total = 0;
+        unsigned int m_samples = 0;
+
+        void poll()
+        {
+            for (unsigned int i = 0 ; i < LATENCY ; i++){
+                unsigned int index = (m_next + i) % LATENCY;
+                if (!m_pending[index])
+                    continue;
+                int available = 0;
+                glGetQueryObjectiv(m_queries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    return;
+                GLuint64 passed = 0;
+                glGetQueryObjectui64v(m_queries[index], GL_QUERY_RESULT, &passed);
+                m_pending[index] = false;
+                m_total += passed;
+                m_samples++;
+            }
+        }
+};
+
+// Optional depth-only pass before the shading pass. Opaque geometry is drawn first from a
+// position-only vertex stream with colour writes off, then shaded with GL_EQUAL and depth writes
+// off, so each pixel runs the lighting once. Both passes must compute gl_Position with the same
+// expression and declare it invariant, or GL_EQUAL drops fragments.
+//
+// Every `interval` seconds a [depth] line prints the GPU frame time and the fragments per pixel
+// each pass let through. With the pre-pass on, depth fragments / shaded fragments is the overdraw
+// of the scene, the rest are the fragments early-Z rejected before shading. Compare the GPU time of both
+// modes: the pre-pass pays off when the overdraw saves more shading than drawing twice costs
+class DepthPrepass
+{
+    public:
+        DepthPrepass(const bool enabled = false, const double interval = 2.0) : m_enabled(enabled), m_interval(interval) {}
+
+        void Release()
+        {
+            m_frameTimer.Release();
+            m_depthSamples.Release();
+            m_shadedSamples.Release();
+        }
+
+        // Results still in flight belong to the old mode, the first report after a switch mixes both
+        void SetEnabled(const bool enabled)
+        {
+            m_enabled = enabled;
+            std::printf("[depth] pre-pass %s\n", enabled ? "on" : "off");
+        }
+
+        bool Enabled() const { return m_enabled; }
+
+        void BeginFrame()
+        {
+            m_frameTimer.Begin();
+        }
+
+        // Only called with the pre-pass on
+        void BeginDepth()
+        {
+            g_glState.ColorMask(false);
+            g_glState.DepthMask(true);
+            g_glState.DepthFunc(GL_LESS);
+            m_depthSamples.Begin();
+        }
+
+        void EndDepth()
+        {
+            m_depthSamples.End();
+            g_glState.ColorMask(true);
+        }
+
+        void BeginShading()
+        {
+            g_glState.DepthMask(!m_enabled);
+            g_glState.DepthFunc(m_enabled ? GL_EQUAL : GL_LESS);
+            m_shadedSamples.Begin();
+        }
+
+        // Back to the default depth state for what follows (light cubes, transparent objects)
+        void EndShading()
+        {
+            m_shadedSamples.End();
+            g_glState.DepthMask(true);
+            g_glState.DepthFunc(GL_LESS);
+        }
+
+        void EndFrame(const double now, const int pixels)
+        {
+            m_frameTimer.End();
+            if (m_start < 0.0)
+                m_start = now;
+            if (now - m_start < m_interval)
+                return;
+            m_start = now;
+            if (pixels <= 0){ // Minimized, no per-pixel figures. The averages are still taken
+                m_shadedSamples.TakeAverage();
+                m_depthSamples.TakeAverage();
+                std::printf("[depth] pre-pass %s | gpu %.2f ms | no framebuffer\n", m_enabled ? "on" : "off", m_frameTimer.TakeAverageMs());
+                return;
+            }
+
+            double shaded = m_shadedSamples.TakeAverage() / pixels;
+            double depth = m_depthSamples.TakeAverage() / pixels;
+            float gpuMs = m_frameTimer.TakeAverageMs();
+            if (!m_enabled){
+                std::printf("[depth] pre-pass off | gpu %.2f ms | shaded %.2f fragments per pixel\n", gpuMs, shaded);
+                return;
+            }
+            std::printf("[depth] pre-pass on | gpu %.2f ms | depth %.2f, shaded %.2f fragments per pixel | overdraw %.2f, %.0f%% rejected by early-Z\n",
+                gpuMs, depth, shaded, shaded > 0.0 ? depth / shaded : 0.0, depth > 0.0 ? 100.0 * (1.0 - shaded / depth) : 0.0);
+        }
+
+    private:
+        bool m_enabled;
+        double m_interval;
+        double m_start = -1.0;
+        GpuTimer m_frameTimer;
+        SamplesCounter m_depthSamples, m_shadedSamples;
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+// Picks the render scale of the scene from the measured GPU frame time. The scale moves only
+// when the smoothed time leaves the band [LOW, HIGH] of the budget and the last change is
+// COOLDOWN results old, so a time close to a threshold doesn't make it flip every frame.
+// Scales are quantized to STEP, targets then only take a few sizes the RenderTargetPool keeps
+class DynamicResolution
+{
+    public:
+        static constexpr float HIGH = 0.95f;   // Over this fraction of the budget, the scale goes down
+        static constexpr float LOW = 0.75f;    // Under it, the scale goes up
+        static constexpr float STEP = 0.05f;
+        static constexpr float SMOOTHING = 0.1f;
+        static const unsigned int COOLDOWN = 30;
+
+        DynamicResolution(const float budgetMs, const float minScale = 0.5f, const float maxScale = 1.f)
+            : m_budgetMs(budgetMs), m_minScale(minScale), m_maxScale(maxScale), m_scale(maxScale) {}
+
+        // Fed once per new GPU timer result, returns true when the scale changed
+        bool Update(const float gpuMs)
+        {
+            m_smoothedMs = m_smoothedMs < 0.f ? gpuMs : m_smoothedMs + (gpuMs - m_smoothedMs) * SMOOTHING;
+            if (++m_sinceChange < COOLDOWN || !m_enabled)
+                return false;
+            float ratio = m_smoothedMs / m_budgetMs;
+            if (ratio <= HIGH && ratio >= LOW)
+                return false;
+
+            // GPU time follows the pixel count, the square of the scale. Aim for the middle of the band
+            float target = m_scale * std::sqrt((HIGH + LOW) * 0.5f / std::max(ratio, 0.01f));
+            target = std::round(target / STEP) * STEP;
+            target = std::clamp(target, m_minScale, m_maxScale);
+            if (std::fabs(target - m_scale) < STEP * 0.5f)
+                return false;
+            m_scale = target;
+            m_sinceChange = 0;
+            m_smoothedMs = -1.f; // Times measured at the old scale mean nothing now
+            return true;
+        }
+
+        // Disabled, the scale goes back to the maximum. Returns true when that changed it
+        bool SetEnabled(const bool enabled)
+        {
+            m_enabled = enabled;
+            if (enabled || m_scale == m_maxScale)
+                return false;
+            m_scale = m_maxScale;
+            m_sinceChange = 0;
+            return true;
+        }
+
+        void SetBudget(const float budgetMs) { m_budgetMs = budgetMs; }
+
+        int Scaled(const int size) const { return std::max(1, (int)std::lround(size * m_scale)); }
+        float Scale() const { return m_scale; }
+        float BudgetMs() const { return m_budgetMs; }
+        float SmoothedMs() const { return std::max(m_smoothedMs, 0.f); }
+        bool Enabled() const { return m_enabled; }
+
+    private:
+        float m_budgetMs, m_minScale, m_maxScale;
+        float m_scale;
+        float m_smoothedMs = -1.f;
+        unsigned int m_sinceChange = 0;
+        bool m_enabled = true;
+};
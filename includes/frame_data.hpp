@@ -0,0 +1,109 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstring>
+#include <iostream>
+
+#include "frame_stats.hpp"
+#include "gl_trace.hpp"
+
+// Binding point of the FrameData block, fixed in includes/shaders/frame_data.glsl
+const unsigned int FRAME_DATA_BINDING = 0;
+
+// std140 mirror of the FrameData block, only vec4 and mat4 members so no padding rule applies
+struct FrameData
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 inverseView;
+    glm::mat4 inverseProjection;
+    glm::vec4 cameraPosition; // w unused
+    glm::vec4 viewport;       // x, y, width, height
+    glm::vec4 time;           // time, deltaTime, unused, unused
+};
+
+static_assert(sizeof(FrameData) == 4*64 + 3*16, "FrameData must match the std140 layout of the GLSL block");
+
+// Per-frame data shared by every program through one uniform block, written once per frame
+// into a persistently mapped ring. Each frame writes its own slot, guarded by a fence, so the
+// CPU never overwrites data the GPU is still reading
+class FrameUniformBuffer
+{
+    public:
+        static const unsigned int FRAMES_IN_FLIGHT = 3;
+
+        FrameUniformBuffer()
+        {
+            int alignment = 256;
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            m_stride = (sizeof(FrameData) + alignment - 1) / alignment * alignment;
+
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glCreateBuffers(1, &m_buffer);
+            glNamedBufferStorage(m_buffer, m_stride * FRAMES_IN_FLIGHT, NULL, flags);
+            m_mapped = (char*)glMapNamedBufferRange(m_buffer, 0, m_stride * FRAMES_IN_FLIGHT, flags);
+            if (!m_mapped)
+                std::cerr << "Can't map the FrameData buffer\n";
+        }
+
+        ~FrameUniformBuffer()
+        {
+            Release();
+        }
+
+        // Needs the context, call before glfwTerminate
+        void Release()
+        {
+            for (GLsync& fence : m_fences){
+                if (fence)
+                    glDeleteSync(fence);
+                fence = NULL;
+            }
+            if (m_mapped)
+                glUnmapNamedBuffer(m_buffer);
+            if (m_buffer)
+                glDeleteBuffers(1, &m_buffer);
+            m_buffer = 0;
+            m_mapped = NULL;
+        }
+
+        // Fills the inverses, writes the current slot and binds it, call once per frame before drawing
+        void Update(FrameData data)
+        {
+            data.inverseView = glm::inverse(data.view);
+            data.inverseProjection = glm::inverse(data.projection);
+            if (!m_mapped) // The map failed at creation, reported then
+                return;
+
+            GLsync& fence = m_fences[m_slot];
+            if (fence){ // Only waits when the GPU is FRAMES_IN_FLIGHT frames behind
+                glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+                glDeleteSync(fence);
+                fence = NULL;
+            }
+            std::memcpy(m_mapped + m_slot * m_stride, &data, sizeof(FrameData));
+            glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, m_buffer, m_slot * m_stride, sizeof(FrameData));
+            g_frameStats.uniformBufferUpdates++;
+            if (g_glTrace.Recording()){
+                g_glTrace.BufferSubData(m_buffer, m_slot * m_stride, &data, sizeof(FrameData));
+                g_glTrace.BindBufferRange(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, m_buffer, m_slot * m_stride, sizeof(FrameData));
+            }
+        }
+
+        // Call after the last draw reading this frame's slot
+        void EndFrame()
+        {
+            if (!m_mapped)
+                return;
+            m_fences[m_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            m_slot = (m_slot + 1) % FRAMES_IN_FLIGHT;
+        }
+
+    private:
+        unsigned int m_buffer = 0;
+        char* m_mapped = NULL;
+        unsigned int m_stride = 0;
+        unsigned int m_slot = 0;
+        GLsync m_fences[FRAMES_IN_FLIGHT] = {};
+};
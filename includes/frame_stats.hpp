@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// Counters reset every frame, read by FrameStatsReporter
+struct FrameStats
+{
+    unsigned long long uniformCalls = 0;   // glProgramUniform* actually sent to the driver
+    unsigned long long uniformSkipped = 0; // Values equal to the cached one, never re-sent
+    unsigned long long uniformLookups = 0; // glGetUniformLocation calls
+    unsigned long long uniformBufferUpdates = 0; // FrameData blocks written
+    unsigned long long stateCalls = 0;     // State changes GLState forwarded to the driver
+    unsigned long long stateElided = 0;    // Redundant state changes GLState dropped
+    unsigned long long commands = 0;       // CommandList entries executed
+    unsigned long long commandBuildUs = 0; // Time spent building command lists, set by the chapter
+    unsigned long long allocations = 0;    // Only counted with FRAME_STATS_COUNT_ALLOCATIONS
+    unsigned long long gpuFrameUs = 0;     // Latest GPU frame time, set by chapters with dynamic resolution
+    unsigned long long gpuBudgetUs = 0;    // 0 when the chapter has no budget, the GPU fields aren't printed
+    unsigned long long renderScale = 0;    // Percent of the window resolution the scene renders at
+
+    void Add(const FrameStats& other)
+    {
+        uniformCalls += other.uniformCalls;
+        uniformSkipped += other.uniformSkipped;
+        uniformLookups += other.uniformLookups;
+        uniformBufferUpdates += other.uniformBufferUpdates;
+        stateCalls += other.stateCalls;
+        stateElided += other.stateElided;
+        commands += other.commands;
+        commandBuildUs += other.commandBuildUs;
+        allocations += other.allocations;
+        gpuFrameUs += other.gpuFrameUs;
+        gpuBudgetUs += other.gpuBudgetUs;
+        renderScale += other.renderScale;
+    }
+};
+
+inline FrameStats g_frameStats;
+// Allocations come from every thread (JobPool workers too), counted apart and moved into
+// g_frameStats.allocations at the end of each frame
+inline std::atomic<unsigned long long> g_allocationCount{0};
+
+// Prints the per-frame average of every counter each `interval` seconds
+class FrameStatsReporter
+{
+    public:
+        FrameStatsReporter(double interval = 1.0) : m_interval(interval) {}
+
+        void EndFrame(double now)
+        {
+            g_frameStats.allocations = g_allocationCount.exchange(0, std::memory_order_relaxed);
+            m_sum.Add(g_frameStats);
+            g_frameStats = FrameStats();
+            m_frames++;
+
+            if (m_start < 0.0)
+                m_start = now;
+            if (now - m_start < m_interval)
+                return;
+
+            double n = (double)m_frames;
+            std::printf("[stats] %.1f fps | uniforms sent %.1f, skipped %.1f, lookups %.1f | uniform blocks %.1f | state calls %.1f, elided %.1f | commands %.1f, built in %.1f us | allocations %.1f\n",
+                n / (now - m_start), m_sum.uniformCalls / n, m_sum.uniformSkipped / n,
+                m_sum.uniformLookups / n, m_sum.uniformBufferUpdates / n,
+                m_sum.stateCalls / n, m_sum.stateElided / n, m_sum.commands / n, m_sum.commandBuildUs / n,
+                m_sum.allocations / n);
+            if (m_sum.gpuBudgetUs > 0)
+                std::printf("[stats] gpu %.2f ms of %.2f ms budget | render scale %.0f%%\n",
+                    m_sum.gpuFrameUs / n / 1000.0, m_sum.gpuBudgetUs / n / 1000.0, m_sum.renderScale / n);
+
+            m_sum = FrameStats();
+            m_frames = 0;
+            m_start = now;
+        }
+
+    private:
+        FrameStats m_sum;
+        unsigned int m_frames = 0;
+        double m_start = -1.0;
+        double m_interval;
+};
+
+// Replacing the global allocator must happen in a single translation unit,
+// so only the chapter's main.cpp should be built with this definition
+#ifdef FRAME_STATS_COUNT_ALLOCATIONS
+void* operator new(std::size_t size)
+{
+    g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+#endif
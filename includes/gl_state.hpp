@@ -0,0 +1,526 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstring>
+#include <iostream>
+
+#include "frame_stats.hpp"
+#include "gl_trace.hpp"
+
+// Shadows the GL state a frame keeps setting and forwards only actual changes.
+// Everything set behind its back (raw GL calls during setup, deleting bound objects) makes the
+// shadow wrong, call Reset() afterwards. With validation on, each elided call is cross-checked
+// against glGet*, which catches such mistakes (build with GL_STATE_VALIDATE or SetValidation).
+// Forwarded calls and draws are what g_glTrace records
+class GLState
+{
+    public:
+        static const unsigned int MAX_TEXTURE_UNITS = 32;
+
+        GLState()
+        {
+            Reset();
+#ifdef GL_STATE_VALIDATE
+            m_validate = true;
+#endif
+        }
+
+        // Forget everything, the next call of each kind is always forwarded
+        void Reset()
+        {
+            m_program = m_vertexArray = UNKNOWN;
+            m_drawFramebuffer = m_readFramebuffer = UNKNOWN;
+            for (unsigned int& buffer : m_buffers)
+                buffer = UNKNOWN;
+            for (TextureUnit& unit : m_units)
+                unit = TextureUnit{UNKNOWN, UNKNOWN, UNKNOWN};
+            for (int& enabled : m_enabled)
+                enabled = -1;
+            m_depthFunc = m_depthMask = UNKNOWN;
+            m_colorMask = UNKNOWN;
+            m_stencilFunc[0] = UNKNOWN;
+            m_stencilOp[0] = UNKNOWN;
+            m_stencilMask = UNKNOWN;
+            m_blendFunc[0] = UNKNOWN;
+            m_cullFace = UNKNOWN;
+            m_viewport[2] = -1;
+            m_clearColor[0] = -1.f;
+        }
+
+        void SetValidation(const bool validate) { m_validate = validate; }
+
+        void UseProgram(const unsigned int program)
+        {
+            if (elide(m_program == program, "program", GL_CURRENT_PROGRAM, program))
+                return;
+            m_program = program;
+            glUseProgram(program);
+            if (g_glTrace.Recording())
+                g_glTrace.UseProgram(program);
+        }
+
+        void BindVertexArray(const unsigned int vertexArray)
+        {
+            if (elide(m_vertexArray == vertexArray, "vertex array", GL_VERTEX_ARRAY_BINDING, vertexArray))
+                return;
+            m_vertexArray = vertexArray;
+            glBindVertexArray(vertexArray);
+            if (g_glTrace.Recording())
+                g_glTrace.BindVertexArray(vertexArray);
+        }
+
+        // GL_ELEMENT_ARRAY_BUFFER belongs to the bound vertex array, it's always forwarded
+        void BindBuffer(const GLenum target, const unsigned int buffer)
+        {
+            int index = bufferIndex(target);
+            if (index >= 0){
+                if (elide(m_buffers[index] == buffer, "buffer", BUFFER_BINDINGS[index], buffer))
+                    return;
+                m_buffers[index] = buffer;
+            }
+            else {
+                g_frameStats.stateCalls++;
+            }
+            glBindBuffer(target, buffer);
+            if (g_glTrace.Recording())
+                g_glTrace.BindBuffer(target, buffer);
+        }
+
+        // Binds with glBindTextureUnit, glActiveTexture is never needed. Units past
+        // MAX_TEXTURE_UNITS aren't shadowed, always forwarded
+        void BindTexture(const unsigned int unit, const GLenum target, const unsigned int texture)
+        {
+            if (unit >= MAX_TEXTURE_UNITS){
+                g_frameStats.stateCalls++;
+                glBindTextureUnit(unit, texture);
+                if (g_glTrace.Recording())
+                    g_glTrace.BindTexture(unit, target, texture);
+                return;
+            }
+            TextureUnit& shadow = m_units[unit];
+            bool same = shadow.texture == texture && (shadow.target == target || texture == 0);
+            if (same && !m_validate){
+                g_frameStats.stateElided++;
+                return;
+            }
+            if (same){
+                g_frameStats.stateElided++;
+                checkUnit(unit, textureBinding(target), texture, "texture");
+                return;
+            }
+            shadow.texture = texture;
+            shadow.target = target;
+            g_frameStats.stateCalls++;
+            glBindTextureUnit(unit, texture);
+            if (g_glTrace.Recording())
+                g_glTrace.BindTexture(unit, target, texture);
+        }
+
+        void BindSampler(const unsigned int unit, const unsigned int sampler)
+        {
+            if (unit >= MAX_TEXTURE_UNITS){
+                g_frameStats.stateCalls++;
+                glBindSampler(unit, sampler);
+                if (g_glTrace.Recording())
+                    g_glTrace.BindSampler(unit, sampler);
+                return;
+            }
+            TextureUnit& shadow = m_units[unit];
+            if (shadow.sampler == sampler){
+                g_frameStats.stateElided++;
+                if (m_validate)
+                    checkUnit(unit, GL_SAMPLER_BINDING, sampler, "sampler");
+                return;
+            }
+            shadow.sampler = sampler;
+            g_frameStats.stateCalls++;
+            glBindSampler(unit, sampler);
+            if (g_glTrace.Recording())
+                g_glTrace.BindSampler(unit, sampler);
+        }
+
+        // GL_FRAMEBUFFER sets both the draw and read bindings
+        void BindFramebuffer(const GLenum target, const unsigned int framebuffer)
+        {
+            bool draw = target != GL_READ_FRAMEBUFFER;
+            bool read = target != GL_DRAW_FRAMEBUFFER;
+            if ((!draw || m_drawFramebuffer == framebuffer) && (!read || m_readFramebuffer == framebuffer)){
+                elide(true, "framebuffer", draw ? GL_DRAW_FRAMEBUFFER_BINDING : GL_READ_FRAMEBUFFER_BINDING, framebuffer);
+                return;
+            }
+            if (draw)
+                m_drawFramebuffer = framebuffer;
+            if (read)
+                m_readFramebuffer = framebuffer;
+            g_frameStats.stateCalls++;
+            glBindFramebuffer(target, framebuffer);
+            if (g_glTrace.Recording())
+                g_glTrace.BindFramebuffer(target, framebuffer);
+        }
+
+        // Only GL_DEPTH_TEST, GL_STENCIL_TEST, GL_BLEND and GL_CULL_FACE are shadowed
+        void Enable(const GLenum cap) { setEnabled(cap, true); }
+        void Disable(const GLenum cap) { setEnabled(cap, false); }
+
+        void DepthFunc(const GLenum func)
+        {
+            if (elide(m_depthFunc == func, "depth func", GL_DEPTH_FUNC, func))
+                return;
+            m_depthFunc = func;
+            glDepthFunc(func);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::DepthFunc, func);
+        }
+
+        void DepthMask(const bool write)
+        {
+            if (elide(m_depthMask == (unsigned int)write, "depth mask", GL_DEPTH_WRITEMASK, write))
+                return;
+            m_depthMask = write;
+            glDepthMask(write ? GL_TRUE : GL_FALSE);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::DepthMask, (unsigned int)write);
+        }
+
+        // All channels or none, a depth-only pass turns colour writes off
+        void ColorMask(const bool write)
+        {
+            if (elideColorMask(write))
+                return;
+            m_colorMask = write;
+            GLboolean value = write ? GL_TRUE : GL_FALSE;
+            glColorMask(value, value, value, value);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::ColorMask, (unsigned int)write);
+        }
+
+        void StencilFunc(const GLenum func, const int ref, const unsigned int mask)
+        {
+            unsigned int state[3] = {func, (unsigned int)ref, mask};
+            static const GLenum names[3] = {GL_STENCIL_FUNC, GL_STENCIL_REF, GL_STENCIL_VALUE_MASK};
+            if (elideArray(m_stencilFunc, state, names, "stencil func"))
+                return;
+            glStencilFunc(func, ref, mask);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::StencilFunc, func, ref, mask);
+        }
+
+        void StencilOp(const GLenum sfail, const GLenum dpfail, const GLenum dppass)
+        {
+            unsigned int state[3] = {sfail, dpfail, dppass};
+            static const GLenum names[3] = {GL_STENCIL_FAIL, GL_STENCIL_PASS_DEPTH_FAIL, GL_STENCIL_PASS_DEPTH_PASS};
+            if (elideArray(m_stencilOp, state, names, "stencil op"))
+                return;
+            glStencilOp(sfail, dpfail, dppass);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::StencilOp, sfail, dpfail, dppass);
+        }
+
+        void StencilMask(const unsigned int mask)
+        {
+            if (elide(m_stencilMask == mask, "stencil mask", GL_STENCIL_WRITEMASK, mask))
+                return;
+            m_stencilMask = mask;
+            glStencilMask(mask);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::StencilMask, mask);
+        }
+
+        void BlendFunc(const GLenum src, const GLenum dst)
+        {
+            unsigned int state[2] = {src, dst};
+            static const GLenum names[2] = {GL_BLEND_SRC_RGB, GL_BLEND_DST_RGB};
+            if (elideArray(m_blendFunc, state, names, "blend func"))
+                return;
+            glBlendFunc(src, dst);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::BlendFunc, src, dst);
+        }
+
+        void CullFace(const GLenum mode)
+        {
+            if (elide(m_cullFace == mode, "cull face", GL_CULL_FACE_MODE, mode))
+                return;
+            m_cullFace = mode;
+            glCullFace(mode);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::CullFace, mode);
+        }
+
+        void Viewport(const int x, const int y, const int width, const int height)
+        {
+            int state[4] = {x, y, width, height};
+            if (std::memcmp(m_viewport, state, sizeof(state)) == 0){
+                g_frameStats.stateElided++;
+                if (m_validate){
+                    int actual[4];
+                    glGetIntegerv(GL_VIEWPORT, actual);
+                    if (std::memcmp(actual, state, sizeof(state)) != 0)
+                        mismatch("viewport");
+                }
+                return;
+            }
+            std::memcpy(m_viewport, state, sizeof(state));
+            g_frameStats.stateCalls++;
+            glViewport(x, y, width, height);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::Viewport, x, y, width, height);
+        }
+
+        void ClearColor(const float r, const float g, const float b, const float a)
+        {
+            float state[4] = {r, g, b, a};
+            if (std::memcmp(m_clearColor, state, sizeof(state)) == 0){
+                g_frameStats.stateElided++;
+                if (m_validate){
+                    float actual[4];
+                    glGetFloatv(GL_COLOR_CLEAR_VALUE, actual);
+                    if (std::memcmp(actual, state, sizeof(state)) != 0)
+                        mismatch("clear color");
+                }
+                return;
+            }
+            std::memcpy(m_clearColor, state, sizeof(state));
+            g_frameStats.stateCalls++;
+            glClearColor(r, g, b, a);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::ClearColor, r, g, b, a);
+        }
+
+        // Not state, they only go through here to be traced
+        void Clear(const GLbitfield mask)
+        {
+            glClear(mask);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::Clear, mask);
+        }
+
+        void DrawArrays(const GLenum mode, const int first, const int count)
+        {
+            glDrawArrays(mode, first, count);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::DrawArrays, mode, first, count);
+        }
+
+        // offset in bytes into the element buffer of the bound vertex array
+        void DrawElements(const GLenum mode, const int count, const GLenum type, const unsigned int offset = 0)
+        {
+            glDrawElements(mode, count, type, (void*)(size_t)offset);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::DrawElements, mode, count, type, offset);
+        }
+
+        void DrawArraysInstanced(const GLenum mode, const int first, const int count, const int instances)
+        {
+            glDrawArraysInstanced(mode, first, count, instances);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::DrawArraysInstanced, mode, first, count, instances);
+        }
+
+        void DrawElementsInstanced(const GLenum mode, const int count, const GLenum type, const unsigned int offset, const int instances)
+        {
+            glDrawElementsInstanced(mode, count, type, (void*)(size_t)offset, instances);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::DrawElementsInstanced, mode, count, type, offset, instances);
+        }
+
+        // Clears the attachment of the bound draw framebuffer, color takes 4 values, depth 1
+        void ClearBufferfv(const GLenum buffer, const int drawBuffer, const float* value)
+        {
+            glClearBufferfv(buffer, drawBuffer, value);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::ClearBufferfv, buffer, drawBuffer, value[0], buffer == GL_COLOR ? value[1] : 0.f,
+                                  buffer == GL_COLOR ? value[2] : 0.f, buffer == GL_COLOR ? value[3] : 0.f);
+        }
+
+        void ClearBufferfi(const GLenum buffer, const int drawBuffer, const float depth, const int stencil)
+        {
+            glClearBufferfi(buffer, drawBuffer, depth, stencil);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::ClearBufferfi, buffer, drawBuffer, depth, stencil);
+        }
+
+        void InvalidateFramebuffer(const GLenum target, const int count, const GLenum* attachments)
+        {
+            glInvalidateFramebuffer(target, count, attachments);
+            if (g_glTrace.Recording())
+                g_glTrace.InvalidateFramebuffer(target, count, attachments);
+        }
+
+        void MemoryBarrier(const GLbitfield barriers)
+        {
+            glMemoryBarrier(barriers);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::MemoryBarrier, barriers);
+        }
+
+        // Whole level, not layered
+        void BindImageTexture(const unsigned int unit, const unsigned int texture, const int level, const GLenum access, const GLenum format)
+        {
+            glBindImageTexture(unit, texture, level, GL_FALSE, 0, access, format);
+            if (g_glTrace.Recording())
+                g_glTrace.BindImageTexture(unit, texture, level, access, format);
+        }
+
+        void DispatchCompute(const unsigned int x, const unsigned int y, const unsigned int z = 1)
+        {
+            glDispatchCompute(x, y, z);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(TraceOp::DispatchCompute, x, y, z);
+        }
+
+    private:
+        static const unsigned int UNKNOWN = 0xFFFFFFFF;
+        static constexpr GLenum BUFFER_TARGETS[4] = {GL_ARRAY_BUFFER, GL_PIXEL_PACK_BUFFER, GL_PIXEL_UNPACK_BUFFER, GL_DRAW_INDIRECT_BUFFER};
+        static constexpr GLenum BUFFER_BINDINGS[4] = {GL_ARRAY_BUFFER_BINDING, GL_PIXEL_PACK_BUFFER_BINDING, GL_PIXEL_UNPACK_BUFFER_BINDING, GL_DRAW_INDIRECT_BUFFER_BINDING};
+        static constexpr GLenum CAPS[4] = {GL_DEPTH_TEST, GL_STENCIL_TEST, GL_BLEND, GL_CULL_FACE};
+
+        struct TextureUnit
+        {
+            unsigned int texture;
+            GLenum target;
+            unsigned int sampler;
+        };
+
+        bool m_validate = false;
+        unsigned int m_program, m_vertexArray;
+        unsigned int m_drawFramebuffer, m_readFramebuffer;
+        unsigned int m_buffers[4];
+        TextureUnit m_units[MAX_TEXTURE_UNITS];
+        int m_enabled[4]; // -1 unknown
+        unsigned int m_depthFunc, m_depthMask;
+        unsigned int m_colorMask;
+        unsigned int m_stencilFunc[3], m_stencilOp[3], m_stencilMask;
+        unsigned int m_blendFunc[2];
+        unsigned int m_cullFace;
+        int m_viewport[4];
+        float m_clearColor[4];
+
+        static int bufferIndex(const GLenum target)
+        {
+            for (int i = 0 ; i < 4 ; i++){
+                if (BUFFER_TARGETS[i] == target)
+                    return i;
+            }
+            return -1;
+        }
+
+        // glGet name of the unit's binding for a texture target
+        static GLenum textureBinding(const GLenum target)
+        {
+            switch (target){
+                case GL_TEXTURE_1D: return GL_TEXTURE_BINDING_1D;
+                case GL_TEXTURE_1D_ARRAY: return GL_TEXTURE_BINDING_1D_ARRAY;
+                case GL_TEXTURE_2D_ARRAY: return GL_TEXTURE_BINDING_2D_ARRAY;
+                case GL_TEXTURE_2D_MULTISAMPLE: return GL_TEXTURE_BINDING_2D_MULTISAMPLE;
+                case GL_TEXTURE_2D_MULTISAMPLE_ARRAY: return GL_TEXTURE_BINDING_2D_MULTISAMPLE_ARRAY;
+                case GL_TEXTURE_3D: return GL_TEXTURE_BINDING_3D;
+                case GL_TEXTURE_CUBE_MAP: return GL_TEXTURE_BINDING_CUBE_MAP;
+                case GL_TEXTURE_CUBE_MAP_ARRAY: return GL_TEXTURE_BINDING_CUBE_MAP_ARRAY;
+                case GL_TEXTURE_RECTANGLE: return GL_TEXTURE_BINDING_RECTANGLE;
+                case GL_TEXTURE_BUFFER: return GL_TEXTURE_BINDING_BUFFER;
+                default: return GL_TEXTURE_BINDING_2D;
+            }
+        }
+
+        // Counts the call, and when it's redundant checks the shadow in validation mode
+        bool elide(const bool same, const char* what, const GLenum name, const unsigned int expected)
+        {
+            if (!same){
+                g_frameStats.stateCalls++;
+                return false;
+            }
+            g_frameStats.stateElided++;
+            if (m_validate){
+                int actual;
+                glGetIntegerv(name, &actual);
+                if ((unsigned int)actual != expected)
+                    mismatch(what);
+            }
+            return true;
+        }
+
+        // GL_COLOR_WRITEMASK has four values, elide() reads one
+        bool elideColorMask(const bool write)
+        {
+            if (m_colorMask != (unsigned int)write){
+                g_frameStats.stateCalls++;
+                return false;
+            }
+            g_frameStats.stateElided++;
+            if (m_validate){
+                GLboolean actual[4];
+                glGetBooleanv(GL_COLOR_WRITEMASK, actual);
+                for (GLboolean channel : actual){
+                    if (channel != (GLboolean)write)
+                        mismatch("color mask");
+                }
+            }
+            return true;
+        }
+
+        template <unsigned int N>
+        bool elideArray(unsigned int (&shadow)[N], const unsigned int (&state)[N], const GLenum (&names)[N], const char* what)
+        {
+            if (std::memcmp(shadow, state, sizeof(state)) != 0){
+                std::memcpy(shadow, state, sizeof(state));
+                g_frameStats.stateCalls++;
+                return false;
+            }
+            g_frameStats.stateElided++;
+            for (unsigned int i = 0 ; m_validate && i < N ; i++){
+                int actual;
+                glGetIntegerv(names[i], &actual);
+                if ((unsigned int)actual != state[i])
+                    mismatch(what);
+            }
+            return true;
+        }
+
+        void setEnabled(const GLenum cap, const bool enabled)
+        {
+            int index = -1;
+            for (int i = 0 ; i < 4 ; i++){
+                if (CAPS[i] == cap)
+                    index = i;
+            }
+            if (index < 0){
+                g_frameStats.stateCalls++;
+            }
+            else if (m_enabled[index] == (int)enabled){
+                g_frameStats.stateElided++;
+                if (m_validate && glIsEnabled(cap) != (GLboolean)enabled)
+                    mismatch("enable");
+                return;
+            }
+            else {
+                m_enabled[index] = enabled;
+                g_frameStats.stateCalls++;
+            }
+            if (enabled)
+                glEnable(cap);
+            else
+                glDisable(cap);
+            if (g_glTrace.Recording())
+                g_glTrace.Command(enabled ? TraceOp::Enable : TraceOp::Disable, cap);
+        }
+
+        // Per-unit bindings can only be read through the active unit, restored afterwards
+        void checkUnit(const unsigned int unit, const GLenum name, const unsigned int expected, const char* what)
+        {
+            int active, actual;
+            glGetIntegerv(GL_ACTIVE_TEXTURE, &active);
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glGetIntegerv(name, &actual);
+            glActiveTexture(active);
+            if ((unsigned int)actual != expected)
+                mismatch(what);
+        }
+
+        void mismatch(const char* what)
+        {
+            std::cerr << "GLState : shadowed " << what << " differs from the GL state, a call bypassed GLState\n";
+        }
+};
+
+inline GLState g_glState;
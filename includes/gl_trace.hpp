@@ -0,0 +1,676 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Binary trace of the GL work issued through GLState, Shader and FrameUniformBuffer,
+// played back by the replay project. Every command is an op, a payload size and a payload
+// of 32-bit words followed by raw bytes for sources and contents. Objects are defined with
+// their contents the first time a command references them, ids are the recorded ones
+
+const char TRACE_MAGIC[4] = {'G', 'L', 'T', 'R'};
+const uint32_t TRACE_VERSION = 4;
+
+enum class TraceOp : uint32_t
+{
+    // Definitions, executed once by the replay
+    DefineBuffer, DefineTexture, DefineRenderbuffer, DefineFramebuffer, DefineVertexArray, DefineProgram, DefineSampler,
+    // Frame commands
+    UseProgram, BindVertexArray, BindBuffer, BindBufferRange, BindTexture, BindSampler, BindFramebuffer,
+    Enable, Disable, DepthFunc, DepthMask, ColorMask, StencilFunc, StencilOp, StencilMask, BlendFunc, CullFace,
+    Viewport, ClearColor, Clear, Uniform, BufferSubData,
+    DrawArrays, DrawElements, DrawArraysInstanced, DrawElementsInstanced,
+    ClearBufferfv, ClearBufferfi, InvalidateFramebuffer, MemoryBarrier, BindImageTexture, DispatchCompute, EndFrame,
+    Count
+};
+
+inline const char* TraceOpName(const TraceOp op)
+{
+    static const char* names[] = {
+        "DefineBuffer", "DefineTexture", "DefineRenderbuffer", "DefineFramebuffer", "DefineVertexArray", "DefineProgram", "DefineSampler",
+        "UseProgram", "BindVertexArray", "BindBuffer", "BindBufferRange", "BindTexture", "BindSampler", "BindFramebuffer",
+        "Enable", "Disable", "DepthFunc", "DepthMask", "ColorMask", "StencilFunc", "StencilOp", "StencilMask", "BlendFunc", "CullFace",
+        "Viewport", "ClearColor", "Clear", "Uniform", "BufferSubData",
+        "DrawArrays", "DrawElements", "DrawArraysInstanced", "DrawElementsInstanced",
+        "ClearBufferfv", "ClearBufferfi", "InvalidateFramebuffer", "MemoryBarrier", "BindImageTexture", "DispatchCompute", "EndFrame"
+    };
+    return op < TraceOp::Count ? names[(uint32_t)op] : "Unknown";
+}
+
+inline bool IsTraceDefinition(const TraceOp op)
+{
+    return op <= TraceOp::DefineSampler;
+}
+
+struct TraceHeader
+{
+    char magic[4];
+    uint32_t version;
+    int32_t width, height; // Default framebuffer, replayed offscreen
+};
+
+// Component layout of a uniform type, shared by the recorder snapshot and the replay
+struct TraceUniformShape
+{
+    unsigned int components; // 16 for mat4
+    char base;               // 'f' float, 'i' int/bool/sampler, 'u' unsigned
+};
+
+inline TraceUniformShape TraceUniformShapeOf(const GLenum type)
+{
+    switch (type){
+        case GL_FLOAT: return {1, 'f'};
+        case GL_FLOAT_VEC2: return {2, 'f'};
+        case GL_FLOAT_VEC3: return {3, 'f'};
+        case GL_FLOAT_VEC4: return {4, 'f'};
+        case GL_FLOAT_MAT2: return {4, 'f'};
+        case GL_FLOAT_MAT3: return {9, 'f'};
+        case GL_FLOAT_MAT4: return {16, 'f'};
+        case GL_INT_VEC2: case GL_BOOL_VEC2: return {2, 'i'};
+        case GL_INT_VEC3: case GL_BOOL_VEC3: return {3, 'i'};
+        case GL_INT_VEC4: case GL_BOOL_VEC4: return {4, 'i'};
+        case GL_UNSIGNED_INT: return {1, 'u'};
+        case GL_UNSIGNED_INT_VEC2: return {2, 'u'};
+        case GL_UNSIGNED_INT_VEC3: return {3, 'u'};
+        case GL_UNSIGNED_INT_VEC4: return {4, 'u'};
+        case GL_DOUBLE: case GL_DOUBLE_VEC2: case GL_DOUBLE_VEC3: case GL_DOUBLE_VEC4: return {0, 'f'}; // Not traced
+        default: return {1, 'i'}; // int, bool and every sampler/image type
+    }
+}
+
+// Reads the payload of a command word by word
+class TraceReader
+{
+    public:
+        TraceReader(const unsigned char* data, const uint32_t size) : m_data(data), m_end(data + size) {}
+
+        template <typename T>
+        T Get()
+        {
+            static_assert(sizeof(T) == 4, "Trace payloads are made of 32-bit words");
+            T value{};
+            if (m_data + sizeof(T) <= m_end){
+                std::memcpy(&value, m_data, sizeof(T));
+                m_data += sizeof(T);
+            }
+            return value;
+        }
+
+        // Raw bytes stored after a size word
+        const unsigned char* Bytes(uint32_t& size)
+        {
+            size = Get<uint32_t>();
+            const unsigned char* bytes = m_data;
+            if (m_data + size > m_end)
+                size = (uint32_t)(m_end - m_data);
+            m_data += (size + 3) & ~3u;
+            return bytes;
+        }
+
+    private:
+        const unsigned char* m_data;
+        const unsigned char* m_end;
+};
+
+// Records the commands of the frames between Begin and End. Recording starts with a snapshot
+// of the bound objects and fixed-function state, so the trace doesn't depend on what
+// happened before it. Calls are appended in memory and written by End
+class GLTraceRecorder
+{
+    public:
+        bool Recording() const { return m_recording; }
+
+        // Programs can't give their sources back, Shader registers them when building.
+        // Builds run on the shader worker thread too
+        void RegisterProgram(const unsigned int program, const std::string& vertexCode, const std::string& fragmentCode)
+        {
+            std::lock_guard<std::mutex> lock(m_programsMutex);
+            m_programSources[program] = {vertexCode, fragmentCode};
+        }
+
+        bool Begin(const std::string& path)
+        {
+            if (m_recording)
+                return false;
+            m_path = path;
+            m_data.clear();
+            m_defined.clear();
+            m_recording = true;
+
+            int viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            TraceHeader header;
+            std::memcpy(header.magic, TRACE_MAGIC, 4);
+            header.version = TRACE_VERSION;
+            header.width = viewport[2];
+            header.height = viewport[3];
+            m_data.resize(sizeof(header));
+            std::memcpy(m_data.data(), &header, sizeof(header));
+
+            snapshot();
+            return true;
+        }
+
+        void EndFrame()
+        {
+            if (m_recording)
+                Command(TraceOp::EndFrame);
+        }
+
+        bool End()
+        {
+            if (!m_recording)
+                return false;
+            m_recording = false;
+            std::ofstream file(m_path, std::ios::binary);
+            if (!file){
+                std::cerr << "Can't write trace " << m_path << "\n";
+                return false;
+            }
+            file.write((const char*)m_data.data(), m_data.size());
+            std::cout << "[trace] " << m_commands << " commands, " << m_data.size() / 1024 << " KiB written to " << m_path << "\n";
+            m_commands = 0;
+            return true;
+        }
+
+        // Commands without object references, every argument is one 32-bit word
+        template <typename... Args>
+        void Command(const TraceOp op, const Args... args)
+        {
+            static_assert(((sizeof(Args) == 4) && ...), "Trace arguments are 32-bit words");
+            size_t start = beginCommand(op);
+            (put(args), ...);
+            endCommand(start);
+        }
+
+        void UseProgram(const unsigned int program)
+        {
+            defineProgram(program);
+            Command(TraceOp::UseProgram, program);
+        }
+
+        // Call after binding, the attribute layout is read from the bound vertex array
+        void BindVertexArray(const unsigned int vertexArray)
+        {
+            defineVertexArray(vertexArray);
+            Command(TraceOp::BindVertexArray, vertexArray);
+        }
+
+        void BindBuffer(const GLenum target, const unsigned int buffer)
+        {
+            defineBuffer(buffer);
+            Command(TraceOp::BindBuffer, target, buffer);
+        }
+
+        void BindBufferRange(const GLenum target, const unsigned int index, const unsigned int buffer, const unsigned int offset, const unsigned int size)
+        {
+            defineBuffer(buffer);
+            Command(TraceOp::BindBufferRange, target, index, buffer, offset, size);
+        }
+
+        void BindTexture(const unsigned int unit, const GLenum target, const unsigned int texture)
+        {
+            defineTexture(texture);
+            Command(TraceOp::BindTexture, unit, target, texture);
+        }
+
+        void BindImageTexture(const unsigned int unit, const unsigned int texture, const int level, const GLenum access, const GLenum format)
+        {
+            defineTexture(texture);
+            Command(TraceOp::BindImageTexture, unit, texture, level, access, format);
+        }
+
+        void BindSampler(const unsigned int unit, const unsigned int sampler)
+        {
+            defineSampler(sampler);
+            Command(TraceOp::BindSampler, unit, sampler);
+        }
+
+        void BindFramebuffer(const GLenum target, const unsigned int framebuffer)
+        {
+            defineFramebuffer(framebuffer);
+            Command(TraceOp::BindFramebuffer, target, framebuffer);
+        }
+
+        // values holds TraceUniformShapeOf(type).components words
+        void Uniform(const unsigned int program, const int location, const GLenum type, const void* values)
+        {
+            defineProgram(program);
+            unsigned int components = TraceUniformShapeOf(type).components;
+            size_t start = beginCommand(TraceOp::Uniform);
+            put(program);
+            put(location);
+            put(type);
+            putBytes(values, components * 4);
+            endCommand(start);
+        }
+
+        void InvalidateFramebuffer(const GLenum target, const int count, const GLenum* attachments)
+        {
+            size_t start = beginCommand(TraceOp::InvalidateFramebuffer);
+            put(target);
+            putBytes(attachments, count * sizeof(GLenum));
+            endCommand(start);
+        }
+
+        void BufferSubData(const unsigned int buffer, const unsigned int offset, const void* data, const unsigned int size)
+        {
+            defineBuffer(buffer);
+            size_t start = beginCommand(TraceOp::BufferSubData);
+            put(buffer);
+            put(offset);
+            putBytes(data, size);
+            endCommand(start);
+        }
+
+    private:
+        static const unsigned int MAX_UNITS = 16;
+        static const unsigned int MAX_INDEXED_BUFFERS = 8;
+
+        bool m_recording = false;
+        std::string m_path;
+        std::vector<unsigned char> m_data;
+        unsigned long long m_commands = 0;
+        std::unordered_set<unsigned long long> m_defined; // kind << 32 | id
+
+        struct ProgramSources
+        {
+            std::string vertex, fragment;
+        };
+        std::mutex m_programsMutex;
+        std::unordered_map<unsigned int, ProgramSources> m_programSources;
+
+        template <typename T>
+        void put(const T value)
+        {
+            size_t offset = m_data.size();
+            m_data.resize(offset + sizeof(T));
+            std::memcpy(m_data.data() + offset, &value, sizeof(T));
+        }
+
+        void putBytes(const void* data, const uint32_t size)
+        {
+            put(size);
+            size_t offset = m_data.size();
+            m_data.resize(offset + ((size + 3) & ~3u), 0);
+            if (size)
+                std::memcpy(m_data.data() + offset, data, size);
+        }
+
+        size_t beginCommand(const TraceOp op)
+        {
+            put((uint32_t)op);
+            put((uint32_t)0); // Payload size, patched by endCommand
+            m_commands++;
+            return m_data.size();
+        }
+
+        void endCommand(const size_t start)
+        {
+            uint32_t size = (uint32_t)(m_data.size() - start);
+            std::memcpy(m_data.data() + start - 4, &size, 4);
+        }
+
+        // True the first time an object is seen in this trace
+        bool firstReference(const TraceOp kind, const unsigned int id)
+        {
+            if (id == 0)
+                return false;
+            return m_defined.insert(((unsigned long long)kind << 32) | id).second;
+        }
+
+        void defineBuffer(const unsigned int buffer)
+        {
+            if (!firstReference(TraceOp::DefineBuffer, buffer))
+                return;
+            int size = 0;
+            glGetNamedBufferParameteriv(buffer, GL_BUFFER_SIZE, &size);
+            std::vector<unsigned char> contents(size);
+            if (size > 0) // Persistently mapped buffers can be read too
+                glGetNamedBufferSubData(buffer, 0, size, contents.data());
+
+            size_t start = beginCommand(TraceOp::DefineBuffer);
+            put(buffer);
+            putBytes(contents.data(), size);
+            endCommand(start);
+        }
+
+        static bool isDepthFormat(const GLenum format)
+        {
+            return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 || format == GL_DEPTH_COMPONENT32 ||
+                   format == GL_DEPTH_COMPONENT32F || format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8 ||
+                   format == GL_STENCIL_INDEX8;
+        }
+
+        static bool isFloatFormat(const GLenum format)
+        {
+            return format == GL_R16F || format == GL_RG16F || format == GL_RGB16F || format == GL_RGBA16F ||
+                   format == GL_R32F || format == GL_RG32F || format == GL_RGB32F || format == GL_RGBA32F ||
+                   format == GL_R11F_G11F_B10F || format == GL_RGB9_E5;
+        }
+
+        // Level 0 is captured as RGBA8 or RGBA32F, the replay regenerates the mipmaps.
+        // Depth and multisampled textures are render targets, only their storage is recorded
+        void defineTexture(const unsigned int texture)
+        {
+            if (!firstReference(TraceOp::DefineTexture, texture))
+                return;
+            int target = 0, width = 0, height = 0, depth = 0, internalFormat = 0, samples = 0;
+            int parameters[7] = {};
+            const GLenum names[7] = {GL_TEXTURE_MIN_FILTER, GL_TEXTURE_MAG_FILTER, GL_TEXTURE_WRAP_S, GL_TEXTURE_WRAP_T,
+                                     GL_TEXTURE_WRAP_R, GL_TEXTURE_COMPARE_MODE, GL_TEXTURE_COMPARE_FUNC};
+            glGetTextureParameteriv(texture, GL_TEXTURE_TARGET, &target);
+            glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_WIDTH, &width);
+            glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_HEIGHT, &height);
+            glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_DEPTH, &depth);
+            glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+            glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_SAMPLES, &samples);
+            if (target == GL_TEXTURE_CUBE_MAP)
+                depth = 6;
+            bool multisample = target == GL_TEXTURE_2D_MULTISAMPLE;
+            for (int i = 0 ; i < 7 && !multisample ; i++)
+                glGetTextureParameteriv(texture, names[i], &parameters[i]);
+
+            std::vector<unsigned char> pixels;
+            GLenum pixelType = isFloatFormat(internalFormat) ? GL_FLOAT : GL_UNSIGNED_BYTE;
+            if (!multisample && !isDepthFormat(internalFormat) && width > 0){
+                pixels.resize((size_t)width * height * depth * 4 * (pixelType == GL_FLOAT ? 4 : 1));
+                int packBuffer = 0;
+                glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &packBuffer);
+                if (packBuffer)
+                    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                glGetTextureImage(texture, 0, GL_RGBA, pixelType, (int)pixels.size(), pixels.data());
+                if (packBuffer)
+                    glBindBuffer(GL_PIXEL_PACK_BUFFER, packBuffer);
+            }
+
+            size_t start = beginCommand(TraceOp::DefineTexture);
+            put(texture);
+            put(target);
+            put(internalFormat);
+            put(width);
+            put(height);
+            put(depth);
+            put(samples);
+            for (int parameter : parameters)
+                put(parameter);
+            put(pixelType);
+            putBytes(pixels.data(), (uint32_t)pixels.size());
+            endCommand(start);
+        }
+
+        void defineSampler(const unsigned int sampler)
+        {
+            if (!firstReference(TraceOp::DefineSampler, sampler))
+                return;
+            const GLenum names[7] = {GL_TEXTURE_MIN_FILTER, GL_TEXTURE_MAG_FILTER, GL_TEXTURE_WRAP_S, GL_TEXTURE_WRAP_T,
+                                     GL_TEXTURE_WRAP_R, GL_TEXTURE_COMPARE_MODE, GL_TEXTURE_COMPARE_FUNC};
+            size_t start = beginCommand(TraceOp::DefineSampler);
+            put(sampler);
+            for (GLenum name : names){
+                int value;
+                glGetSamplerParameteriv(sampler, name, &value);
+                put(value);
+            }
+            endCommand(start);
+        }
+
+        void defineRenderbuffer(const unsigned int renderbuffer)
+        {
+            if (!firstReference(TraceOp::DefineRenderbuffer, renderbuffer))
+                return;
+            int width, height, internalFormat, samples;
+            glGetNamedRenderbufferParameteriv(renderbuffer, GL_RENDERBUFFER_WIDTH, &width);
+            glGetNamedRenderbufferParameteriv(renderbuffer, GL_RENDERBUFFER_HEIGHT, &height);
+            glGetNamedRenderbufferParameteriv(renderbuffer, GL_RENDERBUFFER_INTERNAL_FORMAT, &internalFormat);
+            glGetNamedRenderbufferParameteriv(renderbuffer, GL_RENDERBUFFER_SAMPLES, &samples);
+            Command(TraceOp::DefineRenderbuffer, renderbuffer, internalFormat, width, height, samples);
+        }
+
+        // Attachments are listed as (attachment, object type, name, level, layer)
+        void defineFramebuffer(const unsigned int framebuffer)
+        {
+            if (!firstReference(TraceOp::DefineFramebuffer, framebuffer))
+                return;
+            std::vector<int> attachments;
+            const GLenum points[10] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3,
+                                       GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5, GL_COLOR_ATTACHMENT6, GL_COLOR_ATTACHMENT7,
+                                       GL_DEPTH_ATTACHMENT, GL_STENCIL_ATTACHMENT};
+            for (GLenum point : points){
+                int type = GL_NONE, name = 0, level = 0, layer = 0;
+                glGetNamedFramebufferAttachmentParameteriv(framebuffer, point, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &type);
+                if (type == GL_NONE)
+                    continue;
+                glGetNamedFramebufferAttachmentParameteriv(framebuffer, point, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &name);
+                if (type == GL_TEXTURE){
+                    glGetNamedFramebufferAttachmentParameteriv(framebuffer, point, GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_LEVEL, &level);
+                    glGetNamedFramebufferAttachmentParameteriv(framebuffer, point, GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_LAYER, &layer);
+                    defineTexture(name);
+                }
+                else {
+                    defineRenderbuffer(name);
+                }
+                attachments.insert(attachments.end(), {(int)point, type, name, level, layer});
+            }
+
+            size_t start = beginCommand(TraceOp::DefineFramebuffer);
+            put(framebuffer);
+            put((uint32_t)attachments.size() / 5);
+            for (int value : attachments)
+                put(value);
+            endCommand(start);
+        }
+
+        // Reads the bound vertex array, per attribute (index, buffer, size, type, normalized,
+        // integer, stride, offset, divisor) for enabled ones
+        void defineVertexArray(const unsigned int vertexArray)
+        {
+            if (!firstReference(TraceOp::DefineVertexArray, vertexArray))
+                return;
+            int elementBuffer = 0, maxAttributes = 16;
+            glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &elementBuffer);
+            glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &maxAttributes);
+            defineBuffer(elementBuffer);
+
+            std::vector<int> attributes;
+            for (int i = 0 ; i < maxAttributes && i < 16 ; i++){
+                int enabled = 0;
+                glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &enabled);
+                if (!enabled)
+                    continue;
+                int buffer, size, type, normalized, integer, stride, divisor;
+                void* pointer = NULL;
+                glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &buffer);
+                glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_SIZE, &size);
+                glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_TYPE, &type);
+                glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_NORMALIZED, &normalized);
+                glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_INTEGER, &integer);
+                glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_STRIDE, &stride);
+                glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_DIVISOR, &divisor);
+                glGetVertexAttribPointerv(i, GL_VERTEX_ATTRIB_ARRAY_POINTER, &pointer);
+                defineBuffer(buffer);
+                attributes.insert(attributes.end(), {i, buffer, size, type, normalized, integer, stride, (int)(size_t)pointer, divisor});
+            }
+
+            size_t start = beginCommand(TraceOp::DefineVertexArray);
+            put(vertexArray);
+            put(elementBuffer);
+            put((uint32_t)attributes.size() / 9);
+            for (int value : attributes)
+                put(value);
+            endCommand(start);
+        }
+
+        // The sources come from RegisterProgram. Locations are listed with their names so the
+        // replay can remap them, then the current values are recorded as Uniform commands
+        void defineProgram(const unsigned int program)
+        {
+            if (!firstReference(TraceOp::DefineProgram, program))
+                return;
+            ProgramSources sources;
+            {
+                std::lock_guard<std::mutex> lock(m_programsMutex);
+                auto it = m_programSources.find(program);
+                if (it != m_programSources.end())
+                    sources = it->second;
+                else
+                    std::cerr << "[trace] Sources of program " << program << " unknown, it won't be replayed\n";
+            }
+
+            struct Location
+            {
+                int location;
+                GLenum type;
+                std::string name;
+            };
+            std::vector<Location> locations;
+            int count = 0, maxLength = 0;
+            glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+            glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+            std::vector<char> buffer(maxLength + 1);
+            for (int i = 0 ; i < count ; i++){
+                int length, size;
+                GLenum type;
+                glGetActiveUniform(program, i, (int)buffer.size(), &length, &size, &type, buffer.data());
+                std::string name(buffer.data(), length);
+                if (size > 1 && name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+                    name.resize(name.size() - 3);
+                for (int j = 0 ; j < size ; j++){
+                    std::string element = size > 1 ? name + "[" + std::to_string(j) + "]" : name;
+                    int location = glGetUniformLocation(program, element.c_str());
+                    if (location >= 0) // Members of uniform blocks have none
+                        locations.push_back(Location{location, type, element});
+                }
+            }
+
+            size_t start = beginCommand(TraceOp::DefineProgram);
+            put(program);
+            putBytes(sources.vertex.data(), (uint32_t)sources.vertex.size());
+            putBytes(sources.fragment.data(), (uint32_t)sources.fragment.size());
+            put((uint32_t)locations.size());
+            for (const Location& location : locations){
+                put(location.location);
+                putBytes(location.name.data(), (uint32_t)location.name.size());
+            }
+            endCommand(start);
+
+            for (const Location& location : locations)
+                snapshotUniform(program, location.location, location.type);
+        }
+
+        void snapshotUniform(const unsigned int program, const int location, const GLenum type)
+        {
+            TraceUniformShape shape = TraceUniformShapeOf(type);
+            if (shape.components == 0)
+                return;
+            uint32_t values[16];
+            if (shape.base == 'f')
+                glGetUniformfv(program, location, (float*)values);
+            else if (shape.base == 'u')
+                glGetUniformuiv(program, location, values);
+            else
+                glGetUniformiv(program, location, (int*)values);
+            Uniform(program, location, type, values);
+        }
+
+        void snapshotEnable(const GLenum cap)
+        {
+            Command(glIsEnabled(cap) ? TraceOp::Enable : TraceOp::Disable, cap);
+        }
+
+        // Bindings and fixed-function state current when recording starts
+        void snapshot()
+        {
+            int v[4];
+            float color[4];
+            glGetIntegerv(GL_VIEWPORT, v);
+            Command(TraceOp::Viewport, v[0], v[1], v[2], v[3]);
+            glGetFloatv(GL_COLOR_CLEAR_VALUE, color);
+            Command(TraceOp::ClearColor, color[0], color[1], color[2], color[3]);
+
+            snapshotEnable(GL_DEPTH_TEST);
+            snapshotEnable(GL_STENCIL_TEST);
+            snapshotEnable(GL_BLEND);
+            snapshotEnable(GL_CULL_FACE);
+            glGetIntegerv(GL_DEPTH_FUNC, v);
+            Command(TraceOp::DepthFunc, v[0]);
+            glGetIntegerv(GL_DEPTH_WRITEMASK, v);
+            Command(TraceOp::DepthMask, v[0]);
+            GLboolean colorMask[4];
+            glGetBooleanv(GL_COLOR_WRITEMASK, colorMask);
+            Command(TraceOp::ColorMask, (unsigned int)colorMask[0]);
+            glGetIntegerv(GL_STENCIL_FUNC, &v[0]);
+            glGetIntegerv(GL_STENCIL_REF, &v[1]);
+            glGetIntegerv(GL_STENCIL_VALUE_MASK, &v[2]);
+            Command(TraceOp::StencilFunc, v[0], v[1], v[2]);
+            glGetIntegerv(GL_STENCIL_FAIL, &v[0]);
+            glGetIntegerv(GL_STENCIL_PASS_DEPTH_FAIL, &v[1]);
+            glGetIntegerv(GL_STENCIL_PASS_DEPTH_PASS, &v[2]);
+            Command(TraceOp::StencilOp, v[0], v[1], v[2]);
+            glGetIntegerv(GL_STENCIL_WRITEMASK, v);
+            Command(TraceOp::StencilMask, v[0]);
+            glGetIntegerv(GL_BLEND_SRC_RGB, &v[0]);
+            glGetIntegerv(GL_BLEND_DST_RGB, &v[1]);
+            Command(TraceOp::BlendFunc, v[0], v[1]);
+            glGetIntegerv(GL_CULL_FACE_MODE, v);
+            Command(TraceOp::CullFace, v[0]);
+
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &v[0]);
+            glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &v[1]);
+            BindFramebuffer(GL_DRAW_FRAMEBUFFER, v[0]);
+            BindFramebuffer(GL_READ_FRAMEBUFFER, v[1]);
+            glGetIntegerv(GL_CURRENT_PROGRAM, v);
+            UseProgram(v[0]);
+            glGetIntegerv(GL_VERTEX_ARRAY_BINDING, v);
+            BindVertexArray(v[0]);
+            glGetIntegerv(GL_ARRAY_BUFFER_BINDING, v);
+            BindBuffer(GL_ARRAY_BUFFER, v[0]);
+
+            const GLenum targets[4] = {GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_3D};
+            const GLenum bindings[4] = {GL_TEXTURE_BINDING_2D, GL_TEXTURE_BINDING_CUBE_MAP, GL_TEXTURE_BINDING_2D_ARRAY, GL_TEXTURE_BINDING_3D};
+            int active;
+            glGetIntegerv(GL_ACTIVE_TEXTURE, &active);
+            for (unsigned int unit = 0 ; unit < MAX_UNITS ; unit++){
+                glActiveTexture(GL_TEXTURE0 + unit);
+                for (int i = 0 ; i < 4 ; i++){
+                    glGetIntegerv(bindings[i], v);
+                    if (v[0])
+                        BindTexture(unit, targets[i], v[0]);
+                }
+                glGetIntegerv(GL_SAMPLER_BINDING, v);
+                if (v[0])
+                    BindSampler(unit, v[0]);
+            }
+            glActiveTexture(active);
+
+            const GLenum indexed[2][3] = {
+                {GL_UNIFORM_BUFFER, GL_UNIFORM_BUFFER_BINDING, GL_UNIFORM_BUFFER_START},
+                {GL_SHADER_STORAGE_BUFFER, GL_SHADER_STORAGE_BUFFER_BINDING, GL_SHADER_STORAGE_BUFFER_START}
+            };
+            for (const auto& target : indexed){
+                for (unsigned int i = 0 ; i < MAX_INDEXED_BUFFERS ; i++){
+                    GLint64 start = 0, size = 0;
+                    glGetIntegeri_v(target[1], i, v);
+                    if (!v[0])
+                        continue;
+                    glGetInteger64i_v(target[2], i, &start);
+                    glGetInteger64i_v(target[0] == GL_UNIFORM_BUFFER ? GL_UNIFORM_BUFFER_SIZE : GL_SHADER_STORAGE_BUFFER_SIZE, i, &size);
+                    if (size == 0){ // Bound with glBindBufferBase, the whole buffer
+                        glGetNamedBufferParameteriv(v[0], GL_BUFFER_SIZE, &v[1]);
+                        size = v[1];
+                    }
+                    BindBufferRange(target[0], i, v[0], (unsigned int)start, (unsigned int)size);
+                }
+            }
+        }
+};
+
+inline GLTraceRecorder g_glTrace;
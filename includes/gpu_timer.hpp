@@ -0,0 +1,91 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// GPU time of a section of the frame, read a few frames later so the CPU never waits on the
+// query. Timestamps rather than GL_TIME_ELAPSED, so timers can nest (a whole frame and one pass).
+// Queries are created on the first Begin, the context must be current
+class GpuTimer
+{
+    public:
+        static const unsigned int LATENCY = 4; // Frames a result can take to come back
+
+        ~GpuTimer()
+        {
+            Release();
+        }
+
+        void Release()
+        {
+            if (m_queries[0])
+                glDeleteQueries(2 * LATENCY, m_queries);
+            m_queries[0] = 0;
+        }
+
+        void Begin()
+        {
+            if (!m_queries[0])
+                glCreateQueries(GL_TIMESTAMP, 2 * LATENCY, m_queries);
+            poll();
+            // Every query is still in flight, this frame isn't timed
+            m_skipped = m_pending[m_next];
+            if (!m_skipped)
+                glQueryCounter(m_queries[2 * m_next], GL_TIMESTAMP);
+        }
+
+        void End()
+        {
+            if (m_skipped)
+                return;
+            glQueryCounter(m_queries[2 * m_next + 1], GL_TIMESTAMP);
+            m_pending[m_next] = true;
+            m_next = (m_next + 1) % LATENCY;
+        }
+
+        // Latest result, 0 until the first one comes back
+        float LastMs() const { return m_lastMs; }
+
+        // Results received so far, changes when LastMs is a new value
+        unsigned int Results() const { return m_results; }
+
+        // Mean of the results since the last call, 0 if there was none
+        float TakeAverageMs()
+        {
+            float average = m_samples ? (float)(m_totalMs / m_samples) : 0.f;
+            m_totalMs = 0.0;
+            m_samples = 0;
+            return average;
+        }
+
+    private:
+        unsigned int m_queries[2 * LATENCY] = {}; // Begin and end timestamps
+        bool m_pending[LATENCY] = {};
+        unsigned int m_next = 0;
+        bool m_skipped = false;
+        float m_lastMs = 0.f;
+        double m_totalMs = 0.0;
+        unsigned int m_samples = 0;
+        unsigned int m_results = 0;
+
+        // Results come back in order, stop at the first one not ready
+        void poll()
+        {
+            for (unsigned int i = 0 ; i < LATENCY ; i++){
+                unsigned int index = (m_next + i) % LATENCY;
+                if (!m_pending[index])
+                    continue;
+                int available = 0;
+                glGetQueryObjectiv(m_queries[2 * index + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    return;
+                GLuint64 begin = 0, end = 0;
+                glGetQueryObjectui64v(m_queries[2 * index], GL_QUERY_RESULT, &begin);
+                glGetQueryObjectui64v(m_queries[2 * index + 1], GL_QUERY_RESULT, &end);
+                m_pending[index] = false;
+                m_lastMs = (end - begin) / 1e6f;
+                m_results++;
+                m_totalMs += m_lastMs;
+                m_samples++;
+            }
+        }
+};
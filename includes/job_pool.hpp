@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running the indices of one job at a time. The calling thread
+// works too and Run returns once every index is done. Jobs are passed by reference without
+// std::function, running one doesn't allocate
+class JobPool
+{
+    public:
+        JobPool(unsigned int workers = std::max(1u, std::thread::hardware_concurrency()) - 1)
+        {
+            for (unsigned int i = 0 ; i < workers ; i++)
+                m_threads.emplace_back(&JobPool::workerLoop, this);
+        }
+
+        ~JobPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_jobsQueued.notify_all();
+            for (std::thread& thread : m_threads)
+                thread.join();
+        }
+
+        // Threads running a job, the caller included
+        unsigned int Size() const { return (unsigned int)m_threads.size() + 1; }
+
+        // Calls job(index) for every index in [0, count), in any order and on any thread
+        template <typename Job>
+        void Run(const unsigned int count, Job& job)
+        {
+            if (count == 0)
+                return;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_context = &job;
+                m_invoke = [](void* context, unsigned int index){ (*(Job*)context)(index); };
+                m_count = count;
+                m_next = 0;
+            }
+            m_jobsQueued.notify_all();
+            work();
+
+            // Every index is taken, wait for the workers still running one
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_jobsFinished.wait(lock, [this]{ return m_active == 0; });
+        }
+
+    private:
+        std::vector<std::thread> m_threads;
+        std::mutex m_mutex;
+        std::condition_variable m_jobsQueued, m_jobsFinished;
+        void* m_context = nullptr;
+        void (*m_invoke)(void*, unsigned int) = nullptr;
+        unsigned int m_count = 0;
+        std::atomic<unsigned int> m_next{0};
+        unsigned int m_active = 0; // Workers inside work()
+        bool m_stop = false;
+
+        void work()
+        {
+            for (unsigned int index = m_next++ ; index < m_count ; index = m_next++)
+                m_invoke(m_context, index);
+        }
+
+        // A worker only joins a job that still has indices left, checked under the lock,
+        // so it can't start on a job whose Run already returned
+        void workerLoop()
+        {
+            for (;;){
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_jobsQueued.wait(lock, [this]{ return m_stop || m_next < m_count; });
+                    if (m_stop)
+                        return;
+                    m_active++;
+                }
+                work();
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_active--;
+                }
+                m_jobsFinished.notify_one();
+            }
+        }
+};
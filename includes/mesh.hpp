@@ -39,35 +39,45 @@ class Mesh
         }
 
         void Draw(Shader& shader){
-            unsigned int diffuse_nr = 1;
-            unsigned int specular_nr = 1;
             for (unsigned int i = 0 ; i < m_textures.size() ; i++){
-                glActiveTexture(GL_TEXTURE0+i);
-                std::string number;
-                std::string name = m_textures[i].type;
-                if (name =="texture_diffuse")
-                    number = std::to_string(diffuse_nr++);
-                if (name =="texture_specular")
-                    number = std::to_string(specular_nr++);
-                shader.SetInt(("material."+(name+number)).c_str(), i);
-                glBindTexture(GL_TEXTURE_2D, m_textures[i].id);
+                shader.SetInt(m_samplerHashes[i], i);
+                g_glState.BindTexture(i, GL_TEXTURE_2D, m_textures[i].id);
             }
-            glActiveTexture(GL_TEXTURE0);
-            glBindVertexArray(VAO);
-            glDrawElements(GL_TRIANGLES, m_indices.size(), GL_UNSIGNED_INT, 0);
-            glBindVertexArray(0);
+            // No unbinding afterwards, GLState skips the rebind when the next draw uses the same VAO
+            g_glState.BindVertexArray(VAO);
+            g_glState.DrawElements(GL_TRIANGLES, (int)m_indices.size(), GL_UNSIGNED_INT);
+        }
+
+        // Depth pre-pass, positions only: 12 bytes a vertex instead of 32 and no texture binding
+        void DrawDepth(){
+            g_glState.BindVertexArray(positionVAO);
+            g_glState.DrawElements(GL_TRIANGLES, (int)m_indices.size(), GL_UNSIGNED_INT);
         }
     
     private:
         unsigned int VAO, VBO, EBO;
+        unsigned int positionVAO, positionVBO; // Tightly packed copy of the positions, same EBO
+        std::vector<unsigned int> m_samplerHashes; // "material.texture_diffuse1", ... hashed once
+
         void setupMesh(){
+            unsigned int diffuse_nr = 1;
+            unsigned int specular_nr = 1;
+            for (const Texture& texture : m_textures){
+                std::string number;
+                if (texture.type == "texture_diffuse")
+                    number = std::to_string(diffuse_nr++);
+                if (texture.type == "texture_specular")
+                    number = std::to_string(specular_nr++);
+                m_samplerHashes.push_back(UniformHash("material." + texture.type + number));
+            }
+
             glGenVertexArrays(1, &VAO);
             glGenBuffers(1, &VBO);
             glGenBuffers(1, &EBO);
 
-            glBindVertexArray(VAO);
+            g_glState.BindVertexArray(VAO);
 
-            glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            g_glState.BindBuffer(GL_ARRAY_BUFFER, VBO);
             glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(Vertex),
                 &m_vertices[0], GL_STATIC_DRAW);
 
@@ -84,7 +94,21 @@ class Mesh
             
             glEnableVertexAttribArray(2);
             glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+
+            std::vector<glm::vec3> positions;
+            positions.reserve(m_vertices.size());
+            for (const Vertex& vertex : m_vertices)
+                positions.push_back(vertex.Position);
+
+            glGenVertexArrays(1, &positionVAO);
+            glGenBuffers(1, &positionVBO);
+            g_glState.BindVertexArray(positionVAO);
+            g_glState.BindBuffer(GL_ARRAY_BUFFER, positionVBO);
+            glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
             
-            glBindVertexArray(0);
+            g_glState.BindVertexArray(0);
         }
 };
\ No newline at end of file
@@ -18,6 +18,12 @@ class Model
             for (Mesh& mesh : m_meshes)
                 mesh.Draw(shader);
         }
+
+        // Positions only, with whatever depth program is in use
+        void DrawDepth(){
+            for (Mesh& mesh : m_meshes)
+                mesh.DrawDepth();
+        }
         
     private:
         std::vector<Mesh> m_meshes;
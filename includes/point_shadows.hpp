@@ -0,0 +1,243 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_access.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+
+#include "gl_state.hpp"
+#include "gpu_timer.hpp"
+#include "shader.hpp"
+
+// Shadows of up to MAX_LIGHTS point lights in one cube map array, face f of light l is layer-face
+// 6 * l + f. Every light and face renders in a single pass: each caster is drawn once with the
+// mask of the faces it overlaps, and point_shadow.gs emits its triangles to those faces only,
+// rather than six passes per light. includes/shaders/point_shadows.glsl samples the result.
+//
+// The resolution of each light follows the share of the screen its range covers, lights whose
+// range is out of view aren't rendered at all. Faces render into the lower left corner of their
+// layer, so the receivers sample through a 2D array view of the texture and pick the face themselves.
+//
+// Frame order: SetLight, Fit, CasterMask for each caster (thread-safe), BeginPass, draw the
+// casters, EndPass, then Bind on the programs receiving the shadows
+class PointShadowMaps
+{
+    public:
+        static const unsigned int MAX_LIGHTS = 4;  // MAX_POINT_SHADOWS in point_shadow.gs and point_shadows.glsl
+        static constexpr float NEAR = 0.05f;       // POINT_SHADOW_NEAR in point_shadow.gs and point_shadows.glsl
+
+        PointShadowMaps(const unsigned int lights = 4, const int size = 1024, const int minSize = 64)
+            : m_lights(std::clamp(lights, 1u, MAX_LIGHTS)), m_size(size), m_minSize(std::min(minSize, size)) {}
+
+        ~PointShadowMaps()
+        {
+            Release();
+        }
+
+        void Release()
+        {
+            if (m_framebuffer)
+                glDeleteFramebuffers(1, &m_framebuffer);
+            if (m_view)
+                glDeleteTextures(1, &m_view);
+            if (m_texture)
+                glDeleteTextures(1, &m_texture);
+            m_framebuffer = m_view = m_texture = 0;
+            m_timer.Release();
+        }
+
+        // Distance where the attenuation of phong.glsl brings a light of this intensity under threshold
+        static float AttenuationRange(const float constant, const float linear, const float quadratic, const float intensity,
+                                      const float threshold = 1.f / 32.f)
+        {
+            float c = constant - intensity / threshold;
+            if (c >= 0.f)
+                return 0.f;
+            if (quadratic <= 0.f)
+                return linear > 0.f ? -c / linear : 0.f;
+            return (-linear + std::sqrt(linear * linear - 4.f * quadratic * c)) / (2.f * quadratic);
+        }
+
+        // The range is the far plane of the faces, receivers beyond it are lit
+        void SetLight(const unsigned int light, const glm::vec3& position, const float range)
+        {
+            m_positions[light] = position;
+            m_ranges[light] = std::max(range, 2.f * NEAR);
+        }
+
+        unsigned int Lights() const { return m_lights; }
+
+        // Picks the resolution of every light from the screen radius of its range: full size once the
+        // camera is inside it, down to minSize, powers of two in between. 0 when it can't reach the view
+        void Fit(const glm::mat4& projection, const glm::mat4& view, const float fovY)
+        {
+            glm::mat4 viewProjection = projection * view;
+            glm::vec4 planes[6];
+            for (unsigned int i = 0 ; i < 3 ; i++){
+                planes[2 * i] = glm::row(viewProjection, 3) + glm::row(viewProjection, i);
+                planes[2 * i + 1] = glm::row(viewProjection, 3) - glm::row(viewProjection, i);
+            }
+            glm::vec3 camera(glm::inverse(view)[3]);
+            float tanY = std::tan(fovY * 0.5f);
+
+            for (unsigned int l = 0 ; l < m_lights ; l++){
+                glm::vec3 position = m_positions[l];
+                float range = m_ranges[l];
+                bool visible = true;
+                for (const glm::vec4& plane : planes)
+                    visible = visible && glm::dot(glm::vec3(plane), position) + plane.w >= -range * glm::length(glm::vec3(plane));
+                if (!visible){
+                    m_resolutions[l] = 0;
+                    continue;
+                }
+                float distance = glm::length(position - camera);
+                float share = distance <= range ? 1.f : range / (std::sqrt(distance * distance - range * range) * tanY);
+                int resolution = m_minSize;
+                while (resolution < m_size && resolution < share * m_size)
+                    resolution *= 2;
+                m_resolutions[l] = std::min(resolution, m_size);
+            }
+        }
+
+        // Faces rendered this frame the caster's bounding sphere reaches, bit 6 * light + face, 0 means
+        // it can be skipped. A face sees the pyramid around its axis, |other axis| <= distance along it
+        unsigned int CasterMask(const glm::vec3& centre, const float radius) const
+        {
+            const float INV_SQRT2 = 0.70710678f;
+            unsigned int mask = 0;
+            for (unsigned int l = 0 ; l < m_lights ; l++){
+                glm::vec3 d = centre - m_positions[l];
+                float reach = m_ranges[l] + radius;
+                if (!m_resolutions[l] || glm::dot(d, d) > reach * reach)
+                    continue;
+                for (unsigned int face = 0 ; face < 6 ; face++){
+                    unsigned int axis = face / 2;
+                    float along = face % 2 ? -d[axis] : d[axis];
+                    float a = d[(axis + 1) % 3], b = d[(axis + 2) % 3];
+                    if (along < -radius ||
+                        (along - std::fabs(a)) * INV_SQRT2 < -radius ||
+                        (along - std::fabs(b)) * INV_SQRT2 < -radius)
+                        continue;
+                    mask |= 1u << (6 * l + face);
+                }
+            }
+            return mask;
+        }
+
+        // Face draws out of `tested` casters, summed by the recording jobs once each
+        void AddCasterCounts(const unsigned int faces, const unsigned int tested)
+        {
+            m_faces.fetch_add(faces, std::memory_order_relaxed);
+            m_tested.fetch_add(tested, std::memory_order_relaxed);
+        }
+
+        // Binds the layered framebuffer and clears the faces of the lights rendered this frame. The
+        // caster program (cascade_shadow.vs, point_shadow.gs) gets the lights, each draw then sets its "faceMask"
+        void BeginPass(Shader& casterShader)
+        {
+            static constexpr unsigned int LIGHT_HASHES[MAX_LIGHTS] = {
+                "pointShadows[0]"_uniform, "pointShadows[1]"_uniform, "pointShadows[2]"_uniform, "pointShadows[3]"_uniform
+            };
+            if (!m_texture)
+                create();
+            m_timer.Begin();
+            g_glState.BindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+            const float farDepth = 1.f;
+            for (unsigned int l = 0 ; l < m_lights ; l++){
+                if (!m_resolutions[l])
+                    continue;
+                glClearTexSubImage(m_texture, 0, 0, 0, 6 * l, m_resolutions[l], m_resolutions[l], 6, GL_DEPTH_COMPONENT, GL_FLOAT, &farDepth);
+                // Viewport 0 belongs to GLState, lights use 1 to MAX_LIGHTS
+                glViewportIndexedf(l + 1, 0.f, 0.f, (float)m_resolutions[l], (float)m_resolutions[l]);
+            }
+            g_glState.Enable(GL_DEPTH_TEST);
+            g_glState.DepthMask(true);
+            g_glState.DepthFunc(GL_LESS);
+            casterShader.Use();
+            for (unsigned int l = 0 ; l < m_lights ; l++)
+                casterShader.Set(LIGHT_HASHES[l], glm::vec4(m_positions[l], m_ranges[l]));
+        }
+
+        // Back to the default framebuffer. Every `interval` seconds prints a [point shadows] line
+        void EndPass(const double now, const double interval = 2.0)
+        {
+            g_glState.BindFramebuffer(GL_FRAMEBUFFER, 0);
+            m_timer.End();
+            m_frames++;
+
+            if (m_reportStart < 0.0)
+                m_reportStart = now;
+            if (now - m_reportStart < interval)
+                return;
+            m_reportStart = now;
+            unsigned int tested = m_tested.exchange(0);
+            unsigned int faces = m_faces.exchange(0);
+            std::printf("[point shadows] gpu %.2f ms | resolution", m_timer.TakeAverageMs());
+            for (unsigned int l = 0 ; l < m_lights ; l++)
+                std::printf(" %d", m_resolutions[l]);
+            std::printf(" | %.2f faces per caster of %u, %.0f casters per frame\n", tested ? faces / (double)tested : 0.0,
+                6 * m_lights, tested / (double)m_frames);
+            m_frames = 0;
+        }
+
+        // Texture view and uniforms of point_shadows.glsl. A light with a resolution of 0 isn't shadowed
+        void Bind(const Shader& receiver, const unsigned int unit) const
+        {
+            static constexpr unsigned int LIGHT_HASHES[MAX_LIGHTS] = {
+                "pointShadows[0]"_uniform, "pointShadows[1]"_uniform, "pointShadows[2]"_uniform, "pointShadows[3]"_uniform
+            };
+            static constexpr unsigned int SCALE_HASHES[MAX_LIGHTS] = {
+                "pointShadowScale[0]"_uniform, "pointShadowScale[1]"_uniform, "pointShadowScale[2]"_uniform, "pointShadowScale[3]"_uniform
+            };
+            g_glState.BindTexture(unit, GL_TEXTURE_2D_ARRAY, m_view);
+            receiver.SetInt("pointShadowMap"_uniform, (int)unit);
+            for (unsigned int l = 0 ; l < m_lights ; l++){
+                receiver.Set(LIGHT_HASHES[l], glm::vec4(m_positions[l], m_resolutions[l] ? m_ranges[l] : 0.f));
+                receiver.Set(SCALE_HASHES[l], m_resolutions[l] / (float)m_size);
+            }
+        }
+
+        unsigned int Texture() const { return m_texture; }
+
+    private:
+        unsigned int m_lights;
+        int m_size, m_minSize;
+        glm::vec3 m_positions[MAX_LIGHTS] = {};
+        float m_ranges[MAX_LIGHTS] = {};
+        int m_resolutions[MAX_LIGHTS] = {};
+
+        unsigned int m_framebuffer = 0, m_texture = 0;
+        unsigned int m_view = 0; // 2D array view of the cube map array, sampled by the receivers
+        GpuTimer m_timer;
+
+        std::atomic<unsigned int> m_faces = 0;
+        std::atomic<unsigned int> m_tested = 0;
+        unsigned int m_frames = 0;
+        double m_reportStart = -1.0;
+
+        void create()
+        {
+            glCreateTextures(GL_TEXTURE_CUBE_MAP_ARRAY, 1, &m_texture);
+            glTextureStorage3D(m_texture, 1, GL_DEPTH_COMPONENT32F, m_size, m_size, 6 * m_lights);
+
+            // Views need a name that was never bound, not one from glCreateTextures
+            glGenTextures(1, &m_view);
+            glTextureView(m_view, GL_TEXTURE_2D_ARRAY, m_texture, GL_DEPTH_COMPONENT32F, 0, 1, 0, 6 * m_lights);
+            glTextureParameteri(m_view, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTextureParameteri(m_view, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTextureParameteri(m_view, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTextureParameteri(m_view, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTextureParameteri(m_view, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTextureParameteri(m_view, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+            glCreateFramebuffers(1, &m_framebuffer);
+            glNamedFramebufferTexture(m_framebuffer, GL_DEPTH_ATTACHMENT, m_texture, 0); // Layered
+            glNamedFramebufferDrawBuffer(m_framebuffer, GL_NONE);
+            glNamedFramebufferReadBuffer(m_framebuffer, GL_NONE);
+            if (glCheckNamedFramebufferStatus(m_framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cerr << "Point shadow framebuffer is not complete\n";
+        }
+};
@@ -0,0 +1,379 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "gl_state.hpp"
+#include "gl_trace.hpp"
+#include "gpu_timer.hpp"
+#include "render_graph.hpp"
+#include "shader.hpp"
+
+// Square kernel of odd size, row-major with the top row first like the 3x3 kernels of quad.fs
+struct ConvolutionKernel
+{
+    int size = 1;
+    std::vector<float> weights;
+
+    float At(const int row, const int column) const { return weights[row * size + column]; }
+};
+
+// kernel[row][column] = sum of column[row] * row[column] over the terms
+struct SeparableTerm
+{
+    std::vector<float> column, row;
+};
+
+// Rank-one terms found by power iteration then removed from the kernel, until what's left is
+// under tolerance (relative to the kernel's norm). Empty when size terms aren't enough, which
+// only happens for kernels the iteration can't resolve
+inline std::vector<SeparableTerm> DecomposeKernel(const ConvolutionKernel& kernel, const float tolerance = 1e-4f)
+{
+    const int n = kernel.size;
+    std::vector<double> residual(kernel.weights.begin(), kernel.weights.end());
+    auto norm = [&residual](){
+        double sum = 0.0;
+        for (double value : residual)
+            sum += value * value;
+        return std::sqrt(sum);
+    };
+    const double kernelNorm = norm();
+    std::vector<SeparableTerm> terms;
+    if (kernelNorm == 0.0)
+        return terms;
+
+    std::vector<double> u(n), v(n);
+    while (norm() > tolerance * kernelNorm){
+        if ((int)terms.size() == n)
+            return {};
+        // Not a constant start, it would miss kernels whose rows sum to zero
+        for (int i = 0 ; i < n ; i++)
+            v[i] = 1.0 + 0.37 * i;
+        for (int iteration = 0 ; iteration < 200 ; iteration++){
+            for (int r = 0 ; r < n ; r++){
+                u[r] = 0.0;
+                for (int c = 0 ; c < n ; c++)
+                    u[r] += residual[r * n + c] * v[c];
+            }
+            double length = 0.0;
+            for (int c = 0 ; c < n ; c++){
+                v[c] = 0.0;
+                for (int r = 0 ; r < n ; r++)
+                    v[c] += residual[r * n + c] * u[r];
+                length += v[c] * v[c];
+            }
+            length = std::sqrt(length);
+            if (length == 0.0)
+                break;
+            for (double& value : v)
+                value /= length;
+        }
+        // u = K v carries the singular value, v is unit length
+        SeparableTerm term;
+        for (int r = 0 ; r < n ; r++){
+            u[r] = 0.0;
+            for (int c = 0 ; c < n ; c++)
+                u[r] += residual[r * n + c] * v[c];
+        }
+        for (int r = 0 ; r < n ; r++){
+            term.column.push_back((float)u[r]);
+            term.row.push_back((float)v[r]);
+            for (int c = 0 ; c < n ; c++)
+                residual[r * n + c] -= u[r] * v[c];
+        }
+        terms.push_back(term);
+    }
+    return terms;
+}
+
+// Normalized, radius 3 sigma
+inline std::vector<float> GaussianWeights(const float sigma)
+{
+    int radius = std::max(1, (int)std::ceil(3.f * sigma));
+    std::vector<float> weights(2 * radius + 1);
+    float sum = 0.f;
+    for (int i = -radius ; i <= radius ; i++){
+        weights[i + radius] = std::exp(-(float)(i * i) / (2.f * sigma * sigma));
+        sum += weights[i + radius];
+    }
+    for (float& weight : weights)
+        weight /= sum;
+    return weights;
+}
+
+// Image filters as compute passes of a RenderGraph. Each Add* call picks the cheapest way :
+// - kernels whose rank r makes 2r 1D passes cheaper than the NxN one run separable, a row pass
+//   and a column pass per term, each loading a line of the image in shared memory once
+// - the others run as one pass over 16x16 shared memory tiles, or past 9x9 as one pass fetching
+//   every tap from the texture
+// - gaussians too wide for one separable pass are blurred at lower resolution, the image goes
+//   down a chain of half-size textures and is upsampled back
+// Intermediate textures are RGBA16F transients of the graph, edge detection and other kernels
+// with negative weights keep their sign between passes
+class PostProcess
+{
+    public:
+        // Match the defines of the compute shaders
+        static const int SEPARABLE_TILE = 128;
+        static const int MAX_SEPARABLE_RADIUS = 16;
+        static const int TILE_2D = 16;
+        static const int MAX_2D_RADIUS = 4;
+        static const unsigned int WEIGHTS_BINDING = 3;
+        // Radius 3 sigma must stay under MAX_SEPARABLE_RADIUS
+        static constexpr float MAX_DIRECT_SIGMA = 5.f;
+
+        // shaderDirectory holds convolve_separable.comp, convolve_2d.comp, downsample.comp and upsample.comp
+        PostProcess(const std::string& shaderDirectory)
+            : m_separable((shaderDirectory + "convolve_separable.comp").c_str()),
+              m_convolve2D((shaderDirectory + "convolve_2d.comp").c_str()),
+              m_downsample((shaderDirectory + "downsample.comp").c_str()),
+              m_upsample((shaderDirectory + "upsample.comp").c_str())
+        {
+            m_separableHorizontal = m_separable.GetUniform<int>("horizontal");
+            m_separableRadius = m_separable.GetUniform<int>("radius");
+            m_separableOffset = m_separable.GetUniform<int>("weightOffset");
+            m_separableAccumulate = m_separable.GetUniform<int>("accumulate");
+            m_convolveRadius = m_convolve2D.GetUniform<int>("radius");
+            m_convolveOffset = m_convolve2D.GetUniform<int>("weightOffset");
+            m_convolveDirect = m_convolve2D.GetUniform<int>("direct");
+        }
+
+        PostProcess(const PostProcess&) = delete;
+        PostProcess& operator=(const PostProcess&) = delete;
+
+        ~PostProcess()
+        {
+            Release();
+        }
+
+        void Release()
+        {
+            if (m_weightBuffer)
+                glDeleteBuffers(1, &m_weightBuffer);
+            m_weightBuffer = 0;
+        }
+
+        // source is sampled, destination must be RGBA16F and of the same size.
+        // The timer, if any, covers every pass of the filter
+        void AddConvolution(RenderGraph& graph, const std::string& name, const RenderResource source, const RenderResource destination,
+                            const ConvolutionKernel& kernel, GpuTimer* timer = nullptr)
+        {
+            const int radius = kernel.size / 2;
+            std::vector<SeparableTerm> terms = DecomposeKernel(kernel);
+            const int fullTaps = kernel.size * kernel.size;
+            const int separableTaps = (int)terms.size() * 2 * kernel.size;
+            bool separable = !terms.empty() && separableTaps < fullTaps && radius <= MAX_SEPARABLE_RADIUS;
+
+            if (separable){
+                std::printf("[post] %s : %dx%d kernel of rank %zu, %zu row and column pass(es), %d taps per texel instead of %d\n",
+                    name.c_str(), kernel.size, kernel.size, terms.size(), terms.size(), separableTaps, fullTaps);
+                for (unsigned int i = 0 ; i < terms.size() ; i++){
+                    // Shaders go bottom to top, the kernel is written top row first
+                    std::vector<float> column(terms[i].column.rbegin(), terms[i].column.rend());
+                    addSeparable(graph, name + " term " + std::to_string(i), source, destination, terms[i].row, column,
+                        i > 0, i == 0 ? timer : nullptr, i + 1 == terms.size() ? timer : nullptr);
+                }
+                return;
+            }
+
+            // Past the tiles' margin every tap is a texture fetch, slower but any size works
+            const bool direct = radius > MAX_2D_RADIUS;
+            std::printf("[post] %s : %dx%d kernel of rank %s, one %s pass, %d taps per texel\n",
+                name.c_str(), kernel.size, kernel.size, terms.empty() ? "full" : std::to_string(terms.size()).c_str(),
+                direct ? "direct fetch" : "tiled", fullTaps);
+            std::vector<float> weights;
+            for (int row = kernel.size - 1 ; row >= 0 ; row--){
+                for (int column = 0 ; column < kernel.size ; column++)
+                    weights.push_back(kernel.At(row, column));
+            }
+            int offset = addWeights(weights);
+            graph.AddPass(name.c_str(),
+                [=](RenderPassBuilder& pass){
+                    pass.Read(source);
+                    pass.WriteImage(destination);
+                },
+                [=, &graph](const RenderPassContext& context){
+                    if (timer)
+                        timer->Begin();
+                    const RenderTextureDesc& desc = graph.Desc(destination);
+                    m_convolve2D.Use();
+                    m_convolve2D.Set(m_convolveRadius, radius);
+                    m_convolve2D.Set(m_convolveOffset, offset);
+                    m_convolve2D.Set(m_convolveDirect, (int)direct);
+                    bindWeights();
+                    g_glState.BindTexture(0, GL_TEXTURE_2D, context.Texture(source));
+                    g_glState.BindImageTexture(0, context.Texture(destination), 0, GL_WRITE_ONLY, GL_RGBA16F);
+                    g_glState.DispatchCompute((desc.width + TILE_2D - 1) / TILE_2D, (desc.height + TILE_2D - 1) / TILE_2D);
+                    if (timer)
+                        timer->End();
+                });
+        }
+
+        // destination must be RGBA16F and of the same size as source
+        void AddGaussianBlur(RenderGraph& graph, const std::string& name, const RenderResource source, const RenderResource destination,
+                             const float sigma, GpuTimer* timer = nullptr)
+        {
+            if (sigma <= MAX_DIRECT_SIGMA){
+                std::vector<float> weights = GaussianWeights(sigma);
+                std::printf("[post] %s : gaussian sigma %.1f, row and column pass, %zu taps per texel\n", name.c_str(), sigma, 2 * weights.size());
+                addSeparable(graph, name, source, destination, weights, weights, false, timer, timer);
+                return;
+            }
+
+            // Each level halves the resolution and the blur radius in texels
+            int levels = (int)std::ceil(std::log2(sigma / MAX_DIRECT_SIGMA));
+            float levelSigma = sigma / (float)(1 << levels);
+            std::vector<float> weights = GaussianWeights(levelSigma);
+            std::printf("[post] %s : gaussian sigma %.1f, %d downsamples then sigma %.2f at 1/%d resolution\n",
+                name.c_str(), sigma, levels, levelSigma, 1 << levels);
+
+            std::vector<RenderResource> chain(levels + 1);
+            chain[0] = source;
+            for (int level = 1 ; level <= levels ; level++){
+                chain[level] = transient(graph, name + " down " + std::to_string(level), destination, 1 << level);
+                addResample(graph, name + " downsample " + std::to_string(level), chain[level - 1], chain[level], true,
+                    level == 1 ? timer : nullptr);
+            }
+            RenderResource blurred = transient(graph, name + " blurred", destination, 1 << levels);
+            addSeparable(graph, name + " blur", chain[levels], blurred, weights, weights, false, nullptr, nullptr);
+            RenderResource current = blurred;
+            for (int level = levels - 1 ; level >= 0 ; level--){
+                RenderResource target = level == 0 ? destination : transient(graph, name + " up " + std::to_string(level), destination, 1 << level);
+                addResample(graph, name + " upsample " + std::to_string(level), current, target, false, level == 0 ? timer : nullptr);
+                current = target;
+            }
+        }
+
+        // Textures created by the module follow the new size of the graph
+        void Resize(RenderGraph& graph, const int width, const int height)
+        {
+            for (const Scaled& scaled : m_scaled)
+                graph.Resize(scaled.resource, std::max(1, (width + scaled.divisor - 1) / scaled.divisor), std::max(1, (height + scaled.divisor - 1) / scaled.divisor));
+        }
+
+    private:
+        struct Scaled
+        {
+            RenderResource resource;
+            int divisor;
+        };
+
+        Shader m_separable, m_convolve2D, m_downsample, m_upsample;
+        Uniform<int> m_separableHorizontal, m_separableRadius, m_separableOffset, m_separableAccumulate;
+        Uniform<int> m_convolveRadius, m_convolveOffset, m_convolveDirect;
+        std::vector<float> m_weights; // Every kernel, uploaded once in the weight buffer
+        unsigned int m_weightBuffer = 0;
+        bool m_weightsDirty = false;
+        std::vector<Scaled> m_scaled;
+
+        RenderResource transient(RenderGraph& graph, const std::string& name, const RenderResource like, const int divisor)
+        {
+            RenderTextureDesc desc = graph.Desc(like);
+            desc.width = std::max(1, (desc.width + divisor - 1) / divisor);
+            desc.height = std::max(1, (desc.height + divisor - 1) / divisor);
+            desc.format = GL_RGBA16F;
+            RenderResource resource = graph.CreateTexture(name.c_str(), desc);
+            m_scaled.push_back(Scaled{resource, divisor});
+            return resource;
+        }
+
+        int addWeights(const std::vector<float>& weights)
+        {
+            int offset = (int)m_weights.size();
+            m_weights.insert(m_weights.end(), weights.begin(), weights.end());
+            m_weightsDirty = true;
+            return offset;
+        }
+
+        // Kernels are only added while the graph is built, the buffer is uploaded by the first pass after
+        void bindWeights()
+        {
+            unsigned int size = (unsigned int)(m_weights.size() * sizeof(float));
+            if (m_weightsDirty){
+                if (!m_weightBuffer)
+                    glCreateBuffers(1, &m_weightBuffer);
+                glNamedBufferData(m_weightBuffer, size, m_weights.data(), GL_STATIC_DRAW);
+                m_weightsDirty = false;
+            }
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, WEIGHTS_BINDING, m_weightBuffer, 0, size);
+            if (g_glTrace.Recording())
+                g_glTrace.BindBufferRange(GL_SHADER_STORAGE_BUFFER, WEIGHTS_BINDING, m_weightBuffer, 0, size);
+        }
+
+        // A row pass into an intermediate texture, then a column pass into destination,
+        // added to its content when accumulate is set
+        void addSeparable(RenderGraph& graph, const std::string& name, const RenderResource source, const RenderResource destination,
+                          const std::vector<float>& row, const std::vector<float>& column, const bool accumulate,
+                          GpuTimer* beginTimer, GpuTimer* endTimer)
+        {
+            const int radius = (int)row.size() / 2;
+            const int rowOffset = addWeights(row);
+            const int columnOffset = addWeights(column);
+            RenderResource rows = transient(graph, name + " rows", destination, 1);
+
+            auto dispatch = [this, radius](const int offset, const bool horizontal, const bool add,
+                                          const unsigned int sourceTexture, const unsigned int destinationTexture, const RenderTextureDesc& desc){
+                m_separable.Use();
+                m_separable.Set(m_separableHorizontal, (int)horizontal);
+                m_separable.Set(m_separableRadius, radius);
+                m_separable.Set(m_separableOffset, offset);
+                m_separable.Set(m_separableAccumulate, (int)add);
+                bindWeights();
+                g_glState.BindTexture(0, GL_TEXTURE_2D, sourceTexture);
+                g_glState.BindImageTexture(0, destinationTexture, 0, add ? GL_READ_WRITE : GL_WRITE_ONLY, GL_RGBA16F);
+                int extent = horizontal ? desc.width : desc.height;
+                int lines = horizontal ? desc.height : desc.width;
+                g_glState.DispatchCompute((extent + SEPARABLE_TILE - 1) / SEPARABLE_TILE, lines);
+            };
+
+            graph.AddPass((name + " rows").c_str(),
+                [=](RenderPassBuilder& pass){
+                    pass.Read(source);
+                    pass.WriteImage(rows);
+                },
+                [=, &graph](const RenderPassContext& context){
+                    if (beginTimer)
+                        beginTimer->Begin();
+                    dispatch(rowOffset, true, false, context.Texture(source), context.Texture(rows), graph.Desc(rows));
+                });
+            graph.AddPass((name + " columns").c_str(),
+                [=](RenderPassBuilder& pass){
+                    pass.Read(rows);
+                    if (accumulate)
+                        pass.ReadImage(destination);
+                    pass.WriteImage(destination);
+                },
+                [=, &graph](const RenderPassContext& context){
+                    dispatch(columnOffset, false, accumulate, context.Texture(rows), context.Texture(destination), graph.Desc(destination));
+                    if (endTimer)
+                        endTimer->End();
+                });
+        }
+
+        void addResample(RenderGraph& graph, const std::string& name, const RenderResource source, const RenderResource destination,
+                         const bool down, GpuTimer* timer)
+        {
+            const bool first = down;
+            graph.AddPass(name.c_str(),
+                [=](RenderPassBuilder& pass){
+                    pass.Read(source);
+                    pass.WriteImage(destination);
+                },
+                [=, &graph](const RenderPassContext& context){
+                    if (timer && first)
+                        timer->Begin();
+                    Shader& shader = down ? m_downsample : m_upsample;
+                    const RenderTextureDesc& desc = graph.Desc(destination);
+                    shader.Use();
+                    g_glState.BindTexture(0, GL_TEXTURE_2D, context.Texture(source));
+                    g_glState.BindImageTexture(0, context.Texture(destination), 0, GL_WRITE_ONLY, GL_RGBA16F);
+                    g_glState.DispatchCompute((desc.width + 7) / 8, (desc.height + 7) / 8);
+                    if (timer && !first)
+                        timer->End();
+                });
+        }
+};
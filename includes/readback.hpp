@@ -0,0 +1,301 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gl_state.hpp"
+
+// RGBA8 pixels, bottom row first like GL returns them. Only valid during the callback
+struct ReadbackImage
+{
+    int width, height;
+    const unsigned char* pixels;
+    unsigned int frame; // Frame of the request, counted by AsyncReadback::EndFrame
+};
+
+// Copies of a framebuffer or a texture into a ring of pixel pack buffers. The copy is queued
+// behind the frame's commands with a fence, and Poll maps it once the fence passed, usually
+// two or three frames later, so nothing waits on the GPU. When every slot is still in flight
+// a request is dropped rather than stalling, Dropped() counts them
+class AsyncReadback
+{
+    public:
+        using Callback = std::function<void(const ReadbackImage&)>;
+
+        AsyncReadback(const unsigned int slots = 3) : m_slots(slots) {}
+
+        ~AsyncReadback()
+        {
+            Release();
+        }
+
+        // Pending copies are dropped, must run while the context is alive
+        void Release()
+        {
+            for (Slot& slot : m_slots){
+                if (slot.fence)
+                    glDeleteSync(slot.fence);
+                if (slot.buffer)
+                    glDeleteBuffers(1, &slot.buffer);
+                slot = Slot();
+            }
+        }
+
+        // framebuffer 0 reads the back buffer, others their color attachment 0
+        bool RequestFramebuffer(const unsigned int framebuffer, const int width, const int height, const Callback& callback)
+        {
+            Slot* slot = acquire(width, height, callback);
+            if (!slot)
+                return false;
+            g_glState.BindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+            glNamedFramebufferReadBuffer(framebuffer, framebuffer == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+            queue(*slot);
+            return true;
+        }
+
+        // Level 0 of a 2D texture, a render target of the graph for instance
+        bool RequestTexture(const unsigned int texture, const int width, const int height, const Callback& callback)
+        {
+            Slot* slot = acquire(width, height, callback);
+            if (!slot)
+                return false;
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glGetTextureImage(texture, 0, GL_RGBA, GL_UNSIGNED_BYTE, width * height * 4, 0);
+            queue(*slot);
+            return true;
+        }
+
+        // Delivers every finished copy, oldest first. With wait, blocks until all are done (shutdown)
+        void Poll(const bool wait = false)
+        {
+            for (;;){
+                Slot* oldest = nullptr;
+                for (Slot& slot : m_slots){
+                    if (slot.fence && (!oldest || slot.sequence < oldest->sequence))
+                        oldest = &slot;
+                }
+                if (!oldest)
+                    return;
+                GLenum status = glClientWaitSync(oldest->fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0);
+                if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                    return;
+                glDeleteSync(oldest->fence);
+                oldest->fence = 0;
+
+                const unsigned char* pixels = (const unsigned char*)glMapNamedBufferRange(oldest->buffer, 0, oldest->width * oldest->height * 4, GL_MAP_READ_BIT);
+                if (pixels){
+                    oldest->callback(ReadbackImage{oldest->width, oldest->height, pixels, oldest->frame});
+                    glUnmapNamedBuffer(oldest->buffer);
+                }
+                oldest->callback = nullptr;
+                m_delivered++;
+            }
+        }
+
+        void EndFrame() { m_frame++; }
+
+        unsigned int Delivered() const { return m_delivered; }
+        unsigned int Dropped() const { return m_dropped; }
+
+    private:
+        struct Slot
+        {
+            unsigned int buffer = 0;
+            unsigned int capacity = 0; // Bytes of the buffer's storage
+            GLsync fence = 0;          // Set while the copy is in flight
+            int width = 0, height = 0;
+            unsigned int frame = 0;
+            unsigned long long sequence = 0;
+            Callback callback;
+        };
+
+        std::vector<Slot> m_slots;
+        unsigned long long m_sequence = 0;
+        unsigned int m_frame = 0;
+        unsigned int m_delivered = 0, m_dropped = 0;
+
+        // A free slot whose buffer holds the image, bound as the pack buffer
+        Slot* acquire(const int width, const int height, const Callback& callback)
+        {
+            Slot* slot = nullptr;
+            for (Slot& candidate : m_slots){
+                if (!candidate.fence){
+                    slot = &candidate;
+                    break;
+                }
+            }
+            if (!slot){
+                m_dropped++;
+                return nullptr;
+            }
+
+            unsigned int size = (unsigned int)(width * height * 4);
+            if (slot->capacity < size){ // Only grows, a resize back to a smaller window keeps it
+                if (slot->buffer)
+                    glDeleteBuffers(1, &slot->buffer);
+                glCreateBuffers(1, &slot->buffer);
+                glNamedBufferStorage(slot->buffer, size, NULL, GL_MAP_READ_BIT | GL_CLIENT_STORAGE_BIT);
+                slot->capacity = size;
+            }
+            slot->width = width;
+            slot->height = height;
+            slot->frame = m_frame;
+            slot->sequence = m_sequence++;
+            slot->callback = callback;
+            g_glState.BindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+            return slot;
+        }
+
+        void queue(Slot& slot)
+        {
+            slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            // Later uploads must not read from this buffer
+            g_glState.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+};
+
+// Binary PPM, rows flipped to the top-down order of image files
+inline bool WritePpm(const std::string& path, const int width, const int height, const unsigned char* rgba)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file){
+        std::fprintf(stderr, "Can't write %s\n", path.c_str());
+        return false;
+    }
+    file << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<unsigned char> row(width * 3);
+    for (int y = height - 1 ; y >= 0 ; y--){
+        const unsigned char* source = rgba + (size_t)y * width * 4;
+        for (int x = 0 ; x < width ; x++){
+            row[x * 3 + 0] = source[x * 4 + 0];
+            row[x * 3 + 1] = source[x * 4 + 1];
+            row[x * 3 + 2] = source[x * 4 + 2];
+        }
+        file.write((const char*)row.data(), row.size());
+    }
+    return true;
+}
+
+// Reads what WritePpm writes, back to RGBA bottom row first
+inline bool ReadPpm(const std::string& path, int& width, int& height, std::vector<unsigned char>& rgba)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    int maxValue;
+    if (!(file >> magic >> width >> height >> maxValue) || magic != "P6" || maxValue != 255)
+        return false;
+    file.get(); // Single whitespace before the pixels
+    std::vector<unsigned char> rgb((size_t)width * height * 3);
+    if (!file.read((char*)rgb.data(), rgb.size()))
+        return false;
+    rgba.resize((size_t)width * height * 4);
+    for (int y = 0 ; y < height ; y++){
+        const unsigned char* source = &rgb[(size_t)(height - 1 - y) * width * 3];
+        for (int x = 0 ; x < width ; x++){
+            unsigned char* destination = &rgba[((size_t)y * width + x) * 4];
+            destination[0] = source[x * 3 + 0];
+            destination[1] = source[x * 3 + 1];
+            destination[2] = source[x * 3 + 2];
+            destination[3] = 255;
+        }
+    }
+    return true;
+}
+
+struct ImageDifference
+{
+    int maxDifference = 0;        // Largest channel difference, 0 to 255
+    double rmse = 0.0;            // Over every RGB channel
+    unsigned int pixelsAbove = 0; // Pixels with a channel off by more than the threshold
+};
+
+// Alpha is ignored, PPM references don't have it
+inline ImageDifference CompareImages(const int width, const int height, const unsigned char* a, const unsigned char* b, const int threshold = 8)
+{
+    ImageDifference result;
+    double sum = 0.0;
+    for (size_t pixel = 0 ; pixel < (size_t)width * height ; pixel++){
+        int worst = 0;
+        for (int channel = 0 ; channel < 3 ; channel++){
+            int difference = std::abs((int)a[pixel * 4 + channel] - (int)b[pixel * 4 + channel]);
+            worst = std::max(worst, difference);
+            sum += difference * difference;
+        }
+        result.maxDifference = std::max(result.maxDifference, worst);
+        result.pixelsAbove += worst > threshold;
+    }
+    result.rmse = std::sqrt(sum / std::max<size_t>(1, (size_t)width * height * 3));
+    return result;
+}
+
+// Writes images on its own thread, so dumping a sequence doesn't add disk time to the frames.
+// Pixels are copied when queued, the callback's image can be handed over directly
+class ImageWriter
+{
+    public:
+        ImageWriter() : m_thread(&ImageWriter::workerLoop, this) {}
+
+        ~ImageWriter()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_queued.notify_one();
+            m_thread.join();
+        }
+
+        void Write(const std::string& path, const ReadbackImage& image)
+        {
+            Job job{path, image.width, image.height, std::vector<unsigned char>(image.pixels, image.pixels + (size_t)image.width * image.height * 4)};
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_jobs.push_back(std::move(job));
+            }
+            m_queued.notify_one();
+        }
+
+    private:
+        struct Job
+        {
+            std::string path;
+            int width, height;
+            std::vector<unsigned char> pixels;
+        };
+
+        std::mutex m_mutex;
+        std::condition_variable m_queued;
+        std::deque<Job> m_jobs;
+        bool m_stop = false;
+        std::thread m_thread; // Last, started once the rest is constructed
+
+        // Queued images are all written before the destructor returns
+        void workerLoop()
+        {
+            for (;;){
+                Job job;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_queued.wait(lock, [this]{ return m_stop || !m_jobs.empty(); });
+                    if (m_jobs.empty())
+                        return;
+                    job = std::move(m_jobs.front());
+                    m_jobs.pop_front();
+                }
+                WritePpm(job.path, job.width, job.height, job.pixels.data());
+            }
+        }
+};
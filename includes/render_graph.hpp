@@ -0,0 +1,605 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "gl_state.hpp"
+#include "render_target_pool.hpp"
+
+struct RenderResource
+{
+    int index = -1;
+    bool Valid() const { return index >= 0; }
+};
+
+// What an attachment holds when its pass starts
+enum class LoadOp
+{
+    Load,     // Previous content kept
+    Clear,    // Cleared to the given value
+    DontCare  // Invalidated, the pass overwrites every pixel
+};
+
+class RenderGraph;
+
+// Passed to the setup callback of AddPass, declares what the pass reads and writes
+class RenderPassBuilder
+{
+    public:
+        void Read(const RenderResource resource) { add(resource, Usage::Sample); }
+        void ReadImage(const RenderResource resource) { add(resource, Usage::ImageRead); }
+        void WriteImage(const RenderResource resource) { add(resource, Usage::ImageWrite); }
+
+        void WriteColor(const RenderResource resource, const LoadOp load = LoadOp::Load, const glm::vec4& clear = glm::vec4(0.f))
+        {
+            Access& access = add(resource, Usage::Color);
+            access.load = load;
+            access.clearColor = clear;
+        }
+
+        void WriteDepth(const RenderResource resource, const LoadOp load = LoadOp::Load, const float clearDepth = 1.f, const int clearStencil = 0)
+        {
+            Access& access = add(resource, Usage::Depth);
+            access.load = load;
+            access.clearDepth = clearDepth;
+            access.clearStencil = clearStencil;
+        }
+
+        // The pass does something outside the graph (readback, timer...), it's never culled
+        void SideEffect() { m_sideEffect = true; }
+
+    private:
+        friend class RenderGraph;
+
+        enum class Usage { Sample, ImageRead, ImageWrite, Color, Depth };
+
+        struct Access
+        {
+            int resource;
+            Usage usage;
+            LoadOp load = LoadOp::Load;
+            glm::vec4 clearColor = glm::vec4(0.f);
+            float clearDepth = 1.f;
+            int clearStencil = 0;
+        };
+
+        std::vector<Access> m_accesses;
+        bool m_sideEffect = false;
+
+        Access& add(const RenderResource resource, const Usage usage)
+        {
+            m_accesses.push_back(Access{resource.index, usage});
+            return m_accesses.back();
+        }
+};
+
+// Given to the execute callback, with the framebuffer already bound and cleared
+class RenderPassContext
+{
+    public:
+        unsigned int Texture(const RenderResource resource) const;
+        unsigned int Framebuffer() const { return m_framebuffer; }
+        int Width() const { return m_width; }
+        int Height() const { return m_height; }
+
+    private:
+        friend class RenderGraph;
+        const RenderGraph* m_graph = nullptr;
+        unsigned int m_framebuffer = 0;
+        int m_width = 0, m_height = 0;
+};
+
+// Passes declare the textures they read and write, Compile derives everything else :
+// - passes nothing visible depends on are culled, the others are ordered by their dependencies
+// - transient textures get a GL texture, shared by resources whose lifetimes don't overlap
+//   (GL can't alias memory between formats, only textures with the same description are shared)
+// - attachments are cleared or invalidated when their pass starts, and invalidated after their
+//   last use, glMemoryBarrier goes between an image store and the next use of the texture
+// Compile runs again when passes or sizes change, Execute only replays the compiled frame
+class RenderGraph
+{
+    public:
+        using SetupFunction = std::function<void(RenderPassBuilder&)>;
+        using ExecuteFunction = std::function<void(const RenderPassContext&)>;
+
+        RenderGraph() = default;
+
+        // Transient textures come from a pool shared with other graphs or kept across rebuilds
+        explicit RenderGraph(RenderTargetPool& pool) : m_pool(&pool) {}
+
+        RenderGraph(const RenderGraph&) = delete;
+        RenderGraph& operator=(const RenderGraph&) = delete;
+
+        ~RenderGraph()
+        {
+            Release();
+        }
+
+        // Frees the framebuffers and gives the textures back to the pool, must run while the context is alive.
+        // The graph's own pool deletes them, a shared one keeps them for its next Acquire
+        void Release()
+        {
+            releaseTargets();
+            if (m_pool == &m_ownPool)
+                m_ownPool.Release();
+        }
+
+        // Texture owned by the graph, only valid during the frame
+        RenderResource CreateTexture(const char* name, const RenderTextureDesc& desc)
+        {
+            m_resources.push_back(Resource{name, desc, false, 0});
+            return RenderResource{(int)m_resources.size() - 1};
+        }
+
+        // Texture owned by the caller, its content is kept and passes writing it are never culled
+        RenderResource ImportTexture(const char* name, const unsigned int texture, const RenderTextureDesc& desc)
+        {
+            m_resources.push_back(Resource{name, desc, true, texture});
+            return RenderResource{(int)m_resources.size() - 1};
+        }
+
+        // The default framebuffer, a pass writing it can't write anything else
+        RenderResource ImportBackbuffer(const int width, const int height)
+        {
+            RenderTextureDesc desc;
+            desc.width = width;
+            desc.height = height;
+            m_resources.push_back(Resource{"backbuffer", desc, true, 0});
+            m_resources.back().backbuffer = true;
+            return RenderResource{(int)m_resources.size() - 1};
+        }
+
+        void AddPass(const char* name, const SetupFunction& setup, const ExecuteFunction& execute)
+        {
+            Pass pass;
+            pass.name = name;
+            pass.execute = execute;
+            RenderPassBuilder builder;
+            setup(builder);
+            pass.accesses = std::move(builder.m_accesses);
+            pass.sideEffect = builder.m_sideEffect;
+            m_passes.push_back(std::move(pass));
+            m_compiled = false;
+        }
+
+        // New size of a texture or of the backbuffer, the graph is compiled again before the next Execute
+        void Resize(const RenderResource resource, const int width, const int height)
+        {
+            RenderTextureDesc& desc = m_resources[resource.index].desc;
+            if (desc.width == width && desc.height == height)
+                return;
+            desc.width = width;
+            desc.height = height;
+            m_compiled = false;
+        }
+
+        // Drops every pass and resource with their GL objects
+        void Clear()
+        {
+            Release();
+            m_passes.clear();
+            m_resources.clear();
+            m_order.clear();
+            m_compiled = false;
+        }
+
+        bool Compile()
+        {
+            releaseTargets();
+            buildDependencies();
+            cull();
+            if (!sortPasses())
+                return false;
+            allocate();
+            buildFramebuffers();
+            m_compiled = true;
+            return true;
+        }
+
+        void Execute()
+        {
+            if (!m_compiled && !Compile())
+                return;
+            for (int index : m_order){
+                Pass& pass = m_passes[index];
+                if (pass.barriersBefore)
+                    g_glState.MemoryBarrier(pass.barriersBefore);
+
+                RenderPassContext context;
+                context.m_graph = this;
+                context.m_framebuffer = pass.framebuffer;
+                context.m_width = pass.width;
+                context.m_height = pass.height;
+                if (pass.hasAttachments){
+                    g_glState.BindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+                    g_glState.Viewport(0, 0, pass.width, pass.height);
+                    beginAttachments(pass);
+                }
+
+                pass.execute(context);
+
+                if (!pass.invalidateAfter.empty()){
+                    g_glState.BindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+                    g_glState.InvalidateFramebuffer(GL_FRAMEBUFFER, (int)pass.invalidateAfter.size(), pass.invalidateAfter.data());
+                }
+            }
+        }
+
+        const RenderTextureDesc& Desc(const RenderResource resource) const
+        {
+            return m_resources[resource.index].desc;
+        }
+
+        unsigned int Texture(const RenderResource resource) const
+        {
+            return resource.Valid() ? m_resources[resource.index].texture : 0;
+        }
+
+        // Memory of the transient textures, with the aliasing and as if each resource had its own
+        unsigned long long PeakMemory() const { return m_peakBytes; }
+        unsigned long long UnaliasedMemory() const { return m_unaliasedBytes; }
+
+        void PrintReport() const
+        {
+            unsigned int transients = 0;
+            for (const Resource& resource : m_resources)
+                transients += !resource.imported && resource.first >= 0;
+            std::printf("[render graph] %zu passes executed, %zu culled | %u transient textures in %zu | peak render-target memory %.2f MiB (%.2f MiB without aliasing)\n",
+                m_order.size(), m_passes.size() - m_order.size(), transients, m_physical.size(),
+                m_peakBytes / 1048576.0, m_unaliasedBytes / 1048576.0);
+            for (int index : m_order){
+                const Pass& pass = m_passes[index];
+                std::printf("[render graph]   %s", pass.name.c_str());
+                if (pass.barriersBefore)
+                    std::printf(" (barrier 0x%x before)", pass.barriersBefore);
+                if (!pass.invalidateAfter.empty())
+                    std::printf(" (invalidates %zu attachment(s) after)", pass.invalidateAfter.size());
+                std::printf("\n");
+            }
+            for (const Pass& pass : m_passes){
+                if (pass.culled)
+                    std::printf("[render graph]   %s culled, nothing reads its output\n", pass.name.c_str());
+            }
+        }
+
+    private:
+        using Access = RenderPassBuilder::Access;
+        using Usage = RenderPassBuilder::Usage;
+
+        struct Resource
+        {
+            std::string name;
+            RenderTextureDesc desc;
+            bool imported;
+            unsigned int texture; // GL texture, set by allocate for transient ones
+            bool backbuffer = false;
+            int first = -1, last = -1; // Position in m_order of the first and last pass using it
+        };
+
+        struct Pass
+        {
+            std::string name;
+            ExecuteFunction execute;
+            std::vector<Access> accesses;
+            bool sideEffect = false;
+            bool culled = false;
+            std::vector<int> dependencies; // Passes that must run before
+            unsigned int framebuffer = 0;
+            bool hasAttachments = false;
+            int width = 0, height = 0;
+            GLbitfield barriersBefore = 0;
+            std::vector<GLenum> invalidateAfter;
+        };
+
+        struct Physical
+        {
+            RenderTextureDesc desc;
+            unsigned int texture;
+            int freeAfter; // Position in m_order after which another resource can take it
+        };
+
+        std::vector<Resource> m_resources;
+        std::vector<Pass> m_passes;
+        std::vector<int> m_order;
+        std::vector<Physical> m_physical;
+        RenderTargetPool m_ownPool;
+        RenderTargetPool* m_pool = &m_ownPool;
+        bool m_compiled = false;
+        unsigned long long m_peakBytes = 0, m_unaliasedBytes = 0;
+
+        static bool writes(const Usage usage)
+        {
+            return usage == Usage::ImageWrite || usage == Usage::Color || usage == Usage::Depth;
+        }
+
+        // A resource with a single writer is read after it wherever the passes were declared,
+        // with several writers declaration order decides
+        void buildDependencies()
+        {
+            std::vector<std::vector<int>> writers(m_resources.size());
+            for (int p = 0 ; p < (int)m_passes.size() ; p++){
+                m_passes[p].dependencies.clear();
+                m_passes[p].culled = false;
+                for (const Access& access : m_passes[p].accesses){
+                    if (writes(access.usage) && (writers[access.resource].empty() || writers[access.resource].back() != p))
+                        writers[access.resource].push_back(p);
+                }
+            }
+
+            for (int p = 0 ; p < (int)m_passes.size() ; p++){
+                Pass& pass = m_passes[p];
+                for (const Access& access : pass.accesses){
+                    const std::vector<int>& resourceWriters = writers[access.resource];
+                    if (resourceWriters.size() == 1){
+                        if (resourceWriters[0] != p)
+                            pass.dependencies.push_back(resourceWriters[0]);
+                        continue;
+                    }
+                    // Several writers, every earlier pass touching the resource comes first
+                    for (int q = 0 ; q < p ; q++){
+                        for (const Access& other : m_passes[q].accesses){
+                            if (other.resource == access.resource && (writes(access.usage) || writes(other.usage))){
+                                pass.dependencies.push_back(q);
+                                break;
+                            }
+                        }
+                    }
+                }
+                std::sort(pass.dependencies.begin(), pass.dependencies.end());
+                pass.dependencies.erase(std::unique(pass.dependencies.begin(), pass.dependencies.end()), pass.dependencies.end());
+            }
+        }
+
+        // Passes are kept when they write an imported resource or have side effects,
+        // then everything they depend on
+        void cull()
+        {
+            std::vector<int> stack;
+            std::vector<bool> live(m_passes.size(), false);
+            for (int p = 0 ; p < (int)m_passes.size() ; p++){
+                bool root = m_passes[p].sideEffect;
+                for (const Access& access : m_passes[p].accesses)
+                    root = root || (writes(access.usage) && m_resources[access.resource].imported);
+                if (root){
+                    live[p] = true;
+                    stack.push_back(p);
+                }
+            }
+            while (!stack.empty()){
+                int p = stack.back();
+                stack.pop_back();
+                for (int dependency : m_passes[p].dependencies){
+                    if (!live[dependency]){
+                        live[dependency] = true;
+                        stack.push_back(dependency);
+                    }
+                }
+            }
+            for (int p = 0 ; p < (int)m_passes.size() ; p++)
+                m_passes[p].culled = !live[p];
+        }
+
+        // Topological order, ties broken by declaration order
+        bool sortPasses()
+        {
+            m_order.clear();
+            std::vector<bool> done(m_passes.size(), false);
+            size_t live = 0;
+            for (const Pass& pass : m_passes)
+                live += !pass.culled;
+            while (m_order.size() < live){
+                int next = -1;
+                for (int p = 0 ; p < (int)m_passes.size() && next < 0 ; p++){
+                    if (done[p] || m_passes[p].culled)
+                        continue;
+                    bool ready = true;
+                    for (int dependency : m_passes[p].dependencies)
+                        ready = ready && (done[dependency] || m_passes[dependency].culled);
+                    if (ready)
+                        next = p;
+                }
+                if (next < 0){
+                    std::cerr << "Render graph : dependency cycle between passes\n";
+                    return false;
+                }
+                done[next] = true;
+                m_order.push_back(next);
+            }
+            return true;
+        }
+
+        // Lifetimes in execution order, then a greedy assignment of transient resources to
+        // textures with the same description that are free by then
+        void allocate()
+        {
+            for (Resource& resource : m_resources){
+                resource.first = resource.last = -1;
+                if (!resource.imported)
+                    resource.texture = 0;
+            }
+            for (int i = 0 ; i < (int)m_order.size() ; i++){
+                for (const Access& access : m_passes[m_order[i]].accesses){
+                    Resource& resource = m_resources[access.resource];
+                    if (resource.first < 0)
+                        resource.first = i;
+                    resource.last = i;
+                    if (resource.first == i && !resource.imported && !writes(access.usage))
+                        std::cerr << "Render graph : " << m_passes[m_order[i]].name << " reads " << resource.name << " before any pass writes it\n";
+                }
+            }
+
+            std::vector<int> transients;
+            for (int r = 0 ; r < (int)m_resources.size() ; r++){
+                if (!m_resources[r].imported && m_resources[r].first >= 0)
+                    transients.push_back(r);
+            }
+            std::sort(transients.begin(), transients.end(), [this](int a, int b){ return m_resources[a].first < m_resources[b].first; });
+
+            m_unaliasedBytes = 0;
+            for (int r : transients){
+                Resource& resource = m_resources[r];
+                m_unaliasedBytes += RenderTextureBytes(resource.desc);
+                Physical* chosen = nullptr;
+                for (Physical& physical : m_physical){
+                    if (physical.desc == resource.desc && physical.freeAfter < resource.first){
+                        chosen = &physical;
+                        break;
+                    }
+                }
+                if (!chosen){
+                    m_physical.push_back(Physical{resource.desc, m_pool->Acquire(resource.desc), -1});
+                    chosen = &m_physical.back();
+                }
+                chosen->freeAfter = resource.last;
+                resource.texture = chosen->texture;
+            }
+
+            m_peakBytes = 0;
+            for (const Physical& physical : m_physical)
+                m_peakBytes += RenderTextureBytes(physical.desc);
+        }
+
+        void releaseTargets()
+        {
+            for (Pass& pass : m_passes){
+                if (pass.framebuffer)
+                    glDeleteFramebuffers(1, &pass.framebuffer);
+                pass.framebuffer = 0;
+            }
+            for (const Physical& physical : m_physical)
+                m_pool->Release(physical.texture);
+            m_physical.clear();
+            m_compiled = false;
+        }
+
+        static GLenum attachmentPoint(const Access& access, const Resource& resource, const int colorIndex)
+        {
+            if (access.usage == Usage::Depth)
+                return HasStencil(resource.desc.format) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+            return GL_COLOR_ATTACHMENT0 + colorIndex;
+        }
+
+        void buildFramebuffers()
+        {
+            for (int i = 0 ; i < (int)m_order.size() ; i++){
+                Pass& pass = m_passes[m_order[i]];
+                pass.framebuffer = 0;
+                pass.hasAttachments = false;
+                pass.barriersBefore = 0;
+                pass.invalidateAfter.clear();
+
+                std::vector<GLenum> drawBuffers;
+                bool backbuffer = false;
+                for (const Access& access : pass.accesses){
+                    const Resource& resource = m_resources[access.resource];
+                    barrierFor(pass, access, i);
+                    if (access.usage != Usage::Color && access.usage != Usage::Depth)
+                        continue;
+                    pass.hasAttachments = true;
+                    pass.width = resource.desc.width;
+                    pass.height = resource.desc.height;
+                    if (resource.backbuffer){
+                        backbuffer = true;
+                        continue;
+                    }
+                    if (pass.framebuffer == 0)
+                        glCreateFramebuffers(1, &pass.framebuffer);
+                    GLenum point = attachmentPoint(access, resource, (int)drawBuffers.size());
+                    glNamedFramebufferTexture(pass.framebuffer, point, resource.texture, 0);
+                    if (access.usage == Usage::Color)
+                        drawBuffers.push_back(point);
+                    // Content nobody reads afterwards doesn't need to reach memory
+                    if (!resource.imported && resource.last == i)
+                        pass.invalidateAfter.push_back(point);
+                }
+                if (backbuffer && pass.framebuffer){
+                    std::cerr << "Render graph : " << pass.name << " can't write the backbuffer and textures together\n";
+                    glDeleteFramebuffers(1, &pass.framebuffer);
+                    pass.framebuffer = 0;
+                    pass.invalidateAfter.clear();
+                }
+                if (pass.framebuffer){
+                    glNamedFramebufferDrawBuffers(pass.framebuffer, (int)drawBuffers.size(), drawBuffers.data());
+                    if (drawBuffers.empty())
+                        glNamedFramebufferReadBuffer(pass.framebuffer, GL_NONE);
+                    if (glCheckNamedFramebufferStatus(pass.framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                        std::cerr << "Render graph : framebuffer of " << pass.name << " is incomplete\n";
+                }
+            }
+        }
+
+        // Image stores aren't ordered with later reads without a barrier, framebuffer writes are
+        void barrierFor(Pass& pass, const Access& access, const int position)
+        {
+            for (int i = position - 1 ; i >= 0 ; i--){
+                const Pass& previous = m_passes[m_order[i]];
+                bool touched = false, stored = false;
+                for (const Access& other : previous.accesses){
+                    if (other.resource != access.resource)
+                        continue;
+                    touched = true;
+                    stored = stored || other.usage == Usage::ImageWrite;
+                }
+                if (!touched)
+                    continue;
+                if (stored){
+                    switch (access.usage){
+                        case Usage::Sample: pass.barriersBefore |= GL_TEXTURE_FETCH_BARRIER_BIT; break;
+                        case Usage::ImageRead: case Usage::ImageWrite: pass.barriersBefore |= GL_SHADER_IMAGE_ACCESS_BARRIER_BIT; break;
+                        default: pass.barriersBefore |= GL_FRAMEBUFFER_BARRIER_BIT; break;
+                    }
+                }
+                return;
+            }
+        }
+
+        void beginAttachments(const Pass& pass)
+        {
+            std::vector<GLenum>& invalidate = m_scratchAttachments;
+            invalidate.clear();
+            int colorIndex = 0;
+            for (const Access& access : pass.accesses){
+                if (access.usage != Usage::Color && access.usage != Usage::Depth)
+                    continue;
+                const Resource& resource = m_resources[access.resource];
+                bool color = access.usage == Usage::Color;
+                if (access.load == LoadOp::Clear){
+                    if (color){
+                        g_glState.ClearBufferfv(GL_COLOR, pass.framebuffer ? colorIndex : 0, &access.clearColor[0]);
+                    }
+                    else {
+                        g_glState.DepthMask(true); // Clears respect the write masks
+                        if (HasStencil(resource.desc.format) || resource.backbuffer){
+                            g_glState.StencilMask(0xFF);
+                            g_glState.ClearBufferfi(GL_DEPTH_STENCIL, 0, access.clearDepth, access.clearStencil);
+                        }
+                        else {
+                            g_glState.ClearBufferfv(GL_DEPTH, 0, &access.clearDepth);
+                        }
+                    }
+                }
+                else if (access.load == LoadOp::DontCare){
+                    if (resource.backbuffer)
+                        invalidate.push_back(color ? GL_COLOR : GL_DEPTH);
+                    else
+                        invalidate.push_back(attachmentPoint(access, resource, colorIndex));
+                }
+                colorIndex += color;
+            }
+            if (!invalidate.empty())
+                g_glState.InvalidateFramebuffer(GL_FRAMEBUFFER, (int)invalidate.size(), invalidate.data());
+        }
+
+        std::vector<GLenum> m_scratchAttachments;
+};
+
+inline unsigned int RenderPassContext::Texture(const RenderResource resource) const
+{
+    return m_graph->Texture(resource);
+}
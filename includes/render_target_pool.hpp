@@ -0,0 +1,160 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+struct RenderTextureDesc
+{
+    int width = 0, height = 0;
+    GLenum format = GL_RGBA8;
+    int samples = 0; // 0 for a plain 2D texture
+    int levels = 1;
+
+    bool operator==(const RenderTextureDesc& other) const
+    {
+        return width == other.width && height == other.height && format == other.format &&
+               samples == other.samples && levels == other.levels;
+    }
+};
+
+// Approximate size in VRAM, RGB formats are counted padded to 4 bytes like drivers store them
+inline unsigned long long RenderTextureBytes(const RenderTextureDesc& desc)
+{
+    unsigned int pixel = 4;
+    switch (desc.format){
+        case GL_R8: pixel = 1; break;
+        case GL_RG8: case GL_R16F: case GL_DEPTH_COMPONENT16: pixel = 2; break;
+        case GL_RGBA16F: case GL_RGB16F: case GL_RG32F: case GL_DEPTH32F_STENCIL8: pixel = 8; break;
+        case GL_RGBA32F: case GL_RGB32F: pixel = 16; break;
+        default: break;
+    }
+    unsigned long long bytes = (unsigned long long)desc.width * desc.height * pixel * std::max(desc.samples, 1);
+    return desc.levels > 1 ? bytes * 4 / 3 : bytes; // Full mip chain
+}
+
+inline bool IsDepthFormat(const GLenum format)
+{
+    return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 || format == GL_DEPTH_COMPONENT32F ||
+           format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+inline bool HasStencil(const GLenum format)
+{
+    return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+// Textures handed out by (size, format, samples, levels). A released texture waits in the pool
+// for the next Acquire of the same description, it's only deleted after staying unused for
+// a few frames, so a resize going back and forth or a graph compiled again doesn't reallocate.
+// Acquire and Release are meant for rebuilds, the pool is only scanned, never grown, on frames
+// where nothing changes
+class RenderTargetPool
+{
+    public:
+        RenderTargetPool(const unsigned int maxIdleFrames = 60) : m_maxIdleFrames(maxIdleFrames) {}
+
+        ~RenderTargetPool()
+        {
+            Release();
+        }
+
+        unsigned int Acquire(const RenderTextureDesc& desc)
+        {
+            for (Target& target : m_targets){
+                if (!target.used && target.desc == desc){
+                    target.used = true;
+                    m_reused++;
+                    return target.texture;
+                }
+            }
+            m_targets.push_back(Target{desc, createTexture(desc), true, m_frame});
+            m_created++;
+            return m_targets.back().texture;
+        }
+
+        void Release(const unsigned int texture)
+        {
+            for (Target& target : m_targets){
+                if (target.texture == texture){
+                    target.used = false;
+                    target.lastUsedFrame = m_frame;
+                    return;
+                }
+            }
+        }
+
+        // Deletes the targets nobody acquired for maxIdleFrames frames
+        void EndFrame()
+        {
+            m_frame++;
+            for (unsigned int i = 0 ; i < m_targets.size() ; ){
+                Target& target = m_targets[i];
+                if (!target.used && m_frame - target.lastUsedFrame > m_maxIdleFrames){
+                    glDeleteTextures(1, &target.texture);
+                    target = m_targets.back();
+                    m_targets.pop_back();
+                }
+                else
+                    i++;
+            }
+        }
+
+        // Deletes every texture, acquired ones included, must run while the context is alive
+        void Release()
+        {
+            for (const Target& target : m_targets)
+                glDeleteTextures(1, &target.texture);
+            m_targets.clear();
+        }
+
+        unsigned long long Bytes() const
+        {
+            unsigned long long bytes = 0;
+            for (const Target& target : m_targets)
+                bytes += RenderTextureBytes(target.desc);
+            return bytes;
+        }
+
+        void PrintReport() const
+        {
+            unsigned int used = 0;
+            for (const Target& target : m_targets)
+                used += target.used;
+            std::printf("[render targets] %zu textures (%u in use, %.2f MiB) | %u created, %u reused so far\n",
+                m_targets.size(), used, Bytes() / 1048576.0, m_created, m_reused);
+        }
+
+    private:
+        struct Target
+        {
+            RenderTextureDesc desc;
+            unsigned int texture;
+            bool used;
+            unsigned int lastUsedFrame;
+        };
+
+        std::vector<Target> m_targets;
+        unsigned int m_maxIdleFrames;
+        unsigned int m_frame = 0;
+        unsigned int m_created = 0, m_reused = 0;
+
+        static unsigned int createTexture(const RenderTextureDesc& desc)
+        {
+            unsigned int texture;
+            if (desc.samples > 0){
+                glCreateTextures(GL_TEXTURE_2D_MULTISAMPLE, 1, &texture);
+                glTextureStorage2DMultisample(texture, desc.samples, desc.format, desc.width, desc.height, GL_TRUE);
+                return texture;
+            }
+            glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+            glTextureStorage2D(texture, desc.levels, desc.format, desc.width, desc.height);
+            GLenum filter = IsDepthFormat(desc.format) ? GL_NEAREST : GL_LINEAR;
+            glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, desc.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : filter);
+            glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, filter);
+            glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            return texture;
+        }
+};
@@ -1,98 +1,540 @@
-#pragma once 
+#pragma once
 
 #include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
 #include <fstream>
-#include <sstream>
 #include <iostream>
 
+#include "frame_stats.hpp"
+#include "gl_state.hpp"
+#include "shader_preprocessor.hpp"
+
+// FNV-1a, usable at compile time so uniform names never have to be hashed in the render loop
+constexpr unsigned int UniformHash(std::string_view name)
+{
+    unsigned int hash = 2166136261u;
+    for (char c : name){
+        hash ^= (unsigned char)c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+constexpr unsigned int operator""_uniform(const char* name, std::size_t length)
+{
+    return UniformHash(std::string_view(name, length));
+}
+
+// Linked programs are stored here with glGetProgramBinary, an empty path disables the cache
+inline std::string g_programBinaryCache = "shader_cache";
+
+// Atomic because programs can be built on the ShaderManager worker thread
+struct ProgramBinaryStats
+{
+    std::atomic<unsigned int> loaded = 0;   // Programs restored from the cache
+    std::atomic<unsigned int> compiled = 0; // Programs compiled from source (cache miss or disabled)
+    std::atomic<unsigned int> rejected = 0; // Cached binaries refused by the driver
+};
+
+inline ProgramBinaryStats g_programBinaryStats;
+
+// A program whose compile and link have been issued but maybe not finished yet
+struct ProgramBuild
+{
+    unsigned int program = 0;
+    bool fromBinary = false;
+    std::string binaryPath; // Where to store the binary once linked, empty if not cached
+};
+
+// Typed handle to a reflected uniform, resolved once with Shader::GetUniform
+template <typename T>
+struct Uniform
+{
+    int index = -1;
+    bool Valid() const { return index >= 0; }
+};
+
 class Shader
 {
     public:
-        unsigned int m_id; // program id
+        unsigned int m_id = 0; // program id
+        std::string m_vertexPath, m_fragmentPath;
+        std::string m_computePath; // Set for compute programs, which have no other stage
+        std::string m_geometryPath; // Optional stage between vertex and fragment
+        std::string m_defines; // Inserted after #version in every stage
+        std::vector<std::string> m_dependencies; // Every file read by the last ReadSources, includes too
 
-        Shader(const char* vertexPath, const char* fragmentPath)
+        Shader(const char* vertexPath, const char* fragmentPath) : Shader(vertexPath, fragmentPath, "", true) {}
+
+        // With build = false, the sources are only remembered and the program is created later with Adopt
+        Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines, bool build)
+            : m_vertexPath(vertexPath), m_fragmentPath(fragmentPath), m_defines(defines)
         {
+            if (!build)
+                return;
             std::string vertexCode, fragmentCode;
-            std::ifstream vShaderFile, fShaderFile;
-            vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-            fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-
-            try{
-                vShaderFile.open(vertexPath);
-                fShaderFile.open(fragmentPath);
-                std::stringstream vShaderStream, fShaderStream;
-                vShaderStream << vShaderFile.rdbuf();
-                fShaderStream << fShaderFile.rdbuf();
-                vShaderFile.close();
-                fShaderFile.close();
-                vertexCode = vShaderStream.str();
-                fragmentCode = fShaderStream.str();
-            }
-            catch(std::ifstream::failure e){
-                std::cout << "Can't read shader file\n";
+            if (ReadSources(vertexCode, fragmentCode))
+                Adopt(BuildProgram(vertexCode, fragmentCode));
+        }
+
+        // Same with a geometry stage, layered rendering for instance
+        Shader(const char* vertexPath, const char* geometryPath, const char* fragmentPath, const std::string& defines = "", bool build = true)
+            : m_vertexPath(vertexPath), m_fragmentPath(fragmentPath), m_geometryPath(geometryPath), m_defines(defines)
+        {
+            if (!build)
+                return;
+            std::string vertexCode, fragmentCode, geometryCode;
+            if (ReadSources(vertexCode, fragmentCode, geometryCode))
+                Adopt(BuildProgram(vertexCode, fragmentCode, geometryCode));
+        }
+
+        explicit Shader(const char* computePath) : m_computePath(computePath)
+        {
+            std::string computeCode, unused;
+            if (ReadSources(computeCode, unused))
+                Adopt(BuildProgram(computeCode, unused));
+        }
+
+        // Every stage goes through PreprocessShader, so #include works in any shader.
+        // A compute program returns its source in vertexCode and an empty fragmentCode
+        bool ReadSources(std::string& vertexCode, std::string& fragmentCode)
+        {
+            std::string geometryCode;
+            return ReadSources(vertexCode, fragmentCode, geometryCode);
+        }
+
+        // geometryCode stays empty without a geometry stage
+        bool ReadSources(std::string& vertexCode, std::string& fragmentCode, std::string& geometryCode)
+        {
+            std::vector<std::string> vertexFiles, fragmentFiles, geometryFiles;
+            vertexCode.clear();
+            fragmentCode.clear();
+            geometryCode.clear();
+            if (!m_computePath.empty()){
+                if (!PreprocessShader(m_computePath, m_defines, vertexCode, vertexFiles))
+                    return false;
+                m_dependencies = vertexFiles;
+                return true;
             }
+            if (!PreprocessShader(m_vertexPath, m_defines, vertexCode, vertexFiles) ||
+                !PreprocessShader(m_fragmentPath, m_defines, fragmentCode, fragmentFiles))
+                return false;
+
+            if (!m_geometryPath.empty() && !PreprocessShader(m_geometryPath, m_defines, geometryCode, geometryFiles))
+                return false;
+
+            m_dependencies = vertexFiles;
+            m_dependencies.insert(m_dependencies.end(), fragmentFiles.begin(), fragmentFiles.end());
+            m_dependencies.insert(m_dependencies.end(), geometryFiles.begin(), geometryFiles.end());
+            return true;
+        }
+
+        // Restores the program from the binary cache, or issues its compile and link.
+        // Statuses aren't queried so drivers with parallel compilation don't block here,
+        // it only needs a current context and can run on a shared one.
+        // g_glTrace only records the vertex and fragment sources, programs with a geometry stage don't replay
+        static ProgramBuild BuildProgram(const std::string& vertexCode, const std::string& fragmentCode, const std::string& geometryCode = "")
+        {
+            ProgramBuild build;
+            build.program = glCreateProgram();
+            build.binaryPath = programBinaryPath(vertexCode, fragmentCode, geometryCode);
+            g_glTrace.RegisterProgram(build.program, vertexCode, fragmentCode);
+            if (loadProgramBinary(build.program, build.binaryPath)){
+                build.fromBinary = true;
+                return build;
+            }
+
             const char* vShaderCode = vertexCode.c_str();
             const char* fShaderCode = fragmentCode.c_str();
 
-            unsigned int vertex, fragment;
-            int success;
-            char infoLog[512];
+            if (fragmentCode.empty()){ // Compute program, see ReadSources
+                unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+                glShaderSource(compute, 1, &vShaderCode, NULL);
+                glCompileShader(compute);
+                glAttachShader(build.program, compute);
+                glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+                glLinkProgram(build.program);
+                g_programBinaryStats.compiled++;
+                return build;
+            }
 
-            vertex = glCreateShader(GL_VERTEX_SHADER);
+            unsigned int vertex = glCreateShader(GL_VERTEX_SHADER);
             glShaderSource(vertex, 1, &vShaderCode, NULL);
             glCompileShader(vertex);
-            glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-            if (!success){
-                glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-                std::cerr << "Error in vertex shader : " << infoLog << "\n";
-            }
 
-            fragment = glCreateShader(GL_FRAGMENT_SHADER);
+            unsigned int fragment = glCreateShader(GL_FRAGMENT_SHADER);
             glShaderSource(fragment, 1, &fShaderCode, NULL);
             glCompileShader(fragment);
-            glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-            if (!success){
-                glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-                std::cerr << "Error in fragment shader : " << infoLog << "\n";
+
+            // Shaders stay attached until Adopt, to read their logs
+            glAttachShader(build.program, vertex);
+            glAttachShader(build.program, fragment);
+            if (!geometryCode.empty()){
+                const char* gShaderCode = geometryCode.c_str();
+                unsigned int geometry = glCreateShader(GL_GEOMETRY_SHADER);
+                glShaderSource(geometry, 1, &gShaderCode, NULL);
+                glCompileShader(geometry);
+                glAttachShader(build.program, geometry);
             }
+            glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            glLinkProgram(build.program);
+            g_programBinaryStats.compiled++;
+            return build;
+        }
+
+        // Checks a finished build and makes it the current program. When a previous program
+        // exists and the new one fails, the previous one is kept (hot reload of a broken file).
+        // Uniform handles stay valid and every cached value is sent again to the new program
+        bool Adopt(const ProgramBuild& build)
+        {
+            int success;
+            char infoLog[512];
 
-            m_id = glCreateProgram();
-            glAttachShader(m_id, vertex);
-            glAttachShader(m_id, fragment);
-            glLinkProgram(m_id);
-            glGetProgramiv(m_id, GL_LINK_STATUS, &success);
+            unsigned int attached[3];
+            int attachedCount = 0;
+            glGetAttachedShaders(build.program, 3, &attachedCount, attached);
+            for (int i = 0 ; i < attachedCount ; i++){
+                int type;
+                glGetShaderiv(attached[i], GL_SHADER_TYPE, &type);
+                glGetShaderiv(attached[i], GL_COMPILE_STATUS, &success);
+                if (!success){
+                    glGetShaderInfoLog(attached[i], 512, NULL, infoLog);
+                    const char* stage = type == GL_VERTEX_SHADER ? "vertex" : type == GL_FRAGMENT_SHADER ? "fragment" :
+                                        type == GL_GEOMETRY_SHADER ? "geometry" : "compute";
+                    std::cerr << "Error in " << stage << " shader : " << infoLog << "\n";
+                }
+                glDetachShader(build.program, attached[i]);
+                glDeleteShader(attached[i]);
+            }
+
+            glGetProgramiv(build.program, GL_LINK_STATUS, &success);
             if (!success){
-                glGetProgramInfoLog(m_id, 512, NULL, infoLog);
+                glGetProgramInfoLog(build.program, 512, NULL, infoLog);
                 std::cerr << "Error while linking shaders : " << infoLog << "\n";
+                if (m_id != 0){
+                    glDeleteProgram(build.program);
+                    return false;
+                }
+            }
+            else if (!build.fromBinary){
+                saveProgramBinary(build.program, build.binaryPath);
             }
 
-            glDeleteShader(vertex);
-            glDeleteShader(fragment);
+            if (m_id != 0)
+                glDeleteProgram(m_id);
+            m_id = build.program;
+            reflectUniforms();
+            return success;
         }
 
         void Use()
         {
-            glUseProgram(m_id);
+            g_glState.UseProgram(m_id);
+        }
+
+        template <typename T>
+        Uniform<T> GetUniform(const unsigned int hash) const
+        {
+            return Uniform<T>{findUniform(hash)};
+        }
+
+        template <typename T>
+        Uniform<T> GetUniform(std::string_view name) const
+        {
+            return GetUniform<T>(UniformHash(name));
+        }
+
+        // Values are cached per uniform, setting the same value twice doesn't reach the driver
+        template <typename T>
+        void Set(const Uniform<T> uniform, const T& value) const
+        {
+            setCached(uniform.index, value);
+        }
+
+        // Keyed by a name hashed at compile time, "model"_uniform, costs one table lookup
+        template <typename T>
+        void Set(const unsigned int hash, const T& value) const
+        {
+            setCached(findUniform(hash), value);
         }
 
-        void SetBool(const std::string& name, const bool value) const
+        // Type-erased Set for values recorded as bytes (CommandList), size must match the uniform type
+        void SetRaw(const int index, const void* value, const unsigned int size) const
         {
-            glUniform1i(glGetUniformLocation(m_id, name.c_str()), (int)value);
+            if (index < 0)
+                return;
+            UniformSlot& slot = m_uniforms[index];
+            if (slot.location < 0 || size != typeSize(slot.type))
+                return;
+            if (slot.cached && std::memcmp(slot.value, value, size) == 0){
+                g_frameStats.uniformSkipped++;
+                return;
+            }
+            std::memcpy(slot.value, value, size);
+            slot.cached = true;
+            uploadSlot(slot);
+        }
+
+        // The program doesn't need to be bound, the uniforms are set with glProgramUniform*
+        void SetBool(std::string_view name, const bool value) const
+        {
+            setCached(findUniform(UniformHash(name)), (int)value);
+        }
+
+        void SetInt(std::string_view name, const int value) const
+        {
+            setCached(findUniform(UniformHash(name)), value);
+        }
+
+        void SetInt(const unsigned int hash, const int value) const
+        {
+            setCached(findUniform(hash), value);
+        }
+
+        void SetFloat(std::string_view name, const float value) const
+        {
+            setCached(findUniform(UniformHash(name)), value);
+        }
+
+        void SetVec3(std::string_view name, const glm::vec3& value) const
+        {
+            setCached(findUniform(UniformHash(name)), value);
         }
 
-        void SetInt(const std::string& name, const int value) const
+        void SetMat4(std::string_view name, const glm::mat4& value) const
         {
-            glUniform1i(glGetUniformLocation(m_id, name.c_str()), value);
+            setCached(findUniform(UniformHash(name)), value);
         }
 
-        void SetFloat(const std::string& name, const float value) const
+    private:
+        struct UniformSlot
         {
-            glUniform1f(glGetUniformLocation(m_id, name.c_str()), value);
+            int location;
+            GLenum type;
+            bool cached;
+            alignas(16) unsigned char value[sizeof(glm::mat4)];
+        };
+
+        mutable std::vector<UniformSlot> m_uniforms;
+        std::unordered_map<unsigned int, int> m_uniformIndices; // name hash -> slot
+
+        // The key covers the final sources (so every define) and the driver that produced the binary
+        static std::string programBinaryPath(const std::string& vertexCode, const std::string& fragmentCode, const std::string& geometryCode)
+        {
+            if (g_programBinaryCache.empty())
+                return "";
+            int formats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            if (formats == 0)
+                return "";
+
+            unsigned long long hash = 14695981039346656037ull;
+            auto hashString = [&hash](const char* str){
+                for (; str && *str ; str++){
+                    hash ^= (unsigned char)*str;
+                    hash *= 1099511628211ull;
+                }
+                hash ^= 0xff; // Separator, "ab"+"c" and "a"+"bc" must differ
+                hash *= 1099511628211ull;
+            };
+            hashString(vertexCode.c_str());
+            hashString(fragmentCode.c_str());
+            hashString(geometryCode.c_str());
+            hashString((const char*)glGetString(GL_VENDOR));
+            hashString((const char*)glGetString(GL_RENDERER));
+            hashString((const char*)glGetString(GL_VERSION));
+
+            char name[32];
+            std::snprintf(name, sizeof(name), "%016llx.bin", hash);
+            return g_programBinaryCache + "/" + name;
+        }
+
+        static bool loadProgramBinary(const unsigned int program, const std::string& path)
+        {
+            if (path.empty())
+                return false;
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+                return false;
+
+            GLenum format;
+            if (!file.read((char*)&format, sizeof(format)))
+                return false;
+            std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            if (binary.empty())
+                return false;
+
+            glProgramBinary(program, format, binary.data(), (int)binary.size());
+            int success;
+            glGetProgramiv(program, GL_LINK_STATUS, &success);
+            if (!success){ // Driver updated or binary corrupted, compile from source instead
+                g_programBinaryStats.rejected++;
+                return false;
+            }
+            g_programBinaryStats.loaded++;
+            return true;
         }
 
-        void SetVec3(const std::string& name, const glm::vec3& value) const
+        static void saveProgramBinary(const unsigned int program, const std::string& path)
         {
-            glUniform3fv(glGetUniformLocation(m_id, name.c_str()), 1, glm::value_ptr(value));
+            int length = 0;
+            if (path.empty())
+                return;
+            glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+            if (length == 0)
+                return;
+
+            GLenum format;
+            std::vector<char> binary(length);
+            glGetProgramBinary(program, length, NULL, &format, binary.data());
+
+            std::error_code error;
+            std::filesystem::create_directories(g_programBinaryCache, error);
+            std::ofstream file(path, std::ios::binary);
+            if (!file){
+                std::cerr << "Can't write program binary " << path << "\n";
+                return;
+            }
+            file.write((const char*)&format, sizeof(format));
+            file.write(binary.data(), length);
         }
+
+        // Slots are kept across relinks so handles stay valid, uniforms gone from the new
+        // program only lose their location
+        void registerUniform(const std::string& name, const int location, const GLenum type)
+        {
+            unsigned int hash = UniformHash(name);
+            auto it = m_uniformIndices.find(hash);
+            if (it == m_uniformIndices.end()){
+                m_uniformIndices[hash] = (int)m_uniforms.size();
+                m_uniforms.push_back(UniformSlot{location, type, false, {}});
+                return;
+            }
+            UniformSlot& slot = m_uniforms[it->second];
+            if (slot.location >= 0){
+                std::cerr << "Uniform name hash collision on " << name << "\n";
+                return;
+            }
+            slot.location = location;
+            slot.type = type;
+        }
+
+        // Every active uniform is resolved once after linking, array elements included
+        void reflectUniforms()
+        {
+            for (UniformSlot& slot : m_uniforms)
+                slot.location = -1;
+
+            int count = 0, maxLength = 0;
+            glGetProgramiv(m_id, GL_ACTIVE_UNIFORMS, &count);
+            glGetProgramiv(m_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+            std::vector<char> buffer(maxLength + 1);
+
+            for (int i = 0 ; i < count ; i++){
+                int length, size;
+                GLenum type;
+                glGetActiveUniform(m_id, i, (int)buffer.size(), &length, &size, &type, buffer.data());
+                std::string name(buffer.data(), length);
+
+                int location = glGetUniformLocation(m_id, name.c_str());
+                g_frameStats.uniformLookups++;
+                if (location < 0) // Member of a uniform block
+                    continue;
+                registerUniform(name, location, type);
+
+                // "weights[0]" is reported once for the whole array, "weights" is an alias of it
+                if (size > 1 && name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0){
+                    std::string base = name.substr(0, name.size() - 3);
+                    m_uniformIndices[UniformHash(base)] = m_uniformIndices[UniformHash(name)];
+                    for (int j = 1 ; j < size ; j++){
+                        std::string element = base + "[" + std::to_string(j) + "]";
+                        int elementLocation = glGetUniformLocation(m_id, element.c_str());
+                        g_frameStats.uniformLookups++;
+                        registerUniform(element, elementLocation, type);
+                    }
+                }
+            }
+
+            for (UniformSlot& slot : m_uniforms){
+                if (slot.cached && slot.location >= 0)
+                    uploadSlot(slot);
+            }
+        }
+
+        int findUniform(const unsigned int hash) const
+        {
+            auto it = m_uniformIndices.find(hash);
+            return it == m_uniformIndices.end() ? -1 : it->second;
+        }
+
+        static unsigned int typeSize(const GLenum type)
+        {
+            switch (type){
+                case GL_FLOAT_VEC2: return sizeof(glm::vec2);
+                case GL_FLOAT_VEC3: return sizeof(glm::vec3);
+                case GL_FLOAT_VEC4: return sizeof(glm::vec4);
+                case GL_FLOAT_MAT3: return sizeof(glm::mat3);
+                case GL_FLOAT_MAT4: return sizeof(glm::mat4);
+                default: return 4; // float, int, bool and samplers
+            }
+        }
+
+        template <typename T>
+        void setCached(const int index, const T& value) const
+        {
+            static_assert(sizeof(T) <= sizeof(glm::mat4), "Uniform value too large for the cache");
+            if (index < 0) // Unknown or optimized out by the GLSL compiler
+                return;
+            UniformSlot& slot = m_uniforms[index];
+            if (slot.location < 0)
+                return;
+            if (typeSize(slot.type) != sizeof(T)){ // Wrong type, let the driver report it as before
+                upload(slot.location, value);
+                return;
+            }
+            if (slot.cached && std::memcmp(slot.value, &value, sizeof(T)) == 0){
+                g_frameStats.uniformSkipped++;
+                return;
+            }
+            std::memcpy(slot.value, &value, sizeof(T));
+            slot.cached = true;
+            g_frameStats.uniformCalls++;
+            upload(slot.location, value);
+            if (g_glTrace.Recording())
+                g_glTrace.Uniform(m_id, slot.location, slot.type, slot.value);
+        }
+
+        void uploadSlot(const UniformSlot& slot) const
+        {
+            const float* values = (const float*)slot.value;
+            switch (slot.type){
+                case GL_FLOAT: glProgramUniform1fv(m_id, slot.location, 1, values); break;
+                case GL_FLOAT_VEC2: glProgramUniform2fv(m_id, slot.location, 1, values); break;
+                case GL_FLOAT_VEC3: glProgramUniform3fv(m_id, slot.location, 1, values); break;
+                case GL_FLOAT_VEC4: glProgramUniform4fv(m_id, slot.location, 1, values); break;
+                case GL_FLOAT_MAT3: glProgramUniformMatrix3fv(m_id, slot.location, 1, GL_FALSE, values); break;
+                case GL_FLOAT_MAT4: glProgramUniformMatrix4fv(m_id, slot.location, 1, GL_FALSE, values); break;
+                default: glProgramUniform1iv(m_id, slot.location, 1, (const int*)slot.value); break;
+            }
+            g_frameStats.uniformCalls++;
+            if (g_glTrace.Recording())
+                g_glTrace.Uniform(m_id, slot.location, slot.type, slot.value);
+        }
+
+        void upload(const int location, const int value) const { glProgramUniform1i(m_id, location, value); }
+        void upload(const int location, const float value) const { glProgramUniform1f(m_id, location, value); }
+        void upload(const int location, const glm::vec2& value) const { glProgramUniform2fv(m_id, location, 1, glm::value_ptr(value)); }
+        void upload(const int location, const glm::vec3& value) const { glProgramUniform3fv(m_id, location, 1, glm::value_ptr(value)); }
+        void upload(const int location, const glm::vec4& value) const { glProgramUniform4fv(m_id, location, 1, glm::value_ptr(value)); }
+        void upload(const int location, const glm::mat3& value) const { glProgramUniformMatrix3fv(m_id, location, 1, GL_FALSE, glm::value_ptr(value)); }
+        void upload(const int location, const glm::mat4& value) const { glProgramUniformMatrix4fv(m_id, location, 1, GL_FALSE, glm::value_ptr(value)); }
 };
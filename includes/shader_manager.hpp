@@ -0,0 +1,371 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "shader.hpp"
+
+// GL_KHR_parallel_shader_compile, glad was generated without extensions
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Owns the programs of a chapter. Every compile is issued up front, then finished without blocking :
+// - with GL_KHR_parallel_shader_compile the driver compiles in its own threads and completion is polled
+// - otherwise programs are compiled on a worker thread owning a hidden context shared with the window
+// On Linux, the shader directories are watched with inotify and edited programs are rebuilt in the
+// background, then swapped in by Update between two frames
+class ShaderManager
+{
+    public:
+        ShaderManager(GLFWwindow* window)
+        {
+            if (hasExtension("GL_KHR_parallel_shader_compile") || hasExtension("GL_ARB_parallel_shader_compile")){
+                typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+                MaxShaderCompilerThreadsProc maxThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+                if (!maxThreads)
+                    maxThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+                if (maxThreads)
+                    maxThreads(0xFFFFFFFF); // Let the driver choose
+                m_mode = Mode::Parallel;
+            }
+            else {
+                // Current hints (version, profile) are still the ones used for the window
+                glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+                m_workerContext = glfwCreateWindow(1, 1, "shader compiler", NULL, window);
+                glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+                if (m_workerContext){
+                    m_mode = Mode::Worker;
+                    m_worker = std::thread(&ShaderManager::workerLoop, this);
+                }
+            }
+
+#ifdef __linux__
+            m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (m_inotify < 0)
+                std::cerr << "inotify unavailable, shaders won't be reloaded\n";
+#endif
+        }
+
+        ~ShaderManager()
+        {
+            Release();
+        }
+
+        // Stops the worker and destroys its context, must run before glfwTerminate
+        void Release()
+        {
+            if (m_worker.joinable()){
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stop = true;
+                }
+                m_jobsQueued.notify_one();
+                m_worker.join();
+            }
+            for (Finished& finished : m_finished)
+                glDeleteSync(finished.fence);
+            m_finished.clear();
+            if (m_workerContext)
+                glfwDestroyWindow(m_workerContext);
+            m_workerContext = NULL;
+#ifdef __linux__
+            if (m_inotify >= 0)
+                close(m_inotify);
+            m_inotify = -1;
+#endif
+        }
+
+        // The returned Shader has no program until it's ready, call WaitAll before setting its uniforms
+        Shader& Load(const char* vertexPath, const char* fragmentPath, const std::string& defines = "")
+        {
+            m_programs.push_back(std::make_unique<Program>());
+            Program& program = *m_programs.back();
+            program.shader = std::make_unique<Shader>(vertexPath, fragmentPath, defines, false);
+            issue(program);
+            return *program.shader;
+        }
+
+        // With a geometry stage between the two
+        Shader& Load(const char* vertexPath, const char* geometryPath, const char* fragmentPath, const std::string& defines)
+        {
+            m_programs.push_back(std::make_unique<Program>());
+            Program& program = *m_programs.back();
+            program.shader = std::make_unique<Shader>(vertexPath, geometryPath, fragmentPath, defines, false);
+            issue(program);
+            return *program.shader;
+        }
+
+        // Blocks until every issued program is linked, used once at startup
+        void WaitAll()
+        {
+            while (poll(true) > 0)
+                ;
+        }
+
+        // Called once per frame, never blocks
+        void Update()
+        {
+            readFileEvents();
+            poll(false);
+        }
+
+        double LastBuildMs(const Shader& shader) const
+        {
+            for (const std::unique_ptr<Program>& program : m_programs){
+                if (program->shader.get() == &shader)
+                    return program->lastBuildMs;
+            }
+            return 0.0;
+        }
+
+        void PrintStats() const
+        {
+            std::printf("[shaders] %s compilation\n", m_mode == Mode::Parallel ? "driver parallel" : m_mode == Mode::Worker ? "worker thread" : "blocking");
+            for (const std::unique_ptr<Program>& program : m_programs){
+                std::printf("  %-24s %-24s builds %u, last %.2f ms (issue %.2f ms), mean %.2f ms\n",
+                    fileName(program->shader->m_vertexPath).c_str(), fileName(program->shader->m_fragmentPath).c_str(),
+                    program->builds, program->lastBuildMs, program->lastIssueMs, program->builds ? program->totalBuildMs / program->builds : 0.0);
+            }
+        }
+
+    private:
+        enum class Mode { Blocking, Parallel, Worker };
+
+        struct Program
+        {
+            std::unique_ptr<Shader> shader;
+            ProgramBuild build;
+            bool building = false;
+            bool dirty = false; // Edited again while building
+            std::chrono::steady_clock::time_point issueTime;
+            std::vector<std::pair<int, std::string>> watches; // (inotify watch, file name)
+            unsigned int builds = 0;
+            double lastIssueMs = 0.0, lastBuildMs = 0.0, totalBuildMs = 0.0;
+        };
+
+        struct Job
+        {
+            Program* program;
+            std::string vertexCode, fragmentCode;
+            std::string geometryCode; // Empty without a geometry stage
+        };
+
+        struct Finished
+        {
+            Program* program;
+            ProgramBuild build;
+            GLsync fence;
+        };
+
+        Mode m_mode = Mode::Blocking;
+        std::vector<std::unique_ptr<Program>> m_programs;
+
+        GLFWwindow* m_workerContext = NULL;
+        std::thread m_worker;
+        std::mutex m_mutex;
+        std::condition_variable m_jobsQueued;
+        std::condition_variable m_buildsFinished;
+        std::deque<Job> m_jobs;
+        std::vector<Finished> m_finished; // Protected by m_mutex
+        bool m_stop = false;
+
+        int m_inotify = -1;
+
+        static bool hasExtension(const char* name)
+        {
+            int count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (int i = 0 ; i < count ; i++){
+                if (std::strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+                    return true;
+            }
+            return false;
+        }
+
+        static std::string fileName(const std::string& path)
+        {
+            return std::filesystem::path(path).filename().string();
+        }
+
+        void watch(Program& program, const std::string& path)
+        {
+#ifdef __linux__
+            if (m_inotify < 0)
+                return;
+            std::string directory = std::filesystem::path(path).parent_path().string();
+            // Editors often save through a temporary file and a rename, hence IN_MOVED_TO
+            int wd = inotify_add_watch(m_inotify, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            std::pair<int, std::string> watched(wd, fileName(path));
+            if (wd >= 0 && std::find(program.watches.begin(), program.watches.end(), watched) == program.watches.end())
+                program.watches.push_back(watched);
+#endif
+        }
+
+        void readFileEvents()
+        {
+#ifdef __linux__
+            if (m_inotify < 0)
+                return;
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length;
+            while ((length = read(m_inotify, buffer, sizeof(buffer))) > 0){
+                for (char* ptr = buffer ; ptr < buffer + length ; ptr += sizeof(inotify_event) + ((inotify_event*)ptr)->len){
+                    const inotify_event* event = (const inotify_event*)ptr;
+                    if (event->len == 0)
+                        continue;
+                    for (std::unique_ptr<Program>& program : m_programs){
+                        for (const std::pair<int, std::string>& watched : program->watches){
+                            if (watched.first == event->wd && watched.second == event->name)
+                                program->dirty = true;
+                        }
+                    }
+                }
+            }
+            for (std::unique_ptr<Program>& program : m_programs){
+                if (program->dirty && !program->building){
+                    std::cout << "Reloading " << program->shader->m_vertexPath << ", " << program->shader->m_fragmentPath << "\n";
+                    issue(*program);
+                }
+            }
+#endif
+        }
+
+        void issue(Program& program)
+        {
+            std::string vertexCode, fragmentCode, geometryCode;
+            program.dirty = false;
+            bool read = program.shader->ReadSources(vertexCode, fragmentCode, geometryCode);
+            // Included files are watched as well, the list can change from one build to the next
+            watch(program, program.shader->m_vertexPath);
+            watch(program, program.shader->m_fragmentPath);
+            if (!program.shader->m_geometryPath.empty())
+                watch(program, program.shader->m_geometryPath);
+            for (const std::string& dependency : program.shader->m_dependencies)
+                watch(program, dependency);
+            if (!read)
+                return;
+
+            program.building = true;
+            program.issueTime = std::chrono::steady_clock::now();
+            if (m_mode == Mode::Worker){
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_jobs.push_back(Job{&program, std::move(vertexCode), std::move(fragmentCode), std::move(geometryCode)});
+                }
+                m_jobsQueued.notify_one();
+            }
+            else {
+                program.build = Shader::BuildProgram(vertexCode, fragmentCode, geometryCode);
+            }
+            program.lastIssueMs = elapsedMs(program.issueTime);
+            if (m_mode == Mode::Blocking)
+                finish(program, program.build);
+        }
+
+        void finish(Program& program, const ProgramBuild& build)
+        {
+            program.shader->Adopt(build);
+            program.building = false;
+            program.builds++;
+            program.lastBuildMs = elapsedMs(program.issueTime);
+            program.totalBuildMs += program.lastBuildMs;
+            if (program.builds > 1)
+                std::printf("[shaders] %s reloaded in %.2f ms\n", fileName(program.shader->m_fragmentPath).c_str(), program.lastBuildMs);
+        }
+
+        // Adopts every finished build, returns how many are still pending
+        int poll(const bool block)
+        {
+            int pending = 0;
+            if (m_mode == Mode::Parallel){
+                for (std::unique_ptr<Program>& program : m_programs){
+                    if (!program->building)
+                        continue;
+                    int complete = GL_TRUE;
+                    if (!block) // Querying GL_LINK_STATUS in Adopt waits for the driver threads
+                        glGetProgramiv(program->build.program, GL_COMPLETION_STATUS_KHR, &complete);
+                    if (complete)
+                        finish(*program, program->build);
+                    else
+                        pending++;
+                }
+            }
+            else if (m_mode == Mode::Worker){
+                std::vector<Finished> finished;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    if (block && m_finished.empty())
+                        m_buildsFinished.wait_for(lock, std::chrono::milliseconds(1));
+                    finished.swap(m_finished);
+                }
+                std::vector<Finished> notReady;
+                for (Finished& done : finished){
+                    // The fence makes the worker's program visible to this context
+                    GLenum status = glClientWaitSync(done.fence, 0, block ? 1000000 : 0);
+                    if (status == GL_TIMEOUT_EXPIRED){
+                        notReady.push_back(done);
+                        continue;
+                    }
+                    glDeleteSync(done.fence);
+                    finish(*done.program, done.build);
+                }
+                if (!notReady.empty()){
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_finished.insert(m_finished.end(), notReady.begin(), notReady.end());
+                }
+                for (std::unique_ptr<Program>& program : m_programs){
+                    if (program->building)
+                        pending++;
+                }
+            }
+            return pending;
+        }
+
+        void workerLoop()
+        {
+            glfwMakeContextCurrent(m_workerContext);
+            while (true){
+                Job job;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_jobsQueued.wait(lock, [this]{ return m_stop || !m_jobs.empty(); });
+                    if (m_stop)
+                        break;
+                    job = std::move(m_jobs.front());
+                    m_jobs.pop_front();
+                }
+                ProgramBuild build = Shader::BuildProgram(job.vertexCode, job.fragmentCode, job.geometryCode);
+                int linked;
+                glGetProgramiv(build.program, GL_LINK_STATUS, &linked); // Wait for the link here, not on the render thread
+                GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                glFlush();
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_finished.push_back(Finished{job.program, build, fence});
+                }
+                m_buildsFinished.notify_one();
+            }
+            glfwMakeContextCurrent(NULL);
+        }
+
+        static double elapsedMs(const std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+};
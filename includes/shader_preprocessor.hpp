@@ -0,0 +1,59 @@
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Expands #include "file" lines, paths are relative to the including file and every file is
+// included once. `defines` is inserted right after #version. Each file read is appended to
+// `files`, its index there is the source number used by the #line directives, so "2(15)" in
+// a driver error means line 15 of files[2]
+inline bool PreprocessShader(const std::string& path, const std::string& defines, std::string& output, std::vector<std::string>& files)
+{
+    std::ifstream file(path);
+    if (!file){
+        std::cerr << "Can't read shader file " << path << "\n";
+        return false;
+    }
+    int source = (int)files.size();
+    files.push_back(std::filesystem::path(path).lexically_normal().string());
+    if (source != 0) // The root file must start with #version
+        output += "#line 1 " + std::to_string(source) + "\n";
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)){
+        lineNumber++;
+        size_t start = line.find_first_not_of(" \t");
+        std::string_view directive = start == std::string::npos ? std::string_view() : std::string_view(line).substr(start);
+
+        if (directive.substr(0, 8) == "#include"){
+            size_t open = line.find('"');
+            size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            if (close == std::string::npos){
+                std::cerr << path << "(" << lineNumber << ") : malformed #include\n";
+                return false;
+            }
+            std::filesystem::path included = std::filesystem::path(path).parent_path() / line.substr(open + 1, close - open - 1);
+            std::string normalized = included.lexically_normal().string();
+            if (std::find(files.begin(), files.end(), normalized) == files.end()){
+                if (!PreprocessShader(normalized, "", output, files))
+                    return false;
+            }
+            output += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(source) + "\n";
+            continue;
+        }
+
+        output += line;
+        output += "\n";
+        if (directive.substr(0, 8) == "#version" && !defines.empty()){
+            output += defines;
+            output += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(source) + "\n";
+        }
+    }
+    return true;
+}
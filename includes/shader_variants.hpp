@@ -0,0 +1,116 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "shader_manager.hpp"
+
+// Feature bits of includes/shaders/phong.glsl. Each combination is compiled as its own program,
+// so disabled lights and missing maps cost nothing at runtime
+struct PhongVariant
+{
+    unsigned int pointLights = 0; // 0 to 15
+    bool dirLight = false;
+    bool spotLight = false;
+    bool diffuseMap = true;  // Otherwise material.diffuse is a vec3
+    bool specularMap = true; // Otherwise material.specular is a vec3
+    bool dirShadows = false; // Cascaded shadows of the directional light, see includes/shaders/shadows.glsl
+    bool pointShadows = false; // Cube map shadows of the point lights, see includes/shaders/point_shadows.glsl
+    bool clustered = false;  // Lights of ClusteredLights, see includes/shaders/clustered_lights.glsl
+
+    constexpr unsigned int Key() const
+    {
+        return (pointLights & 0xF) | dirLight << 4 | spotLight << 5 | diffuseMap << 6 | specularMap << 7 | dirShadows << 8 | pointShadows << 9 | clustered << 10;
+    }
+
+    std::string Defines() const
+    {
+        std::string defines = "#define NR_POINT_LIGHT " + std::to_string(pointLights) + "\n";
+        if (dirLight)
+            defines += "#define DIR_LIGHT\n";
+        if (spotLight)
+            defines += "#define SPOT_LIGHT\n";
+        if (diffuseMap)
+            defines += "#define DIFFUSE_MAP\n";
+        if (specularMap)
+            defines += "#define SPECULAR_MAP\n";
+        if (dirShadows)
+            defines += "#define DIR_SHADOWS\n";
+        if (pointShadows)
+            defines += "#define POINT_SHADOWS\n";
+        if (clustered)
+            defines += "#define CLUSTERED_LIGHTS\n";
+        return defines;
+    }
+
+    std::string Name() const
+    {
+        return std::to_string(pointLights) + " point" + (dirLight ? " +dir" : "") + (spotLight ? " +spot" : "")
+            + (diffuseMap ? " +diffuseMap" : "") + (specularMap ? " +specularMap" : "") + (dirShadows ? " +shadows" : "")
+            + (pointShadows ? " +pointShadows" : "") + (clustered ? " +clustered" : "");
+    }
+};
+
+// Lazily built permutations of one vertex/fragment pair, selected by a Variant type providing a
+// constexpr Key(), Defines() and Name(). Programs go through the ShaderManager, so they're also hot reloaded
+template <typename Variant>
+class ShaderVariants
+{
+    public:
+        // setup runs once on every new variant, typically to set the uniforms that never change
+        ShaderVariants(ShaderManager& manager, const char* vertexPath, const char* fragmentPath, std::function<void(Shader&)> setup = nullptr)
+            : m_manager(manager), m_vertexPath(vertexPath), m_fragmentPath(fragmentPath), m_setup(setup) {}
+
+        // Issues every variant at once so they compile in parallel
+        void Precompile(const std::vector<Variant>& variants)
+        {
+            std::vector<Variant> issued;
+            for (const Variant& variant : variants){
+                if (!m_variants.count(variant.Key())){
+                    m_variants[variant.Key()] = Entry{variant, &m_manager.Load(m_vertexPath.c_str(), m_fragmentPath.c_str(), variant.Defines())};
+                    issued.push_back(variant);
+                }
+            }
+            m_manager.WaitAll();
+            for (const Variant& variant : issued){
+                if (m_setup)
+                    m_setup(*m_variants[variant.Key()].shader);
+            }
+        }
+
+        // A variant that wasn't precompiled stalls the frame while it's built
+        Shader& Get(const Variant& variant)
+        {
+            auto it = m_variants.find(variant.Key());
+            if (it != m_variants.end())
+                return *it->second.shader;
+            Precompile({variant});
+            return *m_variants[variant.Key()].shader;
+        }
+
+        void PrintReport() const
+        {
+            double total = 0.0;
+            std::printf("[variants] %zu of %s\n", m_variants.size(), m_fragmentPath.c_str());
+            for (const auto& [key, entry] : m_variants){
+                double ms = m_manager.LastBuildMs(*entry.shader);
+                total += ms;
+                std::printf("  0x%02x %-40s %.2f ms\n", key, entry.variant.Name().c_str(), ms);
+            }
+            std::printf("  total %.2f ms\n", total);
+        }
+
+    private:
+        struct Entry
+        {
+            Variant variant;
+            Shader* shader;
+        };
+
+        ShaderManager& m_manager;
+        std::string m_vertexPath, m_fragmentPath;
+        std::function<void(Shader&)> m_setup;
+        std::unordered_map<unsigned int, Entry> m_variants;
+};
@@ -0,0 +1,24 @@
+#version 460 core
+
+// One invocation per cascade, each emits the triangle to its own layer and viewport when the
+// draw's cascadeMask has its bit. Casters are drawn once for every cascade in a single pass
+#define MAX_CASCADES 4
+
+layout (triangles, invocations = MAX_CASCADES) in;
+layout (triangle_strip, max_vertices = 3) out;
+
+uniform mat4 lightMatrices[MAX_CASCADES];
+uniform int cascadeMask; // Set per draw from CascadedShadowMap::CasterMask
+
+void main()
+{
+    if ((cascadeMask & (1 << gl_InvocationID)) == 0)
+        return;
+    for (int i = 0 ; i < 3 ; i++){
+        gl_Position = lightMatrices[gl_InvocationID] * gl_in[i].gl_Position;
+        gl_Layer = gl_InvocationID;
+        gl_ViewportIndex = gl_InvocationID + 1; // Viewport 0 is the window's
+        EmitVertex();
+    }
+    EndPrimitive();
+}
@@ -0,0 +1,13 @@
+#version 460 core
+
+// Casters of CascadedShadowMap (includes/cascaded_shadows.hpp) and PointShadowMaps
+// (includes/point_shadows.hpp), from a position-only stream. World space out,
+// cascade_shadow.gs and point_shadow.gs apply the matrix of each cascade or face
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+
+void main()
+{
+    gl_Position = model * vec4(aPos, 1.0);
+}
@@ -0,0 +1,87 @@
+// Lights assigned to the froxels of the view by cluster_lights.comp, written by ClusteredLights
+// (includes/clustered_lights.hpp). The view is split in clusterGrid.x * clusterGrid.y tiles and
+// clusterGrid.z depth slices, exponential between clusterDepth.x and clusterDepth.y.
+// Needs frame_data.glsl
+
+#define CLUSTER_STRIDE 256u // ClusteredLights::CLUSTER_STRIDE, the count then up to 255 light indices
+
+// A point light is a spot light whose cone never cuts: cos cutOff -1, cos outerCutOff -2
+struct ClusterLight
+{
+    vec4 positionRange;  // World position, range where the attenuation ends
+    vec4 diffuseAmbient; // Diffuse color, ambient intensity in w
+    vec4 specularShadow; // Specular color, point shadow index in w, -1 without
+    vec4 directionCutOff;
+    vec4 attenuation;    // Constant, linear, quadratic, cos outerCutOff in w
+};
+
+layout(std430, binding = 5) readonly buffer ClusterLightData
+{
+    ClusterLight clusterLights[];
+};
+
+// One head per cluster, x fastest then y then the slice, with the offset of the cluster's list:
+// its count then its light indices. cluster_lights.comp gives every list CLUSTER_STRIDE entries
+// after the heads, the CPU binning of ClusteredLights packs them
+#ifdef CLUSTER_CULLING
+layout(std430, binding = 6) writeonly buffer ClusterLightLists
+#else
+layout(std430, binding = 6) readonly buffer ClusterLightLists
+#endif
+{
+    uint clusterLists[];
+};
+
+uniform vec3 clusterGrid;   // Tiles across, tiles up and slices, whole numbers
+uniform vec2 clusterDepth;  // Near and far view depth of the slices
+uniform int clusterLightCount;
+
+// Culling helpers of the compute passes assigning these lights, in view space
+
+// View space point at depth 1 seen through a NDC position
+vec3 ViewRay(vec2 ndc)
+{
+    vec4 near = inverseProjection * vec4(ndc, -1.0, 1.0);
+    near /= near.w;
+    return near.xyz / -near.z;
+}
+
+bool SphereInBox(vec3 centre, float radius, vec3 boxMin, vec3 boxMax)
+{
+    vec3 closest = clamp(centre, boxMin, boxMax);
+    vec3 d = closest - centre;
+    return dot(d, d) <= radius * radius;
+}
+
+// Bounding sphere of the box against the cone of apex `apex`, axis `direction` and half angle of cosine cosAngle
+bool SphereInCone(vec3 centre, float radius, vec3 apex, vec3 direction, float cosAngle, float range)
+{
+    vec3 v = centre - apex;
+    float along = dot(v, direction);
+    float across = sqrt(max(dot(v, v) - along * along, 0.0));
+    float sinAngle = sqrt(max(1.0 - cosAngle * cosAngle, 0.0));
+    if (cosAngle * across - along * sinAngle > radius) // Distance to the cone's side
+        return false;
+    return along >= -radius && along <= range + radius;
+}
+
+// Slice of a positive view depth, clamped to the grid
+uint ClusterSlice(float depth)
+{
+    float slice = log(max(depth, clusterDepth.x) / clusterDepth.x) / log(clusterDepth.y / clusterDepth.x) * clusterGrid.z;
+    return min(uint(slice), uint(clusterGrid.z) - 1u);
+}
+
+#ifndef CLUSTER_CULLING
+// Offset of the list of the cluster holding a world position seen at window position fragCoord.
+// gl_FragCoord is passed in, the file is also included by compute shaders. The culling pass
+// only writes the lists, it doesn't get this reader
+uint ClusterOffset(vec2 fragCoord, vec3 fragPos)
+{
+    vec2 screen = clamp((fragCoord - viewport.xy) / viewport.zw, 0.0, 0.999);
+    uvec2 tile = uvec2(screen * clusterGrid.xy);
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    uint cluster = (ClusterSlice(depth) * uint(clusterGrid.y) + tile.y) * uint(clusterGrid.x) + tile.x;
+    return clusterLists[cluster];
+}
+#endif
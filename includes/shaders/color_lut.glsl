@@ -0,0 +1,11 @@
+// Colour operators baked by ColorLut, LUT_SIZE matches ColorLut::SIZE
+#define LUT_SIZE 32.0
+
+uniform sampler3D colorLut;
+
+// Scaled so 0 and 1 land on the centers of the first and last texels
+vec3 ApplyColorLut(vec3 color)
+{
+    vec3 coords = clamp(color, 0.0, 1.0) * ((LUT_SIZE - 1.0) / LUT_SIZE) + 0.5 / LUT_SIZE;
+    return texture(colorLut, coords).rgb;
+}
@@ -0,0 +1,6 @@
+#version 460 core
+
+// Depth pre-pass and shadow maps, there is no colour and the depth comes from the rasterizer
+void main()
+{
+}
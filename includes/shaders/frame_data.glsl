@@ -0,0 +1,13 @@
+// Per-frame data written once by FrameUniformBuffer (includes/frame_data.hpp), shared by every program.
+// The members are global, view and projection replace the former uniforms of the same name
+
+layout (std140, binding = 0) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 inverseView;
+    mat4 inverseProjection;
+    vec4 cameraPosition; // w unused
+    vec4 viewport;       // x, y, width, height
+    vec4 time;           // time, deltaTime, unused, unused
+};
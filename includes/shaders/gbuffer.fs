@@ -0,0 +1,37 @@
+#version 460 core
+
+// Geometry pass of TiledDeferred. The material maps are sampled once per pixel here, the lighting
+// pass only reads the G-buffer. Inputs are those of the chapters' object.vs
+
+in vec2 TexCoords;
+in vec3 Normal;
+in vec3 FragPos;
+
+layout (location = 0) out vec4 gAlbedoSpecular;
+layout (location = 1) out vec4 gNormalShininess;
+layout (location = 2) out vec4 gPosition; // Wide layout only
+
+#include "gbuffer.glsl"
+
+struct GBufferMaterial
+{
+    sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+};
+
+uniform GBufferMaterial material;
+uniform int gbufferLayout;
+
+void main()
+{
+    vec3 specular = texture(material.specular, TexCoords).rgb;
+    gAlbedoSpecular = vec4(texture(material.diffuse, TexCoords).rgb, max(specular.r, max(specular.g, specular.b)));
+    vec3 normal = normalize(Normal);
+    if (gbufferLayout == GBUFFER_WIDE){
+        gNormalShininess = vec4(normal, material.shininess);
+        gPosition = vec4(FragPos, 1.0);
+    }
+    else
+        gNormalShininess = vec4(EncodeOctahedral(normal), EncodeShininess(material.shininess), 0.0);
+}
@@ -0,0 +1,38 @@
+// G-buffer layouts of TiledDeferred (includes/tiled_deferred.hpp), GBufferLayout on the C++ side.
+// Compact : 0 RGBA8 albedo, specular | 1 RGB10_A2 octahedral normal, shininess. Positions come from the depth
+// Wide    : 0 RGBA8 albedo, specular | 1 RGBA16F normal, shininess | 2 RGBA16F world position
+// Specular is one intensity, the specular maps are grey
+
+#define GBUFFER_COMPACT 0
+#define GBUFFER_WIDE 1
+
+// Unit vector folded on an octahedron and unfolded on the [0, 1] square
+vec2 EncodeOctahedral(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 folded = n.xy;
+    if (n.z < 0.0)
+        folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return folded * 0.5 + 0.5;
+}
+
+vec3 DecodeOctahedral(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// Shininess 1 to 1024 on a log scale, 10 bits keep steps under 1%
+float EncodeShininess(float shininess)
+{
+    return clamp(log2(shininess) / 10.0, 0.0, 1.0);
+}
+
+float DecodeShininess(float encoded)
+{
+    return exp2(encoded * 10.0);
+}
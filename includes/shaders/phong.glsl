@@ -0,0 +1,256 @@
+// Phong lighting shared by the chapters, included after the fragment inputs TexCoords.
+// Specialized by the defines of PhongVariant (includes/shader_variants.hpp) :
+// NR_POINT_LIGHT, DIR_LIGHT, SPOT_LIGHT, DIFFUSE_MAP, SPECULAR_MAP, DIR_SHADOWS, POINT_SHADOWS,
+// CLUSTERED_LIGHTS (needs frame_data.glsl), GBUFFER_MATERIAL.
+// The light functions read the material from the globals gAlbedo, gSpecular and gShininess, filled
+// once per fragment: CalcLighting samples the maps of `material` before its first light. With
+// GBUFFER_MATERIAL there is no `material`, the caller fills them from a G-buffer and sums the
+// lights itself
+
+#ifndef NR_POINT_LIGHT
+#define NR_POINT_LIGHT 0
+#endif
+
+struct Material
+{
+#ifdef DIFFUSE_MAP
+    sampler2D diffuse;
+#else
+    vec3 diffuse;
+#endif
+#ifdef SPECULAR_MAP
+    sampler2D specular;
+#else
+    vec3 specular;
+#endif
+    float shininess;
+};
+
+struct DirLight
+{
+    vec3 direction;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight
+{
+    vec3 position;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+struct SpotLight
+{
+    vec3 position;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+// Material of the fragment being shaded
+vec3 gAlbedo;
+vec3 gSpecular;
+float gShininess;
+#ifndef GBUFFER_MATERIAL
+uniform Material material;
+#endif
+#ifdef DIR_LIGHT
+uniform DirLight dirLight;
+#endif
+#if NR_POINT_LIGHT > 0
+uniform PointLight pointLights[NR_POINT_LIGHT];
+#endif
+#ifdef SPOT_LIGHT
+uniform SpotLight spotLight;
+#endif
+#ifdef DIR_SHADOWS
+#include "shadows.glsl"
+#endif
+#ifdef CLUSTERED_LIGHTS
+#include "clustered_lights.glsl"
+#endif
+#if defined(POINT_SHADOWS) && (NR_POINT_LIGHT > 0 || defined(CLUSTERED_LIGHTS))
+#include "point_shadows.glsl"
+#endif
+
+#ifndef GBUFFER_MATERIAL
+// Samples the maps once, every light reuses them
+void LoadMaterial()
+{
+#ifdef DIFFUSE_MAP
+    gAlbedo = texture(material.diffuse, TexCoords).rgb;
+#else
+    gAlbedo = material.diffuse;
+#endif
+#ifdef SPECULAR_MAP
+    gSpecular = texture(material.specular, TexCoords).rgb;
+#else
+    gSpecular = material.specular;
+#endif
+    gShininess = material.shininess;
+}
+#endif
+
+vec3 MaterialDiffuse()
+{
+    return gAlbedo;
+}
+
+vec3 MaterialSpecular()
+{
+    return gSpecular;
+}
+
+float MaterialShininess()
+{
+    return gShininess;
+}
+
+// shadow scales the diffuse and specular terms, 1 when lit
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, float shadow)
+{
+    // Ambient
+    vec3 ambient = light.ambient * MaterialDiffuse();
+
+    // Diffuse
+    vec3 lightDir = normalize(-light.direction); // Must be inverted
+    float diff = max(dot(normal, lightDir), 0.);
+    vec3 diffuse = light.diffuse * diff * MaterialDiffuse();
+
+    // Specular
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), MaterialShininess());
+    vec3 specular = light.specular * spec * MaterialSpecular();
+
+    return ambient + (diffuse + specular) * shadow;
+}
+
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, float shadow)
+{
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear*distance + light.quadratic * (distance*distance));
+
+    // Ambient
+    vec3 ambient = light.ambient * MaterialDiffuse();
+
+    // Diffuse
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(normal, lightDir), 0.);
+    vec3 diffuse = light.diffuse * diff * MaterialDiffuse();
+
+    // Specular
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), MaterialShininess());
+    vec3 specular = light.specular * spec * MaterialSpecular();
+
+    ambient *= attenuation;
+    diffuse *= attenuation;
+    specular *= attenuation;
+
+    return ambient + (diffuse + specular) * shadow;
+}
+
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff)/epsilon, 0.0, 1.0);
+
+    // Ambient
+    vec3 ambient = light.ambient * MaterialDiffuse();
+
+    // Diffuse
+    float diff = max(dot(normal, lightDir), 0.);
+    vec3 diffuse = light.diffuse * diff * MaterialDiffuse();
+
+    // Specular
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), MaterialShininess());
+    vec3 specular = light.specular * spec * MaterialSpecular();
+
+    ambient *= intensity;
+    diffuse *= intensity;
+    specular *= intensity;
+    return ambient + diffuse + specular;
+}
+
+#ifdef CLUSTERED_LIGHTS
+// CalcPointLight and CalcSpotLight in one, point lights have a cone that never cuts. The
+// attenuation is faded out before the range, lights don't end with a visible edge at their cluster
+vec3 CalcClusterLight(ClusterLight light, vec3 normal, vec3 fragPos, vec3 viewDir, float shadow)
+{
+    vec3 toLight = light.positionRange.xyz - fragPos;
+    float distance = length(toLight);
+    vec3 lightDir = toLight / distance;
+    vec3 k = light.attenuation.xyz;
+    float fade = clamp(1.0 - pow(distance / light.positionRange.w, 4.0), 0.0, 1.0);
+    float attenuation = fade * fade / (k.x + k.y * distance + k.z * distance * distance);
+    float theta = dot(lightDir, -light.directionCutOff.xyz);
+    float intensity = clamp((theta - light.attenuation.w) / (light.directionCutOff.w - light.attenuation.w), 0.0, 1.0);
+
+    vec3 ambient = light.diffuseAmbient.w * MaterialDiffuse();
+    float diff = max(dot(normal, lightDir), 0.);
+    vec3 diffuse = light.diffuseAmbient.rgb * diff * MaterialDiffuse();
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), MaterialShininess());
+    vec3 specular = light.specularShadow.rgb * spec * MaterialSpecular();
+
+    return (ambient + (diffuse + specular) * shadow) * attenuation * intensity;
+}
+#endif
+
+#ifndef GBUFFER_MATERIAL
+// Sum of every light enabled in the variant
+vec3 CalcLighting(vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    LoadMaterial();
+    vec3 result = vec3(0.);
+#ifdef DIR_LIGHT
+#ifdef DIR_SHADOWS
+    result += CalcDirLight(dirLight, normal, viewDir, CalcDirShadow(fragPos, normal));
+#else
+    result += CalcDirLight(dirLight, normal, viewDir, 1.0);
+#endif
+#endif
+#if NR_POINT_LIGHT > 0
+    for (int i = 0 ; i < NR_POINT_LIGHT ; i++){
+#ifdef POINT_SHADOWS
+        // Lights past MAX_POINT_SHADOWS aren't shadowed
+        float shadow = i < MAX_POINT_SHADOWS ? CalcPointShadow(i, fragPos, normal) : 1.0;
+#else
+        float shadow = 1.0;
+#endif
+        result += CalcPointLight(pointLights[i], normal, fragPos, viewDir, shadow);
+    }
+#endif
+#ifdef CLUSTERED_LIGHTS
+    // Only the lights reaching the fragment's cluster
+    uint cluster = ClusterOffset(gl_FragCoord.xy, fragPos);
+    uint count = clusterLists[cluster];
+    for (uint i = 1u ; i <= count ; i++){
+        ClusterLight light = clusterLights[clusterLists[cluster + i]];
+#ifdef POINT_SHADOWS
+        int shadowIndex = int(light.specularShadow.w);
+        float shadow = shadowIndex >= 0 ? CalcPointShadow(shadowIndex, fragPos, normal) : 1.0;
+#else
+        float shadow = 1.0;
+#endif
+        result += CalcClusterLight(light, normal, fragPos, viewDir, shadow);
+    }
+#endif
+#ifdef SPOT_LIGHT
+    result += CalcSpotLight(spotLight, normal, fragPos, viewDir);
+#endif
+    return result;
+}
+#endif
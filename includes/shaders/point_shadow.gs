@@ -0,0 +1,41 @@
+#version 460 core
+
+// One invocation per face of every light, each emits the triangle to its layer-face of the cube
+// map array when the draw's faceMask has its bit. Casters are drawn once for every light and face
+#define MAX_POINT_SHADOWS 4
+#define POINT_SHADOW_NEAR 0.05
+
+layout (triangles, invocations = 6 * MAX_POINT_SHADOWS) in;
+layout (triangle_strip, max_vertices = 3) out;
+
+uniform vec4 pointShadows[MAX_POINT_SHADOWS]; // Position, range
+uniform int faceMask; // Set per draw from PointShadowMaps::CasterMask
+
+// Rows of the view rotation of each face, +X -X +Y -Y +Z -Z, oriented like cube map faces
+const mat3 FACE_ROWS[6] = mat3[](
+    mat3(vec3(0.0, 0.0, -1.0), vec3(0.0, -1.0, 0.0), vec3(-1.0, 0.0, 0.0)),
+    mat3(vec3(0.0, 0.0, 1.0), vec3(0.0, -1.0, 0.0), vec3(1.0, 0.0, 0.0)),
+    mat3(vec3(1.0, 0.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, -1.0, 0.0)),
+    mat3(vec3(1.0, 0.0, 0.0), vec3(0.0, 0.0, -1.0), vec3(0.0, 1.0, 0.0)),
+    mat3(vec3(1.0, 0.0, 0.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, -1.0)),
+    mat3(vec3(-1.0, 0.0, 0.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0))
+);
+
+void main()
+{
+    if ((faceMask & (1 << gl_InvocationID)) == 0)
+        return;
+    int light = gl_InvocationID / 6;
+    mat3 rotation = transpose(FACE_ROWS[gl_InvocationID % 6]);
+    float far = pointShadows[light].w;
+    float n = POINT_SHADOW_NEAR;
+    for (int i = 0 ; i < 3 ; i++){
+        vec3 position = rotation * (gl_in[i].gl_Position.xyz - pointShadows[light].xyz);
+        // 90 degrees perspective, square
+        gl_Position = vec4(position.xy, -(far + n) / (far - n) * position.z - 2.0 * far * n / (far - n), -position.z);
+        gl_Layer = gl_InvocationID;
+        gl_ViewportIndex = light + 1; // Viewport 0 is the window's
+        EmitVertex();
+    }
+    EndPrimitive();
+}
@@ -0,0 +1,49 @@
+// Shadows of the point lights, written by PointShadowMaps (includes/point_shadows.hpp)
+
+#define MAX_POINT_SHADOWS 4
+#define POINT_SHADOW_NEAR 0.05
+
+uniform sampler2DArrayShadow pointShadowMap;      // Layer-face 6 * light + face of the cube map array
+uniform vec4 pointShadows[MAX_POINT_SHADOWS];     // Position, range. A range of 0 isn't shadowed
+uniform float pointShadowScale[MAX_POINT_SHADOWS]; // Share of the layer's width the light renders to
+
+// 1 lit, 0 in shadow. The face is picked like a cube map lookup would, from the major axis of the
+// direction. The position is pushed along the normal by a texel, a texel it covers at that distance
+float CalcPointShadow(int light, vec3 fragPos, vec3 normal)
+{
+    float far = pointShadows[light].w;
+    if (far <= 0.0)
+        return 1.0;
+    float resolution = textureSize(pointShadowMap, 0).x * pointShadowScale[light];
+    vec3 d = fragPos - pointShadows[light].xyz;
+    float ma = max(abs(d.x), max(abs(d.y), abs(d.z)));
+    d += normal * ma * 2.0 / resolution * 1.5;
+
+    vec3 a = abs(d);
+    int face;
+    vec2 st;
+    if (a.x >= a.y && a.x >= a.z){
+        ma = a.x;
+        face = d.x > 0.0 ? 0 : 1;
+        st = vec2(d.x > 0.0 ? -d.z : d.z, -d.y);
+    }
+    else if (a.y >= a.z){
+        ma = a.y;
+        face = d.y > 0.0 ? 2 : 3;
+        st = vec2(d.x, d.y > 0.0 ? d.z : -d.z);
+    }
+    else{
+        ma = a.z;
+        face = d.z > 0.0 ? 4 : 5;
+        st = vec2(d.z > 0.0 ? d.x : -d.x, -d.y);
+    }
+    if (ma >= far)
+        return 1.0;
+
+    // Bilinear comparisons must not read the next face's texels or the unused part of the layer
+    vec2 uv = clamp(st / ma * 0.5 + 0.5, vec2(0.5 / resolution), vec2(1.0 - 0.5 / resolution));
+    float n = POINT_SHADOW_NEAR;
+    float biased = ma - ma * 2.0 / resolution; // A texel closer to the light
+    float depth = ((far + n) / (far - n) - 2.0 * far * n / ((far - n) * biased)) * 0.5 + 0.5;
+    return texture(pointShadowMap, vec4(uv * pointShadowScale[light], 6 * light + face, depth));
+}
@@ -0,0 +1,77 @@
+// Cascaded shadows of the directional light, written by CascadedShadowMap (includes/cascaded_shadows.hpp)
+
+#define MAX_CASCADES 4
+
+uniform sampler2DArrayShadow shadowMap;
+uniform sampler2DArray shadowMoments;        // EVSM moments with mips, the same layout as shadowMap
+uniform int cascadeCount;
+uniform mat4 cascadeMatrices[MAX_CASCADES];  // Matrix each layer was last rendered with
+uniform float cascadeScale[MAX_CASCADES];      // Share of the layer's width the cascade renders to
+uniform float cascadeWorldTexel[MAX_CASCADES]; // World size of one shadow texel
+uniform float cascadeDepthRange[MAX_CASCADES]; // World depth the cascade's [0, 1] covers
+uniform int shadowFilter;    // 0 PCF, 1 EVSM, ShadowFilter
+uniform int shadowPcfRadius; // PCF kernel of (2r+1)^2 comparisons
+uniform vec3 shadowEvsm;     // Positive and negative exponents, light bleeding reduction
+
+// Upper bound of the lit fraction from the mean and variance of the occluders. The bound is
+// cut under `bleed` and rescaled, which removes the faint light that leaks behind stacked occluders
+float Chebyshev(vec2 moments, float mean, float minVariance, float bleed)
+{
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = mean - moments.x;
+    float lit = variance / (variance + d * d);
+    lit = clamp((lit - bleed) / (1.0 - bleed), 0.0, 1.0);
+    return mean <= moments.x ? 1.0 : lit;
+}
+
+// One trilinear, anisotropic fetch of the prefiltered moments. Gradients come from the fragment
+// so the cascade choice, which varies between neighbours, doesn't break the mip selection
+float EvsmShadow(int cascade, vec2 uv, float depth, vec2 gradX, vec2 gradY)
+{
+    vec4 moments = textureGrad(shadowMoments, vec3(uv, cascade), gradX, gradY);
+    depth = 2.0 * depth - 1.0;
+    vec2 warped = vec2(exp(shadowEvsm.x * depth), -exp(-shadowEvsm.y * depth));
+    // Variance floor of the depth bias, scaled by the derivative of each warp
+    vec2 minVariance = 0.0001 * shadowEvsm.xy * warped;
+    minVariance *= minVariance;
+    float positive = Chebyshev(moments.xy, warped.x, minVariance.x, shadowEvsm.z);
+    float negative = Chebyshev(moments.zw, warped.y, minVariance.y, shadowEvsm.z);
+    return min(positive, negative);
+}
+
+// 1 lit, 0 in shadow. The first cascade containing the fragment is used rather than a split
+// distance, so a cascade that wasn't updated this frame is only used where it's still valid.
+// The position is pushed along the normal by a texel, then filtered by PCF or EVSM
+float CalcDirShadow(vec3 fragPos, vec3 normal)
+{
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    vec3 dx = dFdx(fragPos);
+    vec3 dy = dFdy(fragPos);
+    int radius = shadowFilter == 0 ? shadowPcfRadius : 1;
+    for (int i = 0 ; i < cascadeCount ; i++){
+        vec3 position = fragPos + normal * cascadeWorldTexel[i] * 1.5;
+        vec3 coords = (cascadeMatrices[i] * vec4(position, 1.0)).xyz * 0.5 + 0.5;
+        mat3 rotation = mat3(cascadeMatrices[i]); // Orthographic, the gradients only need the linear part
+        vec2 gradX = (rotation * dx).xy * 0.5 * cascadeScale[i];
+        vec2 gradY = (rotation * dy).xy * 0.5 * cascadeScale[i];
+        // The filter must stay inside the cascade. A mip of the moments averages 2^lod texels, the
+        // footprint of the fetch in texels, so coarse fetches need a margin that wide
+        float footprint = shadowFilter == 1 ? max(1.0, max(length(gradX), length(gradY)) / texel.x) : 1.0;
+        float margin = (float(radius) + 0.5) * footprint * texel.x / cascadeScale[i];
+        if (any(lessThan(coords.xy, vec2(margin))) || any(greaterThan(coords.xy, vec2(1.0 - margin))) || coords.z > 1.0)
+            continue;
+
+        float depth = coords.z - 0.5 * cascadeWorldTexel[i] / cascadeDepthRange[i];
+        vec2 uv = coords.xy * cascadeScale[i];
+        if (shadowFilter == 1)
+            return EvsmShadow(i, uv, depth, gradX, gradY);
+
+        float lit = 0.0;
+        for (int x = -radius ; x <= radius ; x++){
+            for (int y = -radius ; y <= radius ; y++)
+                lit += texture(shadowMap, vec4(uv + vec2(x, y) * texel, i, depth));
+        }
+        return lit / float((2 * radius + 1) * (2 * radius + 1));
+    }
+    return 1.0;
+}
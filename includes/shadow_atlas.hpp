@@ -0,0 +1,430 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_access.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "gl_state.hpp"
+#include "gl_trace.hpp"
+#include "gpu_timer.hpp"
+#include "shader.hpp"
+
+// Square power of two tiles out of a square power of two area. Free nodes are split in four
+// down to the requested size, and four free siblings merge back into their parent when freed
+class QuadtreeAllocator
+{
+    public:
+        QuadtreeAllocator(const int size = 0) { Reset(size); }
+
+        // Frees everything
+        void Reset(const int size)
+        {
+            m_nodes.assign(1, Node{0, 0, size, -1, -1, false});
+            m_freeGroups.clear();
+            m_usedArea = 0;
+        }
+
+        // Node of a free size x size tile, -1 when no free node is large enough. The smallest
+        // free node that fits is split, so large free nodes are kept for large requests
+        int Allocate(const int size)
+        {
+            int best = -1;
+            findFree(0, size, best);
+            if (best < 0)
+                return -1;
+            while (m_nodes[best].size > size){
+                split(best);
+                best = m_nodes[best].children;
+            }
+            m_nodes[best].used = true;
+            m_usedArea += (long long)size * size;
+            return best;
+        }
+
+        void Free(const int node)
+        {
+            m_nodes[node].used = false;
+            m_usedArea -= (long long)m_nodes[node].size * m_nodes[node].size;
+            int parent = m_nodes[node].parent;
+            while (parent >= 0 && freeLeaves(m_nodes[parent].children)){
+                m_freeGroups.push_back(m_nodes[parent].children);
+                m_nodes[parent].children = -1;
+                parent = m_nodes[parent].parent;
+            }
+        }
+
+        int X(const int node) const { return m_nodes[node].x; }
+        int Y(const int node) const { return m_nodes[node].y; }
+        int Size(const int node) const { return m_nodes[node].size; }
+
+        // Share of the area in allocated tiles
+        float Occupancy() const
+        {
+            long long size = m_nodes[0].size;
+            return size ? (float)((double)m_usedArea / (size * size)) : 0.f;
+        }
+
+    private:
+        struct Node
+        {
+            int x, y, size;
+            int parent;
+            int children; // First of four consecutive nodes, -1 for a leaf
+            bool used;
+        };
+
+        std::vector<Node> m_nodes;
+        std::vector<int> m_freeGroups; // Children of merged nodes, reused by the next split
+        long long m_usedArea = 0;
+
+        void findFree(const int node, const int size, int& best) const
+        {
+            const Node& n = m_nodes[node];
+            if (n.size < size || (best >= 0 && m_nodes[best].size == size))
+                return;
+            if (n.children >= 0){
+                for (int i = 0 ; i < 4 ; i++)
+                    findFree(n.children + i, size, best);
+                return;
+            }
+            if (!n.used && (best < 0 || n.size < m_nodes[best].size))
+                best = node;
+        }
+
+        void split(const int node)
+        {
+            int group;
+            if (!m_freeGroups.empty()){
+                group = m_freeGroups.back();
+                m_freeGroups.pop_back();
+            }
+            else {
+                group = (int)m_nodes.size();
+                m_nodes.resize(m_nodes.size() + 4);
+            }
+            Node parent = m_nodes[node];
+            int half = parent.size / 2;
+            for (int i = 0 ; i < 4 ; i++)
+                m_nodes[group + i] = Node{parent.x + (i % 2) * half, parent.y + (i / 2) * half, half, node, -1, false};
+            m_nodes[node].children = group;
+        }
+
+        bool freeLeaves(const int group) const
+        {
+            for (int i = 0 ; i < 4 ; i++){
+                if (m_nodes[group + i].used || m_nodes[group + i].children >= 0)
+                    return false;
+            }
+            return true;
+        }
+};
+
+// Spotlight as the atlas sees it, cutOff and outerCutOff are cosines like in the shaders
+struct SpotShadowLight
+{
+    glm::vec3 position;
+    glm::vec3 direction;
+    float cutOff;
+    float outerCutOff;
+    float range; // Far plane of the shadow, the light fades out to it
+    glm::vec3 color;
+};
+
+// Shadows of many spotlights in tiles of one depth texture. Each light gets a square tile from a
+// QuadtreeAllocator, sized from the share of the screen its cone covers, so every light shares one
+// framebuffer, one clear and one texture binding. A light whose size changes gets a new tile, and
+// when the atlas is too fragmented for it every tile is packed again, largest first.
+// Lights, matrices and tile rects reach the lighting shader through a shader storage buffer at
+// LIGHT_BINDING, laid out like SpotLight in light_casters/shaders/object.fs.
+//
+// Frame order: Update, BeginPass, for each light BeginLight then draw the casters CasterVisible
+// keeps, EndPass, then Bind on the programs receiving the shadows
+class ShadowAtlas
+{
+    public:
+        static const unsigned int MAX_LIGHTS = 64;
+        static const unsigned int LIGHT_BINDING = 4; // Binding of the SpotLights buffer
+        static const unsigned int GROW_COOLDOWN = 60; // Frames without growing tiles after a repack had to shrink some
+
+        ShadowAtlas(const int size = 4096, const int minTile = 64, const int maxTile = 1024)
+            : m_size(size), m_minTile(minTile), m_maxTile(std::min(maxTile, size)), m_allocator(size) {}
+
+        ~ShadowAtlas()
+        {
+            Release();
+        }
+
+        void Release()
+        {
+            if (m_framebuffer)
+                glDeleteFramebuffers(1, &m_framebuffer);
+            if (m_texture)
+                glDeleteTextures(1, &m_texture);
+            if (m_buffer)
+                glDeleteBuffers(1, &m_buffer);
+            m_framebuffer = m_texture = m_buffer = 0;
+            m_timer.Release();
+        }
+
+        // Sizes and places the tiles of this frame's lights and uploads the light buffer. Lights keep
+        // their index from frame to frame, past MAX_LIGHTS they're ignored
+        void Update(const std::vector<SpotShadowLight>& lights, const glm::mat4& projection, const glm::mat4& view, const float fovY)
+        {
+            unsigned int count = std::min((unsigned int)lights.size(), MAX_LIGHTS);
+            for (unsigned int i = count ; i < m_lights.size() ; i++){
+                if (m_lights[i].node >= 0)
+                    m_allocator.Free(m_lights[i].node);
+            }
+            m_lights.resize(count);
+
+            glm::mat4 viewProjection = projection * view;
+            glm::vec4 planes[6];
+            for (unsigned int i = 0 ; i < 3 ; i++){
+                planes[2 * i] = glm::row(viewProjection, 3) + glm::row(viewProjection, i);
+                planes[2 * i + 1] = glm::row(viewProjection, 3) - glm::row(viewProjection, i);
+            }
+            glm::vec3 camera(glm::inverse(view)[3]);
+            float tanY = std::tan(fovY * 0.5f);
+
+            std::vector<unsigned int> order(count);
+            for (unsigned int i = 0 ; i < count ; i++){
+                Light& light = m_lights[i];
+                light.light = lights[i];
+                light.desired = desiredSize(lights[i], planes, camera, tanY);
+                order[i] = i;
+            }
+            std::sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b){ return m_lights[a].desired > m_lights[b].desired; });
+
+            // Grow as soon as needed, shrink only once the tile is 4 times too large, so a light
+            // moving around a threshold doesn't get a new tile every frame
+            bool failed = false;
+            if (m_growCooldown)
+                m_growCooldown--;
+            for (unsigned int i : order){
+                Light& light = m_lights[i];
+                int target = light.size;
+                if (light.desired == 0 || light.size == 0 || (light.desired > light.size && !m_growCooldown) || light.desired * 2 < light.size)
+                    target = light.desired;
+                if (target == light.size && (light.node >= 0 || target == 0))
+                    continue;
+                if (light.node >= 0){
+                    m_allocator.Free(light.node);
+                    m_reallocations++;
+                }
+                light.size = target;
+                light.node = target ? m_allocator.Allocate(target) : -1;
+                failed = failed || (target && light.node < 0);
+            }
+            if (failed)
+                repack(order);
+
+            if (!m_buffer){
+                glCreateBuffers(1, &m_buffer);
+                glNamedBufferStorage(m_buffer, MAX_LIGHTS * sizeof(GpuLight), NULL, GL_DYNAMIC_STORAGE_BIT);
+            }
+            std::vector<GpuLight> entries(count);
+            for (unsigned int i = 0 ; i < count ; i++){
+                Light& light = m_lights[i];
+                const SpotShadowLight& spot = light.light;
+                // A little wider than the cone, the filter of the edge texels stays in the tile
+                float fov = std::min(2.f * std::acos(spot.outerCutOff) + glm::radians(2.f), glm::radians(170.f));
+                float near = std::max(0.05f, spot.range * 0.005f);
+                glm::vec3 up = std::fabs(glm::normalize(spot.direction).y) > 0.99f ? glm::vec3(1.f, 0.f, 0.f) : glm::vec3(0.f, 1.f, 0.f);
+                light.matrix = glm::perspective(fov, 1.f, near, spot.range) * glm::lookAt(spot.position, spot.position + spot.direction, up);
+                light.tanHalfFov = std::tan(fov * 0.5f);
+
+                GpuLight& entry = entries[i];
+                entry.matrix = light.matrix;
+                entry.rect = light.node >= 0
+                    ? glm::vec4(m_allocator.X(light.node), m_allocator.Y(light.node), light.size, light.size) / (float)m_size
+                    : glm::vec4(0.f);
+                entry.position = glm::vec4(spot.position, spot.range);
+                entry.direction = glm::vec4(glm::normalize(spot.direction), spot.cutOff);
+                entry.color = glm::vec4(spot.color, spot.outerCutOff);
+            }
+            if (count){
+                glNamedBufferSubData(m_buffer, 0, count * sizeof(GpuLight), entries.data());
+                if (g_glTrace.Recording())
+                    g_glTrace.BufferSubData(m_buffer, 0, entries.data(), count * sizeof(GpuLight));
+            }
+        }
+
+        // Whether the caster's bounding sphere can be in the cone of the light, and the light has a tile
+        bool CasterVisible(const unsigned int light, const glm::vec3& centre, const float radius) const
+        {
+            const Light& l = m_lights[light];
+            if (l.node < 0)
+                return false;
+            glm::vec3 direction = glm::normalize(l.light.direction);
+            glm::vec3 d = centre - l.light.position;
+            float along = glm::dot(d, direction);
+            if (along < -radius || along > l.light.range + radius)
+                return false;
+            float across = glm::length(d - along * direction);
+            return across <= along * l.tanHalfFov + radius * std::sqrt(1.f + l.tanHalfFov * l.tanHalfFov);
+        }
+
+        // Binds the atlas and clears it whole, once for every light
+        void BeginPass()
+        {
+            if (!m_texture)
+                create();
+            m_timer.Begin();
+            g_glState.BindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+            g_glState.Enable(GL_DEPTH_TEST);
+            g_glState.DepthMask(true);
+            g_glState.DepthFunc(GL_LESS);
+            g_glState.Viewport(0, 0, m_size, m_size);
+            g_glState.Clear(GL_DEPTH_BUFFER_BIT);
+        }
+
+        // Viewport on the light's tile and its matrix in the caster program's "lightMatrix".
+        // False when the light has no tile this frame, its casters are skipped
+        bool BeginLight(const unsigned int light, Shader& casterShader)
+        {
+            const Light& l = m_lights[light];
+            if (l.node < 0)
+                return false;
+            g_glState.Viewport(m_allocator.X(l.node), m_allocator.Y(l.node), l.size, l.size);
+            casterShader.Use();
+            casterShader.Set("lightMatrix"_uniform, l.matrix);
+            return true;
+        }
+
+        // Back to the default framebuffer and its viewport. Every `interval` seconds prints an [atlas] line
+        void EndPass(const int width, const int height, const double now, const double interval = 2.0)
+        {
+            g_glState.BindFramebuffer(GL_FRAMEBUFFER, 0);
+            g_glState.Viewport(0, 0, width, height);
+            m_timer.End();
+            m_frames++;
+
+            if (m_reportStart < 0.0)
+                m_reportStart = now;
+            if (now - m_reportStart < interval)
+                return;
+            m_reportStart = now;
+            unsigned int shadowed = 0;
+            for (const Light& light : m_lights)
+                shadowed += light.node >= 0;
+            std::printf("[atlas] gpu %.2f ms | %u of %u lights shadowed, %.0f%% of %dx%d used | %.2f new tiles, %.2f repacks per frame\n",
+                m_timer.TakeAverageMs(), shadowed, (unsigned int)m_lights.size(), 100.f * m_allocator.Occupancy(), m_size, m_size,
+                m_reallocations / (double)m_frames, m_repacks / (double)m_frames);
+            m_frames = m_reallocations = m_repacks = 0;
+        }
+
+        // Atlas texture, light buffer and count of the receivers
+        void Bind(const Shader& receiver, const unsigned int unit) const
+        {
+            g_glState.BindTexture(unit, GL_TEXTURE_2D, m_texture);
+            receiver.SetInt("shadowAtlas"_uniform, (int)unit);
+            receiver.SetInt("spotLightCount"_uniform, (int)m_lights.size());
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, m_buffer, 0, MAX_LIGHTS * sizeof(GpuLight));
+            if (g_glTrace.Recording())
+                g_glTrace.BindBufferRange(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, m_buffer, 0, MAX_LIGHTS * sizeof(GpuLight));
+        }
+
+        unsigned int Lights() const { return (unsigned int)m_lights.size(); }
+        unsigned int Texture() const { return m_texture; }
+
+    private:
+        // std430 layout of SpotLight in the shaders
+        struct GpuLight
+        {
+            glm::mat4 matrix;
+            glm::vec4 rect;      // Offset and size of the tile in atlas UVs, 0 without shadows
+            glm::vec4 position;  // Range in w
+            glm::vec4 direction; // cutOff in w
+            glm::vec4 color;     // outerCutOff in w
+        };
+
+        struct Light
+        {
+            SpotShadowLight light;
+            glm::mat4 matrix = glm::mat4(1.f);
+            float tanHalfFov = 1.f;
+            int desired = 0; // Tile size the coverage asks for, 0 out of view
+            int size = 0;    // Tile size it has
+            int node = -1;   // Tile of the allocator
+        };
+
+        int m_size, m_minTile, m_maxTile;
+        QuadtreeAllocator m_allocator;
+        std::vector<Light> m_lights;
+        unsigned int m_growCooldown = 0;
+
+        unsigned int m_framebuffer = 0, m_texture = 0, m_buffer = 0;
+        GpuTimer m_timer;
+        unsigned int m_frames = 0, m_reallocations = 0, m_repacks = 0;
+        double m_reportStart = -1.0;
+
+        // Screen radius of the cone's bounding sphere over the screen height, to a power of two
+        // between the min and max tile. 0 when the cone is out of view
+        int desiredSize(const SpotShadowLight& spot, const glm::vec4 (&planes)[6], const glm::vec3& camera, const float tanY) const
+        {
+            float cosine = std::max(spot.outerCutOff, 0.01f);
+            glm::vec3 direction = glm::normalize(spot.direction);
+            glm::vec3 centre;
+            float radius;
+            if (cosine >= 0.7071f){ // Under 45 degrees, the sphere passes through the apex and the rim
+                radius = spot.range / (2.f * cosine * cosine);
+                centre = spot.position + direction * radius;
+            }
+            else {
+                radius = spot.range * std::sqrt(1.f - cosine * cosine) / cosine;
+                centre = spot.position + direction * spot.range;
+            }
+            for (const glm::vec4& plane : planes){
+                if (glm::dot(glm::vec3(plane), centre) + plane.w < -radius * glm::length(glm::vec3(plane)))
+                    return 0;
+            }
+            float distance = glm::length(centre - camera);
+            float share = distance <= radius ? 1.f : radius / (std::sqrt(distance * distance - radius * radius) * tanY);
+            int size = m_minTile;
+            while (size < m_maxTile && size < share * m_maxTile)
+                size *= 2;
+            return size;
+        }
+
+        // Every tile again, largest first, so power of two squares pack without holes. Tiles that
+        // still don't fit are halved, down to no shadows under the minimum tile
+        void repack(const std::vector<unsigned int>& order)
+        {
+            m_allocator.Reset(m_size);
+            m_repacks++;
+            for (unsigned int i : order){
+                Light& light = m_lights[i];
+                light.node = -1;
+                while (light.size >= m_minTile && (light.node = m_allocator.Allocate(light.size)) < 0){
+                    light.size /= 2;
+                    m_growCooldown = GROW_COOLDOWN;
+                }
+                if (light.node < 0)
+                    light.size = 0;
+            }
+        }
+
+        void create()
+        {
+            glCreateTextures(GL_TEXTURE_2D, 1, &m_texture);
+            glTextureStorage2D(m_texture, 1, GL_DEPTH_COMPONENT32F, m_size, m_size);
+            glTextureParameteri(m_texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTextureParameteri(m_texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTextureParameteri(m_texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTextureParameteri(m_texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTextureParameteri(m_texture, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTextureParameteri(m_texture, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+            glCreateFramebuffers(1, &m_framebuffer);
+            glNamedFramebufferTexture(m_framebuffer, GL_DEPTH_ATTACHMENT, m_texture, 0);
+            glNamedFramebufferDrawBuffer(m_framebuffer, GL_NONE);
+            glNamedFramebufferReadBuffer(m_framebuffer, GL_NONE);
+            if (glCheckNamedFramebufferStatus(m_framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cerr << "Shadow atlas framebuffer is not complete\n";
+        }
+};
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "clustered_lights.hpp"
+#include "gl_state.hpp"
+#include "gpu_timer.hpp"
+#include "render_target_pool.hpp"
+#include "shader.hpp"
+
+// Layouts of includes/shaders/gbuffer.glsl
+enum class GBufferLayout
+{
+    Compact, // Albedo and specular RGBA8, octahedral normal and shininess RGB10_A2, positions from the depth
+    Wide     // Albedo and specular RGBA8, normal and shininess RGBA16F, world position RGBA16F
+};
+
+inline const char* GBufferLayoutName(const GBufferLayout layout)
+{
+    return layout == GBufferLayout::Compact ? "compact" : "wide";
+}
+
+// Colour formats of a layout, in attachment order
+inline std::vector<GLenum> GBufferFormats(const GBufferLayout layout)
+{
+    if (layout == GBufferLayout::Compact)
+        return {GL_RGBA8, GL_RGB10_A2};
+    return {GL_RGBA8, GL_RGBA16F, GL_RGBA16F};
+}
+
+// Memory traffic of one frame with a layout, counting each target texel once: the geometry pass
+// writes the G-buffer and its depth, the lighting pass reads them and writes the RGBA8 result,
+// the copy to the window reads the result and the depth and writes both. Overdraw, compression and
+// caches change the real numbers, this compares the layouts
+struct GBufferTraffic
+{
+    unsigned long long gbufferBytes = 0; // Targets and depth
+    unsigned long long geometryWrite = 0;
+    unsigned long long lightingRead = 0, lightingWrite = 0;
+    unsigned long long copyBytes = 0;
+
+    unsigned long long Total() const { return geometryWrite + lightingRead + lightingWrite + copyBytes; }
+};
+
+inline GBufferTraffic ComputeGBufferTraffic(const GBufferLayout layout, const int width, const int height)
+{
+    GBufferTraffic traffic;
+    RenderTextureDesc desc;
+    desc.width = width;
+    desc.height = height;
+    for (GLenum format : GBufferFormats(layout)){
+        desc.format = format;
+        traffic.gbufferBytes += RenderTextureBytes(desc);
+    }
+    desc.format = GL_DEPTH24_STENCIL8;
+    unsigned long long depth = RenderTextureBytes(desc);
+    desc.format = GL_RGBA8;
+    unsigned long long result = RenderTextureBytes(desc);
+    traffic.gbufferBytes += depth;
+    traffic.geometryWrite = traffic.gbufferBytes;
+    traffic.lightingRead = traffic.gbufferBytes;
+    traffic.lightingWrite = result;
+    traffic.copyBytes = 2 * (result + depth);
+    return traffic;
+}
+
+// Deferred path for scenes with many lights. The geometry pass samples the material maps once and
+// writes them with the normal into a G-buffer; tiled_deferred.comp then culls the lights of
+// ClusteredLights per 16x16 tile against the depth bounds of its pixels and shades every pixel
+// from the G-buffer, one read of the material for all its lights. The result and the depth are
+// copied to the default framebuffer, so forward passes (light cubes, transparent objects) follow.
+// Shadows stay on the forward path, the lighting pass has no derivatives for their filters.
+//
+// Every `interval` seconds a [deferred] line prints the GPU time of both passes and the traffic of
+// the layout from ComputeGBufferTraffic
+class TiledDeferred
+{
+    public:
+        static const int TILE = 16;                   // Match tiled_deferred.comp
+        static const unsigned int ALBEDO_UNIT = 5;    // Then normal, position and depth. 0 to 4 are the forward passes'
+        static constexpr glm::vec3 BACKGROUND = glm::vec3(0.1f);
+
+        // shaderDirectory holds tiled_deferred.comp
+        TiledDeferred(const GBufferLayout layout = GBufferLayout::Compact, const std::string& shaderDirectory = "../../includes/shaders/")
+            : m_layout(layout), m_shaderDirectory(shaderDirectory) {}
+
+        ~TiledDeferred()
+        {
+            Release();
+        }
+
+        void Release()
+        {
+            releaseTargets();
+            m_lighting.reset();
+            m_geometryTimer.Release();
+            m_lightingTimer.Release();
+        }
+
+        // Targets are created again with the next frame
+        void SetLayout(const GBufferLayout layout)
+        {
+            if (layout == m_layout)
+                return;
+            m_layout = layout;
+            releaseTargets();
+            PrintTraffic(m_width, m_height);
+        }
+
+        GBufferLayout Layout() const { return m_layout; }
+
+        // Built on the first call, its DirLight and SpotLight uniforms are the caller's
+        Shader& Lighting()
+        {
+            if (!m_lighting)
+                m_lighting = std::make_unique<Shader>((m_shaderDirectory + "tiled_deferred.comp").c_str());
+            return *m_lighting;
+        }
+
+        // Binds and clears the G-buffer at the size of the window. Draw with gbuffer.fs and its gbufferLayout
+        void BeginGeometry(const int width, const int height)
+        {
+            if (width != m_width || height != m_height)
+                releaseTargets();
+            m_width = width;
+            m_height = height;
+            if (!m_framebuffer)
+                createTargets();
+            m_geometryTimer.Begin();
+            g_glState.BindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+            g_glState.Enable(GL_DEPTH_TEST);
+            g_glState.DepthMask(true);
+            g_glState.DepthFunc(GL_LESS);
+            // Cleared texels are never read, the lighting pass skips pixels at the far plane
+            g_glState.Clear(GL_DEPTH_BUFFER_BIT);
+        }
+
+        void EndGeometry()
+        {
+            m_geometryTimer.End();
+        }
+
+        // Lights the G-buffer and copies the result and the depth to the default framebuffer, left bound
+        void Shade(const ClusteredLights& lights)
+        {
+            m_lightingTimer.Begin();
+            Shader& lighting = Lighting();
+            lighting.Use();
+            lights.BindLights(lighting);
+            lighting.SetInt("gbufferLayout"_uniform, (int)m_layout);
+            lighting.Set("background"_uniform, BACKGROUND);
+            static constexpr unsigned int SAMPLERS[4] = {"gbufferAlbedo"_uniform, "gbufferNormal"_uniform, "gbufferPosition"_uniform, "gbufferDepth"_uniform};
+            for (unsigned int i = 0 ; i < 4 ; i++){
+                g_glState.BindTexture(ALBEDO_UNIT + i, GL_TEXTURE_2D, m_textures[i]);
+                lighting.SetInt(SAMPLERS[i], (int)(ALBEDO_UNIT + i));
+            }
+            g_glState.BindImageTexture(0, m_result, 0, GL_WRITE_ONLY, GL_RGBA8);
+            g_glState.DispatchCompute((m_width + TILE - 1) / TILE, (m_height + TILE - 1) / TILE);
+            g_glState.MemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+
+            glBlitNamedFramebuffer(m_resultFramebuffer, 0, 0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            glBlitNamedFramebuffer(m_framebuffer, 0, 0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            g_glState.BindFramebuffer(GL_FRAMEBUFFER, 0);
+            m_lightingTimer.End();
+        }
+
+        // Traffic of every layout at this size, the current one marked
+        void PrintTraffic(const int width, const int height) const
+        {
+            if (width <= 0 || height <= 0) // Minimized, or no frame drawn yet
+                return;
+            for (GBufferLayout layout : {GBufferLayout::Compact, GBufferLayout::Wide}){
+                GBufferTraffic traffic = ComputeGBufferTraffic(layout, width, height);
+                std::printf("[deferred] %c %-7s %2llu bytes per pixel | %.2f MB per frame : geometry %.2f, lighting %.2f + %.2f, copy %.2f\n",
+                    layout == m_layout ? '*' : ' ', GBufferLayoutName(layout), traffic.gbufferBytes / ((unsigned long long)width * height),
+                    traffic.Total() / 1e6, traffic.geometryWrite / 1e6, traffic.lightingRead / 1e6, traffic.lightingWrite / 1e6, traffic.copyBytes / 1e6);
+            }
+        }
+
+        // Every `interval` seconds prints a [deferred] line, the bandwidth at the measured frame rate
+        void Report(const double now, const double interval = 2.0)
+        {
+            m_frames++;
+            if (m_reportStart < 0.0)
+                m_reportStart = now;
+            if (now - m_reportStart < interval)
+                return;
+            double fps = m_frames / (now - m_reportStart);
+            m_reportStart = now;
+            m_frames = 0;
+            GBufferTraffic traffic = ComputeGBufferTraffic(m_layout, m_width, m_height);
+            std::printf("[deferred] %s | geometry %.2f ms, lighting %.2f ms | %.2f MB per frame, %.2f GB/s at %.0f fps\n",
+                GBufferLayoutName(m_layout), m_geometryTimer.TakeAverageMs(), m_lightingTimer.TakeAverageMs(),
+                traffic.Total() / 1e6, traffic.Total() * fps / 1e9, fps);
+        }
+
+    private:
+        GBufferLayout m_layout;
+        std::string m_shaderDirectory;
+        std::unique_ptr<Shader> m_lighting;
+        int m_width = 0, m_height = 0;
+        unsigned int m_framebuffer = 0;
+        unsigned int m_textures[4] = {}; // Albedo, normal, position (wide only), depth
+        unsigned int m_result = 0, m_resultFramebuffer = 0;
+        GpuTimer m_geometryTimer, m_lightingTimer;
+        double m_reportStart = -1.0;
+        unsigned int m_frames = 0;
+
+        void createTargets()
+        {
+            std::vector<GLenum> formats = GBufferFormats(m_layout);
+            GLenum drawBuffers[3];
+            glCreateFramebuffers(1, &m_framebuffer);
+            for (unsigned int i = 0 ; i < formats.size() ; i++){
+                glCreateTextures(GL_TEXTURE_2D, 1, &m_textures[i]);
+                glTextureStorage2D(m_textures[i], 1, formats[i], m_width, m_height);
+                glNamedFramebufferTexture(m_framebuffer, GL_COLOR_ATTACHMENT0 + i, m_textures[i], 0);
+                drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+            }
+            glNamedFramebufferDrawBuffers(m_framebuffer, (int)formats.size(), drawBuffers);
+            glCreateTextures(GL_TEXTURE_2D, 1, &m_textures[3]);
+            glTextureStorage2D(m_textures[3], 1, GL_DEPTH24_STENCIL8, m_width, m_height);
+            glNamedFramebufferTexture(m_framebuffer, GL_DEPTH_STENCIL_ATTACHMENT, m_textures[3], 0);
+            if (glCheckNamedFramebufferStatus(m_framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::fprintf(stderr, "G-buffer framebuffer incomplete\n");
+
+            glCreateTextures(GL_TEXTURE_2D, 1, &m_result);
+            glTextureStorage2D(m_result, 1, GL_RGBA8, m_width, m_height);
+            glCreateFramebuffers(1, &m_resultFramebuffer);
+            glNamedFramebufferTexture(m_resultFramebuffer, GL_COLOR_ATTACHMENT0, m_result, 0);
+        }
+
+        void releaseTargets()
+        {
+            for (unsigned int& texture : m_textures){
+                if (texture)
+                    glDeleteTextures(1, &texture);
+                texture = 0;
+            }
+            if (m_result)
+                glDeleteTextures(1, &m_result);
+            if (m_framebuffer)
+                glDeleteFramebuffers(1, &m_framebuffer);
+            if (m_resultFramebuffer)
+                glDeleteFramebuffers(1, &m_resultFramebuffer);
+            m_result = m_framebuffer = m_resultFramebuffer = 0;
+        }
+};
@@ -18,12 +18,7 @@ struct Light
     // float linear;
     // float quadractic;
 
-    // Spotlight
-    vec3 position;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-
+    // Spotlights are in the SpotLights buffer below, these are the intensities they all share
     vec3 ambient;
     vec3 diffuse;
     vec3 specular;
@@ -34,9 +29,45 @@ in vec3 Normal;
 in vec3 FragPos;
 out vec4 FragColor;
 
+// Written by ShadowAtlas (includes/shadow_atlas.hpp), the camera's flashlight is the first one
+struct SpotLight
+{
+    mat4 matrix;    // World to the light's clip space
+    vec4 rect;      // Offset and size of the shadow tile in the atlas, size 0 without shadows
+    vec4 position;  // Range in w
+    vec4 direction; // cos(cutOff) in w
+    vec4 color;     // cos(outerCutOff) in w
+};
+
+layout(std430, binding = 4) readonly buffer SpotLights
+{
+    SpotLight spotLights[];
+};
+
 uniform Material material;
 uniform Light light;
 uniform vec3 viewPos;
+uniform int spotLightCount;
+uniform sampler2DShadow shadowAtlas;
+
+// 1 lit, 0 in shadow. The position is pushed along the normal and toward the light by a texel of
+// the tile at its distance, then 2x2 comparisons are filtered by the sampler
+float SpotShadow(SpotLight spot, vec3 norm, vec3 lightDir)
+{
+    if (spot.rect.z <= 0.0)
+        return 1.0;
+    float tileTexels = spot.rect.z * textureSize(shadowAtlas, 0).x;
+    float distance = length(spot.position.xyz - FragPos);
+    float tanHalfFov = sqrt(1.0 - spot.color.w * spot.color.w) / spot.color.w; // The tile covers about the outer cone
+    float texel = 2.0 * distance * tanHalfFov / tileTexels;
+    vec4 clip = spot.matrix * vec4(FragPos + (norm + lightDir) * texel, 1.0);
+    vec3 coords = clip.xyz / clip.w * 0.5 + 0.5;
+    if (clip.w <= 0.0 || coords.z > 1.0)
+        return 1.0;
+    // The filter must not read the neighbouring tiles
+    vec2 uv = clamp(coords.xy, vec2(0.5 / tileTexels), vec2(1.0 - 0.5 / tileTexels));
+    return texture(shadowAtlas, vec3(spot.rect.xy + uv * spot.rect.zw, coords.z));
+}
 
 void main()
 {
@@ -82,35 +113,37 @@ void main()
     // result *= attenuation;
     // FragColor = vec4(result, 1.0);
 
-    // Spotlight
-    vec3 lightDir = normalize(light.position - FragPos);
-    float theta = dot(lightDir, normalize(-light.direction));
-    float epsilon = light.cutOff - light.outerCutOff;
-    float intensity = clamp((theta - light.outerCutOff)/epsilon, 0.0, 1.0);
-    
-    // Ambient
-    vec3 ambient = light.ambient * texture(material.diffuse, TexCoords).rgb;
+    // Spotlights, the material maps are read once for all of them
+    vec3 diffuseColor = texture(material.diffuse, TexCoords).rgb;
+    vec3 specularColor = texture(material.specular, TexCoords).rgb;
+    vec3 norm = normalize(Normal);
+    vec3 viewDir = normalize(viewPos-FragPos);
+
+    // Ambient, once rather than per light to always keep some light
+    vec3 result = light.ambient * diffuseColor;
+
+    for (int i = 0 ; i < spotLightCount ; i++){
+        SpotLight spot = spotLights[i];
+        vec3 lightDir = normalize(spot.position.xyz - FragPos);
+        float theta = dot(lightDir, -spot.direction.xyz);
+        if (theta <= spot.color.w) // Fragment outside the spotlight
+            continue;
+        float epsilon = spot.direction.w - spot.color.w;
+        float intensity = clamp((theta - spot.color.w)/epsilon, 0.0, 1.0);
+        // Fades out to the range, the far plane of its shadow
+        float falloff = clamp(1.0 - length(spot.position.xyz - FragPos) / spot.position.w, 0.0, 1.0);
+        falloff *= falloff;
 
-    if (theta > light.outerCutOff){ // Fragment inside the spotlight
         // Diffuse
-        vec3 norm = normalize(Normal);
         float diff = max(dot(norm, lightDir), 0.);
-        vec3 diffuse = light.diffuse * diff * texture(material.diffuse, TexCoords).rgb;
+        vec3 diffuse = light.diffuse * diff * diffuseColor;
 
         // Specular
-        vec3 viewDir = normalize(viewPos-FragPos);
         vec3 reflectDir = reflect(-lightDir, norm);
         float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-        vec3 specular = light.specular * spec * texture(material.specular, TexCoords).rgb;
-
-        // Remove the 2 lines below to get hard edges
-        diffuse *= intensity;
-        specular *= intensity;
-        // Ambient is unaffected to always keep some light 
+        vec3 specular = light.specular * spec * specularColor;
 
-        vec3 result = ambient + diffuse + specular;
-        FragColor = vec4(result, 1.0);
-    } else { // Fragment outside the spotlight
-        FragColor = vec4(ambient, 1.0);
+        result += (diffuse + specular) * spot.color.rgb * intensity * falloff * SpotShadow(spot, norm, lightDir);
     }
+    FragColor = vec4(result, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,12 @@
+#version 460 core
+
+// Casters of the spotlight shadows, drawn into the light's tile of the atlas
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+uniform mat4 lightMatrix; // Set by ShadowAtlas::BeginLight
+
+void main()
+{
+    gl_Position = lightMatrix * model * vec4(aPos, 1.0);
+}
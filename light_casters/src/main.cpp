@@ -4,11 +4,16 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <math.h>
+#include <vector>
 
 #include "camera.hpp"
 #include "shader.hpp"
+#include "shadow_atlas.hpp"
 #include "stb_image.h"
 
 Camera camera;
@@ -16,7 +21,7 @@ float lastX = 400, lastY = 300; // Center of the screen
 bool firstMouse = true;
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height){
-    glViewport(0, 0, width, height);
+    g_glState.Viewport(0, 0, width, height);
 }
 
 void processInput(GLFWwindow* window, const float deltaTime){
@@ -56,8 +61,18 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(yoffset);
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    // --spotlights N moving spotlights besides the flashlight, --atlas-size <texels> of the shadow atlas
+    unsigned int spotlightCount = 16;
+    int atlasSize = 4096;
+    for (int i = 1 ; i < argc ; i++){
+        if (std::strcmp(argv[i], "--spotlights") == 0 && i + 1 < argc)
+            spotlightCount = (unsigned int)std::clamp(std::atoi(argv[++i]), 0, (int)ShadowAtlas::MAX_LIGHTS - 1);
+        else if (std::strcmp(argv[i], "--atlas-size") == 0 && i + 1 < argc)
+            atlasSize = std::max(256, std::atoi(argv[++i]));
+    }
+
     if (!glfwInit()){
         std::cerr << "Error at GLFW initialization\n";
         return -1;
@@ -149,6 +164,18 @@ int main()
         glm::vec3( 1.5f, 0.2f, -1.5f),
         glm::vec3(-1.3f, 1.0f, -1.5f)
     };
+
+    // Floor under the cubes, it receives the spotlights' shadows
+    float floor_vertices[] = {
+        -15.f, -3.5f, 8.f, 0.f, 1.f, 0.f, 0.f, 0.f,
+        15.f, -3.5f, 8.f, 0.f, 1.f, 0.f, 15.f, 0.f,
+        15.f, -3.5f, -25.f, 0.f, 1.f, 0.f, 15.f, 16.5f,
+        -15.f, -3.5f, -25.f, 0.f, 1.f, 0.f, 0.f, 16.5f
+    };
+    unsigned int floor_indices[] = {
+        0, 1, 2,
+        0, 2, 3
+    };
     
     // -----------------------------------
     // LOAD THE CUBE OBJECT TEXTURES
@@ -223,6 +250,25 @@ int main()
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
     
+    // FLOOR
+    unsigned int floorVAO, floorVBO, floorEBO;
+    glGenVertexArrays(1, &floorVAO);
+    glGenBuffers(1, &floorVBO);
+    glGenBuffers(1, &floorEBO);
+
+    glBindVertexArray(floorVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, floorVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(floor_vertices), floor_vertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(3*sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(6*sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, floorEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(floor_indices), floor_indices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+
     // -----------------------------------
 
     // LIGHT CUBE
@@ -265,10 +311,7 @@ int main()
     // objectShader.SetFloat("light.linear", 0.09f); // Kl
     // objectShader.SetFloat("light.quadratic", 0.032f); // Kq
 
-    // Spotlight
-    // Setting cutOff with the cosine of the angle, don't need to compute cos-1 in shader
-    objectShader.SetFloat("light.cutOff", glm::cos(glm::radians(12.5f)));
-    objectShader.SetFloat("light.outerCutOff", glm::cos(glm::radians(17.5f)));
+    // Spotlights go through the SpotLights buffer of the ShadowAtlas, see below
 
     int modelLocation = glGetUniformLocation(objectShader.m_id, "model");
     int viewLocation = glGetUniformLocation(objectShader.m_id, "view");
@@ -290,11 +333,30 @@ int main()
 
     lightShader.SetVec3("lightColor", glm::vec3(1.f));
 
+    // -----------------------------------
+    // SPOTLIGHT SHADOWS
+    // The flashlight and the moving spotlights share one atlas, tiles follow their size on screen
+
+    Shader casterShader("../shaders/shadow.vs", "../../includes/shaders/depth_only.fs");
+    ShadowAtlas atlas(atlasSize);
+    const unsigned int ATLAS_UNIT = 2; // 0 and 1 are the material maps
+    const float CUBE_RADIUS = 0.87f;   // Bounding sphere of a unit cube
+
+    glm::mat4 cubeModels[10];
+    for (unsigned int i = 0 ; i < 10 ; i++){
+        cubeModels[i] = glm::translate(glm::mat4(1.f), cubePositions[i]);
+        cubeModels[i] = glm::rotate(cubeModels[i], glm::radians(20.f * i), glm::vec3(1.f, 0.3f, 0.5f));
+    }
+    std::vector<SpotShadowLight> spotlights(1 + spotlightCount);
+
     // -----------------------------------
 
     float deltaTime = 0.f;
     float lastFrame = 0.f;
 
+    // Setup bound objects directly, from here state goes through GLState
+    g_glState.Reset();
+
     while (!glfwWindowShouldClose(window)){
         processInput(window, deltaTime);
 
@@ -302,31 +364,62 @@ int main()
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
         
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), 800.f/600.f, 0.1f, 100.f);
+        glm::mat4 view = glm::lookAt(camera.Position, camera.Position+camera.Front, camera.Up); 
+
+        // -----------------------------------
+        // SPOTLIGHT SHADOWS
+
+        // Setting cutOff with the cosine of the angle, don't need to compute cos-1 in shader
+        spotlights[0] = SpotShadowLight{camera.Position, camera.Front, glm::cos(glm::radians(12.5f)), glm::cos(glm::radians(17.5f)), 40.f, glm::vec3(1.f)};
+        for (unsigned int i = 1 ; i <= spotlightCount ; i++){
+            // A ring of lights above the cubes, each sweeping its own spot of the floor
+            float phase = 6.2831853f * i / spotlightCount;
+            float angle = 0.3f * currentFrame + phase;
+            float ring = 6.f + 2.f * (i % 3);
+            glm::vec3 position(std::cos(angle) * ring, 5.f + (i % 4), -6.f + std::sin(angle) * ring);
+            glm::vec3 target(2.f * std::cos(1.7f * angle), -3.5f, -6.f + 4.f * std::sin(1.3f * angle));
+            glm::vec3 color = 0.6f * (0.5f + 0.5f * glm::cos(phase + glm::vec3(0.f, 2.094f, 4.189f)));
+            spotlights[i] = SpotShadowLight{position, target - position, glm::cos(glm::radians(20.f)), glm::cos(glm::radians(25.f)), 25.f, color};
+        }
+        atlas.Update(spotlights, projection, view, glm::radians(camera.Zoom));
+
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        atlas.BeginPass();
+        g_glState.BindVertexArray(cubeVAO);
+        for (unsigned int l = 0 ; l < atlas.Lights() ; l++){
+            if (!atlas.BeginLight(l, casterShader))
+                continue;
+            for (unsigned int i = 0 ; i < 10 ; i++){
+                if (!atlas.CasterVisible(l, cubePositions[i], CUBE_RADIUS))
+                    continue;
+                casterShader.Set("model"_uniform, cubeModels[i]);
+                g_glState.DrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT);
+            }
+        }
+        atlas.EndPass(framebufferWidth, framebufferHeight, glfwGetTime());
+
+        g_glState.Clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
         // -----------------------------------
-        // CUBE OBJECT
+        // CUBE OBJECT and FLOOR
 
         objectShader.Use();
         objectShader.SetVec3("viewPos", camera.Position);
-        objectShader.SetVec3("light.position", camera.Position);
-        objectShader.SetVec3("light.direction", camera.Front);
-
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), 800.f/600.f, 0.1f, 100.f);
+        atlas.Bind(objectShader, ATLAS_UNIT);
         glUniformMatrix4fv(projectionLocation, 1, GL_FALSE, glm::value_ptr(projection));
-
-        glm::mat4 view = glm::lookAt(camera.Position, camera.Position+camera.Front, camera.Up); 
         glUniformMatrix4fv(viewLocation, 1, GL_FALSE, glm::value_ptr(view));
         
-        glBindVertexArray(cubeVAO);
+        g_glState.BindVertexArray(cubeVAO);
         for (unsigned int i = 0 ; i < 10 ; i++){
-            glm::mat4 cube_model = glm::mat4(1.f);
-            cube_model = glm::translate(cube_model, cubePositions[i]);
-            float angle = 20.f * i;
-            cube_model = glm::rotate(cube_model, glm::radians(angle), glm::vec3(1.f, 0.3f, 0.5f));
-            glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(cube_model));
-            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+            glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(cubeModels[i]));
+            g_glState.DrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT);
         }
+        glm::mat4 floor_model = glm::mat4(1.f);
+        glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(floor_model));
+        g_glState.BindVertexArray(floorVAO);
+        g_glState.DrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT);
 
         // -----------------------------------
         // LIGHT CUBE
@@ -336,12 +429,22 @@ int main()
         glUniformMatrix4fv(projectionLocationLight, 1, GL_FALSE, glm::value_ptr(projection));
         glUniformMatrix4fv(viewLocationLight, 1, GL_FALSE, glm::value_ptr(view));
 
-        glBindVertexArray(lightVAO);
+        g_glState.BindVertexArray(lightVAO);
         glm::mat4 light_model = glm::mat4(1.f);
         light_model = glm::translate(light_model, lightPos);
         light_model = glm::scale(light_model, glm::vec3(0.2f));
+        lightShader.SetVec3("lightColor", glm::vec3(1.f));
         glUniformMatrix4fv(modelLocationLight, 1, GL_FALSE, glm::value_ptr(light_model));
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+        g_glState.DrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT);
+
+        // Moving spotlights, the flashlight is the camera
+        for (unsigned int i = 1 ; i < spotlights.size() ; i++){
+            light_model = glm::translate(glm::mat4(1.f), spotlights[i].position);
+            light_model = glm::scale(light_model, glm::vec3(0.2f));
+            lightShader.SetVec3("lightColor", spotlights[i].color / 0.6f);
+            glUniformMatrix4fv(modelLocationLight, 1, GL_FALSE, glm::value_ptr(light_model));
+            g_glState.DrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT);
+        }
 
         // -----------------------------------
 
@@ -351,7 +454,11 @@ int main()
 
     glDeleteVertexArrays(1, &cubeVAO);
     glDeleteVertexArrays(1, &lightVAO);
+    glDeleteVertexArrays(1, &floorVAO);
     glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &floorVBO);
+    glDeleteBuffers(1, &floorEBO);
+    atlas.Release();
     
     glfwDestroyWindow(window);
     glfwTerminate();
@@ -0,0 +1,16 @@
+#version 460 core
+
+// Depth pre-pass, position only. gl_Position is computed like object.vs, GL_EQUAL needs the same depth
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+invariant gl_Position;
+
+void main()
+{
+    vec3 FragPos = vec3(model * vec4(aPos, 1.0));
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -50,21 +50,25 @@ uniform Material material;
 uniform PointLight pointLights[NR_POINT_LIGHT];
 uniform SpotLight spotLight;
 
+// Maps sampled once in main, every light reuses them
+vec3 materialDiffuse;
+vec3 materialSpecular;
+
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
 {
     // Ambient
-    vec3 ambient = light.ambient * texture(material.texture_diffuse1, TexCoords).rgb;
+    vec3 ambient = light.ambient * materialDiffuse;
 
     // Diffuse
     vec3 norm = normalize(Normal);
     vec3 lightDir = normalize(-light.direction); // Must be inverted 
     float diff = max(dot(norm, lightDir), 0.);
-    vec3 diffuse = light.diffuse * diff * texture(material.texture_diffuse1, TexCoords).rgb;
+    vec3 diffuse = light.diffuse * diff * materialDiffuse;
 
     // Specular
     vec3 reflectDir = reflect(-lightDir, norm);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    vec3 specular = light.specular * spec * texture(material.texture_specular1, TexCoords).rgb;
+    vec3 specular = light.specular * spec * materialSpecular;
 
     return ambient + diffuse + specular;
 }
@@ -75,17 +79,17 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float attenuation = 1.0 / (light.constant + light.linear*distance + light.quadratic * (distance*distance));
     
     // Ambient
-    vec3 ambient = light.ambient * texture(material.texture_diffuse1, TexCoords).rgb;
+    vec3 ambient = light.ambient * materialDiffuse;
 
     // Diffuse
     vec3 lightDir = normalize(light.position - fragPos);
     float diff = max(dot(normal, lightDir), 0.);
-    vec3 diffuse = light.diffuse * diff * texture(material.texture_diffuse1, TexCoords).rgb;
+    vec3 diffuse = light.diffuse * diff * materialDiffuse;
 
     // Specular
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    vec3 specular = light.specular * spec * texture(material.texture_specular1, TexCoords).rgb;
+    vec3 specular = light.specular * spec * materialSpecular;
 
     // ambient *= attenuation;
     diffuse *= attenuation;
@@ -102,16 +106,16 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float intensity = clamp((theta - light.outerCutOff)/epsilon, 0.0, 1.0);
     
     // Ambient
-    vec3 ambient = light.ambient * texture(material.texture_diffuse1, TexCoords).rgb;
+    vec3 ambient = light.ambient * materialDiffuse;
 
     // Diffuse
     float diff = max(dot(normal, lightDir), 0.);
-    vec3 diffuse = light.diffuse * diff * texture(material.texture_diffuse1, TexCoords).rgb;
+    vec3 diffuse = light.diffuse * diff * materialDiffuse;
 
     // Specular
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    vec3 specular = light.specular * spec * texture(material.texture_specular1, TexCoords).rgb;
+    vec3 specular = light.specular * spec * materialSpecular;
 
     ambient *= intensity;
     diffuse *= intensity;
@@ -121,6 +125,8 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 
 void main()
 {
+    materialDiffuse = texture(material.texture_diffuse1, TexCoords).rgb;
+    materialSpecular = texture(material.texture_specular1, TexCoords).rgb;
     vec3 viewDir = normalize(viewPos-FragPos);
     vec3 norm = normalize(Normal);
     vec3 result = vec3(0.0);
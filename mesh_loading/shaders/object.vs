@@ -12,6 +12,8 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+invariant gl_Position; // Same depth as depth.vs for the GL_EQUAL test after the pre-pass
+
 void main()
 {
     FragPos = vec3(model * vec4(aPos, 1.0)); // World space position of the fragment
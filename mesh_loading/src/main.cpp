@@ -4,10 +4,14 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cstring>
 #include <iostream>
 #include <math.h>
 
 #include "camera.hpp"
+#include "depth_prepass.hpp"
+#include "frame_stats.hpp"
+#include "gl_state.hpp"
 #include "mesh.hpp"
 #include "model.hpp"
 #include "shader.hpp"
@@ -16,9 +20,11 @@
 Camera camera;
 float lastX = 400, lastY = 300; // Center of the screen
 bool firstMouse = true;
+bool prepassKeyDown = false;
+bool prepassToggled = false;
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height){
-    glViewport(0, 0, width, height);
+    g_glState.Viewport(0, 0, width, height);
 }
 
 void processInput(GLFWwindow* window, const float deltaTime){
@@ -37,6 +43,11 @@ void processInput(GLFWwindow* window, const float deltaTime){
         camera.ProcessKeyboard(Camera_Movement::UP, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL))
         camera.ProcessKeyboard(Camera_Movement::DOWN, deltaTime);
+
+    // P switches the depth pre-pass
+    bool prepassDown = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+    prepassToggled = prepassDown && !prepassKeyDown;
+    prepassKeyDown = prepassDown;
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos){
@@ -58,8 +69,19 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(yoffset);
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    // --trace <file> records one frame once the scene is warm, for the replay project
+    const char* tracePath = NULL;
+    const unsigned int TRACE_FRAME = 60;
+    bool prepassEnabled = false; // --prepass starts with the depth pre-pass on
+    for (int i = 1 ; i < argc ; i++){
+        if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (std::strcmp(argv[i], "--prepass") == 0)
+            prepassEnabled = true;
+    }
+
     if (!glfwInit()){
         std::cerr << "Error at GLFW initialization\n";
         return -1;
@@ -84,8 +106,8 @@ int main()
         return -1;
     }
 
-    glViewport(0, 0, 800, 600);
-    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    g_glState.Viewport(0, 0, 800, 600);
+    g_glState.ClearColor(0.1f, 0.1f, 0.1f, 1.0f);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     glfwSetCursorPosCallback(window, mouse_callback);
@@ -93,7 +115,7 @@ int main()
 
     stbi_set_flip_vertically_on_load(true);
 
-    glEnable(GL_DEPTH_TEST); // Disabled by default
+    g_glState.Enable(GL_DEPTH_TEST); // Disabled by default
 
     float cube_vertices[] = {
         // Back face
@@ -160,12 +182,12 @@ int main()
 
     unsigned int VBO, lightVAO, EBO;
     glGenVertexArrays(1, &lightVAO);
-    glBindVertexArray(lightVAO);
+    g_glState.BindVertexArray(lightVAO);
 
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    g_glState.BindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_STATIC_DRAW);
     
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)0);
@@ -180,9 +202,9 @@ int main()
     Shader objectShader("../shaders/object.vs", "../shaders/object.fs");
     objectShader.Use();
 
-    int modelLocation = glGetUniformLocation(objectShader.m_id, "model");
-    int viewLocation = glGetUniformLocation(objectShader.m_id, "view");
-    int projectionLocation = glGetUniformLocation(objectShader.m_id, "projection");
+    Uniform<glm::mat4> modelUniform = objectShader.GetUniform<glm::mat4>("model");
+    Uniform<glm::mat4> viewUniform = objectShader.GetUniform<glm::mat4>("view");
+    Uniform<glm::mat4> projectionUniform = objectShader.GetUniform<glm::mat4>("projection");
 
     objectShader.SetFloat("material.shininess", 32.f);
 
@@ -224,69 +246,112 @@ int main()
 
     Shader lightShader("../shaders/light.vs", "../shaders/light.fs");
     lightShader.Use();
-    int modelLocationLight = glGetUniformLocation(lightShader.m_id, "model");
-    int viewLocationLight = glGetUniformLocation(lightShader.m_id, "view");
-    int projectionLocationLight = glGetUniformLocation(lightShader.m_id, "projection");
+    Uniform<glm::mat4> modelUniformLight = lightShader.GetUniform<glm::mat4>("model");
+    Uniform<glm::mat4> viewUniformLight = lightShader.GetUniform<glm::mat4>("view");
+    Uniform<glm::mat4> projectionUniformLight = lightShader.GetUniform<glm::mat4>("projection");
+
+    // -----------------------------------
+    // DEPTH PRE-PASS SHADER
+
+    Shader depthShader("../shaders/depth.vs", "../../includes/shaders/depth_only.fs");
+    depthShader.Use();
+    Uniform<glm::mat4> modelUniformDepth = depthShader.GetUniform<glm::mat4>("model");
+    Uniform<glm::mat4> viewUniformDepth = depthShader.GetUniform<glm::mat4>("view");
+    Uniform<glm::mat4> projectionUniformDepth = depthShader.GetUniform<glm::mat4>("projection");
+    DepthPrepass prepass(prepassEnabled);
 
     // -----------------------------------
 
     Model backpack_model("../../assets/backpack/backpack.obj");
-    
+    g_glState.Reset(); // Textures were bound directly while loading the model
+
     float deltaTime = 0.f;
     float lastFrame = 0.f;
+    FrameStatsReporter frameStats;
+    unsigned int frameIndex = 0;
 
     while (!glfwWindowShouldClose(window)){
         processInput(window, deltaTime);
+        if (tracePath && frameIndex == TRACE_FRAME)
+            g_glTrace.Begin(tracePath);
 
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        if (prepassToggled)
+            prepass.SetEnabled(!prepass.Enabled());
         
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        
-        objectShader.Use();
-        objectShader.SetVec3("viewPos", camera.Position);
-        objectShader.SetVec3("spotLight.position", camera.Position);
-        objectShader.SetVec3("spotLight.direction", camera.Front);
+        prepass.BeginFrame();
+        g_glState.Clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), 800.f/600.f, 0.1f, 100.f);
-        glUniformMatrix4fv(projectionLocation, 1, GL_FALSE, glm::value_ptr(projection));
-
         glm::mat4 view = glm::lookAt(camera.Position, camera.Position+camera.Front, camera.Up); 
-        glUniformMatrix4fv(viewLocation, 1, GL_FALSE, glm::value_ptr(view));
-
-        // -----------------------------------
-        // OBJECT
-        
         glm::mat4 model = glm::mat4(1.0f);
         model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
         model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));
-        glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(model));
+
+        // -----------------------------------
+        // DEPTH PRE-PASS
+
+        if (prepass.Enabled()){
+            prepass.BeginDepth();
+            depthShader.Use();
+            depthShader.Set(projectionUniformDepth, projection);
+            depthShader.Set(viewUniformDepth, view);
+            depthShader.Set(modelUniformDepth, model);
+            backpack_model.DrawDepth();
+            prepass.EndDepth();
+        }
+        
+        // -----------------------------------
+        // OBJECT
+
+        prepass.BeginShading();
+        objectShader.Use();
+        objectShader.SetVec3("viewPos", camera.Position);
+        objectShader.SetVec3("spotLight.position", camera.Position);
+        objectShader.SetVec3("spotLight.direction", camera.Front);
+        objectShader.Set(projectionUniform, projection);
+        objectShader.Set(viewUniform, view);
+        objectShader.Set(modelUniform, model);
         backpack_model.Draw(objectShader);
+        prepass.EndShading();
 
         // -----------------------------------
         // LIGHT CUBES
 
         lightShader.Use();
 
-        glUniformMatrix4fv(projectionLocationLight, 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(viewLocationLight, 1, GL_FALSE, glm::value_ptr(view));
+        lightShader.Set(projectionUniformLight, projection);
+        lightShader.Set(viewUniformLight, view);
 
-        glBindVertexArray(lightVAO);
-        for (unsigned int i = 0 ; i < 4 ; i++){
+        g_glState.BindVertexArray(lightVAO);
+        for (unsigned int i = 0 ; i < 3 ; i++){
             glm::mat4 light_model = glm::mat4(1.f);
             light_model = glm::translate(light_model, pointLightPositions[i]);
             light_model = glm::scale(light_model, glm::vec3(0.2f));
-            glUniformMatrix4fv(modelLocationLight, 1, GL_FALSE, glm::value_ptr(light_model));
+            lightShader.Set(modelUniformLight, light_model);
             lightShader.SetVec3("lightColor", pointLightColors[i]);
-            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+            g_glState.DrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT);
         }
 
         // -----------------------------------
 
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        prepass.EndFrame(glfwGetTime(), framebufferWidth * framebufferHeight);
+        frameStats.EndFrame(glfwGetTime());
+        if (g_glTrace.Recording()){
+            g_glTrace.EndFrame();
+            g_glTrace.End();
+        }
+        frameIndex++;
+
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
+
+    prepass.Release();
     
     glfwDestroyWindow(window);
     glfwTerminate();
@@ -2,9 +2,9 @@
 
 layout (location = 0) in vec3 aPos;
 
+#include "../../includes/shaders/frame_data.glsl"
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main()
 {
@@ -1,134 +1,19 @@
 #version 460 core
 
-#define NR_POINT_LIGHT 4
-
-struct Material
-{
-    sampler2D diffuse;
-    sampler2D specular;
-    float shininess;
-};
-
-struct DirLight
-{
-    vec3 direction;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct PointLight
-{
-    vec3 position;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-    float constant;
-    float linear;
-    float quadratic;
-};
-
-struct SpotLight
-{
-    vec3 position;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
+// NR_POINT_LIGHT, DIR_LIGHT, SPOT_LIGHT... are defined by the PhongVariant this program is built for
 
 in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
 out vec4 FragColor;
 
-uniform Material material;
-uniform DirLight dirLight;
-uniform PointLight pointLights[NR_POINT_LIGHT];
-uniform SpotLight spotLight;
-uniform vec3 viewPos;
-
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
-{
-    // Ambient
-    vec3 ambient = light.ambient * texture(material.diffuse, TexCoords).rgb;
-
-    // Diffuse
-    vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(-light.direction); // Must be inverted 
-    float diff = max(dot(norm, lightDir), 0.);
-    vec3 diffuse = light.diffuse * diff * texture(material.diffuse, TexCoords).rgb;
-
-    // Specular
-    vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    vec3 specular = light.specular * spec * texture(material.specular, TexCoords).rgb;
-
-    return ambient + diffuse + specular;
-}
-
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
-{
-    float distance = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear*distance + light.quadratic * (distance*distance));
-    
-    // Ambient
-    vec3 ambient = light.ambient * texture(material.diffuse, TexCoords).rgb;
-
-    // Diffuse
-    vec3 lightDir = normalize(light.position - fragPos);
-    float diff = max(dot(normal, lightDir), 0.);
-    vec3 diffuse = light.diffuse * diff * texture(material.diffuse, TexCoords).rgb;
-
-    // Specular
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    vec3 specular = light.specular * spec * texture(material.specular, TexCoords).rgb;
-
-    ambient *= attenuation;
-    diffuse *= attenuation;
-    specular *= attenuation;
-
-    return (ambient + diffuse + specular);
-}
-
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
-{
-    vec3 lightDir = normalize(light.position - fragPos);
-    float theta = dot(lightDir, normalize(-light.direction));
-    float epsilon = light.cutOff - light.outerCutOff;
-    float intensity = clamp((theta - light.outerCutOff)/epsilon, 0.0, 1.0);
-    
-    // Ambient
-    vec3 ambient = light.ambient * texture(material.diffuse, TexCoords).rgb;
-
-    // Diffuse
-    float diff = max(dot(normal, lightDir), 0.);
-    vec3 diffuse = light.diffuse * diff * texture(material.diffuse, TexCoords).rgb;
-
-    // Specular
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    vec3 specular = light.specular * spec * texture(material.specular, TexCoords).rgb;
-
-    ambient *= intensity;
-    diffuse *= intensity;
-    specular *= intensity;
-    return ambient + diffuse + specular;
-}
+#include "../../includes/shaders/frame_data.glsl"
+#include "../../includes/shaders/phong.glsl"
 
 void main()
 {
-    vec3 viewDir = normalize(viewPos-FragPos);
+    vec3 viewDir = normalize(cameraPosition.xyz-FragPos);
     vec3 norm = normalize(Normal);
 
-    // vec3 result = CalcDirLight(dirLight, norm, viewDir);
-    vec3 result = vec3(0.);
-    for (int i = 0 ; i < NR_POINT_LIGHT ; i++){
-        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);
-    }
-    // result += CalcSpotLight(spotLight, norm, FragPos, viewDir);
-    FragColor = vec4(result, 1.0);
-}
\ No newline at end of file
+    FragColor = vec4(CalcLighting(norm, FragPos, viewDir), 1.0);
+}
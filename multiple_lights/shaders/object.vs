@@ -8,9 +8,11 @@ out vec3 Normal;
 out vec3 FragPos;
 out vec2 TexCoords;
 
+#include "../../includes/shaders/frame_data.glsl"
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+invariant gl_Position; // Same depth as depth.vs for the GL_EQUAL test after the pre-pass
 
 void main()
 {
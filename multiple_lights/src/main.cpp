@@ -5,18 +5,82 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <math.h>
+#include <random>
 
 #include "camera.hpp"
+#include "cascaded_shadows.hpp"
+#include "clustered_lights.hpp"
+#include "point_shadows.hpp"
+#include "command_list.hpp"
+#include "depth_prepass.hpp"
+#include "frame_data.hpp"
+#include "frame_stats.hpp"
+#include "gl_state.hpp"
+#include "gpu_timer.hpp"
+#include "job_pool.hpp"
 #include "shader.hpp"
+#include "shader_manager.hpp"
+#include "shader_variants.hpp"
 #include "stb_image.h"
+#include "tiled_deferred.hpp"
 
 Camera camera;
 float lastX = 400, lastY = 300; // Center of the screen
 bool firstMouse = true;
 
+// Selected with the 1, 2 and 3 keys. Point lights come from ClusteredLights
+constexpr PhongVariant objectVariants[] = {
+    {0, true, true, true, true, false, false, true},   // Every light, as the chapter always lit the scene, no shadows
+    {0, true, true, true, true, true, true, true},     // Every light, shadows of the directional and point lights
+    {0, true, false, true, false, true},               // Directional light with shadows, constant specular color
+};
+unsigned int selectedVariant = 0;
+bool prepassKeyDown = false;
+bool prepassToggled = false;
+bool shadowCacheKeyDown = false;
+bool shadowCacheToggled = false;
+
+// Filters of the directional shadows, cycled with F and by --filter-benchmark. PCF sizes are the kernel width
+struct ShadowFilterMode
+{
+    const char* name;
+    ShadowFilter filter;
+    int pcfRadius;
+};
+constexpr ShadowFilterMode shadowFilterModes[] = {
+    {"pcf1", ShadowFilter::Pcf, 0},
+    {"pcf3", ShadowFilter::Pcf, 1},
+    {"pcf5", ShadowFilter::Pcf, 2},
+    {"pcf7", ShadowFilter::Pcf, 3},
+    {"evsm", ShadowFilter::Evsm, 0},
+};
+constexpr unsigned int SHADOW_FILTER_MODES = sizeof(shadowFilterModes) / sizeof(shadowFilterModes[0]);
+// EVSM light bleeding reductions, cycled with B
+constexpr float bleedReductions[] = {0.f, 0.15f, 0.3f, 0.5f};
+unsigned int selectedFilter = 1;
+unsigned int selectedBleed = 2;
+bool filterKeyDown = false;
+bool filterToggled = false;
+bool bleedKeyDown = false;
+bool bleedToggled = false;
+bool binningKeyDown = false;
+bool binningToggled = false;
+bool deferredKeyDown = false;
+bool deferredToggled = false;
+bool layoutKeyDown = false;
+bool layoutToggled = false;
+bool lightCountKeyDown = false;
+int lightCountStep = 0; // +1 doubles the extra lights, -1 halves them
+float lightTurn = 0.f; // Radians the directional light turns this frame
+
 void framebuffer_size_callback(GLFWwindow* window, int width, int height){
-    glViewport(0, 0, width, height);
+    g_glState.Viewport(0, 0, width, height);
 }
 
 void processInput(GLFWwindow* window, const float deltaTime){
@@ -35,6 +99,49 @@ void processInput(GLFWwindow* window, const float deltaTime){
         camera.ProcessKeyboard(Camera_Movement::UP, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL))
         camera.ProcessKeyboard(Camera_Movement::DOWN, deltaTime);
+
+    for (unsigned int i = 0 ; i < 3 ; i++){
+        if (glfwGetKey(window, GLFW_KEY_1 + i) == GLFW_PRESS)
+            selectedVariant = i;
+    }
+
+    // P switches the depth pre-pass
+    bool prepassDown = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+    prepassToggled = prepassDown && !prepassKeyDown;
+    prepassKeyDown = prepassDown;
+
+    // C switches the static shadow cache, holding L turns the directional light
+    bool shadowCacheDown = glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS;
+    shadowCacheToggled = shadowCacheDown && !shadowCacheKeyDown;
+    shadowCacheKeyDown = shadowCacheDown;
+    lightTurn = glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS ? 0.5f * deltaTime : 0.f;
+
+    // F cycles the shadow filters, B the EVSM light bleeding reduction
+    bool filterDown = glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS;
+    filterToggled = filterDown && !filterKeyDown;
+    filterKeyDown = filterDown;
+    bool bleedDown = glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS;
+    bleedToggled = bleedDown && !bleedKeyDown;
+    bleedKeyDown = bleedDown;
+
+    // G switches the light lists between the GPU culling pass and the CPU binning
+    bool binningDown = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+    binningToggled = binningDown && !binningKeyDown;
+    binningKeyDown = binningDown;
+
+    // T switches between forward and tiled deferred shading, Y the layout of the G-buffer
+    bool deferredDown = glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS;
+    deferredToggled = deferredDown && !deferredKeyDown;
+    deferredKeyDown = deferredDown;
+    bool layoutDown = glfwGetKey(window, GLFW_KEY_Y) == GLFW_PRESS;
+    layoutToggled = layoutDown && !layoutKeyDown;
+    layoutKeyDown = layoutDown;
+
+    // + and - double and halve the extra lights, a new light buffer copy without any recompile
+    bool moreDown = glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS;
+    bool fewerDown = glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS;
+    lightCountStep = lightCountKeyDown ? 0 : moreDown ? 1 : fewerDown ? -1 : 0;
+    lightCountKeyDown = moreDown || fewerDown;
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos){
@@ -56,8 +163,69 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(yoffset);
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    auto startupBegin = std::chrono::steady_clock::now();
+    unsigned int cubeCount = 10; // --cubes N repeats the 10 cubes in a grid
+    bool prepassEnabled = false; // --prepass starts with the depth pre-pass on
+    // Cascaded shadows : --cascades N, --shadow-size <texels> of the texture, --cascade-sizes a,b,...
+    // for the resolution of each cascade, --shadow-budget <ms> before cascade updates are staggered
+    unsigned int cascadeCount = 4;
+    int shadowSize = 2048;
+    const char* cascadeSizes = NULL;
+    float shadowBudgetMs = 2.f;
+    bool shadowCache = true;    // --no-shadow-cache renders every caster each time a cascade updates
+    unsigned int spinCount = 0; // --spin N makes the first N cubes turn, they are the dynamic casters
+    int pointShadowSize = 1024; // --point-shadow-size <texels> of a cube face, lights far on screen use less
+    // --shadow-filter pcf1|pcf3|pcf5|pcf7|evsm, --filter-benchmark times every filter in turn then prints a table
+    bool filterBenchmark = false;
+    unsigned int extraLights = 0; // --lights N adds N small point and spot lights over the grid of cubes
+    bool cpuBinning = false;      // --cpu-lights builds the light lists on the CPU
+    bool binningBenchmark = false; // --binning-benchmark times the CPU binning of several light counts first
+    bool deferredEnabled = false;  // --deferred starts with tiled deferred shading, --gbuffer compact|wide picks its layout
+    GBufferLayout gbufferLayout = GBufferLayout::Compact;
+    for (int i = 1 ; i < argc ; i++){
+        if (std::strcmp(argv[i], "--no-shader-cache") == 0)
+            g_programBinaryCache.clear();
+        else if (std::strcmp(argv[i], "--cubes") == 0 && i + 1 < argc)
+            cubeCount = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--prepass") == 0)
+            prepassEnabled = true;
+        else if (std::strcmp(argv[i], "--cascades") == 0 && i + 1 < argc)
+            cascadeCount = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--shadow-size") == 0 && i + 1 < argc)
+            shadowSize = std::max(16, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--cascade-sizes") == 0 && i + 1 < argc)
+            cascadeSizes = argv[++i];
+        else if (std::strcmp(argv[i], "--shadow-budget") == 0 && i + 1 < argc)
+            shadowBudgetMs = (float)std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--no-shadow-cache") == 0)
+            shadowCache = false;
+        else if (std::strcmp(argv[i], "--spin") == 0 && i + 1 < argc)
+            spinCount = (unsigned int)std::max(0, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--point-shadow-size") == 0 && i + 1 < argc)
+            pointShadowSize = std::max(64, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--shadow-filter") == 0 && i + 1 < argc){
+            const char* name = argv[++i];
+            for (unsigned int f = 0 ; f < SHADOW_FILTER_MODES ; f++){
+                if (std::strcmp(name, shadowFilterModes[f].name) == 0)
+                    selectedFilter = f;
+            }
+        }
+        else if (std::strcmp(argv[i], "--filter-benchmark") == 0)
+            filterBenchmark = true;
+        else if (std::strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+            extraLights = (unsigned int)std::max(0, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--cpu-lights") == 0)
+            cpuBinning = true;
+        else if (std::strcmp(argv[i], "--binning-benchmark") == 0)
+            binningBenchmark = true;
+        else if (std::strcmp(argv[i], "--deferred") == 0)
+            deferredEnabled = true;
+        else if (std::strcmp(argv[i], "--gbuffer") == 0 && i + 1 < argc)
+            gbufferLayout = std::strcmp(argv[++i], "wide") == 0 ? GBufferLayout::Wide : GBufferLayout::Compact;
+    }
+
     if (!glfwInit()){
         std::cerr << "Error at GLFW initialization\n";
         return -1;
@@ -164,6 +332,21 @@ int main()
         glm::vec3(1.f)
     };
 
+    glm::vec3 dirLightDirection(-0.2f, -1.0f, -0.3f);
+
+    // Floor under the grid of cubes, it receives their shadows
+    float floorDepth = (cubeCount / 10 / 32 + 1) * 20.f + 40.f;
+    float floor_vertices[] = {
+        -40.f, -4.f, 40.f, 0.f, 1.f, 0.f, 0.f, 0.f,
+        360.f, -4.f, 40.f, 0.f, 1.f, 0.f, 80.f, 0.f,
+        360.f, -4.f, -floorDepth, 0.f, 1.f, 0.f, 80.f, (40.f + floorDepth) / 5.f,
+        -40.f, -4.f, -floorDepth, 0.f, 1.f, 0.f, 0.f, (40.f + floorDepth) / 5.f
+    };
+    unsigned int floor_indices[] = {
+        0, 1, 2,
+        0, 2, 3
+    };
+
     // -----------------------------------
     // LOAD THE CUBE OBJECT TEXTURES
 
@@ -236,12 +419,48 @@ int main()
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+    // POSITION-ONLY STREAM for the depth pre-pass, the positions packed without normals and texture coordinates
+    float positions[24 * 3];
+    for (unsigned int i = 0 ; i < 24 ; i++){
+        for (unsigned int j = 0 ; j < 3 ; j++)
+            positions[i * 3 + j] = vertices[i * 8 + j];
+    }
+    unsigned int positionVBO, positionVAO;
+    glGenVertexArrays(1, &positionVAO);
+    glGenBuffers(1, &positionVBO);
+
+    glBindVertexArray(positionVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(positions), positions, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
     
+    // FLOOR, position at location 0 like the position-only stream, so the depth programs can draw it
+    unsigned int floorVAO, floorVBO, floorEBO;
+    glGenVertexArrays(1, &floorVAO);
+    glGenBuffers(1, &floorVBO);
+    glGenBuffers(1, &floorEBO);
+
+    glBindVertexArray(floorVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, floorVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(floor_vertices), floor_vertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(3*sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(6*sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, floorEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(floor_indices), floor_indices, GL_STATIC_DRAW);
+
     // -----------------------------------
 
     // LIGHT CUBE
     glm::vec3 lightPos(1.2f, 1.f, 2.f);
     glBindVertexArray(lightVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
@@ -256,67 +475,58 @@ int main()
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
     // -----------------------------------
-    // OBJECT SHADER
+    // SHADERS
+    // Every program compiles in parallel, edited files are reloaded while running
+
+    ShaderManager shaderManager(window);
+    Shader& lightShader = shaderManager.Load("../shaders/light.vs", "../shaders/light.fs");
+    Shader& depthShader = shaderManager.Load("../shaders/depth.vs", "../../includes/shaders/depth_only.fs");
+    Shader& casterShader = shaderManager.Load("../../includes/shaders/cascade_shadow.vs", "../../includes/shaders/cascade_shadow.gs",
+                                              "../../includes/shaders/depth_only.fs", "");
+    Shader& pointCasterShader = shaderManager.Load("../../includes/shaders/cascade_shadow.vs", "../../includes/shaders/point_shadow.gs",
+                                                   "../../includes/shaders/depth_only.fs", "");
+    Shader& gbufferShader = shaderManager.Load("../shaders/object.vs", "../../includes/shaders/gbuffer.fs");
 
-    Shader objectShader("../shaders/object.vs", "../shaders/object.fs");
-    objectShader.Use();
+    // -----------------------------------
+    // OBJECT SHADER
+    // One program per PhongVariant, the uniforms below are set on each of them
+
+    // Directional light and spotlight, shared with the lighting pass of the deferred path
+    auto setLightUniforms = [&](Shader& shader){
+        // Directional light
+        shader.SetVec3("dirLight.direction", dirLightDirection);
+        shader.SetVec3("dirLight.ambient", glm::vec3(0.3f));
+        shader.SetVec3("dirLight.diffuse", glm::vec3(0.9f));
+        shader.SetVec3("dirLight.specular", glm::vec3(1.f));
+    
+        // Spotlight
+        // Setting cutOff with the cosine of the angle, don't need to compute cos-1 in shader
+        shader.SetFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
+        shader.SetFloat("spotLight.outerCutOff", glm::cos(glm::radians(17.5f)));
+        shader.SetVec3("spotLight.ambient", glm::vec3(0.3f));
+        shader.SetVec3("spotLight.diffuse", glm::vec3(0.9f));
+        shader.SetVec3("spotLight.specular", glm::vec3(1.f));
+    };
+    ShaderVariants<PhongVariant> objectShaders(shaderManager, "../shaders/object.vs", "../shaders/object.fs", [&](Shader& shader){
+        // http://devernay.free.fr/cours/opengl/materials.html
+        shader.SetInt("material.diffuse", 0);
+        shader.SetInt("material.specular", 1);
+        shader.SetVec3("material.specular", glm::vec3(0.5f, 0.5f, 0.5f));
+        shader.SetFloat("material.shininess", 32.f);
+        setLightUniforms(shader);
+    });
+    objectShaders.Precompile(std::vector<PhongVariant>(std::begin(objectVariants), std::end(objectVariants)));
 
-    // http://devernay.free.fr/cours/opengl/materials.html
-    objectShader.SetInt("material.diffuse", 0);
-    objectShader.SetInt("material.specular", 1);
-    objectShader.SetVec3("material.specular", glm::vec3(0.5f, 0.5f, 0.5f));
-    objectShader.SetFloat("material.shininess", 32.f);
+    // -----------------------------------
+    // DEFERRED SHADING
+    // The geometry pass writes the material and the normal, the compute pass lights them per tile
 
-    // Directional light
-    objectShader.SetVec3("dirLight.direction", glm::vec3(-0.2f, -1.0f, -0.3f));
-    objectShader.SetVec3("dirLight.ambient", glm::vec3(0.3f));
-    objectShader.SetVec3("dirLight.diffuse", glm::vec3(0.9f));
-    objectShader.SetVec3("dirLight.specular", glm::vec3(1.f));
-    
-    // Point light with attenuation
-    objectShader.SetVec3("pointLights[0].ambient", glm::vec3(0.3f));
-    objectShader.SetVec3("pointLights[0].diffuse", pointLightColors[0]);
-    objectShader.SetVec3("pointLights[0].specular", glm::vec3(1.f));
-    objectShader.SetVec3("pointLights[0].position", pointLightPositions[0]);
-    objectShader.SetFloat("pointLights[0].constant", 1.0f);
-    objectShader.SetFloat("pointLights[0].linear", 0.09f);
-    objectShader.SetFloat("pointLights[0].quadratic", 0.032f);
-
-    objectShader.SetVec3("pointLights[1].ambient", glm::vec3(0.3f));
-    objectShader.SetVec3("pointLights[1].diffuse", pointLightColors[1]);
-    objectShader.SetVec3("pointLights[1].specular", glm::vec3(1.f));
-    objectShader.SetVec3("pointLights[1].position", pointLightPositions[1]);
-    objectShader.SetFloat("pointLights[1].constant", 1.0f);
-    objectShader.SetFloat("pointLights[1].linear", 0.09f);
-    objectShader.SetFloat("pointLights[1].quadratic", 0.032f);
-
-    objectShader.SetVec3("pointLights[2].ambient", glm::vec3(0.3f));
-    objectShader.SetVec3("pointLights[2].diffuse", pointLightColors[2]);
-    objectShader.SetVec3("pointLights[2].specular", glm::vec3(1.f));
-    objectShader.SetVec3("pointLights[2].position", pointLightPositions[2]);
-    objectShader.SetFloat("pointLights[2].constant", 1.0f);
-    objectShader.SetFloat("pointLights[2].linear", 0.09f);
-    objectShader.SetFloat("pointLights[2].quadratic", 0.032f);
-
-    objectShader.SetVec3("pointLights[3].ambient", glm::vec3(0.3f));
-    objectShader.SetVec3("pointLights[3].diffuse", pointLightColors[3]);
-    objectShader.SetVec3("pointLights[3].specular", glm::vec3(1.f));
-    objectShader.SetVec3("pointLights[3].position", pointLightPositions[3]);
-    objectShader.SetFloat("pointLights[3].constant", 1.0f);
-    objectShader.SetFloat("pointLights[3].linear", 0.09f);
-    objectShader.SetFloat("pointLights[3].quadratic", 0.032f);
-
-    // Spotlight
-    // Setting cutOff with the cosine of the angle, don't need to compute cos-1 in shader
-    objectShader.SetFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
-    objectShader.SetFloat("spotLight.outerCutOff", glm::cos(glm::radians(17.5f)));
-    objectShader.SetVec3("spotLight.ambient", glm::vec3(0.3f));
-    objectShader.SetVec3("spotLight.diffuse", glm::vec3(0.9f));
-    objectShader.SetVec3("spotLight.specular", glm::vec3(1.f));
-
-    int modelLocation = glGetUniformLocation(objectShader.m_id, "model");
-    int viewLocation = glGetUniformLocation(objectShader.m_id, "view");
-    int projectionLocation = glGetUniformLocation(objectShader.m_id, "projection");
+    shaderManager.WaitAll(); // Loaded with the other programs, it has none until it's adopted
+    gbufferShader.SetInt("material.diffuse", 0);
+    gbufferShader.SetInt("material.specular", 1);
+    gbufferShader.SetFloat("material.shininess", 32.f);
+    TiledDeferred deferred(gbufferLayout);
+    setLightUniforms(deferred.Lighting());
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, texture1);
@@ -326,77 +536,475 @@ int main()
     // -----------------------------------
     // LIGHT SHADER
 
-    Shader lightShader("../shaders/light.vs", "../shaders/light.fs");
     lightShader.Use();
-    int modelLocationLight = glGetUniformLocation(lightShader.m_id, "model");
-    int viewLocationLight = glGetUniformLocation(lightShader.m_id, "view");
-    int projectionLocationLight = glGetUniformLocation(lightShader.m_id, "projection");
+    Uniform<glm::mat4> modelUniformLight = lightShader.GetUniform<glm::mat4>("model"_uniform);
+    Uniform<glm::vec3> lightColorUniform = lightShader.GetUniform<glm::vec3>("lightColor"_uniform);
+
+    // -----------------------------------
+    // View, projection and camera position are shared by every program through the FrameData block
+
+    FrameUniformBuffer frameUniforms;
 
     // -----------------------------------
 
     float deltaTime = 0.f;
     float lastFrame = 0.f;
+    FrameStatsReporter statsReporter;
+    bool firstFrame = true;
+
+    // Cubes are split in partitions recorded in parallel, the light cubes are a pass of their own.
+    // Lists are executed in order on this thread
+    JobPool jobs;
+    const unsigned int CUBES_PER_PARTITION = 256;
+    unsigned int partitions = std::min(jobs.Size() * 4, (cubeCount + CUBES_PER_PARTITION - 1) / CUBES_PER_PARTITION);
+    std::vector<CommandList> cubeLists(partitions);
+    std::vector<CommandList> depthLists(partitions); // Same cubes from the position-only stream
+    // Casters, each draw with the mask of the cascades it reaches. Static ones only when their cache is re-rendered
+    std::vector<CommandList> staticShadowLists(partitions);
+    std::vector<CommandList> shadowLists(partitions);
+    std::vector<CommandList> pointShadowLists(partitions); // Each draw with the mask of the light faces it reaches
+    CommandList lightList;
+    DepthPrepass prepass(prepassEnabled);
+
+    CascadedShadowMap shadows(cascadeCount, shadowSize);
+    shadows.SetBudget(shadowBudgetMs);
+    if (!shadowCache)
+        shadows.SetStaticCaching(false);
+    for (unsigned int i = 0 ; cascadeSizes && *cascadeSizes && i < shadows.Cascades() ; i++){
+        char* end;
+        shadows.SetResolution(i, (int)std::strtol(cascadeSizes, &end, 10));
+        cascadeSizes = *end == ',' ? end + 1 : end;
+    }
+    // Ranges follow the attenuation of the lights, dimmer colours reach less far
+    PointShadowMaps pointShadows(4, pointShadowSize);
+    for (unsigned int i = 0 ; i < 4 ; i++){
+        float luminance = glm::dot(pointLightColors[i], glm::vec3(0.2126f, 0.7152f, 0.0722f));
+        pointShadows.SetLight(i, pointLightPositions[i], PointShadowMaps::AttenuationRange(1.f, 0.09f, 0.032f, luminance));
+    }
+    // The four coloured lights cast the point shadows, the extra ones are short range and unshadowed.
+    // One in four extra lights is a spot light looking down
+    ClusteredLights clusters;
+    std::vector<ClusterLight> clusterLights;
+    for (unsigned int i = 0 ; i < 4 ; i++){
+        ClusterLight light;
+        light.position = pointLightPositions[i];
+        light.diffuse = pointLightColors[i];
+        light.ambient = 0.3f;
+        light.shadow = (int)i;
+        clusterLights.push_back(light);
+    }
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    unsigned int gridColumns = std::min(32u, (cubeCount + 9) / 10);
+    unsigned int gridRows = ((cubeCount + 9) / 10 + 31) / 32;
+    auto addExtraLight = [&](){
+        unsigned int i = (unsigned int)clusterLights.size() - 4;
+        ClusterLight light;
+        light.position = glm::vec3(-5.f + unit(random) * (gridColumns * 10.f + 5.f), -3.5f + unit(random) * 8.f,
+                                   5.f - unit(random) * (gridRows * 20.f + 5.f));
+        light.diffuse = glm::vec3(unit(random), unit(random), unit(random));
+        light.specular = light.diffuse;
+        light.linear = 0.7f;
+        light.quadratic = 1.8f;
+        if (i % 4 == 3){
+            light.direction = glm::vec3(unit(random) - 0.5f, -1.f, unit(random) - 0.5f);
+            light.cutOff = glm::cos(glm::radians(20.f));
+            light.outerCutOff = glm::cos(glm::radians(30.f));
+        }
+        clusterLights.push_back(light);
+    };
+    for (unsigned int i = 0 ; i < extraLights ; i++)
+        addExtraLight();
+    clusters.SetLights(clusterLights);
+
+    // Light counts times thread counts, the lights spread in front of the starting camera
+    if (binningBenchmark){
+        JobPool single(0);
+        glm::mat4 view = glm::lookAt(camera.Position, camera.Position + camera.Front, camera.Up);
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), 800.f/600.f, 0.1f, 100.f);
+        const unsigned int RUNS = 20;
+        std::printf("[binning] %u clusters, %u runs each\n", clusters.Clusters(), RUNS);
+        for (unsigned int count : {256u, 1024u, 4096u, 16384u}){
+            std::vector<ClusterLight> lights(count);
+            for (ClusterLight& light : lights){
+                light.position = camera.Position + glm::vec3(unit(random) * 80.f - 40.f, unit(random) * 14.f - 8.f, -unit(random) * 90.f);
+                light.linear = 0.7f;
+                light.quadratic = 1.8f;
+            }
+            clusters.SetLights(lights);
+            for (JobPool* pool : {&single, &jobs}){
+                for (unsigned int run = 0 ; run < 3 ; run++){ // Warms the scratch buffers
+                    clusters.Bin(*pool, view, projection);
+                    clusters.EndFrame();
+                }
+                auto begin = std::chrono::steady_clock::now();
+                for (unsigned int run = 0 ; run < RUNS ; run++){
+                    clusters.Bin(*pool, view, projection);
+                    clusters.EndFrame();
+                }
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() / RUNS;
+                std::printf("[binning] %6u lights | %2u threads | %.3f ms | %.0f light-cluster pairs per ms\n",
+                    count, pool->Size(), ms, (double)count * clusters.Clusters() / ms);
+            }
+        }
+        clusters.SetLights(clusterLights);
+    }
+
+    const unsigned int SHADOW_UNIT = 2;       // 0 and 1 are the material maps, 3 the EVSM moments
+    const unsigned int POINT_SHADOW_UNIT = 4;
+    const float CUBE_RADIUS = 0.87f;          // Bounding sphere of a unit cube
+
+    // Shadow filter timings. The benchmark shows each filter for BENCHMARK_SECONDS on the shadowed
+    // variant, frames right after a switch are skipped while the timers still return the old filter
+    GpuTimer shadingTimer;
+    const double BENCHMARK_SECONDS = 3.0;
+    const unsigned int SETTLE_FRAMES = 10;
+    struct FilterTimes
+    {
+        double shadingMs = 0.0;
+        double shadowMs = 0.0;
+        unsigned int frames = 0;
+    };
+    FilterTimes filterTimes[SHADOW_FILTER_MODES];
+    double filterSwitch = 0.0;
+    unsigned int framesSinceSwitch = 0;
+    double filterReport = 0.0;
+    if (filterBenchmark){
+        selectedFilter = 0;
+        selectedVariant = 2;
+        std::printf("[shadow filter] benchmark, %.0f s per filter\n", BENCHMARK_SECONDS);
+    }
+    bool filterChanged = true;
+    bool printTraffic = deferredEnabled; // Once the framebuffer size of the frame is known
+
+    // Setup bound objects directly, from here state goes through GLState
+    g_glState.Reset();
 
     while (!glfwWindowShouldClose(window)){
         processInput(window, deltaTime);
+        shaderManager.Update();
 
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        if (prepassToggled)
+            prepass.SetEnabled(!prepass.Enabled());
+        if (shadowCacheToggled)
+            shadows.SetStaticCaching(!shadows.StaticCaching());
+        if (lightTurn != 0.f)
+            dirLightDirection = glm::vec3(glm::rotate(glm::mat4(1.f), lightTurn, glm::vec3(0.f, 1.f, 0.f)) * glm::vec4(dirLightDirection, 0.f));
+        if (filterToggled && !filterBenchmark){
+            selectedFilter = (selectedFilter + 1) % SHADOW_FILTER_MODES;
+            filterChanged = true;
+        }
+        if (bleedToggled){
+            selectedBleed = (selectedBleed + 1) % (sizeof(bleedReductions) / sizeof(bleedReductions[0]));
+            filterChanged = true;
+        }
+        if (deferredToggled){
+            deferredEnabled = !deferredEnabled;
+            std::printf("[deferred] %s shading\n", deferredEnabled ? "tiled deferred" : "forward");
+            printTraffic = deferredEnabled;
+        }
+        if (lightCountStep != 0){
+            extraLights = lightCountStep > 0 ? std::max(64u, extraLights * 2) : (extraLights >= 128 ? extraLights / 2 : 0);
+            clusterLights.resize(std::min<size_t>(clusterLights.size(), 4 + extraLights));
+            while (clusterLights.size() < 4 + extraLights)
+                addExtraLight();
+            clusters.SetLights(clusterLights);
+            std::printf("[clusters] %u extra lights\n", extraLights);
+        }
+        if (layoutToggled)
+            deferred.SetLayout(deferred.Layout() == GBufferLayout::Compact ? GBufferLayout::Wide : GBufferLayout::Compact);
+        if (filterChanged){
+            const ShadowFilterMode& mode = shadowFilterModes[selectedFilter];
+            shadows.SetFilter(mode.filter, mode.pcfRadius);
+            shadows.SetBleedReduction(bleedReductions[selectedBleed]);
+            std::printf("[shadow filter] %s, bleed reduction %.2f\n", mode.name, bleedReductions[selectedBleed]);
+            filterSwitch = currentFrame;
+            framesSinceSwitch = 0;
+            filterChanged = false;
+        }
         
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        prepass.BeginFrame();
+        g_glState.Clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // The real size, larger than the window's on HiDPI displays. Clusters are found from it
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        FrameData frameData;
+        frameData.projection = glm::perspective(glm::radians(camera.Zoom), 800.f/600.f, 0.1f, 100.f);
+        frameData.view = glm::lookAt(camera.Position, camera.Position+camera.Front, camera.Up); 
+        frameData.cameraPosition = glm::vec4(camera.Position, 1.f);
+        frameData.viewport = glm::vec4(0.f, 0.f, (float)framebufferWidth, (float)framebufferHeight);
+        if (printTraffic){
+            deferred.PrintTraffic(framebufferWidth, framebufferHeight);
+            printTraffic = false;
+        }
+        frameData.time = glm::vec4(currentFrame, deltaTime, 0.f, 0.f);
+        frameUniforms.Update(frameData);
         
         // -----------------------------------
         // CUBE OBJECT
 
-        objectShader.Use();
-        objectShader.SetVec3("viewPos", camera.Position);
-        objectShader.SetVec3("spotLight.position", camera.Position);
-        objectShader.SetVec3("spotLight.direction", camera.Front);
-
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), 800.f/600.f, 0.1f, 100.f);
-        glUniformMatrix4fv(projectionLocation, 1, GL_FALSE, glm::value_ptr(projection));
-
-        glm::mat4 view = glm::lookAt(camera.Position, camera.Position+camera.Front, camera.Up); 
-        glUniformMatrix4fv(viewLocation, 1, GL_FALSE, glm::value_ptr(view));
-        
-        glBindVertexArray(cubeVAO);
-        for (unsigned int i = 0 ; i < 10 ; i++){
-            glm::mat4 cube_model = glm::mat4(1.f);
-            cube_model = glm::translate(cube_model, cubePositions[i]);
-            float angle = 20.f * i;
-            cube_model = glm::rotate(cube_model, glm::radians(angle), glm::vec3(1.f, 0.3f, 0.5f));
-            glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(cube_model));
-            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+        // Uniforms are keyed by names hashed at compile time, the same keys work on every variant.
+        // The deferred path draws the cubes with the G-buffer program and lights them with Lighting()
+        Shader& objectShader = objectShaders.Get(objectVariants[selectedVariant]);
+        Shader& lightingShader = deferredEnabled ? deferred.Lighting() : objectShader;
+        Shader& drawShader = deferredEnabled ? gbufferShader : objectShader;
+        lightingShader.Use();
+        lightingShader.Set("spotLight.position"_uniform, camera.Position);
+        lightingShader.Set("spotLight.direction"_uniform, camera.Front);
+        lightingShader.Set("dirLight.direction"_uniform, dirLightDirection);
+        if (deferredEnabled)
+            gbufferShader.SetInt("gbufferLayout"_uniform, (int)deferred.Layout());
+        Uniform<glm::mat4> modelUniform = drawShader.GetUniform<glm::mat4>("model"_uniform);
+        Uniform<glm::mat4> depthModelUniform = depthShader.GetUniform<glm::mat4>("model"_uniform);
+        bool recordDepth = prepass.Enabled() && !deferredEnabled;
+
+        // Cascades are fitted before recording, the jobs cull the casters against them.
+        // The deferred path has no shadows
+        bool recordShadows = objectVariants[selectedVariant].dirShadows && !deferredEnabled;
+        Uniform<glm::mat4> casterModelUniform = casterShader.GetUniform<glm::mat4>("model"_uniform);
+        Uniform<int> casterMaskUniform = casterShader.GetUniform<int>("cascadeMask"_uniform);
+        if (recordShadows)
+            shadows.Fit(frameData.view, glm::radians(camera.Zoom), 800.f/600.f, 0.1f, dirLightDirection);
+        if (binningToggled){
+            cpuBinning = !cpuBinning;
+            std::printf("[clusters] light lists built on the %s\n", cpuBinning ? "CPU" : "GPU");
+        }
+        if (objectVariants[selectedVariant].clustered && !deferredEnabled){
+            if (cpuBinning)
+                clusters.Bin(jobs, frameData.view, frameData.projection);
+            else
+                clusters.Cull();
+            clusters.Bind(objectShader);
         }
+        bool recordPointShadows = objectVariants[selectedVariant].pointShadows && !deferredEnabled;
+        Uniform<glm::mat4> pointCasterModelUniform = pointCasterShader.GetUniform<glm::mat4>("model"_uniform);
+        Uniform<int> faceMaskUniform = pointCasterShader.GetUniform<int>("faceMask"_uniform);
+        if (recordPointShadows)
+            pointShadows.Fit(frameData.projection, frameData.view, glm::radians(camera.Zoom));
+
+        // Job index < partitions records a range of cubes, the last one the light cubes.
+        // Workers only write their own list
+        auto recordPass = [&](unsigned int job){
+            if (job == partitions){
+                lightList.Clear();
+                lightList.UseProgram(lightShader);
+                lightList.BindVertexArray(lightVAO);
+                for (unsigned int i = 0 ; i < 4 ; i++){
+                    glm::mat4 light_model = glm::mat4(1.f);
+                    light_model = glm::translate(light_model, pointLightPositions[i]);
+                    light_model = glm::scale(light_model, glm::vec3(0.2f));
+                    lightList.SetUniform(lightShader, modelUniformLight, light_model);
+                    lightList.SetUniform(lightShader, lightColorUniform, pointLightColors[i]);
+                    lightList.DrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT);
+                }
+                return;
+            }
+            CommandList& list = cubeLists[job];
+            list.Clear();
+            list.UseProgram(drawShader);
+            list.BindVertexArray(cubeVAO);
+            CommandList& depthList = depthLists[job];
+            depthList.Clear();
+            if (recordDepth){
+                depthList.UseProgram(depthShader);
+                depthList.BindVertexArray(positionVAO);
+            }
+            CommandList& staticShadowList = staticShadowLists[job];
+            CommandList& shadowList = shadowLists[job];
+            staticShadowList.Clear();
+            shadowList.Clear();
+            if (recordShadows){
+                staticShadowList.UseProgram(casterShader);
+                staticShadowList.BindVertexArray(positionVAO);
+                shadowList.UseProgram(casterShader);
+                shadowList.BindVertexArray(positionVAO);
+            }
+            CommandList& pointShadowList = pointShadowLists[job];
+            pointShadowList.Clear();
+            if (recordPointShadows){
+                pointShadowList.UseProgram(pointCasterShader);
+                pointShadowList.BindVertexArray(positionVAO);
+            }
+            unsigned int kept[CascadedShadowMap::MAX_CASCADES] = {};
+            unsigned int dynamicMask = 0;
+            unsigned int faces = 0;
+            unsigned int end = std::min(cubeCount, (job + 1) * cubeCount / partitions);
+            for (unsigned int i = job * cubeCount / partitions ; i < end ; i++){
+                // Copies of the 10 cubes laid out on a grid, the first copy is the original scene
+                unsigned int copy = i / 10;
+                glm::vec3 offset((copy % 32) * 10.f, 0.f, -(float)(copy / 32) * 20.f);
+                glm::mat4 cube_model = glm::mat4(1.f);
+                cube_model = glm::translate(cube_model, cubePositions[i % 10] + offset);
+                bool spinning = i < spinCount;
+                float angle = 20.f * (i % 10) + (spinning ? 50.f * currentFrame : 0.f);
+                cube_model = glm::rotate(cube_model, glm::radians(angle), glm::vec3(1.f, 0.3f, 0.5f));
+                list.SetUniform(drawShader, modelUniform, cube_model);
+                list.DrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT);
+                if (recordDepth){
+                    depthList.SetUniform(depthShader, depthModelUniform, cube_model);
+                    depthList.DrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT);
+                }
+                unsigned int mask = recordShadows ? shadows.CasterMask(cubePositions[i % 10] + offset, CUBE_RADIUS, !spinning) : 0;
+                if (mask){
+                    CommandList& casterList = spinning ? shadowList : staticShadowList;
+                    casterList.SetUniform(casterShader, casterMaskUniform, (int)mask);
+                    casterList.SetUniform(casterShader, casterModelUniform, cube_model);
+                    casterList.DrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT);
+                    for (unsigned int c = 0 ; c < CascadedShadowMap::MAX_CASCADES ; c++)
+                        kept[c] += (mask >> c) & 1;
+                    if (spinning)
+                        dynamicMask |= mask;
+                }
+                unsigned int faceMask = recordPointShadows ? pointShadows.CasterMask(cubePositions[i % 10] + offset, CUBE_RADIUS) : 0;
+                if (faceMask){
+                    pointShadowList.SetUniform(pointCasterShader, faceMaskUniform, (int)faceMask);
+                    pointShadowList.SetUniform(pointCasterShader, pointCasterModelUniform, cube_model);
+                    pointShadowList.DrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT);
+                    for (unsigned int bits = faceMask ; bits ; bits &= bits - 1)
+                        faces++;
+                }
+            }
+            if (recordShadows){
+                shadows.AddCasterCounts(kept, end - job * cubeCount / partitions);
+                shadows.AddDynamicMask(dynamicMask);
+            }
+            if (recordPointShadows)
+                pointShadows.AddCasterCounts(faces, end - job * cubeCount / partitions);
+        };
+        auto buildBegin = std::chrono::steady_clock::now();
+        jobs.Run(partitions + 1, recordPass);
+        g_frameStats.commandBuildUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - buildBegin).count();
 
         // -----------------------------------
-        // LIGHT CUBE
-
-        lightShader.Use();
-
-        glUniformMatrix4fv(projectionLocationLight, 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(viewLocationLight, 1, GL_FALSE, glm::value_ptr(view));
-
-        glBindVertexArray(lightVAO);
-        for (unsigned int i = 0 ; i < 4 ; i++){
-            glm::mat4 light_model = glm::mat4(1.f);
-            light_model = glm::translate(light_model, pointLightPositions[i]);
-            light_model = glm::scale(light_model, glm::vec3(0.2f));
-            glUniformMatrix4fv(modelLocationLight, 1, GL_FALSE, glm::value_ptr(light_model));
-            lightShader.SetVec3("lightColor", pointLightColors[i]);
-            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+        // SHADOW CASCADES, POINT LIGHT SHADOWS, DEPTH PRE-PASS, CUBE OBJECTS and FLOOR, then LIGHT CUBES
+
+        glm::mat4 floor_model = glm::mat4(1.f);
+        if (recordShadows){
+            shadows.BeginPass(casterShader);
+            for (const CommandList& list : staticShadowLists)
+                list.Execute();
+            shadows.BeginDynamic();
+            for (const CommandList& list : shadowLists)
+                list.Execute();
+            shadows.EndPass(glfwGetTime());
+            shadows.Bind(objectShader, SHADOW_UNIT);
+        }
+        if (recordPointShadows){
+            pointShadows.BeginPass(pointCasterShader);
+            for (const CommandList& list : pointShadowLists)
+                list.Execute();
+            pointShadows.EndPass(glfwGetTime());
+            pointShadows.Bind(objectShader, POINT_SHADOW_UNIT);
+        }
+        if (recordDepth){ // Not in deferred mode, the geometry pass writes its own depth
+            prepass.BeginDepth();
+            for (const CommandList& list : depthLists)
+                list.Execute();
+            depthShader.Set(depthModelUniform, floor_model);
+            g_glState.BindVertexArray(floorVAO);
+            g_glState.DrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT);
+            prepass.EndDepth();
+        }
+        if (deferredEnabled){
+            deferred.BeginGeometry(framebufferWidth, framebufferHeight);
+            for (const CommandList& list : cubeLists)
+                list.Execute();
+            gbufferShader.Set(modelUniform, floor_model);
+            g_glState.BindVertexArray(floorVAO);
+            g_glState.DrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT);
+            deferred.EndGeometry();
+            deferred.Shade(clusters);
+        }
+        else{
+            shadingTimer.Begin();
+            prepass.BeginShading();
+            for (const CommandList& list : cubeLists)
+                list.Execute();
+            objectShader.Set(modelUniform, floor_model);
+            g_glState.BindVertexArray(floorVAO);
+            g_glState.DrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT);
+            prepass.EndShading();
+            shadingTimer.End();
+        }
+        lightList.Execute();
+
+        // Shading pays for the receiver's filter, the shadow pass for the EVSM blur and mips
+        if (filterBenchmark){
+            FilterTimes& times = filterTimes[selectedFilter];
+            if (++framesSinceSwitch > SETTLE_FRAMES && recordShadows){
+                times.shadingMs += shadingTimer.LastMs();
+                times.shadowMs += shadows.LastPassMs();
+                times.frames++;
+            }
+            if (currentFrame - filterSwitch >= BENCHMARK_SECONDS){
+                if (selectedFilter + 1 < SHADOW_FILTER_MODES){
+                    selectedFilter++;
+                    filterChanged = true;
+                }
+                else{
+                    std::printf("[shadow filter] %-6s %12s %12s %8s\n", "filter", "shading ms", "shadows ms", "frames");
+                    for (unsigned int f = 0 ; f < SHADOW_FILTER_MODES ; f++){
+                        const FilterTimes& result = filterTimes[f];
+                        unsigned int frames = std::max(1u, result.frames);
+                        std::printf("[shadow filter] %-6s %12.3f %12.3f %8u\n", shadowFilterModes[f].name,
+                            result.shadingMs / frames, result.shadowMs / frames, result.frames);
+                    }
+                    filterBenchmark = false;
+                }
+            }
+        }
+        else if (recordShadows && currentFrame - filterReport >= 2.0){
+            std::printf("[shadow filter] %s | shading gpu %.2f ms\n", shadowFilterModes[selectedFilter].name, shadingTimer.TakeAverageMs());
+            filterReport = currentFrame;
         }
 
         // -----------------------------------
 
+        frameUniforms.EndFrame();
+        clusters.EndFrame();
+        prepass.EndFrame(glfwGetTime(), framebufferWidth * framebufferHeight);
+        if (deferredEnabled)
+            deferred.Report(glfwGetTime());
+        else if (objectVariants[selectedVariant].clustered)
+            clusters.Report(glfwGetTime());
+        statsReporter.EndFrame(glfwGetTime());
+
         glfwSwapBuffers(window);
         glfwPollEvents();
+
+        if (firstFrame){
+            glFinish();
+            std::chrono::duration<double, std::milli> startup = std::chrono::steady_clock::now() - startupBegin;
+            std::cout << "[startup] first frame after " << startup.count() << " ms, programs : "
+                << g_programBinaryStats.loaded << " from cache, " << g_programBinaryStats.compiled << " compiled, "
+                << g_programBinaryStats.rejected << " rejected by the driver\n";
+            shaderManager.PrintStats();
+            objectShaders.PrintReport();
+            firstFrame = false;
+        }
     }
 
     glDeleteVertexArrays(1, &cubeVAO);
     glDeleteVertexArrays(1, &lightVAO);
+    glDeleteVertexArrays(1, &positionVAO);
+    glDeleteVertexArrays(1, &floorVAO);
     glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &positionVBO);
+    glDeleteBuffers(1, &floorVBO);
+    glDeleteBuffers(1, &floorEBO);
+
+    prepass.Release();
+    shadingTimer.Release();
+    shadows.Release();
+    pointShadows.Release();
+    clusters.Release();
+    deferred.Release();
+    frameUniforms.Release();
+    shaderManager.Release();
     
     glfwDestroyWindow(window);
     glfwTerminate();
@@ -0,0 +1,643 @@
+#include <glad/glad.h> // Must be include before GLFW
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gl_trace.hpp"
+
+// Plays back a trace recorded by a chapter started with --trace <file>, in an invisible window
+// and without vsync. Objects are created once, then the frame commands run again and again.
+// The trace starts with the full state snapshot, so every iteration does the exact same work.
+// Usage : replay <trace> [--iterations N] [--warmup N] [--calls N]
+
+struct Command
+{
+    TraceOp op;
+    uint32_t size;
+    const unsigned char* data;
+};
+
+class Replayer
+{
+    public:
+        int m_width = 0, m_height = 0;
+        std::vector<Command> m_definitions, m_commands;
+        unsigned int m_frames = 0;
+
+        bool Load(const char* path)
+        {
+            std::ifstream file(path, std::ios::binary);
+            if (!file){
+                std::cerr << "Can't open trace " << path << "\n";
+                return false;
+            }
+            m_file.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+            TraceHeader header;
+            if (m_file.size() < sizeof(header)){
+                std::cerr << "Trace " << path << " is truncated\n";
+                return false;
+            }
+            std::memcpy(&header, m_file.data(), sizeof(header));
+            if (std::memcmp(header.magic, TRACE_MAGIC, 4) != 0 || header.version != TRACE_VERSION){
+                std::cerr << "Trace " << path << " has an unknown format\n";
+                return false;
+            }
+            m_width = header.width;
+            m_height = header.height;
+
+            size_t offset = sizeof(header);
+            while (offset + 8 <= m_file.size()){
+                Command command;
+                std::memcpy(&command.op, &m_file[offset], 4);
+                std::memcpy(&command.size, &m_file[offset + 4], 4);
+                command.data = &m_file[offset + 8];
+                offset += 8 + command.size;
+                if (offset > m_file.size() || command.op >= TraceOp::Count){
+                    std::cerr << "Trace " << path << " is corrupted\n";
+                    return false;
+                }
+                if (IsTraceDefinition(command.op))
+                    m_definitions.push_back(command);
+                else
+                    m_commands.push_back(command);
+                if (command.op == TraceOp::EndFrame)
+                    m_frames++;
+            }
+            return true;
+        }
+
+        // The default framebuffer of the recording becomes an offscreen one of the same size
+        void CreateObjects()
+        {
+            glCreateRenderbuffers(2, m_defaultAttachments);
+            glNamedRenderbufferStorage(m_defaultAttachments[0], GL_RGBA8, m_width, m_height);
+            glNamedRenderbufferStorage(m_defaultAttachments[1], GL_DEPTH24_STENCIL8, m_width, m_height);
+            glCreateFramebuffers(1, &m_defaultFramebuffer);
+            glNamedFramebufferRenderbuffer(m_defaultFramebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_defaultAttachments[0]);
+            glNamedFramebufferRenderbuffer(m_defaultFramebuffer, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_defaultAttachments[1]);
+
+            for (const Command& command : m_definitions)
+                define(command);
+        }
+
+        void Execute(const Command& command)
+        {
+            TraceReader in(command.data, command.size);
+            switch (command.op){
+                case TraceOp::UseProgram: glUseProgram(find(m_programs, in.Get<uint32_t>()).program); break;
+                case TraceOp::BindVertexArray: glBindVertexArray(find(m_vertexArrays, in.Get<uint32_t>())); break;
+                case TraceOp::BindBuffer: {
+                    GLenum target = in.Get<uint32_t>();
+                    glBindBuffer(target, find(m_buffers, in.Get<uint32_t>()));
+                    break;
+                }
+                case TraceOp::BindBufferRange: {
+                    GLenum target = in.Get<uint32_t>();
+                    uint32_t index = in.Get<uint32_t>();
+                    unsigned int buffer = find(m_buffers, in.Get<uint32_t>());
+                    uint32_t offset = in.Get<uint32_t>();
+                    glBindBufferRange(target, index, buffer, offset, in.Get<uint32_t>());
+                    break;
+                }
+                case TraceOp::BindTexture: {
+                    uint32_t unit = in.Get<uint32_t>();
+                    in.Get<uint32_t>(); // Target, implied by the texture
+                    glBindTextureUnit(unit, find(m_textures, in.Get<uint32_t>()));
+                    break;
+                }
+                case TraceOp::BindSampler: {
+                    uint32_t unit = in.Get<uint32_t>();
+                    glBindSampler(unit, find(m_samplers, in.Get<uint32_t>()));
+                    break;
+                }
+                case TraceOp::BindFramebuffer: {
+                    GLenum target = in.Get<uint32_t>();
+                    uint32_t framebuffer = in.Get<uint32_t>();
+                    glBindFramebuffer(target, framebuffer == 0 ? m_defaultFramebuffer : find(m_framebuffers, framebuffer));
+                    break;
+                }
+                case TraceOp::Enable: glEnable(in.Get<uint32_t>()); break;
+                case TraceOp::Disable: glDisable(in.Get<uint32_t>()); break;
+                case TraceOp::DepthFunc: glDepthFunc(in.Get<uint32_t>()); break;
+                case TraceOp::DepthMask: glDepthMask(in.Get<uint32_t>() ? GL_TRUE : GL_FALSE); break;
+                case TraceOp::ColorMask: {
+                    GLboolean write = in.Get<uint32_t>() ? GL_TRUE : GL_FALSE;
+                    glColorMask(write, write, write, write);
+                    break;
+                }
+                case TraceOp::StencilFunc: {
+                    GLenum func = in.Get<uint32_t>();
+                    int ref = in.Get<int32_t>();
+                    glStencilFunc(func, ref, in.Get<uint32_t>());
+                    break;
+                }
+                case TraceOp::StencilOp: {
+                    GLenum sfail = in.Get<uint32_t>();
+                    GLenum dpfail = in.Get<uint32_t>();
+                    glStencilOp(sfail, dpfail, in.Get<uint32_t>());
+                    break;
+                }
+                case TraceOp::StencilMask: glStencilMask(in.Get<uint32_t>()); break;
+                case TraceOp::BlendFunc: {
+                    GLenum src = in.Get<uint32_t>();
+                    glBlendFunc(src, in.Get<uint32_t>());
+                    break;
+                }
+                case TraceOp::CullFace: glCullFace(in.Get<uint32_t>()); break;
+                case TraceOp::Viewport: {
+                    int v[4];
+                    for (int& value : v)
+                        value = in.Get<int32_t>();
+                    glViewport(v[0], v[1], v[2], v[3]);
+                    break;
+                }
+                case TraceOp::ClearColor: {
+                    float c[4];
+                    for (float& value : c)
+                        value = in.Get<float>();
+                    glClearColor(c[0], c[1], c[2], c[3]);
+                    break;
+                }
+                case TraceOp::Clear: glClear(in.Get<uint32_t>()); break;
+                case TraceOp::Uniform: uniform(in); break;
+                case TraceOp::BufferSubData: {
+                    unsigned int buffer = find(m_buffers, in.Get<uint32_t>());
+                    uint32_t offset = in.Get<uint32_t>();
+                    uint32_t size;
+                    const unsigned char* data = in.Bytes(size);
+                    glNamedBufferSubData(buffer, offset, size, data);
+                    break;
+                }
+                case TraceOp::DrawArrays: {
+                    GLenum mode = in.Get<uint32_t>();
+                    int first = in.Get<int32_t>();
+                    glDrawArrays(mode, first, in.Get<int32_t>());
+                    break;
+                }
+                case TraceOp::DrawElements: {
+                    GLenum mode = in.Get<uint32_t>();
+                    int count = in.Get<int32_t>();
+                    GLenum type = in.Get<uint32_t>();
+                    glDrawElements(mode, count, type, (void*)(size_t)in.Get<uint32_t>());
+                    break;
+                }
+                case TraceOp::DrawArraysInstanced: {
+                    GLenum mode = in.Get<uint32_t>();
+                    int first = in.Get<int32_t>();
+                    int count = in.Get<int32_t>();
+                    glDrawArraysInstanced(mode, first, count, in.Get<int32_t>());
+                    break;
+                }
+                case TraceOp::DrawElementsInstanced: {
+                    GLenum mode = in.Get<uint32_t>();
+                    int count = in.Get<int32_t>();
+                    GLenum type = in.Get<uint32_t>();
+                    size_t offset = in.Get<uint32_t>();
+                    glDrawElementsInstanced(mode, count, type, (void*)offset, in.Get<int32_t>());
+                    break;
+                }
+                case TraceOp::ClearBufferfv: {
+                    GLenum buffer = in.Get<uint32_t>();
+                    int drawBuffer = in.Get<int32_t>();
+                    float value[4];
+                    for (float& v : value)
+                        v = in.Get<float>();
+                    glClearBufferfv(buffer, drawBuffer, value);
+                    break;
+                }
+                case TraceOp::ClearBufferfi: {
+                    GLenum buffer = in.Get<uint32_t>();
+                    int drawBuffer = in.Get<int32_t>();
+                    float depth = in.Get<float>();
+                    glClearBufferfi(buffer, drawBuffer, depth, in.Get<int32_t>());
+                    break;
+                }
+                case TraceOp::InvalidateFramebuffer: {
+                    GLenum target = in.Get<uint32_t>();
+                    uint32_t size;
+                    const unsigned char* attachments = in.Bytes(size);
+                    glInvalidateFramebuffer(target, size / sizeof(GLenum), (const GLenum*)attachments);
+                    break;
+                }
+                case TraceOp::MemoryBarrier: glMemoryBarrier(in.Get<uint32_t>()); break;
+                case TraceOp::BindImageTexture: {
+                    uint32_t unit = in.Get<uint32_t>();
+                    unsigned int texture = find(m_textures, in.Get<uint32_t>());
+                    int level = in.Get<int32_t>();
+                    GLenum access = in.Get<uint32_t>();
+                    glBindImageTexture(unit, texture, level, GL_FALSE, 0, access, in.Get<uint32_t>());
+                    break;
+                }
+                case TraceOp::DispatchCompute: {
+                    uint32_t x = in.Get<uint32_t>();
+                    uint32_t y = in.Get<uint32_t>();
+                    glDispatchCompute(x, y, in.Get<uint32_t>());
+                    break;
+                }
+                default: break; // EndFrame
+            }
+        }
+
+    private:
+        struct Program
+        {
+            unsigned int program = 0;
+            std::unordered_map<int, int> locations; // recorded -> replayed
+        };
+
+        std::vector<unsigned char> m_file;
+        unsigned int m_defaultFramebuffer = 0;
+        unsigned int m_defaultAttachments[2] = {};
+        std::unordered_map<uint32_t, unsigned int> m_buffers, m_textures, m_renderbuffers, m_framebuffers, m_vertexArrays, m_samplers;
+        std::unordered_map<uint32_t, Program> m_programs;
+
+        template <typename T>
+        static T find(const std::unordered_map<uint32_t, T>& objects, const uint32_t id)
+        {
+            auto it = objects.find(id);
+            return it == objects.end() ? T() : it->second;
+        }
+
+        void define(const Command& command)
+        {
+            TraceReader in(command.data, command.size);
+            uint32_t id = in.Get<uint32_t>();
+            switch (command.op){
+                case TraceOp::DefineBuffer: {
+                    uint32_t size;
+                    const unsigned char* data = in.Bytes(size);
+                    unsigned int buffer;
+                    glCreateBuffers(1, &buffer);
+                    glNamedBufferStorage(buffer, std::max(size, 4u), size ? data : NULL, GL_DYNAMIC_STORAGE_BIT);
+                    m_buffers[id] = buffer;
+                    break;
+                }
+                case TraceOp::DefineTexture: defineTexture(id, in); break;
+                case TraceOp::DefineSampler: {
+                    const GLenum names[7] = {GL_TEXTURE_MIN_FILTER, GL_TEXTURE_MAG_FILTER, GL_TEXTURE_WRAP_S, GL_TEXTURE_WRAP_T,
+                                             GL_TEXTURE_WRAP_R, GL_TEXTURE_COMPARE_MODE, GL_TEXTURE_COMPARE_FUNC};
+                    unsigned int sampler;
+                    glCreateSamplers(1, &sampler);
+                    for (GLenum name : names)
+                        glSamplerParameteri(sampler, name, in.Get<int32_t>());
+                    m_samplers[id] = sampler;
+                    break;
+                }
+                case TraceOp::DefineRenderbuffer: {
+                    GLenum internalFormat = in.Get<uint32_t>();
+                    int width = in.Get<int32_t>();
+                    int height = in.Get<int32_t>();
+                    int samples = in.Get<int32_t>();
+                    unsigned int renderbuffer;
+                    glCreateRenderbuffers(1, &renderbuffer);
+                    if (samples > 0)
+                        glNamedRenderbufferStorageMultisample(renderbuffer, samples, internalFormat, width, height);
+                    else
+                        glNamedRenderbufferStorage(renderbuffer, internalFormat, width, height);
+                    m_renderbuffers[id] = renderbuffer;
+                    break;
+                }
+                case TraceOp::DefineFramebuffer: {
+                    unsigned int framebuffer;
+                    glCreateFramebuffers(1, &framebuffer);
+                    std::vector<GLenum> drawBuffers;
+                    uint32_t count = in.Get<uint32_t>();
+                    for (uint32_t i = 0 ; i < count ; i++){
+                        GLenum point = in.Get<uint32_t>();
+                        GLenum type = in.Get<uint32_t>();
+                        uint32_t name = in.Get<uint32_t>();
+                        int level = in.Get<int32_t>();
+                        int layer = in.Get<int32_t>();
+                        if (type == GL_RENDERBUFFER)
+                            glNamedFramebufferRenderbuffer(framebuffer, point, GL_RENDERBUFFER, find(m_renderbuffers, name));
+                        else if (layer > 0)
+                            glNamedFramebufferTextureLayer(framebuffer, point, find(m_textures, name), level, layer);
+                        else
+                            glNamedFramebufferTexture(framebuffer, point, find(m_textures, name), level);
+                        if (point >= GL_COLOR_ATTACHMENT0 && point <= GL_COLOR_ATTACHMENT7)
+                            drawBuffers.push_back(point);
+                    }
+                    if (!drawBuffers.empty())
+                        glNamedFramebufferDrawBuffers(framebuffer, (int)drawBuffers.size(), drawBuffers.data());
+                    if (glCheckNamedFramebufferStatus(framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                        std::cerr << "Framebuffer " << id << " of the trace is incomplete\n";
+                    m_framebuffers[id] = framebuffer;
+                    break;
+                }
+                case TraceOp::DefineVertexArray: {
+                    unsigned int vertexArray;
+                    glGenVertexArrays(1, &vertexArray);
+                    glBindVertexArray(vertexArray);
+                    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, find(m_buffers, in.Get<uint32_t>()));
+                    uint32_t count = in.Get<uint32_t>();
+                    for (uint32_t i = 0 ; i < count ; i++){
+                        int index = in.Get<int32_t>();
+                        unsigned int buffer = find(m_buffers, in.Get<uint32_t>());
+                        int size = in.Get<int32_t>();
+                        GLenum type = in.Get<uint32_t>();
+                        bool normalized = in.Get<int32_t>();
+                        bool integer = in.Get<int32_t>();
+                        int stride = in.Get<int32_t>();
+                        size_t offset = in.Get<uint32_t>();
+                        int divisor = in.Get<int32_t>();
+                        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+                        if (integer)
+                            glVertexAttribIPointer(index, size, type, stride, (void*)offset);
+                        else
+                            glVertexAttribPointer(index, size, type, normalized, stride, (void*)offset);
+                        glVertexAttribDivisor(index, divisor);
+                        glEnableVertexAttribArray(index);
+                    }
+                    glBindVertexArray(0);
+                    glBindBuffer(GL_ARRAY_BUFFER, 0);
+                    m_vertexArrays[id] = vertexArray;
+                    break;
+                }
+                case TraceOp::DefineProgram: defineProgram(id, in); break;
+                default: break;
+            }
+        }
+
+        void defineTexture(const uint32_t id, TraceReader& in)
+        {
+            GLenum target = in.Get<uint32_t>();
+            GLenum internalFormat = in.Get<uint32_t>();
+            int width = in.Get<int32_t>();
+            int height = in.Get<int32_t>();
+            int depth = in.Get<int32_t>();
+            int samples = in.Get<int32_t>();
+            int parameters[7];
+            for (int& parameter : parameters)
+                parameter = in.Get<int32_t>();
+            GLenum pixelType = in.Get<uint32_t>();
+            uint32_t size;
+            const unsigned char* pixels = in.Bytes(size);
+
+            unsigned int texture;
+            glCreateTextures(target, 1, &texture);
+            m_textures[id] = texture;
+            if (target == GL_TEXTURE_2D_MULTISAMPLE){
+                glTextureStorage2DMultisample(texture, samples, internalFormat, width, height, GL_TRUE);
+                return;
+            }
+
+            bool mipmaps = parameters[0] != GL_NEAREST && parameters[0] != GL_LINEAR;
+            int extent = std::max(width, height);
+            if (target == GL_TEXTURE_3D)
+                extent = std::max(extent, depth);
+            int levels = mipmaps ? (int)std::floor(std::log2((float)std::max(extent, 1))) + 1 : 1;
+            bool layered = target == GL_TEXTURE_2D_ARRAY || target == GL_TEXTURE_3D;
+            if (layered)
+                glTextureStorage3D(texture, levels, internalFormat, width, height, depth);
+            else
+                glTextureStorage2D(texture, levels, internalFormat, width, height);
+
+            if (size > 0){
+                if (target == GL_TEXTURE_2D)
+                    glTextureSubImage2D(texture, 0, 0, 0, width, height, GL_RGBA, pixelType, pixels);
+                else // Cube maps are uploaded as 6 layers
+                    glTextureSubImage3D(texture, 0, 0, 0, 0, width, height, depth, GL_RGBA, pixelType, pixels);
+                if (levels > 1)
+                    glGenerateTextureMipmap(texture);
+            }
+
+            const GLenum names[7] = {GL_TEXTURE_MIN_FILTER, GL_TEXTURE_MAG_FILTER, GL_TEXTURE_WRAP_S, GL_TEXTURE_WRAP_T,
+                                     GL_TEXTURE_WRAP_R, GL_TEXTURE_COMPARE_MODE, GL_TEXTURE_COMPARE_FUNC};
+            for (int i = 0 ; i < 7 ; i++)
+                glTextureParameteri(texture, names[i], parameters[i]);
+        }
+
+        static unsigned int compile(const GLenum stage, const unsigned char* source, const uint32_t size)
+        {
+            const char* code = (const char*)source;
+            int length = (int)size;
+            unsigned int shader = glCreateShader(stage);
+            glShaderSource(shader, 1, &code, &length);
+            glCompileShader(shader);
+            return shader;
+        }
+
+        void defineProgram(const uint32_t id, TraceReader& in)
+        {
+            uint32_t vertexSize, fragmentSize;
+            const unsigned char* vertexCode = in.Bytes(vertexSize);
+            const unsigned char* fragmentCode = in.Bytes(fragmentSize);
+
+            // Compute programs are recorded with their source in place of the vertex stage
+            Program program;
+            if (vertexSize > 0){
+                unsigned int stages[2];
+                int count = 0;
+                if (fragmentSize > 0){
+                    stages[count++] = compile(GL_VERTEX_SHADER, vertexCode, vertexSize);
+                    stages[count++] = compile(GL_FRAGMENT_SHADER, fragmentCode, fragmentSize);
+                }
+                else
+                    stages[count++] = compile(GL_COMPUTE_SHADER, vertexCode, vertexSize);
+                program.program = glCreateProgram();
+                for (int i = 0 ; i < count ; i++)
+                    glAttachShader(program.program, stages[i]);
+                glLinkProgram(program.program);
+                for (int i = 0 ; i < count ; i++)
+                    glDeleteShader(stages[i]);
+
+                int success;
+                char infoLog[512];
+                glGetProgramiv(program.program, GL_LINK_STATUS, &success);
+                if (!success){
+                    glGetProgramInfoLog(program.program, 512, NULL, infoLog);
+                    std::cerr << "Program " << id << " of the trace doesn't link : " << infoLog << "\n";
+                }
+            }
+
+            uint32_t count = in.Get<uint32_t>();
+            for (uint32_t i = 0 ; i < count ; i++){
+                int location = in.Get<int32_t>();
+                uint32_t length;
+                const unsigned char* name = in.Bytes(length);
+                std::string uniformName((const char*)name, length);
+                if (program.program)
+                    program.locations[location] = glGetUniformLocation(program.program, uniformName.c_str());
+            }
+            m_programs[id] = program;
+        }
+
+        void uniform(TraceReader& in)
+        {
+            auto it = m_programs.find(in.Get<uint32_t>());
+            int recorded = in.Get<int32_t>();
+            GLenum type = in.Get<uint32_t>();
+            uint32_t size;
+            const unsigned char* bytes = in.Bytes(size);
+            if (it == m_programs.end() || !it->second.program)
+                return;
+            auto location = it->second.locations.find(recorded);
+            if (location == it->second.locations.end() || location->second < 0)
+                return;
+
+            unsigned int program = it->second.program;
+            int l = location->second;
+            TraceUniformShape shape = TraceUniformShapeOf(type);
+            if (size < shape.components * 4)
+                return;
+            const float* f = (const float*)bytes;
+            const int* i = (const int*)bytes;
+            const unsigned int* u = (const unsigned int*)bytes;
+            switch (type){
+                case GL_FLOAT_MAT2: glProgramUniformMatrix2fv(program, l, 1, GL_FALSE, f); return;
+                case GL_FLOAT_MAT3: glProgramUniformMatrix3fv(program, l, 1, GL_FALSE, f); return;
+                case GL_FLOAT_MAT4: glProgramUniformMatrix4fv(program, l, 1, GL_FALSE, f); return;
+                default: break;
+            }
+            if (shape.base == 'f'){
+                switch (shape.components){
+                    case 1: glProgramUniform1fv(program, l, 1, f); break;
+                    case 2: glProgramUniform2fv(program, l, 1, f); break;
+                    case 3: glProgramUniform3fv(program, l, 1, f); break;
+                    case 4: glProgramUniform4fv(program, l, 1, f); break;
+                }
+            }
+            else if (shape.base == 'u'){
+                switch (shape.components){
+                    case 1: glProgramUniform1uiv(program, l, 1, u); break;
+                    case 2: glProgramUniform2uiv(program, l, 1, u); break;
+                    case 3: glProgramUniform3uiv(program, l, 1, u); break;
+                    case 4: glProgramUniform4uiv(program, l, 1, u); break;
+                }
+            }
+            else {
+                switch (shape.components){
+                    case 1: glProgramUniform1iv(program, l, 1, i); break;
+                    case 2: glProgramUniform2iv(program, l, 1, i); break;
+                    case 3: glProgramUniform3iv(program, l, 1, i); break;
+                    case 4: glProgramUniform4iv(program, l, 1, i); break;
+                }
+            }
+        }
+};
+
+int main(int argc, char** argv)
+{
+    if (argc < 2){
+        std::cerr << "Usage : replay <trace> [--iterations N] [--warmup N] [--calls N]\n";
+        return -1;
+    }
+    unsigned int iterations = 1000, warmup = 10, slowestCalls = 10;
+    for (int i = 2 ; i + 1 < argc ; i++){
+        if (std::strcmp(argv[i], "--iterations") == 0)
+            iterations = std::max(1, std::atoi(argv[i + 1]));
+        else if (std::strcmp(argv[i], "--warmup") == 0)
+            warmup = std::atoi(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--calls") == 0)
+            slowestCalls = std::atoi(argv[i + 1]);
+    }
+
+    Replayer replayer;
+    if (!replayer.Load(argv[1]))
+        return -1;
+
+    if (!glfwInit()){
+        std::cerr << "Error at GLFW initialization\n";
+        return -1;
+    }
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE); // Nothing is presented, the default framebuffer is replaced
+
+    GLFWwindow* window = glfwCreateWindow(64, 64, "Replay", NULL, NULL);
+    if (window == NULL){
+        std::cerr << "Failed to create GLFW window\n";
+        glfwTerminate();
+        return -1;
+    }
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(0);
+
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)){
+        std::cerr << "Failed to initialize GLAD\n";
+        return -1;
+    }
+
+    replayer.CreateObjects();
+    std::cout << "[replay] " << argv[1] << " : " << replayer.m_definitions.size() << " objects, "
+              << replayer.m_commands.size() << " commands, " << replayer.m_frames << " frame(s), "
+              << replayer.m_width << "x" << replayer.m_height << "\n";
+
+    for (unsigned int i = 0 ; i < warmup ; i++){
+        for (const Command& command : replayer.m_commands)
+            replayer.Execute(command);
+    }
+    glFinish();
+
+    // CPU time of every call, GPU time of every iteration
+    std::vector<double> callTimes(replayer.m_commands.size(), 0.0);
+    std::vector<unsigned int> queries(iterations);
+    glGenQueries(iterations, queries.data());
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0 ; i < iterations ; i++){
+        glBeginQuery(GL_TIME_ELAPSED, queries[i]);
+        for (size_t c = 0 ; c < replayer.m_commands.size() ; c++){
+            auto before = std::chrono::steady_clock::now();
+            replayer.Execute(replayer.m_commands[c]);
+            callTimes[c] += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - before).count();
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+    glFinish();
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    double gpuMs = 0.0;
+    for (unsigned int query : queries){
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        gpuMs += elapsed / 1e6;
+    }
+    glDeleteQueries(iterations, queries.data());
+
+    double cpuMs = 0.0;
+    double opTimes[(int)TraceOp::Count] = {};
+    unsigned int opCounts[(int)TraceOp::Count] = {};
+    for (size_t c = 0 ; c < callTimes.size() ; c++){
+        cpuMs += callTimes[c] / 1e6;
+        opTimes[(int)replayer.m_commands[c].op] += callTimes[c];
+        opCounts[(int)replayer.m_commands[c].op]++;
+    }
+
+    double n = (double)iterations;
+    std::printf("[replay] %u iterations : cpu %.3f ms, gpu %.3f ms, wall %.3f ms per iteration\n",
+        iterations, cpuMs / n, gpuMs / n, wallMs / n);
+    std::printf("[replay] %-22s %8s %12s %10s\n", "command", "calls", "us/iter", "ns/call");
+    for (int op = 0 ; op < (int)TraceOp::Count ; op++){
+        if (opCounts[op] == 0)
+            continue;
+        std::printf("[replay] %-22s %8u %12.2f %10.1f\n", TraceOpName((TraceOp)op), opCounts[op],
+            opTimes[op] / n / 1e3, opTimes[op] / n / opCounts[op]);
+    }
+
+    std::vector<size_t> order(callTimes.size());
+    for (size_t c = 0 ; c < order.size() ; c++)
+        order[c] = c;
+    std::sort(order.begin(), order.end(), [&callTimes](size_t a, size_t b){ return callTimes[a] > callTimes[b]; });
+    for (size_t i = 0 ; i < order.size() && i < slowestCalls ; i++){
+        std::printf("[replay] slowest #%zu : command %zu %s, %.1f ns\n", i + 1, order[i],
+            TraceOpName(replayer.m_commands[order[i]].op), callTimes[order[i]] / n);
+    }
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+
+    return 0;
+}
@@ -5,9 +5,9 @@ layout (location = 1) in vec2 aTexCoords;
 
 out vec2 TexCoords;
 
+#include "../../includes/shaders/frame_data.glsl"
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main()
 {
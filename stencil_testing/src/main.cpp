@@ -8,6 +8,8 @@
 #include <math.h>
 
 #include "camera.hpp"
+#include "frame_data.hpp"
+#include "frame_stats.hpp"
 #include "shader.hpp"
 #include "stb_image.h"
 
@@ -258,20 +260,20 @@ int main()
     objectShader.Use();
 
     int modelLocation = glGetUniformLocation(objectShader.m_id, "model");
-    int viewLocation = glGetUniformLocation(objectShader.m_id, "view");
-    int projectionLocation = glGetUniformLocation(objectShader.m_id, "projection");
     objectShader.SetInt("objectTexture", 0);
 
     borderShader.Use();
     int borderModelLocation = glGetUniformLocation(borderShader.m_id, "model");
-    int borderViewLocation = glGetUniformLocation(borderShader.m_id, "view");
-    int borderProjectionLocation = glGetUniformLocation(borderShader.m_id, "projection");
+
+    // View and projection are shared by both programs through the FrameData block
+    FrameUniformBuffer frameUniforms;
 
     // -----------------------------------
     const glm::vec3 cube1Position = glm::vec3(-1.0f, 0.01f, -1.0f);
     const glm::vec3 cube2Position = glm::vec3(2.0f, 0.01f, 0.0f);
     float deltaTime = 0.f;
     float lastFrame = 0.f;
+    FrameStatsReporter statsReporter;
 
     while (!glfwWindowShouldClose(window)){
         processInput(window, deltaTime);
@@ -282,15 +284,18 @@ int main()
         
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-        borderShader.Use();
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), 800.f/600.f, 0.1f, 100.f);
-        glm::mat4 view = glm::lookAt(camera.Position, camera.Position+camera.Front, camera.Up); 
-        glUniformMatrix4fv(borderProjectionLocation, 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(borderViewLocation, 1, GL_FALSE, glm::value_ptr(view));
+        // The real size, larger than the window's on HiDPI displays
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        FrameData frameData;
+        frameData.projection = glm::perspective(glm::radians(camera.Zoom), 800.f/600.f, 0.1f, 100.f);
+        frameData.view = glm::lookAt(camera.Position, camera.Position+camera.Front, camera.Up); 
+        frameData.cameraPosition = glm::vec4(camera.Position, 1.f);
+        frameData.viewport = glm::vec4(0.f, 0.f, (float)framebufferWidth, (float)framebufferHeight);
+        frameData.time = glm::vec4(currentFrame, deltaTime, 0.f, 0.f);
+        frameUniforms.Update(frameData);
 
         objectShader.Use();
-        glUniformMatrix4fv(projectionLocation, 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(viewLocation, 1, GL_FALSE, glm::value_ptr(view));
 
         // -----------------------------------
         // FLOOR OBJECT
@@ -343,6 +348,9 @@ int main()
         glEnable(GL_DEPTH_TEST);
         // -----------------------------------
 
+        frameUniforms.EndFrame();
+        statsReporter.EndFrame(glfwGetTime());
+
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
@@ -351,6 +359,7 @@ int main()
     glDeleteBuffers(1, &cubeVBO);
     glDeleteVertexArrays(1, &floorVAO);
     glDeleteBuffers(1, &floorVBO);
+    frameUniforms.Release();
     
     glfwDestroyWindow(window);
     glfwTerminate();